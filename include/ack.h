@@ -0,0 +1,74 @@
+#ifndef __ACK_H__
+#define __ACK_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "journal.h"
+#include "network.h"
+#include "rcache.h"
+#include "tcpsock.h"
+
+#define ACK_RESPONSE_STRING "Message received\n"
+
+/**
+ * Settings of the acknowledging handler, which answers every message with ACK_RESPONSE_STRING
+ */
+typedef struct ack_config {
+    journal_t* journal;     /**< journal received data is captured in, NULL to print it instead */
+    bool print;             /**< print received data and responses while there is no journal */
+    rcache_t* cache;        /**< cache repeated requests are answered from, NULL for none */
+    unsigned int cache_ttl_ms;  /**< time a cached response is used for */
+} ack_config_t;
+
+extern ack_config_t ack_config;
+
+/**
+ * Captures data received from a client in the journal, or prints it
+ * \param connection_id id of the client the data came from
+ * \param data received data
+ * \param length bytes in 'data'
+ */
+void ack_capture(uint32_t connection_id, const void* data, unsigned int length);
+
+/**
+ * Reports the outcome of sending ACK_RESPONSE_STRING
+ * \param sent whether the response was sent completely
+ */
+void ack_report(bool sent);
+
+/**
+ * Data callback, capturing the data and answering it with ACK_RESPONSE_STRING
+ * Inline so that a loop bound to it by NET_LOOP_DEFINE can fold it into its dispatch
+ * \param client the client which sent the data
+ * \param data received data
+ * \param length bytes in 'data'
+ * \return NET_CB_SUCCESS, or NET_CB_DISCONNECT | NET_CB_CLIENT_ERROR if the response could not be sent
+ */
+static inline int ack_data(tcpsock_t* client, const void* data, unsigned int length)
+{
+    if (ack_config.journal != NULL || ack_config.print) {
+        ack_capture(client->id, data, length);
+    }
+
+    // the response only depends on the request, so repeated requests may be answered from the cache
+    // looked up here instead of by the loop, which would skip capturing the data on a hit
+    int err;
+    if (ack_config.cache == NULL || !rcache_answer(ack_config.cache, client, data, length, &err)) {
+        err = rcache_respond(ack_config.cache, client, data, length,
+                ACK_RESPONSE_STRING, sizeof(ACK_RESPONSE_STRING), ack_config.cache_ttl_ms);
+    }
+    if (err != TCP_NO_ERROR || ack_config.print) {
+        ack_report(err == TCP_NO_ERROR);
+    }
+
+    return err == TCP_NO_ERROR ? NET_CB_SUCCESS : NET_CB_DISCONNECT | NET_CB_CLIENT_ERROR;
+}
+
+/**
+ * Coroutine handler, same as ack_data but the coroutine waits for the data itself
+ * \param task the task of the client
+ */
+void ack_handler(net_task_t* task);
+
+#endif //__ACK_H__
\ No newline at end of file
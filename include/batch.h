@@ -0,0 +1,101 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pipeline.h"
+#include "tcpsock.h"
+
+#define BATCH_NO_ERROR          0
+#define BATCH_SINK_ERROR        1   // upstream could not be connected, or stopped accepting data
+#define BATCH_MEMORY_ERROR      2   // mem alloc error
+
+#define BATCH_DEFAULT_THRESHOLD (64 * 1024)     // bytes
+#define BATCH_DEFAULT_MAX_DELAY 5               // ms
+#define BATCH_RETRY_MS          1               // ms between attempts to send bytes the upstream did not take
+#define BATCH_CLOSE_TIMEOUT_MS  1000            // ms batch_close waits for the upstream to take the pending bytes
+
+/**
+ * Messages forwarded to a single upstream, collected until 'threshold' bytes are pending or the first of them
+ * waited 'max_delay_ms', whichever comes first
+ * The upstream is non-blocking, bytes it does not take stay pending and are sent again after BATCH_RETRY_MS
+ * While they are, messages which do not fit in the buffer are dropped whole
+ */
+typedef struct batch {
+    tcpsock_t upstream;     /**< connection to the destination */
+    uint8_t* buffer;        /**< pending bytes */
+    size_t capacity;        /**< allocated bytes of 'buffer', at least 'threshold', more to finish a partially sent message */
+    size_t pending;         /**< number of pending bytes */
+    size_t threshold;       /**< pending bytes at which the batch is sent */
+    unsigned int max_delay_ms;  /**< time the oldest pending byte may wait, 0 sends every message right away */
+    uint64_t deadline;      /**< CLOCK_MONOTONIC ms by which the pending bytes are sent, UINT64_MAX if none */
+    bool stalled;           /**< did the upstream not take all pending bytes? 'deadline' is then the next retry */
+    bool failed;            /**< did the upstream stop accepting data? later messages are dropped */
+    uint64_t messages;      /**< messages appended */
+    uint64_t bytes;         /**< bytes sent */
+    uint64_t writes;        /**< system calls which sent data */
+    uint64_t size_flushes;  /**< batches sent because the threshold was reached */
+    uint64_t deadline_flushes;  /**< batches sent because the deadline passed */
+    uint64_t dropped;       /**< bytes dropped because the upstream failed or fell behind */
+} batch_t;
+
+/**
+ * Connects to the upstream 'remote_ip' on port 'remote_port' and allocates an empty batch
+ * The connection is made non-blocking afterwards, so sending never waits for the upstream
+ * If the upstream connection cannot be opened, BATCH_SINK_ERROR is returned
+ * If the buffer cannot be allocated, BATCH_MEMORY_ERROR is returned
+ * \param batch a pointer, that will be initialised as a new batch
+ * \param remote_ip the IPv4 or IPv6 address of the upstream
+ * \param remote_port the port of the upstream
+ * \param threshold the number of pending bytes at which the batch is sent, 0 for BATCH_DEFAULT_THRESHOLD
+ * \param max_delay_ms the time the oldest pending byte may wait before the batch is sent
+ * \return BATCH_NO_ERROR if no error occurs during execution
+ */
+int batch_open(batch_t* batch, const char* remote_ip, uint16_t remote_port, size_t threshold,
+               unsigned int max_delay_ms);
+
+/**
+ * Appends a message to the batch, the batch is sent once the message brings it to the threshold
+ * A message which does not fit in the buffer is sent along with the pending bytes, without being copied
+ * What the upstream does not take is kept pending, see batch_t
+ * If sending fails, BATCH_SINK_ERROR is returned and the pending bytes and all later messages are dropped
+ * If the buffer cannot grow to keep a partially sent message, BATCH_MEMORY_ERROR is returned and its rest is dropped
+ * \param batch the batch to append to
+ * \param data the message
+ * \param length the length of the message
+ * \return BATCH_NO_ERROR if no error occurs during execution
+ */
+int batch_append(batch_t* batch, const void* data, unsigned int length);
+
+/**
+ * Sends the pending bytes if their deadline passed, or tries again if the upstream did not take them before
+ * If sending fails, the pending bytes are dropped like batch_flush does, 'failed' tells whether it did
+ * \param batch the batch to check
+ * \param now_ms the current CLOCK_MONOTONIC time in ms
+ * \return the deadline of the batch after the call, UINT64_MAX if nothing is pending
+ */
+uint64_t batch_poll(batch_t* batch, uint64_t now_ms);
+
+/**
+ * Sends the pending bytes right away, what the upstream does not take is kept pending
+ * If sending fails, BATCH_SINK_ERROR is returned and the pending bytes are dropped
+ * \param batch the batch to send
+ * \return BATCH_NO_ERROR if no error occurs during execution
+ */
+int batch_flush(batch_t* batch);
+
+/**
+ * Sends the pending bytes, waiting up to BATCH_CLOSE_TIMEOUT_MS for the upstream to take them
+ * Closes the upstream connection and frees the buffer afterwards
+ * \param batch the batch to close
+ */
+void batch_close(batch_t* batch);
+
+/**
+ * Pipeline stage which appends frames to the batch_t 'context', meant to be added as PIPELINE_TAP
+ */
+pipeline_verdict_t batch_stage(pipeline_frame_t* frame, void* context);
+
+#endif //__BATCH_H__
\ No newline at end of file
@@ -0,0 +1,86 @@
+#ifndef __COROUTINE_H__
+#define __COROUTINE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define CORO_NO_ERROR       0
+#define CORO_MEMORY_ERROR   1   // no stack could be mapped for a new coroutine
+
+#define CORO_DEFAULT_STACK_SIZE (64 * 1024)
+
+typedef void (*coro_fn_t)(void* arg);
+
+/**
+ * Stackful coroutine, switched to and from in user space
+ */
+typedef struct coro {
+    void* sp;               /**< saved stack pointer while the coroutine is not running */
+    void* context;          /**< saved context while the coroutine is not running, on targets without a fast switch */
+    void* stack;            /**< lowest address of the mapping, including the guard page */
+    size_t mapping_size;    /**< size of the mapping */
+    coro_fn_t fn;           /**< function run by the coroutine */
+    void* arg;              /**< argument of 'fn' */
+    bool finished;          /**< did 'fn' return? */
+    struct coro* next_free; /**< next coroutine in the free list of the pool */
+} coro_t;
+
+/**
+ * Pool of coroutines, finished coroutines keep their stack for reuse
+ */
+typedef struct coro_pool {
+    size_t stack_size;      /**< usable stack size of every coroutine */
+    coro_t* free;           /**< coroutines available for reuse */
+    unsigned int allocated; /**< coroutines created by the pool */
+    unsigned int in_use;    /**< coroutines handed out and not released */
+} coro_pool_t;
+
+/**
+ * Initialises an empty pool
+ * \param pool the pool to initialise
+ * \param stack_size usable stack size per coroutine, rounded up to whole pages, 0 for CORO_DEFAULT_STACK_SIZE
+ */
+void coro_pool_init(coro_pool_t* pool, size_t stack_size);
+
+/**
+ * Unmaps the stacks of all released coroutines, coroutines still in use must be released first
+ * \param pool the pool to destroy
+ */
+void coro_pool_destroy(coro_pool_t* pool);
+
+/**
+ * Takes a coroutine from 'pool' which runs 'fn(arg)' when it is first resumed
+ * Stacks are mapped with a guard page below them, so an overflow faults instead of corrupting memory
+ * \param pool the pool to take the coroutine from
+ * \param fn the function to run
+ * \param arg the argument of 'fn'
+ * \return the coroutine, NULL if no stack could be mapped
+ */
+coro_t* coro_create(coro_pool_t* pool, coro_fn_t fn, void* arg);
+
+/**
+ * Returns 'coro' to 'pool', a coroutine which did not finish is abandoned and anything on its stack is lost
+ * \param pool the pool the coroutine was taken from
+ * \param coro the coroutine to release
+ */
+void coro_release(coro_pool_t* pool, coro_t* coro);
+
+/**
+ * Runs 'coro' until it yields or finishes, may not be called from within a coroutine
+ * \param coro the coroutine to resume
+ * \return true if the coroutine finished
+ */
+bool coro_resume(coro_t* coro);
+
+/**
+ * Suspends the running coroutine and returns to the coro_resume that resumed it
+ */
+void coro_yield(void);
+
+/**
+ * Returns the running coroutine
+ * \return the coroutine, NULL outside of coroutines
+ */
+coro_t* coro_current(void);
+
+#endif //__COROUTINE_H__
\ No newline at end of file
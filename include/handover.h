@@ -0,0 +1,78 @@
+#ifndef __HANDOVER_H__
+#define __HANDOVER_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define HANDOVER_NO_ERROR       0
+#define HANDOVER_SPAWN_ERROR    1   // the socket pair could not be created or the successor could not be started
+#define HANDOVER_SOCKET_ERROR   2   // sending or receiving a record failed, or the other process went away
+#define HANDOVER_FORMAT_ERROR   3   // received message is not a handover record
+#define HANDOVER_TIMEOUT        4   // the other process did not answer in time
+
+#define HANDOVER_MAGIC          0x524f5648U     // "HVOR"
+#define HANDOVER_ENV            "HANDOVER_FD"   // environment variable holding the descriptor in the successor
+#define HANDOVER_MAX_STATE      4096            // application state sent along with a single socket
+#define HANDOVER_TIMEOUT_MS     10000
+
+typedef enum handover_kind {
+    HANDOVER_LISTENER = 1,  // a listening socket, carries a descriptor
+    HANDOVER_CLIENT,        // a client connection, carries a descriptor and the state of the client
+    HANDOVER_END,           // all sockets were sent, 'id' holds the next connection id
+    HANDOVER_ACK            // sent back by the successor once it took over all sockets
+} handover_kind_t;
+
+/**
+ * Message sent over the handover socket, the state of a client follows it in the same message
+ */
+typedef struct handover_record {
+    uint32_t magic;         /**< HANDOVER_MAGIC */
+    uint32_t kind;          /**< handover_kind_t of the record */
+    uint32_t id;            /**< connection id of a client, next connection id for HANDOVER_END */
+    uint32_t length;        /**< bytes of state following the record */
+} handover_record_t;
+
+/**
+ * Starts 'argv' as successor of the current process, connected to it by a SOCK_SEQPACKET socket pair
+ * The successor finds its end of the pair with handover_inherited_fd, all other descriptors above stderr are closed
+ * If the socket pair cannot be created or the process cannot be forked, HANDOVER_SPAWN_ERROR is returned
+ * \param argv the command line of the successor, argv[0] is looked up in PATH if it holds no '/'
+ * \param fd a pointer, that will be set to the end of the socket pair of the current process
+ * \param pid a pointer, that will be set to the process id of the successor
+ * \return HANDOVER_NO_ERROR if no error occurs during execution
+ */
+int handover_spawn(char* const argv[], int* fd, pid_t* pid);
+
+/**
+ * Looks up the handover socket a predecessor started the current process with, and removes it from the environment
+ * \return the descriptor of the handover socket, -1 if the process was not started by handover_spawn
+ */
+int handover_inherited_fd(void);
+
+/**
+ * Sends a record, along with the descriptor 'sock_fd' and 'record->length' bytes of 'state'
+ * If sending fails, HANDOVER_SOCKET_ERROR is returned
+ * \param fd the handover socket
+ * \param record the record to send, 'magic' is filled in
+ * \param sock_fd the descriptor to pass on, -1 for none
+ * \param state the state following the record, at most HANDOVER_MAX_STATE bytes
+ * \return HANDOVER_NO_ERROR if no error occurs during execution
+ */
+int handover_send(int fd, handover_record_t* record, int sock_fd, const void* state);
+
+/**
+ * Receives a record, along with the descriptor and state sent with it
+ * Received descriptors are close-on-exec
+ * If no record arrives within 'timeout_ms', HANDOVER_TIMEOUT is returned
+ * If receiving fails or the other process closed its end, HANDOVER_SOCKET_ERROR is returned
+ * If the message is not a record, HANDOVER_FORMAT_ERROR is returned
+ * \param fd the handover socket
+ * \param record a pointer, that will be set to the received record
+ * \param sock_fd a pointer, that will be set to the received descriptor, -1 if the record carried none
+ * \param state a buffer of HANDOVER_MAX_STATE bytes, that will hold the received state
+ * \param timeout_ms the maximum time to wait, -1 to wait without timeout
+ * \return HANDOVER_NO_ERROR if no error occurs during execution
+ */
+int handover_receive(int fd, handover_record_t* record, int* sock_fd, void* state, int timeout_ms);
+
+#endif //__HANDOVER_H__
\ No newline at end of file
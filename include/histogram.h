@@ -0,0 +1,57 @@
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <stdint.h>
+
+#define HISTOGRAM_SUB_BUCKET_BITS   3   // every power of two is split in 8 buckets, so values are off by at most 12.5%
+#define HISTOGRAM_SUB_BUCKETS       (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS           ((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * Log-linear histogram of 64-bit values, recording is constant time and allocation free
+ */
+typedef struct histogram {
+    uint64_t buckets[HISTOGRAM_BUCKETS];    /**< number of values recorded per bucket */
+    uint64_t count;         /**< number of values recorded */
+    uint64_t sum;           /**< sum of all recorded values */
+    uint64_t min;           /**< smallest recorded value, UINT64_MAX if empty */
+    uint64_t max;           /**< largest recorded value */
+} histogram_t;
+
+/**
+ * Removes all recorded values from 'histogram'
+ * \param histogram the histogram to reset
+ */
+void histogram_reset(histogram_t* histogram);
+
+/**
+ * Records 'value' in 'histogram'
+ * \param histogram the histogram to record in
+ * \param value the value to record
+ */
+void histogram_record(histogram_t* histogram, uint64_t value);
+
+/**
+ * Adds all values recorded in 'other' to 'histogram'
+ * \param histogram the histogram to add to
+ * \param other the histogram to add
+ */
+void histogram_merge(histogram_t* histogram, const histogram_t* other);
+
+/**
+ * Looks up the value below which 'percentile' percent of the recorded values lie
+ * The result is the upper bound of the bucket holding that value, capped to the largest recorded value
+ * \param histogram the histogram to look in
+ * \param percentile the percentile, between 0 and 100
+ * \return the value at 'percentile', 0 if the histogram is empty
+ */
+uint64_t histogram_percentile(const histogram_t* histogram, double percentile);
+
+/**
+ * Calculates the average of all recorded values
+ * \param histogram the histogram
+ * \return the average, 0 if the histogram is empty
+ */
+double histogram_mean(const histogram_t* histogram);
+
+#endif //__HISTOGRAM_H__
\ No newline at end of file
@@ -0,0 +1,146 @@
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define JOURNAL_NO_ERROR        0
+#define JOURNAL_FILE_ERROR      1   // segment file could not be created, sized, mapped or synced
+#define JOURNAL_MEMORY_ERROR    2   // mem alloc error
+#define JOURNAL_FRAME_ERROR     3   // frame does not fit in a segment
+#define JOURNAL_FORMAT_ERROR    4   // file is not a journal segment or is corrupt
+#define JOURNAL_END             5   // reader reached the end of the journal
+
+#define JOURNAL_MAGIC                   0x4c4e524aU         // "JRNL"
+#define JOURNAL_VERSION                 1
+#define JOURNAL_DEFAULT_SEGMENT_SIZE    (64 * 1024 * 1024)
+#define JOURNAL_DEFAULT_SYNC_INTERVAL   1000                // ms
+#define JOURNAL_SEGMENT_SUFFIX          ".journal"
+
+/**
+ * Header at the start of every segment file
+ */
+typedef struct journal_segment_header {
+    uint32_t magic;         /**< JOURNAL_MAGIC */
+    uint32_t version;       /**< JOURNAL_VERSION */
+    uint64_t index;         /**< sequence number of the segment, also part of its file name */
+} journal_segment_header_t;
+
+/**
+ * Header in front of every frame, frames start at 8 byte aligned offsets
+ * A header with length 0 (or the end of the file) marks the end of a segment
+ */
+typedef struct journal_frame_header {
+    uint32_t length;        /**< number of data bytes following the header */
+    uint32_t connection_id; /**< id of the connection the data was received on */
+    uint64_t timestamp;     /**< CLOCK_REALTIME in ns at which the frame was appended */
+} journal_frame_header_t;
+
+/**
+ * Structure for holding an open journal, appending to a memory-mapped segment
+ */
+typedef struct journal {
+    char* directory;        /**< directory holding the segment files */
+    uint64_t index;         /**< index of the current segment */
+    int fd;                 /**< descriptor of the current segment file */
+    uint8_t* map;           /**< mapping of the current segment file */
+    size_t segment_size;    /**< size of every segment file */
+    size_t offset;          /**< append position in the current segment */
+    size_t synced;          /**< bytes of the current segment which are known to be on disk */
+    uint64_t sync_interval; /**< ns between two syncs */
+    uint64_t last_sync;     /**< CLOCK_MONOTONIC in ns of the last sync */
+} journal_t;
+
+/**
+ * Structure for reading the segments of a journal sequentially
+ */
+typedef struct journal_reader {
+    char* directory;        /**< directory holding the segment files */
+    uint64_t* indices;      /**< sorted indices of the segments in the directory */
+    unsigned int count;     /**< number of segments */
+    unsigned int current;   /**< segment being read */
+    uint8_t* map;           /**< mapping of the segment being read, NULL if none */
+    size_t size;            /**< size of the segment being read */
+    size_t offset;          /**< read position in the segment being read */
+} journal_reader_t;
+
+/**
+ * Opens a journal in 'directory', appending to a new segment after the last existing one
+ * Appended frames are synced to disk at most every 'sync_interval_ms' by journal_sync, 0 syncs on every call
+ * If a segment cannot be created or mapped, JOURNAL_FILE_ERROR is returned
+ * If memory allocation fails, JOURNAL_MEMORY_ERROR is returned
+ * \param journal a pointer, that will be initialised as a new journal
+ * \param directory the existing directory to put the segment files in
+ * \param segment_size size of a segment file, a multiple of the page size
+ * \param sync_interval_ms minimum time between two syncs
+ * \return JOURNAL_NO_ERROR if no error occurs during execution
+ */
+int journal_open(journal_t* journal, const char* directory, size_t segment_size, unsigned int sync_interval_ms);
+
+/**
+ * Appends a frame of 'length' bytes at 'data' to the journal, rotating to a new segment if it does not fit
+ * No system call is made unless the segment has to be rotated
+ * If the frame can never fit in a segment, JOURNAL_FRAME_ERROR is returned
+ * If a new segment cannot be created, JOURNAL_FILE_ERROR is returned, later appends try to create it again
+ * \param journal the journal to append to
+ * \param connection_id id of the connection the data was received on
+ * \param data the bytes to append
+ * \param length the number of bytes to append
+ * \return JOURNAL_NO_ERROR if no error occurs during execution
+ */
+int journal_append(journal_t* journal, uint32_t connection_id, const void* data, unsigned int length);
+
+/**
+ * Writes the frames appended since the last sync to disk (msync and fdatasync)
+ * Unless 'force' is set, nothing is done if the sync interval has not yet passed
+ * If syncing fails, JOURNAL_FILE_ERROR is returned
+ * \param journal the journal to sync
+ * \param force sync regardless of the sync interval
+ * \return JOURNAL_NO_ERROR if no error occurs during execution
+ */
+int journal_sync(journal_t* journal, bool force);
+
+/**
+ * Syncs and closes the journal, the last segment is truncated to the appended frames
+ * \param journal the journal to close
+ * \return JOURNAL_NO_ERROR if no error occurs during execution
+ */
+int journal_close(journal_t* journal);
+
+/**
+ * Opens all segments in 'directory' for sequential reading, ordered by segment index
+ * If the directory cannot be read, JOURNAL_FILE_ERROR is returned
+ * If memory allocation fails, JOURNAL_MEMORY_ERROR is returned
+ * \param reader a pointer, that will be initialised as a new reader
+ * \param directory the directory holding the segment files
+ * \return JOURNAL_NO_ERROR if no error occurs during execution
+ */
+int journal_reader_open(journal_reader_t* reader, const char* directory);
+
+/**
+ * Reads the next frame of the journal, '*data' points into the mapped segment and stays valid until the next call
+ * If all segments have been read, JOURNAL_END is returned
+ * If a segment is not a valid journal segment, JOURNAL_FORMAT_ERROR is returned
+ * If a segment cannot be opened or mapped, JOURNAL_FILE_ERROR is returned
+ * \param reader the reader to read from
+ * \param header a pointer, that will be set to the header of the frame
+ * \param data a pointer, that will be set to the data of the frame
+ * \return JOURNAL_NO_ERROR if no error occurs during execution
+ */
+int journal_reader_next(journal_reader_t* reader, journal_frame_header_t* header, const void** data);
+
+/**
+ * Returns the index of the segment the last frame returned by journal_reader_next was read from
+ * \param reader the reader
+ * \return segment index
+ */
+uint64_t journal_reader_segment(journal_reader_t* reader);
+
+/**
+ * Closes the reader and frees its resources
+ * \param reader the reader to close
+ */
+void journal_reader_close(journal_reader_t* reader);
+
+#endif //__JOURNAL_H__
\ No newline at end of file
@@ -0,0 +1,110 @@
+#ifndef __MEMTRANSPORT_H__
+#define __MEMTRANSPORT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tcpsock.h"
+#include "vector.h"
+
+#define MEMTRANSPORT_LISTENER_FD    0   // descriptor of the single listening socket
+#define MEMTRANSPORT_FD_BASE        1   // descriptor of connection 0
+
+typedef enum memconn_state {
+    MEMCONN_FREE = 0,
+    MEMCONN_PENDING,        // connected by the peer, not yet accepted
+    MEMCONN_OPEN,
+    MEMCONN_HUNGUP          // closed by the peer, remaining data can still be received
+} memconn_state_t;
+
+/**
+ * Structure for holding one simulated connection
+ */
+typedef struct memconn {
+    uint8_t* data;          /**< bytes written by the peer */
+    uint32_t offset;        /**< bytes of 'data' already received by the server */
+    uint32_t length;        /**< number of valid bytes in 'data' */
+    uint32_t capacity;      /**< allocated size of 'data' */
+    memconn_state_t state;  /**< state of the connection */
+    uint64_t sent;          /**< bytes the server sent on this connection */
+} memconn_t;
+
+struct memtransport;
+
+/**
+ * Called when the server polls while no simulated connection is ready, so the driver can inject more traffic
+ */
+typedef void (*memtransport_idle_t)(struct memtransport* transport, void* context);
+
+/**
+ * An in-process transport which simulates connections without the kernel network stack
+ * Everything happens on the calling thread, so runs are deterministic
+ */
+typedef struct memtransport {
+    tcp_transport_t base;   /**< operations, sockets of this transport point here */
+    memconn_t* conns;       /**< connection table, indexed by connection id */
+    uint32_t conn_count;    /**< used entries of the connection table */
+    uint32_t conn_capacity; /**< allocated entries of the connection table */
+    vec_t pending;          /**< ids of connections waiting to be accepted */
+    vec_t free_ids;         /**< ids of closed connections which can be reused */
+    bool listening;         /**< is the listening socket open? */
+    uint64_t bytes_sent;    /**< bytes sent by the server over all connections */
+    uint64_t sends;         /**< number of send calls made by the server */
+    memtransport_idle_t on_idle;
+    void* idle_context;
+} memtransport_t;
+
+/**
+ * Creates an in-memory transport with room for 'initial_connections' connections (the table grows as needed)
+ * If memory allocation fails, TCP_MEMORY_ERROR is returned
+ * \param transport a pointer, that will be initialised as a new transport
+ * \param initial_connections the initial size of the connection table
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int memtransport_create(memtransport_t* transport, uint32_t initial_connections);
+
+/**
+ * Frees the transport and all of its connections
+ * \param transport the transport to destroy
+ */
+void memtransport_destroy(memtransport_t* transport);
+
+/**
+ * Sets the callback which is called when the server polls while nothing is ready
+ * \param transport the transport
+ * \param on_idle the callback, NULL makes such polls return 0 immediately
+ * \param context passed to 'on_idle'
+ */
+void memtransport_set_idle(memtransport_t* transport, memtransport_idle_t on_idle, void* context);
+
+/**
+ * Simulates a peer connecting, the connection is returned by the next accept on the listening socket
+ * If memory allocation fails, TCP_MEMORY_ERROR is returned
+ * \param transport the transport
+ * \param conn a pointer, that will be set to the id of the new connection
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int memtransport_connect(memtransport_t* transport, uint32_t* conn);
+
+/**
+ * Simulates the peer of connection 'conn' sending 'length' bytes to the server
+ * If 'conn' is not connected, TCP_SOCKET_ERROR is returned
+ * If memory allocation fails, TCP_MEMORY_ERROR is returned
+ * \param transport the transport
+ * \param conn the id of the connection
+ * \param data the bytes to send
+ * \param length the number of bytes to send
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int memtransport_write(memtransport_t* transport, uint32_t conn, const void* data, unsigned int length);
+
+/**
+ * Simulates the peer of connection 'conn' closing the connection
+ * If 'conn' is not connected, TCP_SOCKET_ERROR is returned
+ * \param transport the transport
+ * \param conn the id of the connection
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int memtransport_hangup(memtransport_t* transport, uint32_t conn);
+
+#endif //__MEMTRANSPORT_H__
\ No newline at end of file
@@ -0,0 +1,32 @@
+#ifndef __NETLOOP_H__
+#define __NETLOOP_H__
+
+#include "netloop_impl.h"
+
+/**
+ * Defines the static function 'name', which runs net_loop with the data callback 'cb_data' bound at compile time
+ * The ready clients are served by a copy of the receive path in which 'cb_data' is called directly, and inlined
+ * when its definition is visible where the loop is defined, config->cb_data and config->pipeline are not used
+ * Relays, handlers and everything else net_loop does work the same, e.g.
+ *
+ *     static int _ack(tcpsock_t* client, const void* data, unsigned int length) { ... }
+ *     NET_LOOP_DEFINE(_ack_loop, _ack)
+ *     ...
+ *     int err = _ack_loop(&config);
+ *
+ * \param name the name of the defined function, int name(net_config_t* config)
+ * \param cb_data the data callback, a callback_data_t
+ */
+#define NET_LOOP_DEFINE(name, cb_data) \
+    static void name##_round(netloop_server_t* server, unsigned int listener_count, int pfd_count, int activity, \
+                             net_config_t* config) \
+    { \
+        netloop_serve_round(server, listener_count, pfd_count, activity, config, cb_data); \
+    } \
+    \
+    static int name(net_config_t* config) \
+    { \
+        return netloop_run(config, name##_round); \
+    }
+
+#endif //__NETLOOP_H__
\ No newline at end of file
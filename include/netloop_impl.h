@@ -0,0 +1,388 @@
+#ifndef __NETLOOP_IMPL_H__
+#define __NETLOOP_IMPL_H__
+
+// Internals of net_loop shared with the loop instances of NET_LOOP_DEFINE (netloop.h), not an API of their own
+// The receive path below is inlined into every instance with its data callback bound, everything around it lives in
+// network.c and is reached through netloop_run once per poll round
+// Every name declared here carries the netloop_ or NETLOOP_ prefix, as it is visible to the includers of netloop.h
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "coroutine.h"
+#include "log.h"
+#include "network.h"
+#include "pipeline.h"
+#include "probes.h"
+#include "ratelimit.h"
+#include "rcache.h"
+#include "relay.h"
+#include "shmring.h"
+#include "tcpsock.h"
+#include "trace.h"
+#include "vector.h"
+
+#define NETLOOP_READ_BUFFER_SIZE 1024
+
+#define NETLOOP_INLINE static inline __attribute__((always_inline))
+
+typedef enum netloop_action {
+    NETLOOP_CACT_NONE = 0,
+    NETLOOP_CACT_REMOVE,
+    NETLOOP_CACT_FULL       // the read filled the buffer, so more data may be queued
+} netloop_action_t;
+
+typedef enum netloop_admission {
+    NETLOOP_ADMIT_OK = 0,
+    NETLOOP_ADMIT_CONNECTIONS,  // max_connections reached
+    NETLOOP_ADMIT_MEMORY,       // max_buffered_bytes exceeded
+    NETLOOP_ADMIT_RATE          // max_accepts_per_sec reached
+} netloop_admission_t;
+
+typedef struct netloop_server {
+    vec_t server_vec;       // listening sockets
+    vec_t client_vec;       // connected clients
+    relay_t relay;          // splice relay, only valid if relay_enabled
+    bool relay_enabled;
+    trace_t trace;          // traffic recording, only valid if trace_enabled
+    bool trace_enabled;
+    shmring_t ring;         // publication to consumer processes, only valid if ring_enabled
+    bool ring_enabled;
+    uint32_t next_id;       // id for the next accepted client
+    uint64_t next_tick;     // CLOCK_MONOTONIC ms at which cb_tick is due
+    uint64_t next_sample;   // CLOCK_MONOTONIC ms at which the next TCP_INFO batch is due
+    unsigned int sample_cursor; // index of the next client to sample
+    uint64_t queued_bytes;  // send queue bytes of all clients, as of their last TCP_INFO sample
+    uint64_t accept_window; // CLOCK_MONOTONIC ms at which the current accept rate window started
+    unsigned int window_accepts;    // accepts in the current window
+    netloop_admission_t paused;     // reason the listeners are not polled, NETLOOP_ADMIT_OK while accepting
+    bool rate_enabled;      // are client_limits or source_limits set?
+    ratelimit_table_t sources;  // buckets per peer address, only valid if source_limits are set
+    uint64_t next_resume;   // earliest rate_resume of the paused clients, UINT64_MAX if none is paused
+    coro_pool_t coros;      // stacks of the client tasks, only valid if config->handler is set
+    uint64_t next_wake;     // earliest wake of the sleeping tasks, UINT64_MAX if none is sleeping
+    uint64_t next_timer;    // deadline cb_timer returned last, UINT64_MAX if none
+    const tcp_transport_t* transport;   // transport all sockets of this server use
+    struct pollfd* pfds;    // poll set, listeners followed by clients
+    unsigned int pfd_capacity;
+    unsigned int* ready;    // client indices of a poll round grouped by priority class, pfd_capacity entries
+    uint32_t resume[NET_PRIORITY_CLASSES];  // per class, id of the first client the round budget left unserved
+    uint8_t* read_buffer;   // COALESCE_BUFFER_SIZE bytes for reads under load, only allocated if coalesce_max_us is set
+    uint64_t load;          // moving average of the events per wakeup, in 1/16 events
+    unsigned int level;     // load level of the current round, 0 unless coalesce_max_us is set
+    unsigned int round_events;  // KiB read beyond the first of each read in the current round
+    int fatal_err;          // error which ends the loop after the current round, NET_SUCCESS while serving
+} netloop_server_t;
+
+/**
+ * Serves the clients a poll round reported ready, instantiated once per bound data callback
+ * \param server the server being run
+ * \param listener_count the number of listeners at the start of the poll set
+ * \param pfd_count the number of entries in the poll set
+ * \param activity the number of ready clients
+ * \param config the configuration of the server
+ */
+typedef void (*netloop_round_t)(netloop_server_t* server, unsigned int listener_count, int pfd_count, int activity,
+                                net_config_t* config);
+
+/**
+ * Runs net_loop with 'round' serving the ready clients, see NET_LOOP_DEFINE
+ * \param config the configuration of the server
+ * \param round the instance of netloop_serve_round to use
+ * \return NET_SUCCESS once config->running is cleared, see net_loop
+ */
+int netloop_run(net_config_t* config, netloop_round_t round);
+
+// helpers of the receive path in network.c, see the definitions
+bool netloop_rate_paused(netloop_server_t* server, tcpsock_t* client_sock, net_config_t* config);
+void netloop_rate_consume(netloop_server_t* server, tcpsock_t* client_sock, uint64_t bytes, net_config_t* config);
+int netloop_resume_task(netloop_server_t* server, tcpsock_t* client_sock, short revents, net_config_t* config);
+int netloop_relay_client(netloop_server_t* server, tcpsock_t* client_sock, int client_fd, net_config_t* config);
+bool netloop_reap_client(tcpsock_t* client_sock, short revents, net_config_t* config);
+void netloop_close_client(netloop_server_t* server, tcpsock_t* client_sock, net_config_t* config);
+void netloop_record_rx_latency(const struct timespec* arrival, net_config_t* config);
+bool netloop_still_readable(netloop_server_t* server, int client_fd);
+
+// pass received data on to the pipeline or the data callback, 'writable' data may be rewritten in place by stages
+// 'bound' is a compile time constant in every instance of the loop, NULL in the one calling config->cb_data
+// returns the NET_CB_* flags of the callback, or of the pipeline sink
+NETLOOP_INLINE int netloop_deliver(netloop_server_t* server, tcpsock_t* client_sock, void* data, unsigned int length,
+                                   bool writable, net_config_t* config, callback_data_t bound)
+{
+    if (server->trace_enabled) {
+        trace_record(&server->trace, TRACE_EVENT_DATA, client_sock->id, data, length);
+    }
+    if (server->ring_enabled) {
+        shmring_publish(&server->ring, SHMRING_FRAME_DATA, client_sock->id, data, length);
+    }
+
+    // with a pipeline, the frames reaching its sink are looked up instead
+    int send_err;
+    if (config->response_cache != NULL && config->pipeline == NULL
+            && rcache_answer(config->response_cache, client_sock, data, length, &send_err)) {
+        return send_err == TCP_NO_ERROR ? NET_CB_SUCCESS : NET_CB_DISCONNECT | NET_CB_CLIENT_ERROR;
+    }
+
+    int result = NET_CB_SUCCESS;
+    if (bound != NULL) {
+        PROBE2(callback_entry, client_sock->fd, length);
+        result = bound(client_sock, data, length);
+        PROBE3(callback_exit, client_sock->fd, length, result);
+    } else if (config->pipeline != NULL) {
+        PROBE2(callback_entry, client_sock->fd, length);
+        result = pipeline_run(config->pipeline, client_sock, data, length, writable);
+        PROBE3(callback_exit, client_sock->fd, length, result);
+    } else if (config->cb_data) {
+        PROBE2(callback_entry, client_sock->fd, length);
+        result = config->cb_data(client_sock, data, length);
+        PROBE3(callback_exit, client_sock->fd, length, result);
+    }
+
+    return result;
+}
+
+NETLOOP_INLINE int netloop_handle_client(netloop_server_t* server, tcpsock_t* client_sock, int client_fd,
+                                         short revents, net_config_t* config, callback_data_t bound)
+{
+    if (client_sock->zc_send && !netloop_reap_client(client_sock, revents, config)) {
+        return NETLOOP_CACT_NONE;
+    }
+
+    uint8_t stack_buff[NETLOOP_READ_BUFFER_SIZE];
+    uint8_t* buff = stack_buff;
+    unsigned int buff_size = NETLOOP_READ_BUFFER_SIZE;
+    const void* mapped = NULL;
+    unsigned int map_size = 0;
+    struct timespec arrival = { 0 };
+
+    // under load a single read takes what a run of small reads would, and cb_data gets it in one call
+    if (server->level > 0) {
+        buff = server->read_buffer;
+        buff_size = NETLOOP_READ_BUFFER_SIZE << (2 * server->level);
+    }
+    unsigned int requested = buff_size;
+
+    int err;
+    if (config->zerocopy_receive) {
+        err = tcp_receive_zerocopy(client_sock, &mapped, &map_size, buff, &buff_size);
+    } else if (config->rx_latency != NULL) {
+        err = tcp_receive_timestamped(client_sock, buff, &buff_size, &arrival);
+    } else {
+        err = tcp_receive(client_sock, buff, &buff_size);
+    }
+
+    switch (err) {
+        case TCP_CONNECTION_CLOSED:
+            PRINTF_DEBUG("Client (fd = %i) disconnected", client_fd);
+            netloop_close_client(server, client_sock, config);
+            return NETLOOP_CACT_REMOVE;
+
+        case TCP_SOCKOP_ERROR:
+            PRINTF_DEBUG("Client (fd = %i) failed socket operation while reading, errno = %i", client_fd, errno);
+            netloop_close_client(server, client_sock, config);
+            return NETLOOP_CACT_REMOVE;
+
+        case TCP_NO_ERROR:
+            PRINTF_DEBUG("Client (fd = %i) sent %u bytes (%u mapped)", client_sock->fd, map_size + buff_size, map_size);
+            if (config->rx_latency != NULL && buff_size > 0) {
+                netloop_record_rx_latency(&arrival, config);
+            }
+
+            if (server->rate_enabled && map_size + buff_size > 0) {
+                netloop_rate_consume(server, client_sock, map_size + buff_size, config);
+            }
+            if (map_size + buff_size > NETLOOP_READ_BUFFER_SIZE) {
+                server->round_events += (map_size + buff_size - 1) / NETLOOP_READ_BUFFER_SIZE;
+            }
+
+            // mapped pages precede the copied remainder in the stream
+            int flags = NET_CB_SUCCESS;
+            if (map_size > 0) {
+                flags |= netloop_deliver(server, client_sock, (void*)mapped, map_size, false, config, bound);
+            }
+            if (buff_size > 0 && !(flags & NET_CB_DISCONNECT)) {
+                flags |= netloop_deliver(server, client_sock, buff, buff_size, true, config, bound);
+            }
+            tcp_release_zerocopy(client_sock, map_size);
+
+            if (flags & NET_CB_DISCONNECT) {
+                PRINTF_DEBUG("Client (fd = %i) disconnected by the data callback", client_fd);
+                netloop_close_client(server, client_sock, config);
+                return NETLOOP_CACT_REMOVE;
+            }
+            return map_size + buff_size >= requested ? NETLOOP_CACT_FULL : NETLOOP_CACT_NONE;
+
+        default:
+            PRINTF_DEBUG("Unhandled tcp_receive error, code = %i", err);
+            netloop_close_client(server, client_sock, config);
+            return NETLOOP_CACT_REMOVE;
+    }
+}
+
+NETLOOP_INLINE int netloop_serve_client(netloop_server_t* server, tcpsock_t* client_sock, int client_fd,
+                                        short revents, net_config_t* config, callback_data_t bound)
+{
+    // hangups and errors are handled right away, the rate limit only delays reading data
+    bool rate_paused = server->rate_enabled && client_sock->task == NULL
+            && !(revents & (POLLHUP | POLLERR)) && netloop_rate_paused(server, client_sock, config);
+
+    if (client_sock->task != NULL) {
+        return netloop_resume_task(server, client_sock, revents, config);
+    } else if (rate_paused) {
+        return NETLOOP_CACT_NONE;
+    }
+
+    return server->relay_enabled
+            ? netloop_relay_client(server, client_sock, client_fd, config)
+            : netloop_handle_client(server, client_sock, client_fd, revents, config, bound);
+}
+
+// serve a ready client with up to 'max_reads' reads, returns the number of reads used
+NETLOOP_INLINE unsigned int netloop_serve_ready(netloop_server_t* server, unsigned int index,
+                                                unsigned int listener_count, unsigned int max_reads,
+                                                net_config_t* config, callback_data_t bound)
+{
+    tcpsock_t* client_sock;
+    vec_get_ref(&server->client_vec, (void**)&client_sock, index);
+    struct pollfd* pfd = &server->pfds[listener_count + index];
+
+    int client_action = netloop_serve_client(server, client_sock, pfd->fd, pfd->revents, config, bound);
+    unsigned int reads = 1;
+
+    // a short read drained the client, after a full one it is only polled to not block on an exactly drained socket
+    // tasks and relays drain their clients themselves and never report a full read
+    while (client_action == NETLOOP_CACT_FULL && reads < max_reads && client_sock->rate_resume == 0
+            && netloop_still_readable(server, pfd->fd)) {
+        client_action = netloop_serve_client(server, client_sock, pfd->fd, POLLIN, config, bound);
+        reads++;
+    }
+
+    // removed clients are only taken out of the vector once the round is done, so indices stay valid
+    if (client_action == NETLOOP_CACT_REMOVE) {
+        pfd->fd = -1;
+    }
+    return reads;
+}
+
+// id of the client at 'position' in the ready list
+NETLOOP_INLINE uint32_t netloop_ready_id(netloop_server_t* server, unsigned int position)
+{
+    tcpsock_t* client_sock;
+    vec_get_ref(&server->client_vec, (void**)&client_sock, server->ready[position]);
+    return client_sock->id;
+}
+
+// serve the ready clients from the highest priority class down, within config->round_budget reads
+NETLOOP_INLINE void netloop_dispatch_prioritized(netloop_server_t* server, unsigned int listener_count, int pfd_count,
+                                                 net_config_t* config, callback_data_t bound)
+{
+    unsigned int client_count = pfd_count - listener_count;
+    unsigned int starts[NET_PRIORITY_CLASSES + 1] = { 0 };
+
+    // group the ready clients by class, keeping their order within each class
+    for (unsigned int i = 0; i < client_count; i++) {
+        if (server->pfds[listener_count + i].revents != 0) {
+            tcpsock_t* client_sock;
+            vec_get_ref(&server->client_vec, (void**)&client_sock, i);
+            starts[client_sock->priority + 1]++;
+        }
+    }
+    for (unsigned int c = 0; c < NET_PRIORITY_CLASSES; c++) {
+        starts[c + 1] += starts[c];
+    }
+
+    unsigned int fill[NET_PRIORITY_CLASSES];
+    memcpy(fill, starts, sizeof(fill));
+    for (unsigned int i = 0; i < client_count; i++) {
+        if (server->pfds[listener_count + i].revents != 0) {
+            tcpsock_t* client_sock;
+            vec_get_ref(&server->client_vec, (void**)&client_sock, i);
+            server->ready[fill[client_sock->priority]++] = i;
+        }
+    }
+
+    // reads reserved for a class are used before the shared ones, which go to the higher classes first
+    bool limited = config->round_budget > 0;
+    unsigned int shared = config->round_budget;
+    for (unsigned int c = 0; c < NET_PRIORITY_CLASSES; c++) {
+        unsigned int reserved = config->priorities[c].reserved;
+        shared = shared > reserved ? shared - reserved : 0;
+    }
+
+    for (int c = NET_PRIORITY_CLASSES - 1; c >= 0; c--) {
+        const net_priority_class_t* priority = &config->priorities[c];
+        unsigned int weight = priority->weight > 0 ? priority->weight : 1;
+        unsigned int reserved = priority->reserved;
+        unsigned int count = starts[c + 1] - starts[c];
+
+        // clients left over by an exhausted budget come first in the next round of their class, ids grow in the
+        // order clients are kept in, so a client which is gone or not ready is followed by the next in line
+        unsigned int first = 0;
+        while (first < count && netloop_ready_id(server, starts[c] + first) < server->resume[c]) {
+            first++;
+        }
+        first = first < count ? first : 0;
+        server->resume[c] = 0;
+
+        for (unsigned int k = 0; k < count; k++) {
+            unsigned int available = limited ? reserved + shared : UINT32_MAX;
+            if (available == 0) {
+                server->resume[c] = netloop_ready_id(server, starts[c] + (first + k) % count);
+                break;
+            }
+
+            unsigned int index = server->ready[starts[c] + (first + k) % count];
+            unsigned int reads = netloop_serve_ready(server, index, listener_count,
+                                                     weight < available ? weight : available, config, bound);
+
+            unsigned int from_reserved = reads < reserved ? reads : reserved;
+            reserved -= from_reserved;
+            shared -= limited ? reads - from_reserved : 0;
+        }
+
+        // reserved reads the class did not need go to the classes below it
+        shared += reserved;
+    }
+
+    for (unsigned int i = client_count; i-- > 0;) {
+        if (server->pfds[listener_count + i].fd == -1) {
+            vec_remove(&server->client_vec, i);
+        }
+    }
+}
+
+// serve the ready clients of a round, by priority class or in connection order
+NETLOOP_INLINE void netloop_serve_round(netloop_server_t* server, unsigned int listener_count, int pfd_count,
+                                        int activity, net_config_t* config, callback_data_t bound)
+{
+    if (config->priority_dispatch) {
+        netloop_dispatch_prioritized(server, listener_count, pfd_count, config, bound);
+        return;
+    }
+
+    vec_t* client_vec = &server->client_vec;
+    unsigned int i = 0;
+    for (int p = listener_count; activity > 0 && p < pfd_count; p++) {
+        tcpsock_t* client_sock;
+        vec_get_ref(client_vec, (void**)&client_sock, i);
+
+        int client_action = NETLOOP_CACT_NONE;
+        short revents = server->pfds[p].revents;
+        if (revents != 0) {
+            client_action = netloop_serve_client(server, client_sock, server->pfds[p].fd, revents, config, bound);
+            activity--;
+        }
+
+        if (client_action == NETLOOP_CACT_REMOVE) {
+            vec_remove(client_vec, i);
+        } else {
+            i++;
+        }
+    }
+}
+
+#endif //__NETLOOP_IMPL_H__
\ No newline at end of file
@@ -3,8 +3,13 @@
 
 #include <signal.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "histogram.h"
+#include "pipeline.h"
+#include "ratelimit.h"
+#include "rcache.h"
 #include "tcpsock.h"
 
 #define NET_SUCCESS             0
@@ -13,29 +18,70 @@
 #define NET_SOCKOP_ERROR        3
 #define NET_CONNECTION_CLOSED   4
 #define NET_MEMORY_ERROR        5
+#define NET_RELAY_ERROR         6
+#define NET_TRACE_ERROR         7
+#define NET_CALLBACK_ERROR      8
+#define NET_AFFINITY_ERROR      9
+#define NET_RING_ERROR          10
+#define NET_HANDOVER_ERROR      11
 #define NET_UNSPECIFIED_ERROR   16
 #define NET_UNEXPECTED_NULL     17
 
+#define NET_MAX_LISTENERS       8
+#define NET_PRIORITY_CLASSES    4
+#define NET_MAX_PRIORITY_SOURCES 8
+#define NET_COALESCE_LEVELS     4   // load levels of the adaptive loop, level 0 serves every event right away
+
 #define NET_CB_SUCCESS          0
 #define NET_CB_CLIENT_ERROR     0x04
 #define NET_CB_DISCONNECT       0x08
+#define NET_CB_PRIORITY_SET     0x10
+#define NET_CB_PRIORITY(class)  (NET_CB_PRIORITY_SET | ((class) << 8))  // cb_connected result, serve the client in 'class'
 
 /**
  * @brief Callback for when a client connects
  * 
- * @param client socket of the client that just connected
+ * @note return NET_CB_PRIORITY(class) to move the client into another priority class, or NET_CB_DISCONNECT to
+ *       disconnect it right away
+ * 
+ * @param client socket of the client that just connected, client->priority holds the class assigned so far
  */
 typedef int (*callback_connected_t)(tcpsock_t* client);
 
 /**
  * @brief Callback for when a client sends data
  * 
+ * @note with zero-copy receive enabled, data may point to read-only pages mapped from the socket
+ * @note return NET_CB_DISCONNECT to disconnect the client once the data is handled, with a pipeline the flags its
+ *       sink returned for any frame of the data count
+ * 
  * @param client socket of the client that sent the data
  * @param data pointer to a static buffer where the sent data can be read from
  * @param length length of the data buffer
  */
 typedef int (*callback_data_t)(tcpsock_t* client, const void* data, unsigned int length);
 
+/**
+ * @brief Callback for when a client sent data in relay mode
+ * 
+ * @note the data itself was moved to the relay sink and is never seen by the server
+ * 
+ * @param client socket of the client that sent the data
+ * @param length number of bytes which were forwarded to the relay sink
+ */
+typedef int (*callback_relayed_t)(tcpsock_t* client, unsigned long length);
+
+/**
+ * @brief Callback for when zero-copy sends to a client have completed
+ * 
+ * @note only called for clients on which tcp_enable_zerocopy_send was called
+ * 
+ * @param client socket of the client the data was sent to
+ * @param completed every tcp_send_zerocopy with a sequence number below this value has completed,
+ *                  so its buffer may be reused
+ */
+typedef int (*callback_zerocopy_sent_t)(tcpsock_t* client, uint32_t completed);
+
 /**
  * @brief Callback for when an error occured during handling of a client
  * 
@@ -55,18 +101,279 @@ typedef int (*callback_error_t)(tcpsock_t* client, int err);
  */
 typedef int (*callback_disconnected_t)(tcpsock_t* client);
 
+/**
+ * @brief Callback which is called periodically by net_loop, also while no client is active
+ */
+typedef int (*callback_tick_t)(void);
+
+/**
+ * @brief Callback for deadlines of the application, called after every poll round of net_loop
+ * 
+ * @note the loop sleeps no longer than until the returned deadline, so work is done on time without a fast tick
+ * 
+ * @param now_ms current CLOCK_MONOTONIC time in ms
+ * @param load_level load level of the loop (see coalesce_max_us), at level 0 nothing gains from holding work back
+ * @return CLOCK_MONOTONIC ms at which the callback is due next, UINT64_MAX if nothing is pending
+ */
+typedef uint64_t (*callback_timer_t)(uint64_t now_ms, unsigned int load_level);
+
+/**
+ * @brief Callback for when the send queue of a client grew in slow_client_samples consecutive TCP_INFO samples
+ * 
+ * @note the client is disconnected afterwards if evict_slow_clients is set or NET_CB_DISCONNECT is returned
+ * 
+ * @param client socket of the slow client, client->info holds its last sample
+ */
+typedef int (*callback_slow_client_t)(tcpsock_t* client);
+
+/**
+ * @brief Callback for when a listener was opened, before any client is accepted
+ * 
+ * @note returning anything but NET_CB_SUCCESS aborts net_loop
+ * 
+ * @param listener socket of the listener, listener->profile holds the socket options requested for it
+ */
+typedef int (*callback_listening_t)(tcpsock_t* listener);
+
+/**
+ * @brief Callback for when a client is handed over to a successor process, before its socket is sent
+ * 
+ * @note returns the number of bytes written to 'buffer', which the successor passes to cb_adopted
+ * 
+ * @param client socket of the client being handed over
+ * @param buffer buffer for state of the client, e.g. partially received data
+ * @param size size of 'buffer'
+ */
+typedef unsigned int (*callback_handover_t)(tcpsock_t* client, void* buffer, unsigned int size);
+
+/**
+ * @brief Callback for when a client was taken over from a predecessor process, before it is served
+ * 
+ * @param client socket of the client, it keeps the connection id it had in the predecessor
+ * @param state the state cb_handover returned for the client in the predecessor
+ * @param length number of bytes of state
+ */
+typedef int (*callback_adopted_t)(tcpsock_t* client, const void* state, unsigned int length);
+
+/**
+ * @brief Coroutine serving a single client, see net_read, net_write and net_sleep
+ */
+typedef struct net_task net_task_t;
+
+/**
+ * @brief Handler run in a coroutine of its own for every client, instead of the data callbacks
+ * 
+ * @note the client is disconnected when the handler returns
+ * 
+ * @param task coroutine of the client, valid until the handler returns
+ */
+typedef void (*net_handler_t)(net_task_t* task);
+
+typedef enum net_listener_type {
+    NET_LISTEN_IPV4 = 0,
+    NET_LISTEN_IPV6,
+    NET_LISTEN_UNIX
+} net_listener_type_t;
+
+typedef struct net_listener {
+    net_listener_type_t type;
+    uint16_t port;          // port for IPv4 and IPv6 listeners
+    const char* path;       // socket file path for unix listeners
+    const tcp_profile_t* profile;   // socket options of the listener and its clients, NULL for the profile of net_config_t
+    unsigned int priority;  // priority class of the clients accepted on the listener
+} net_listener_t;
+
+typedef enum net_relay_type {
+    NET_RELAY_NONE = 0,
+    NET_RELAY_UPSTREAM,
+    NET_RELAY_FILE
+} net_relay_type_t;
+
+typedef struct net_relay {
+    net_relay_type_t type;
+    const char* ip;         // address of the upstream for upstream relays
+    uint16_t port;          // port of the upstream for upstream relays
+    const char* path;       // file to append to for file relays
+} net_relay_t;
+
+typedef struct net_priority_class {
+    unsigned int weight;    // reads per round for every ready client of the class, 0 for 1
+    unsigned int reserved;  // reads of round_budget which only clients of this class may use
+} net_priority_class_t;
+
+typedef struct net_priority_source {
+    uint8_t addr[16];       // peer address in the form of tcpsock_t.peer_addr, IPv4 as IPv4-mapped IPv6
+    unsigned int prefix_length; // leading bits of 'addr' which have to match, 0 matches every address
+    unsigned int priority;  // priority class of the matching clients
+} net_priority_source_t;
+
+typedef struct net_tcp_stats {
+    uint64_t samples;       // TCP_INFO samples taken
+    histogram_t rtt_us;     // round trip times of all samples
+    uint64_t retransmits;   // retransmitted segments of the connected clients, as of their last sample
+    uint64_t unacked;       // unacknowledged segments of the connected clients, as of their last sample
+    uint64_t send_queue;    // bytes in the send queues of the connected clients, as of their last sample
+    uint64_t slow_clients;  // clients flagged as slow
+    uint64_t evicted;       // slow clients which were disconnected
+} net_tcp_stats_t;
+
+typedef enum net_shed_policy {
+    NET_SHED_REJECT = 0,    // accept new clients and close them right away with a busy message
+    NET_SHED_PAUSE          // stop accepting, new clients wait in the listen backlog
+} net_shed_policy_t;
+
+typedef struct net_admission_stats {
+    uint64_t accepted;              // clients admitted
+    uint64_t rejected_connections;  // clients shed because max_connections was reached
+    uint64_t rejected_memory;       // clients shed because max_buffered_bytes was exceeded
+    uint64_t rejected_rate;         // clients shed because max_accepts_per_sec was reached while accepting
+    uint64_t paused_connections;    // times accepting paused because max_connections was reached
+    uint64_t paused_memory;         // times accepting paused because max_buffered_bytes was exceeded
+    uint64_t paused_rate;           // times accepting paused because max_accepts_per_sec was reached
+} net_admission_stats_t;
+
+typedef struct net_coalesce_stats {
+    uint64_t wakeups;       // poll rounds
+    uint64_t events;        // ready sockets plus every KiB a read took beyond its first, over all rounds
+    uint64_t rounds[NET_COALESCE_LEVELS];   // rounds served at each load level
+    uint64_t delay_us;      // time waited before polls to gather events
+} net_coalesce_stats_t;
+
 typedef struct net_config {
-    uint16_t port;          // port to open the server on
+    uint16_t port;          // port to open the server on when no listeners are given
     bool verbose;           // enable verbose output
     sig_atomic_t running;   // keep running net_loop?
 
+    const tcp_transport_t* transport;   // transport to serve on, NULL for kernel sockets
+                                        // other transports open a single listener of their own and cannot relay
+
+    net_listener_t listeners[NET_MAX_LISTENERS];    // listeners served by a single net_loop
+    unsigned int listener_count;
+    const tcp_profile_t* profile;   // socket options of listeners without a profile of their own, NULL for none
+
+    net_relay_t relay;      // forward client data to a sink instead of calling cb_data, the data of all clients
+                            // interleaves in the sink, net_loop returns NET_RELAY_ERROR once the sink fails
+
+    const char* trace_path; // record every inbound stream to this trace file, NULL disables recording
+
+    const char* ring_name;  // publish every inbound stream to this shared memory ring (shmring.h), NULL disables it
+    size_t ring_size;       // size of the ring, 0 for SHMRING_DEFAULT_SIZE, relayed data is not published
+
+    bool zerocopy_receive;              // map received pages instead of copying them (TCP_ZEROCOPY_RECEIVE)
+    unsigned int zerocopy_map_size;     // bytes mapped per receive, 0 for TCP_ZEROCOPY_MAP_SIZE
+
+    histogram_t* rx_latency;    // record ns from kernel arrival (SO_TIMESTAMPING) to cb_data here, NULL disables
+                                // not recorded for data received with zerocopy_receive
+
+    unsigned int info_interval_ms;      // sample TCP_INFO of info_batch clients every interval, 0 disables sampling
+    unsigned int info_batch;            // clients sampled per interval in round-robin order, 0 samples all
+    unsigned int slow_client_samples;   // flag clients whose send queue grew in this many samples in a row, 0 never flags
+    bool evict_slow_clients;            // disconnect flagged clients
+    net_tcp_stats_t* tcp_stats;         // aggregates of the samples, reset by net_loop, NULL if not needed
+
+    unsigned int max_connections;       // clients served at once, 0 is unlimited
+    uint64_t max_buffered_bytes;        // limit on the send queues of all clients, 0 is unlimited (requires info_interval_ms)
+    unsigned int max_accepts_per_sec;   // accepts per second, 0 is unlimited, exceeding it always pauses accepting
+    net_shed_policy_t shed_policy;      // what happens to new clients while over max_connections or max_buffered_bytes
+    net_admission_stats_t* admission_stats; // admission counters, reset by net_loop, NULL if not needed
+
+    bool busy_loop;         // spin on poll() with a zero timeout instead of sleeping until something is ready
+    bool pin_cpu;           // run net_loop on cpu only (sched_setaffinity)
+    unsigned int cpu;       // CPU to pin to when pin_cpu is set
+    bool incoming_cpu;      // associate the listeners with cpu (SO_INCOMING_CPU), requires pin_cpu
+                            // with SO_REUSEPORT, a loop per CPU then only accepts connections received on its CPU
+
+    rate_limits_t client_limits;        // receive limits per client, reading pauses while exceeded, rates of 0 are unlimited
+    rate_limits_t source_limits;        // receive limits shared by all clients from the same peer address
+
+    pipeline_t* pipeline;   // stages run on received data, its sink is called instead of cb_data, NULL calls cb_data
+                            // not used by relays and handlers
+
+    rcache_t* response_cache;   // answer requests with a response stored by rcache_respond instead of calling cb_data,
+                                // or the sink of 'pipeline' for the frames reaching it, NULL disables the cache
+                                // hits skip the callback entirely, so only for callbacks without other side effects
+
+    bool priority_dispatch; // serve ready clients by priority class, highest first, instead of in connection order
+                            // clients are in class 0 unless their listener, source or cb_connected assigns another
+    net_priority_class_t priorities[NET_PRIORITY_CLASSES];
+    net_priority_source_t priority_sources[NET_MAX_PRIORITY_SOURCES];  // classes by peer address, the first match wins
+    unsigned int priority_source_count;
+    unsigned int round_budget;  // reads per poll round over all clients, 0 is unlimited
+                                // ready clients left over wait for the next round, which bounds the time a round takes
+                                // must exceed the reserved reads of all classes, or classes without reserve starve
+
+    unsigned int coalesce_max_us;   // adapt to the events per wakeup, adding at most this many us before a poll, 0 serves
+                                    // every round alike, under load reads grow to 64 KiB (one cb_data per read) and
+                                    // polls are delayed so each wakeup finds more events ready, like interrupt coalescing
+                                    // responses are not deferred, only cb_timer can hold its own work back by level
+    net_coalesce_stats_t* coalesce_stats;   // load level counters, reset by net_loop, NULL if not needed
+
     callback_connected_t cb_connected;          
     callback_data_t cb_data;
+    callback_relayed_t cb_relayed;
+    callback_zerocopy_sent_t cb_zerocopy_sent;
     callback_error_t cb_error;
     callback_disconnected_t cb_disconnected;
+
+    unsigned int tick_interval_ms;  // interval of cb_tick, 0 disables it
+    callback_tick_t cb_tick;
+    callback_timer_t cb_timer;
+    callback_slow_client_t cb_slow_client;
+    callback_listening_t cb_listening;
+
+    net_handler_t handler;      // run a coroutine per client instead of calling cb_data, NULL for callbacks
+                                // cannot relay, and clients are read without zerocopy_receive and rx_latency
+    size_t handler_stack_size;  // stack size of each coroutine, 0 for CORO_DEFAULT_STACK_SIZE
+
+    char* const* handover_argv; // command line of the successor started when 'handover' is set, NULL disables it
+    sig_atomic_t handover;      // set to hand all sockets over to a successor and return once it serves them
+                                // not possible with a relay or trace, handler coroutines start over in the successor
+    int inherit_fd;             // handover socket of a predecessor (handover_inherited_fd), whose listeners and
+                                // clients are taken over instead of opening listeners, 0 or less for none
+    callback_handover_t cb_handover;
+    callback_adopted_t cb_adopted;
 } net_config_t;
 
 const char* net_strerror(int net_error);
 int net_loop(net_config_t* config);
 
+/**
+ * @brief Returns the client served by 'task'
+ * 
+ * @note the pointer is only valid until the task suspends in net_read, net_write or net_sleep
+ * 
+ * @param task the running task
+ */
+tcpsock_t* net_task_client(net_task_t* task);
+
+/**
+ * @brief Receives up to '*size' bytes into 'buffer', suspending the task until data arrives
+ * 
+ * @note returns NET_CONNECTION_CLOSED once the client hung up or net_loop disconnects it
+ * 
+ * @param task the running task
+ * @param buffer buffer to receive into
+ * @param size size of 'buffer', set to the number of received bytes
+ */
+int net_read(net_task_t* task, void* buffer, unsigned int* size);
+
+/**
+ * @brief Sends all 'size' bytes of 'data', suspending the task while the send buffer is full
+ * 
+ * @param task the running task
+ * @param data data to send
+ * @param size number of bytes to send
+ */
+int net_write(net_task_t* task, const void* data, unsigned int size);
+
+/**
+ * @brief Suspends the task for 'ms' milliseconds
+ * 
+ * @note returns NET_CONNECTION_CLOSED early if the client hangs up or net_loop disconnects it
+ * 
+ * @param task the running task
+ * @param ms time to sleep
+ */
+int net_sleep(net_task_t* task, unsigned int ms);
+
 #endif //__NETWORK_H__
\ No newline at end of file
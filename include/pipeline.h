@@ -0,0 +1,171 @@
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "rcache.h"
+#include "tcpsock.h"
+
+#define PIPELINE_NO_ERROR       0
+#define PIPELINE_FULL_ERROR     1   // no more than PIPELINE_MAX_STAGES stages can be added
+#define PIPELINE_MEMORY_ERROR   2   // the scratch buffer could not be grown
+
+#define PIPELINE_MAX_STAGES     16
+
+typedef enum pipeline_verdict {
+    PIPELINE_CONTINUE = 0,  // pass the frame on to the next stage
+    PIPELINE_DROP,          // discard the frame
+    PIPELINE_CONSUMED       // the stage took care of the frame, e.g. routed it elsewhere or emitted its parts
+} pipeline_verdict_t;
+
+typedef enum pipeline_stage_kind {
+    PIPELINE_FILTER = 0,    // passes or drops frames
+    PIPELINE_TRANSFORM,     // narrows or rewrites frames
+    PIPELINE_ROUTE,         // hands frames elsewhere or fans them out with pipeline_emit
+    PIPELINE_TAP            // observes frames, its verdict is ignored
+} pipeline_stage_kind_t;
+
+struct pipeline;
+
+/**
+ * Received data travelling through the stages, 'data' is borrowed and only valid during the stage call
+ */
+typedef struct pipeline_frame {
+    tcpsock_t* client;      /**< client the data was received from */
+    uint8_t* data;          /**< start of the frame, stages may narrow it */
+    unsigned int length;    /**< length of the frame */
+    bool writable;          /**< may 'data' be rewritten in place? see pipeline_make_writable */
+    int flags;              /**< NET_CB_* flags returned by the sink so far */
+    struct pipeline* pipeline;  /**< pipeline the frame travels through */
+    unsigned int stage;     /**< index of the stage handling the frame */
+} pipeline_frame_t;
+
+typedef pipeline_verdict_t (*pipeline_stage_fn_t)(pipeline_frame_t* frame, void* context);
+
+/**
+ * Receives the frames which made it through all stages, same signature as callback_data_t
+ */
+typedef int (*pipeline_sink_t)(tcpsock_t* client, const void* data, unsigned int length);
+
+/**
+ * A stage and what it cost so far
+ */
+typedef struct pipeline_stage {
+    const char* name;       /**< name for the statistics */
+    pipeline_stage_kind_t kind;
+    pipeline_stage_fn_t fn; /**< function run on every frame */
+    void* context;          /**< second argument of 'fn' */
+    uint64_t frames;        /**< frames handled */
+    uint64_t dropped;       /**< frames dropped */
+    uint64_t consumed;      /**< frames consumed */
+    uint64_t emitted;       /**< frames emitted to the following stages */
+    uint64_t ns;            /**< time spent in 'fn', without the time of the frames it emitted */
+} pipeline_stage_t;
+
+/**
+ * Ordered chain of stages between receiving data and the sink
+ */
+typedef struct pipeline {
+    pipeline_stage_t stages[PIPELINE_MAX_STAGES];
+    unsigned int count;     /**< number of stages */
+    bool timing;            /**< measure the time spent per stage, costs two clock reads per stage call */
+    pipeline_sink_t sink;   /**< called for frames which pass all stages, NULL to discard them */
+    rcache_t* cache;        /**< answers frames with a cached response instead of calling the sink, NULL for none */
+    uint8_t* scratch[PIPELINE_MAX_STAGES];  /**< per stage, copy of a frame it made writable with pipeline_make_writable */
+    unsigned int scratch_size[PIPELINE_MAX_STAGES];
+    uint64_t emitted_ns;    /**< time spent in pipeline_emit, subtracted from the emitting stage */
+} pipeline_t;
+
+/**
+ * Counter of the frames and bytes seen by pipeline_count
+ */
+typedef struct pipeline_counter {
+    uint64_t frames;
+    uint64_t bytes;
+} pipeline_counter_t;
+
+/**
+ * Initialises an empty pipeline which passes everything to 'sink'
+ * \param pipeline the pipeline to initialise
+ * \param sink the function receiving the frames which pass all stages, NULL to discard them
+ */
+void pipeline_init(pipeline_t* pipeline, pipeline_sink_t sink);
+
+/**
+ * Frees the scratch buffers of 'pipeline'
+ * \param pipeline the pipeline to destroy
+ */
+void pipeline_destroy(pipeline_t* pipeline);
+
+/**
+ * Appends a stage to 'pipeline'
+ * If the pipeline already holds PIPELINE_MAX_STAGES stages, PIPELINE_FULL_ERROR is returned
+ * \param pipeline the pipeline
+ * \param name the name of the stage
+ * \param kind what the stage does to frames
+ * \param fn the function run on every frame
+ * \param context the second argument of 'fn'
+ * \return PIPELINE_NO_ERROR if no error occurs during execution
+ */
+int pipeline_add(pipeline_t* pipeline, const char* name, pipeline_stage_kind_t kind,
+                 pipeline_stage_fn_t fn, void* context);
+
+/**
+ * Runs 'length' bytes of 'data' received from 'client' through all stages and into the sink
+ * \param pipeline the pipeline
+ * \param client the client the data was received from
+ * \param data the received data, borrowed for the duration of the call
+ * \param length the number of received bytes
+ * \param writable may stages rewrite 'data' in place? false for e.g. zero-copy mapped pages
+ * \return the NET_CB_* flags returned by the sink, or'ed together, a cached response that could not be sent
+ *         adds NET_CB_DISCONNECT | NET_CB_CLIENT_ERROR
+ */
+int pipeline_run(pipeline_t* pipeline, tcpsock_t* client, void* data, unsigned int length, bool writable);
+
+/**
+ * Runs 'length' bytes of 'data' through the stages following the one handling 'frame', without copying
+ * Used by route stages to fan a frame out, 'data' is typically a part of the frame
+ * \param frame the frame being handled
+ * \param data the data of the new frame
+ * \param length the length of the new frame
+ */
+void pipeline_emit(pipeline_frame_t* frame, uint8_t* data, unsigned int length);
+
+/**
+ * Makes the data of 'frame' writable, copying it to the scratch buffer of its current stage if it is not
+ * The copy is valid until the stage makes the next frame writable, frames emitted from it are writable as well
+ * If the scratch buffer cannot be grown, PIPELINE_MEMORY_ERROR is returned
+ * \param frame the frame
+ * \return PIPELINE_NO_ERROR if no error occurs during execution
+ */
+int pipeline_make_writable(pipeline_frame_t* frame);
+
+/**
+ * Route stage which emits every line of a frame, including its '\n', as a frame of its own
+ * Lines are not joined across frames, a line split over two reads is emitted as two frames
+ */
+pipeline_verdict_t pipeline_split_lines(pipeline_frame_t* frame, void* context);
+
+/**
+ * Transform stage which narrows frames to exclude leading and trailing whitespace, frames which are empty
+ * afterwards are dropped
+ */
+pipeline_verdict_t pipeline_trim(pipeline_frame_t* frame, void* context);
+
+/**
+ * Transform stage which rewrites ASCII letters to lowercase in place
+ */
+pipeline_verdict_t pipeline_lowercase(pipeline_frame_t* frame, void* context);
+
+/**
+ * Filter stage which drops frames that do not start with the string 'context'
+ */
+pipeline_verdict_t pipeline_prefix_filter(pipeline_frame_t* frame, void* context);
+
+/**
+ * Tap stage which counts frames and bytes in the pipeline_counter_t 'context'
+ */
+pipeline_verdict_t pipeline_count(pipeline_frame_t* frame, void* context);
+
+#endif //__PIPELINE_H__
\ No newline at end of file
@@ -0,0 +1,22 @@
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+// USDT probes of the "ascii_server" provider, e.g. bpftrace -e 'usdt:bin/ascii_server:receive { ... }'
+// Without sys/sdt.h (HAVE_SYS_SDT_H is set by the Makefile) they compile to nothing, their arguments are still
+// evaluated so values computed only for a probe do not trip -Wunused
+// An unattached probe is a single nop, its arguments are only described to the tracer in a note section
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define PROBE1(name, a)             DTRACE_PROBE1(ascii_server, name, a)
+#define PROBE2(name, a, b)          DTRACE_PROBE2(ascii_server, name, a, b)
+#define PROBE3(name, a, b, c)       DTRACE_PROBE3(ascii_server, name, a, b, c)
+#define PROBE4(name, a, b, c, d)    DTRACE_PROBE4(ascii_server, name, a, b, c, d)
+#else
+#define PROBE1(name, a)             ((void)(a))
+#define PROBE2(name, a, b)          ((void)(a), (void)(b))
+#define PROBE3(name, a, b, c)       ((void)(a), (void)(b), (void)(c))
+#define PROBE4(name, a, b, c, d)    ((void)(a), (void)(b), (void)(c), (void)(d))
+#endif
+
+#endif //__PROBES_H__
\ No newline at end of file
@@ -0,0 +1,137 @@
+#ifndef __RATELIMIT_H__
+#define __RATELIMIT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RATELIMIT_NO_ERROR      0
+#define RATELIMIT_MEMORY_ERROR  1   // the address table could not be allocated or grown
+
+#define RATELIMIT_ADDR_SIZE     16  // binary peer address, IPv4 addresses are IPv4-mapped IPv6 addresses
+
+/**
+ * A rate of 'rate' units per second with bursts of up to 'burst' units, a rate of 0 is unlimited
+ */
+typedef struct rate_limit {
+    uint32_t rate;          /**< units refilled per second */
+    uint32_t burst;         /**< capacity of the bucket, 0 for one second worth of 'rate' */
+} rate_limit_t;
+
+/**
+ * Limits on received bytes and messages (receives which delivered data)
+ */
+typedef struct rate_limits {
+    rate_limit_t bytes;
+    rate_limit_t messages;
+} rate_limits_t;
+
+/**
+ * Token bucket, tokens may go negative when more was consumed than was available
+ */
+typedef struct token_bucket {
+    int64_t tokens;         /**< available tokens in thousandths */
+    uint64_t updated;       /**< ms timestamp of the last refill */
+} token_bucket_t;
+
+/**
+ * Byte and message buckets of one rate limited entity
+ */
+typedef struct rate_state {
+    token_bucket_t bytes;
+    token_bucket_t messages;
+} rate_state_t;
+
+/**
+ * Entry of the address table, shared by all connections of the same peer address
+ */
+typedef struct ratelimit_entry {
+    uint8_t addr[RATELIMIT_ADDR_SIZE];  /**< peer address */
+    uint32_t connections;   /**< number of connections from the address, entries with 0 may be reclaimed */
+    bool used;              /**< is the slot occupied? */
+    rate_state_t state;     /**< buckets of the address */
+} ratelimit_entry_t;
+
+/**
+ * Open-addressing hash table of peer addresses with linear probing
+ */
+typedef struct ratelimit_table {
+    ratelimit_entry_t* entries; /**< slots, a power of two */
+    uint32_t capacity;      /**< number of slots */
+    uint32_t count;         /**< number of used slots */
+} ratelimit_table_t;
+
+/**
+ * Checks whether 'limits' limits anything at all
+ * \param limits the limits to check
+ * \return true if a byte or message rate is set
+ */
+bool rate_limits_enabled(const rate_limits_t* limits);
+
+/**
+ * Fills both buckets of 'state' to their burst size
+ * \param state the buckets to initialise
+ * \param limits the limits of the buckets
+ * \param now current time in ms
+ */
+void rate_state_init(rate_state_t* state, const rate_limits_t* limits, uint64_t now);
+
+/**
+ * Refills the buckets of 'state' and checks whether both hold tokens
+ * \param state the buckets to check
+ * \param limits the limits of the buckets
+ * \param now current time in ms
+ * \return 0 if reading may continue, otherwise the time in ms at which both buckets hold tokens again
+ */
+uint64_t rate_state_check(rate_state_t* state, const rate_limits_t* limits, uint64_t now);
+
+/**
+ * Takes 'bytes' bytes and one message from the buckets of 'state', they may go into debt
+ * \param state the buckets to take from
+ * \param limits the limits of the buckets
+ * \param bytes the number of received bytes
+ */
+void rate_state_consume(rate_state_t* state, const rate_limits_t* limits, uint64_t bytes);
+
+/**
+ * Creates an empty address table with room for at least 'capacity' addresses
+ * If memory allocation fails, RATELIMIT_MEMORY_ERROR is returned
+ * \param table a pointer, that will be initialised as a new table
+ * \param capacity the initial number of addresses
+ * \return RATELIMIT_NO_ERROR if no error occurs during execution
+ */
+int ratelimit_table_create(ratelimit_table_t* table, uint32_t capacity);
+
+/**
+ * Frees all entries of 'table'
+ * \param table the table to destroy
+ */
+void ratelimit_table_destroy(ratelimit_table_t* table);
+
+/**
+ * Looks up the entry of 'addr' and counts a new connection from it, a new entry starts with full buckets
+ * Growing the table reclaims entries without connections whose buckets are full again
+ * If memory allocation fails, RATELIMIT_MEMORY_ERROR is returned
+ * \param table the table
+ * \param addr the peer address
+ * \param limits the limits of new entries
+ * \param now current time in ms
+ * \return RATELIMIT_NO_ERROR if no error occurs during execution
+ */
+int ratelimit_table_acquire(ratelimit_table_t* table, const uint8_t* addr, const rate_limits_t* limits, uint64_t now);
+
+/**
+ * Looks up the entry of 'addr', the pointer is valid until the next ratelimit_table_acquire
+ * \param table the table
+ * \param addr the peer address
+ * \return the entry, NULL if the address has no entry
+ */
+ratelimit_entry_t* ratelimit_table_find(ratelimit_table_t* table, const uint8_t* addr);
+
+/**
+ * Counts a closed connection from 'addr', the entry is kept so reconnecting does not refill its buckets
+ * \param table the table
+ * \param addr the peer address
+ */
+void ratelimit_table_release(ratelimit_table_t* table, const uint8_t* addr);
+
+#endif //__RATELIMIT_H__
\ No newline at end of file
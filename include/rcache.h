@@ -0,0 +1,119 @@
+#ifndef __RCACHE_H__
+#define __RCACHE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tcpsock.h"
+
+#define RCACHE_NO_ERROR         0
+#define RCACHE_MEMORY_ERROR     1   // mem alloc error
+#define RCACHE_SIZE_ERROR       2   // entry does not fit in the cache at all
+
+#define RCACHE_DEFAULT_SIZE     (4 * 1024 * 1024)   // bytes
+#define RCACHE_DEFAULT_TTL      1000                // ms
+
+/**
+ * Cached response to a request, the request and response bytes follow the entry in the same allocation
+ */
+typedef struct rcache_entry {
+    uint64_t hash;          /**< hash of the request */
+    struct rcache_entry* chain; /**< next entry in the same bucket */
+    struct rcache_entry* newer; /**< neighbour towards the most recently used entry, NULL for the newest */
+    struct rcache_entry* older; /**< neighbour towards the least recently used entry, NULL for the oldest */
+    uint64_t expires;       /**< CLOCK_MONOTONIC_COARSE ms after which the entry is not used anymore */
+    unsigned int request_length;
+    unsigned int response_length;
+    uint8_t data[];         /**< request followed by the response */
+} rcache_entry_t;
+
+#define RCACHE_RESPONSE(entry)  ((entry)->data + (entry)->request_length)
+
+/**
+ * Responses by request, bounded by the bytes of its entries, the least recently used entries are evicted first
+ */
+typedef struct rcache {
+    rcache_entry_t** buckets;   /**< chained hash table */
+    unsigned int bucket_count;  /**< a power of two, grown to keep chains short */
+    unsigned int count;     /**< number of entries */
+    size_t size;            /**< bytes held by the entries, including their headers */
+    size_t max_size;        /**< bytes the entries may hold */
+    rcache_entry_t* newest; /**< most recently used entry */
+    rcache_entry_t* oldest; /**< least recently used entry, evicted first */
+    uint64_t hits;          /**< requests answered from the cache */
+    uint64_t misses;        /**< requests without a valid entry, expired ones included */
+    uint64_t expired;       /**< entries removed because their TTL passed */
+    uint64_t evictions;     /**< entries removed to make room */
+    uint64_t insertions;    /**< entries added or replaced */
+} rcache_t;
+
+/**
+ * Initialises an empty cache
+ * If the hash table cannot be allocated, RCACHE_MEMORY_ERROR is returned
+ * \param cache a pointer, that will be initialised as a new cache
+ * \param max_size the bytes the entries may hold, 0 for RCACHE_DEFAULT_SIZE
+ * \return RCACHE_NO_ERROR if no error occurs during execution
+ */
+int rcache_init(rcache_t* cache, size_t max_size);
+
+/**
+ * Frees all entries and memory held by 'cache'
+ * \param cache the cache to destroy
+ */
+void rcache_destroy(rcache_t* cache);
+
+/**
+ * Looks up the response to 'request' and marks it as most recently used
+ * An entry whose TTL passed is removed and counted as a miss
+ * \param cache the cache to look in
+ * \param request the complete request
+ * \param length the length of the request
+ * \return the entry, valid until the next rcache_insert, NULL if there is none
+ */
+const rcache_entry_t* rcache_lookup(rcache_t* cache, const void* request, unsigned int length);
+
+/**
+ * Stores 'response' as the answer to 'request' for 'ttl_ms', replacing an earlier answer
+ * Least recently used entries are evicted until the entry fits
+ * If the entry is larger than the whole cache, RCACHE_SIZE_ERROR is returned
+ * If the entry cannot be allocated, RCACHE_MEMORY_ERROR is returned
+ * \param cache the cache to store in
+ * \param request the complete request
+ * \param request_length the length of the request
+ * \param response the response to the request
+ * \param response_length the length of the response
+ * \param ttl_ms the time the response may be used
+ * \return RCACHE_NO_ERROR if no error occurs during execution
+ */
+int rcache_insert(rcache_t* cache, const void* request, unsigned int request_length,
+                  const void* response, unsigned int response_length, unsigned int ttl_ms);
+
+/**
+ * Sends the cached response to 'request' to 'client', if there is one
+ * The result of sending it is stored in '*err' like rcache_respond, the caller handles a failure the same way
+ * \param cache the cache to look in
+ * \param client the client which sent the request
+ * \param request the complete request
+ * \param length the length of the request
+ * \param err set to the result of sending the response if there is one
+ * \return true if the request was answered from the cache
+ */
+bool rcache_answer(rcache_t* cache, tcpsock_t* client, const void* request, unsigned int length, int* err);
+
+/**
+ * Sends 'response' to 'client' like tcp_send, and marks it as cacheable by storing it for 'request' once it was sent
+ * Meant for data callbacks behind a cache, later identical requests are answered by rcache_answer
+ * \param cache the cache to store in, NULL only sends the response
+ * \param client the client which sent the request
+ * \param request the complete request, as passed to the data callback
+ * \param request_length the length of the request
+ * \param response the response to send
+ * \param response_length the length of the response
+ * \param ttl_ms the time the response may be used for later requests
+ * \return the result of tcp_send, or TCP_WOULD_BLOCK if only part of the response was sent
+ */
+int rcache_respond(rcache_t* cache, tcpsock_t* client, const void* request, unsigned int request_length,
+                   const void* response, unsigned int response_length, unsigned int ttl_ms);
+
+#endif //__RCACHE_H__
\ No newline at end of file
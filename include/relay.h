@@ -0,0 +1,72 @@
+#ifndef __RELAY_H__
+#define __RELAY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tcpsock.h"
+
+#define RELAY_NO_ERROR          0
+#define RELAY_PIPE_ERROR        1   // pipe creation failed
+#define RELAY_SINK_ERROR        2   // upstream/file could not be opened or written to
+#define RELAY_SOURCE_ERROR      3   // splicing from the source socket failed
+#define RELAY_CONNECTION_CLOSED 4   // source socket indicates connection is closed
+
+#define RELAY_PIPE_SIZE 65536
+
+/**
+ * Structure for holding a relay: a pipe through which bytes are spliced from a source socket to a sink
+ * All sources share the sink and are forwarded in the order they are read, so their bytes interleave at arbitrary
+ * boundaries: a relay carries byte streams, not messages, unless a single source is forwarded
+ */
+typedef struct relay {
+    int pipe_fds[2];        /**< read and write end of the splice pipe */
+    int sink_fd;            /**< descriptor the pipe is drained into */
+    tcpsock_t upstream;     /**< upstream connection, if the sink is not a file */
+    unsigned int pipe_size; /**< capacity of the pipe, maximum bytes moved per forward */
+} relay_t;
+
+/**
+ * Opens a relay which forwards to a TCP connection with 'remote_ip' on port 'remote_port'
+ * If the pipe cannot be created, RELAY_PIPE_ERROR is returned
+ * If the upstream connection cannot be opened, RELAY_SINK_ERROR is returned
+ * \param relay a pointer, that will be initialised as a new relay
+ * \param remote_ip the IPv4 or IPv6 address of the upstream
+ * \param remote_port the port of the upstream
+ * \return RELAY_NO_ERROR if no error occurs during execution
+ */
+int relay_open_upstream(relay_t* relay, const char* remote_ip, const uint16_t remote_port);
+
+/**
+ * Opens a relay which appends to the file at 'path', the file is created if it does not exist
+ * If the pipe cannot be created, RELAY_PIPE_ERROR is returned
+ * If the file cannot be opened, RELAY_SINK_ERROR is returned
+ * \param relay a pointer, that will be initialised as a new relay
+ * \param path the path of the file to append to
+ * \return RELAY_NO_ERROR if no error occurs during execution
+ */
+int relay_open_file(relay_t* relay, const char* path);
+
+/**
+ * Moves the bytes which are available on 'source_fd' into the relay sink, without copying them to user space
+ * At most 'pipe_size' bytes are moved per call, '*length' is set to the number of bytes forwarded
+ * The call blocks until the sink accepted all bytes which were taken from 'source_fd', so a slow sink stalls the caller
+ * If 'source_fd' indicates the connection is closed, RELAY_CONNECTION_CLOSED is returned
+ * If splicing from 'source_fd' fails, RELAY_SOURCE_ERROR is returned
+ * If splicing into the sink fails, RELAY_SINK_ERROR is returned, the bytes in flight are lost and the relay can only
+ * be closed
+ * \param relay the relay to forward through
+ * \param source_fd the socket descriptor to read from
+ * \param length a pointer, that will be set to the number of forwarded bytes
+ * \return RELAY_NO_ERROR if no error occurs during execution
+ */
+int relay_forward(relay_t* relay, int source_fd, size_t* length);
+
+/**
+ * Closes the relay pipe and its sink
+ * \param relay the relay to close
+ * \return RELAY_NO_ERROR if no error occurs during execution
+ */
+int relay_close(relay_t* relay);
+
+#endif //__RELAY_H__
\ No newline at end of file
@@ -2,13 +2,127 @@
 #define __RES_H__
 
 #define RES_DOC "ASCII server -- a program which opens a socket and prints " \
-                "the recieved ASCII data to the console"
+                "the recieved ASCII data to the console" \
+                "\vOn SIGUSR2 the server starts a new instance of itself with the same arguments and hands " \
+                "all listeners and connected clients over to it, without dropping a connection."
 
 #define RES_ARGS_DOC "PORT"
 
 #define RES_ARGP_OPTIONS_VERBOSE "Enable verbose output"
+#define RES_ARGP_OPTIONS_IPV6 "Also listen for IPv6 clients on PORT"
+#define RES_ARGP_OPTIONS_UNIX "Also listen for local clients on the unix socket PATH"
+#define RES_ARGP_OPTIONS_RELAY "Forward all client data to the upstream at IP:PORT using splice()"
+#define RES_ARGP_OPTIONS_RELAY_FILE "Append all client data to the file PATH using splice()"
+#define RES_ARGP_OPTIONS_ZEROCOPY_RECEIVE "Map received pages into memory instead of copying them " \
+                                          "(TCP_ZEROCOPY_RECEIVE)"
+
+#define RES_ARGP_OPTIONS_JOURNAL "Capture received data in a memory-mapped journal in DIR instead of printing it"
+#define RES_ARGP_OPTIONS_JOURNAL_SEGMENT_MB "Size of a journal segment file in MB (default 64)"
+#define RES_ARGP_OPTIONS_JOURNAL_SYNC_MS "Sync the journal to disk at most every MS milliseconds (default 1000)"
+#define RES_ARGP_OPTIONS_RX_LATENCY "Measure the delay between the kernel receiving data and it being handled, " \
+                                    "printed on exit"
+#define RES_ARGP_OPTIONS_TCP_INFO_MS "Sample TCP_INFO of the clients every MS milliseconds, printed on exit"
+#define RES_ARGP_OPTIONS_EVICT_SLOW "Disconnect clients whose send queue grew in N samples in a row " \
+                                    "(requires --tcp-info-ms)"
+#define RES_ARGP_OPTIONS_MAX_CONNECTIONS "Serve at most N clients at once"
+#define RES_ARGP_OPTIONS_MAX_BUFFERED_KB "Stop admitting clients while their send queues hold more than KB kilobytes " \
+                                         "(requires --tcp-info-ms)"
+#define RES_ARGP_OPTIONS_MAX_ACCEPTS "Accept at most N clients per second"
+#define RES_ARGP_OPTIONS_SHED "What to do with new clients while over a limit: 'reject' them with a busy message " \
+                              "(default) or 'pause' accepting"
+#define RES_ARGP_OPTIONS_CLIENT_BYTES "Read at most N bytes per second from every client"
+#define RES_ARGP_OPTIONS_CLIENT_MESSAGES "Read at most N times per second from every client"
+#define RES_ARGP_OPTIONS_SOURCE_BYTES "Read at most N bytes per second from all clients of one address together"
+#define RES_ARGP_OPTIONS_SOURCE_MESSAGES "Read at most N times per second from all clients of one address together"
+#define RES_ARGP_OPTIONS_SOCKET_PROFILE "Start from the 'latency' or 'throughput' socket options, " \
+                                        "socket options given after it override single values"
+#define RES_ARGP_OPTIONS_NODELAY "Send small writes right away (TCP_NODELAY)"
+#define RES_ARGP_OPTIONS_QUICKACK "Acknowledge received data right away (TCP_QUICKACK)"
+#define RES_ARGP_OPTIONS_RCVBUF "Request a receive buffer of BYTES bytes (SO_RCVBUF)"
+#define RES_ARGP_OPTIONS_SNDBUF "Request a send buffer of BYTES bytes (SO_SNDBUF)"
+#define RES_ARGP_OPTIONS_DEFER_ACCEPT "Accept clients only once they sent data, waiting at most S seconds " \
+                                      "(TCP_DEFER_ACCEPT)"
+#define RES_ARGP_OPTIONS_FASTOPEN "Accept data in the SYN of up to N pending clients (TCP_FASTOPEN)"
+#define RES_ARGP_OPTIONS_BUSY_POLL "Busy poll the device queue for US microseconds on receives (SO_BUSY_POLL)"
+#define RES_ARGP_OPTIONS_REUSEADDR "Allow restarting while old connections are in TIME_WAIT (SO_REUSEADDR)"
+#define RES_ARGP_OPTIONS_REUSEPORT "Allow other processes to listen on the same port (SO_REUSEPORT)"
+#define RES_ARGP_OPTIONS_KEEPALIVE "Probe idle clients after IDLE seconds, every INTVL seconds, " \
+                                   "dropping them after CNT unanswered probes"
+#define RES_ARGP_OPTIONS_BUSY_LOOP "Spin on the sockets instead of sleeping until one is ready, occupies a whole CPU"
+#define RES_ARGP_OPTIONS_CPU "Run the server on CPU N only"
+#define RES_ARGP_OPTIONS_INCOMING_CPU "Only accept clients whose packets arrive on the CPU given with --cpu, " \
+                                      "for one server per CPU sharing a port with --reuseport"
+#define RES_ARGP_OPTIONS_COROUTINES "Serve every client from a coroutine of its own instead of callbacks"
+#define RES_ARGP_OPTIONS_RING "Publish every inbound stream to the shared memory ring NAME (in /dev/shm), " \
+                              "for consumers such as the ring_consumer tool"
+#define RES_ARGP_OPTIONS_RING_SIZE_KB "Size of the shared memory ring in kilobytes (default 4096)"
+#define RES_ARGP_OPTIONS_STAGE "Append a stage to the pipeline data passes before it is answered, repeatable, " \
+                               "STAGE is one of 'lines', 'trim', 'lower', 'prefix:TEXT' or 'count'"
+#define RES_ARGP_OPTIONS_STATSD "Aggregate name:value|type metric lines instead of answering them, " \
+                                "printing the aggregated metrics every MS milliseconds"
+#define RES_ARGP_OPTIONS_PRIORITY "Serve ready clients of priority class CLASS (0-3, higher first) with WEIGHT " \
+                                  "reads per round, RESERVED of the round budget are kept for the class, repeatable"
+#define RES_ARGP_OPTIONS_PRIORITY_SOURCE "Put clients from ADDR, or from the network ADDR/BITS, into priority " \
+                                         "class CLASS, repeatable"
+#define RES_ARGP_OPTIONS_UNIX_PRIORITY "Put clients of the --unix listeners into priority class CLASS"
+#define RES_ARGP_OPTIONS_ROUND_BUDGET "Read from at most N ready clients per poll round, the rest wait for the next " \
+                                      "round, this bounds the time high priority clients wait for a round to end"
+#define RES_ARGP_OPTIONS_FORWARD "Also forward the data passing the pipeline stages given before to the upstream " \
+                                 "IP:PORT, in batches sent at the latest MS milliseconds after their first " \
+                                 "message (default 5), repeatable"
+#define RES_ARGP_OPTIONS_FORWARD_BATCH_KB "Size in kilobytes at which a forwarded batch is sent before its " \
+                                          "deadline (default 64)"
+#define RES_ARGP_OPTIONS_CACHE_KB "Answer repeated lines from a response cache of KB kilobytes (default 4096), " \
+                                  "requires --stage lines"
+#define RES_ARGP_OPTIONS_CACHE_TTL_MS "Time in milliseconds a cached response is used for (default 1000), " \
+                                      "enables the response cache"
+#define RES_ARGP_OPTIONS_COALESCE_MAX_US "Adapt the loop to the load, under load reading more per call and waiting " \
+                                        "up to US microseconds before polling so more events are served per wakeup"
+#define RES_ARGP_OPTIONS_TRACE "Record every inbound stream to the trace FILE, for replay with the replay tool"
 
 #define RES_ARGP_PORT_ERROR_FORMAT "\"%s\" is not a valid port number"
+#define RES_ARGP_NUMBER_ERROR_FORMAT "\"%.24s\" is not a valid number"
+#define RES_ARGP_RELAY_ERROR_FORMAT "\"%.24s\" is not a valid IP:PORT relay address"
+#define RES_ARGP_SHED_ERROR_FORMAT "\"%.16s\" is not a policy, use reject or pause"
+#define RES_ARGP_PROFILE_ERROR_FORMAT "\"%.16s\" is not a profile, use latency or throughput"
+#define RES_ARGP_KEEPALIVE_ERROR_FORMAT "\"%.16s\" is not a valid IDLE:INTVL:CNT setting"
+#define RES_ARGP_STAGE_ERROR_FORMAT "\"%.24s\" is not a pipeline stage"
+#define RES_ARGP_STAGES_ERROR_FORMAT "no more than %i pipeline stages are supported"
+#define RES_ARGP_PRIORITY_ERROR_FORMAT "\"%.16s\" is not a valid CLASS:WEIGHT[:RESERVED]"
+#define RES_ARGP_PRIORITY_SOURCE_ERROR_FORMAT "\"%.20s\" is not a valid ADDR[/BITS]=CLASS"
+#define RES_ARGP_PRIORITY_SOURCES_ERROR_FORMAT "no more than %i priority sources are supported"
+#define RES_ARGP_ROUND_BUDGET_ERROR_FORMAT "--round-budget must exceed the %u reserved reads"
+#define RES_ARGP_FORWARDS_ERROR_FORMAT "no more than %i forward upstreams are supported"
+#define RES_ARGP_INCOMING_CPU_ERROR "--incoming-cpu requires --cpu"
+#define RES_ARGP_MAX_BUFFERED_ERROR "--max-buffered-kb requires --tcp-info-ms"
+#define RES_ARGP_EVICT_SLOW_ERROR "--evict-slow requires --tcp-info-ms"
+#define RES_ARGP_CACHE_ERROR "the response cache requires --stage lines"
+#define RES_ARGP_LISTENERS_ERROR_FORMAT "no more than %i listeners are supported"
 #define RES_ARGP_UNSPECIFIED_ERROR "an unspecified parsing error occured"
 
+#define RES_JOURNAL_OPEN_ERROR_FORMAT "failed to open journal in \"%s\" (error %i)"
+
+#define RES_FORWARD_OPEN_ERROR_FORMAT "failed to connect to the forward upstream %s:%u"
+#define RES_FORWARD_FAILED_FORMAT "forward upstream %s:%u stopped accepting data, stopping"
+
+#define RES_LISTENING_FORMAT "listening on fd %i: %s"
+
+#define RES_RX_LATENCY_FORMAT "receive latency over %llu reads: mean %.1f us, p50 %.1f us, p99 %.1f us, " \
+                              "p99.9 %.1f us, max %.1f us"
+#define RES_TCP_STATS_FORMAT "tcp info over %llu samples: rtt p50 %.1f ms, p99 %.1f ms, %llu retransmits, " \
+                             "%llu slow clients, %llu evicted"
+#define RES_PIPELINE_STAGE_FORMAT "stage %-8s %llu frames, %llu dropped, %llu emitted, mean %.0f ns"
+#define RES_PIPELINE_COUNT_FORMAT "counted %llu frames, %llu bytes"
+#define RES_FORWARD_STATS_FORMAT "forward %s:%u: %llu messages, %llu bytes in %llu writes, %llu batches full, " \
+                                 "%llu due, %llu bytes dropped"
+#define RES_CACHE_OPEN_ERROR "failed to allocate the response cache"
+#define RES_CACHE_STATS_FORMAT "response cache: %llu hits, %llu misses, %llu expired, %llu evicted, " \
+                               "%u entries in %zu bytes"
+#define RES_STATSD_OPEN_ERROR "failed to allocate the statsd table"
+#define RES_STATSD_STATS_FORMAT "statsd: %llu lines, %llu malformed, %u metrics, %llu flushes"
+#define RES_COALESCE_STATS_FORMAT "coalescing: %llu wakeups at %.1f events each, %llu/%llu/%llu/%llu rounds at " \
+                                  "level 0/1/2/3, %.1f ms waited"
+#define RES_ADMISSION_STATS_FORMAT "admission: %llu accepted, rejected %llu/%llu/%llu and paused %llu/%llu/%llu times " \
+                                   "(connections/memory/rate)"
+
 #endif //__RES_H__
\ No newline at end of file
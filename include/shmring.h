@@ -0,0 +1,168 @@
+#ifndef __SHMRING_H__
+#define __SHMRING_H__
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHMRING_NO_ERROR        0
+#define SHMRING_FILE_ERROR      1   // shared memory object could not be created, sized or mapped
+#define SHMRING_FORMAT_ERROR    2   // shared memory object is not a ring
+#define SHMRING_EMPTY           3   // consumer caught up with the producer
+#define SHMRING_OVERRUN         4   // producer overwrote frames before the consumer read them
+
+#define SHMRING_MAGIC           0x474E5253U     // "SRNG"
+#define SHMRING_VERSION         1
+#define SHMRING_DEFAULT_SIZE    (4 * 1024 * 1024)
+#define SHMRING_HEADER_SIZE     256             // data starts at this offset in the mapping
+#define SHMRING_ALIGN           16              // frames start at multiples of this, so a frame header always fits
+#define SHMRING_MAX_LENGTH      ((1U << 30) - 1)
+
+typedef enum shmring_frame_type {
+    SHMRING_FRAME_OPEN = 0, // a connection was accepted
+    SHMRING_FRAME_DATA,     // data was received on a connection
+    SHMRING_FRAME_CLOSE,    // a connection was closed
+    SHMRING_FRAME_PADDING   // fills the end of the ring up to the wrap, skipped by consumers
+} shmring_frame_type_t;
+
+/**
+ * Header at the start of the shared memory object
+ * Positions count bytes ever written, the offset in the ring is the position modulo 'capacity'
+ */
+typedef struct shmring_header {
+    uint32_t magic;         /**< SHMRING_MAGIC */
+    uint32_t version;       /**< SHMRING_VERSION */
+    uint64_t capacity;      /**< size of the data area, a power of two */
+    _Atomic uint32_t closed;    /**< set once the producer closed the ring */
+    _Atomic uint64_t reserve_pos __attribute__((aligned(64)));  /**< end of the frame being written */
+    _Atomic uint64_t write_pos; /**< end of the published frames */
+    _Atomic uint32_t notify __attribute__((aligned(64)));   /**< futex word, bumped on publish while consumers wait */
+    _Atomic uint32_t waiters;   /**< number of consumers waiting on 'notify' */
+} shmring_header_t;
+
+/**
+ * Header in front of every frame, only data frames carry data
+ */
+typedef struct shmring_frame {
+    uint64_t seq;           /**< frame number, consecutive apart from padding frames */
+    uint32_t connection_id; /**< id of the connection the frame belongs to */
+    uint32_t type_length;   /**< frame type in the upper 2 bits, data length in the lower 30 bits */
+} shmring_frame_t;
+
+#define SHMRING_FRAME_TYPE(frame)   ((shmring_frame_type_t)((frame)->type_length >> 30))
+#define SHMRING_FRAME_LENGTH(frame) ((frame)->type_length & SHMRING_MAX_LENGTH)
+
+/**
+ * Producer side of a ring, there is a single producer per ring
+ */
+typedef struct shmring {
+    shmring_header_t* header;   /**< mapping of the shared memory object */
+    uint8_t* data;          /**< data area of the mapping */
+    size_t map_size;        /**< size of the mapping */
+    uint64_t position;      /**< producer copy of write_pos */
+    uint64_t seq;           /**< number of the next frame */
+    char name[64];          /**< name of the shared memory object */
+} shmring_t;
+
+/**
+ * Consumer side of a ring, any number of consumers may read the same ring without affecting the producer
+ */
+typedef struct shmring_consumer {
+    shmring_header_t* header;   /**< mapping of the shared memory object */
+    const uint8_t* data;    /**< data area of the mapping */
+    size_t map_size;        /**< size of the mapping */
+    uint64_t position;      /**< position of the next frame to read */
+    uint64_t frame_position;    /**< position of the frame returned last */
+    uint64_t overruns;      /**< times the consumer was lapped by the producer */
+} shmring_consumer_t;
+
+/**
+ * Creates (or replaces) the shared memory object 'name' (in /dev/shm) and maps it as an empty ring
+ * The producer never waits for consumers, a consumer which falls behind by more than the ring size loses frames
+ * If the object cannot be created or mapped, SHMRING_FILE_ERROR is returned
+ * \param ring a pointer, that will be initialised as a new ring
+ * \param name the name of the shared memory object, with or without leading '/'
+ * \param size size of the data area, rounded up to a power of two, 0 for SHMRING_DEFAULT_SIZE
+ * \return SHMRING_NO_ERROR if no error occurs during execution
+ */
+int shmring_create(shmring_t* ring, const char* name, size_t size);
+
+/**
+ * Publishes a frame on connection 'connection_id', 'data' and 'length' are only used for SHMRING_FRAME_DATA
+ * Data longer than a quarter of the ring is split over multiple frames
+ * Waiting consumers are woken with a futex, publishing costs no system call while no consumer waits
+ * \param ring the ring to publish to
+ * \param type the type of the frame
+ * \param connection_id the id of the connection
+ * \param data the received bytes
+ * \param length the number of received bytes
+ */
+void shmring_publish(shmring_t* ring, shmring_frame_type_t type, uint32_t connection_id,
+                     const void* data, uint32_t length);
+
+/**
+ * Marks the ring closed, wakes all consumers and removes the shared memory object
+ * Consumers which are attached keep their mapping until they close it
+ * \param ring the ring to close
+ */
+void shmring_close(shmring_t* ring);
+
+/**
+ * Same as shmring_close, but the shared memory object is left in place
+ * For handing the ring name over to another producer, which replaced the object already
+ * \param ring the ring to detach from
+ */
+void shmring_detach(shmring_t* ring);
+
+/**
+ * Attaches to the ring 'name', reading starts with the next frame published
+ * If the object cannot be opened or mapped, SHMRING_FILE_ERROR is returned
+ * If the object is not a ring, SHMRING_FORMAT_ERROR is returned
+ * \param consumer a pointer, that will be initialised as a new consumer
+ * \param name the name of the shared memory object, with or without leading '/'
+ * \return SHMRING_NO_ERROR if no error occurs during execution
+ */
+int shmring_consumer_open(shmring_consumer_t* consumer, const char* name);
+
+/**
+ * Reads the next frame without copying it, '*data' points into the ring
+ * The producer may overwrite the frame at any time, check shmring_consumer_valid after using '*data'
+ * If no frame is available, SHMRING_EMPTY is returned
+ * If the producer lapped the consumer, SHMRING_OVERRUN is returned and reading continues with the next frame published
+ * \param consumer the consumer to read with
+ * \param frame a pointer, that will be set to the frame header
+ * \param data a pointer, that will be set to the data of a data frame
+ * \return SHMRING_NO_ERROR if no error occurs during execution
+ */
+int shmring_consumer_next(shmring_consumer_t* consumer, shmring_frame_t* frame, const void** data);
+
+/**
+ * Checks whether the frame returned last by shmring_consumer_next is still intact
+ * \param consumer the consumer
+ * \return true if the producer did not start overwriting the frame
+ */
+bool shmring_consumer_valid(shmring_consumer_t* consumer);
+
+/**
+ * Waits until a frame is available, the producer closes the ring or 'timeout_ms' passes
+ * \param consumer the consumer
+ * \param timeout_ms the maximum time to wait, -1 to wait without timeout
+ * \return true if a frame is available
+ */
+bool shmring_consumer_wait(shmring_consumer_t* consumer, int timeout_ms);
+
+/**
+ * Checks whether the producer closed the ring
+ * \param consumer the consumer
+ * \return true if the ring is closed
+ */
+bool shmring_consumer_closed(shmring_consumer_t* consumer);
+
+/**
+ * Unmaps the ring
+ * \param consumer the consumer to close
+ */
+void shmring_consumer_close(shmring_consumer_t* consumer);
+
+#endif //__SHMRING_H__
\ No newline at end of file
@@ -0,0 +1,156 @@
+#ifndef __STATSD_H__
+#define __STATSD_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "histogram.h"
+#include "pipeline.h"
+
+#define STATSD_NO_ERROR         0
+#define STATSD_PARSE_ERROR      1   // line is not a name:value|type metric
+#define STATSD_MEMORY_ERROR     2   // mem alloc error
+
+#define STATSD_DEFAULT_CAPACITY         1024    // metrics the table holds before growing
+#define STATSD_DEFAULT_FLUSH_INTERVAL   10000   // ms
+#define STATSD_MAX_LINE                 512     // longer lines are dropped as malformed
+
+typedef enum statsd_type {
+    STATSD_COUNTER = 0,     // 'c', values are summed, sampled values are scaled by 1/rate
+    STATSD_GAUGE,           // 'g', the last value is kept, values starting with '+' or '-' are added
+    STATSD_TIMER            // 'ms' or 'h', count, mean, min, max and percentiles are kept
+} statsd_type_t;
+
+/**
+ * Aggregate of a metric since the last flush, the name is interned in the table holding it
+ */
+typedef struct statsd_metric {
+    uint64_t hash;          /**< hash of the name and type, 0 for an empty slot */
+    size_t name;            /**< offset of the name in the names of the table */
+    uint16_t name_length;   /**< length of the name */
+    uint8_t type;           /**< statsd_type_t of the metric */
+    bool updated;           /**< was the metric recorded since the last flush? */
+    double value;           /**< sum of a counter, value of a gauge */
+    uint64_t count;         /**< values recorded for a timer */
+    double sum;             /**< sum of the values of a timer */
+    double min;             /**< smallest value of a timer */
+    double max;             /**< largest value of a timer */
+    histogram_t* histogram; /**< values of a timer in us, for the percentiles, NULL for other metrics */
+} statsd_metric_t;
+
+/**
+ * Unterminated line at the end of the data received from a connection, completed by the next data
+ */
+typedef struct statsd_partial {
+    uint32_t connection_id; /**< id of the connection the line was received from */
+    uint64_t flushes;       /**< value of 'flushes' of the table when the line was last extended */
+    unsigned int length;    /**< length of the line so far */
+    char line[STATSD_MAX_LINE];
+} statsd_partial_t;
+
+/**
+ * Open addressing hash table of metrics, filled by a single thread
+ * Tables of multiple threads are combined with statsd_merge
+ */
+typedef struct statsd_table {
+    statsd_metric_t* metrics;   /**< slots, probed linearly */
+    unsigned int capacity;  /**< number of slots, a power of two */
+    unsigned int count;     /**< number of used slots */
+    char* names;            /**< interned metric names, names are never removed */
+    size_t names_size;      /**< bytes used in 'names' */
+    size_t names_capacity;  /**< bytes allocated for 'names' */
+    statsd_partial_t* partials; /**< unterminated lines per connection */
+    unsigned int partial_count;
+    unsigned int partial_capacity;
+    uint64_t flush_interval;    /**< ns between two flushes */
+    uint64_t last_flush;    /**< CLOCK_MONOTONIC in ns of the last flush */
+    uint64_t flushes;       /**< number of flushes */
+    uint64_t lines;         /**< lines recorded */
+    uint64_t malformed;     /**< lines dropped as malformed */
+} statsd_table_t;
+
+/**
+ * Receives the aggregated metrics, one statsd line (without '\n') per call
+ */
+typedef void (*statsd_sink_t)(const char* line, unsigned int length, void* context);
+
+/**
+ * Initialises an empty table
+ * If the slots cannot be allocated, STATSD_MEMORY_ERROR is returned
+ * \param table a pointer, that will be initialised as a new table
+ * \param capacity the number of metrics to allocate slots for, 0 for STATSD_DEFAULT_CAPACITY
+ * \param flush_interval_ms the interval at which statsd_flush emits the metrics, 0 emits on every call
+ * \return STATSD_NO_ERROR if no error occurs during execution
+ */
+int statsd_init(statsd_table_t* table, unsigned int capacity, unsigned int flush_interval_ms);
+
+/**
+ * Frees all memory held by 'table'
+ * \param table the table to destroy
+ */
+void statsd_destroy(statsd_table_t* table);
+
+/**
+ * Parses a single 'name:value|type[|@rate]' line and adds it to the aggregate of the metric
+ * Sections after the type other than the sample rate (e.g. tags) are ignored
+ * If the line is not a metric, STATSD_PARSE_ERROR is returned
+ * If the metric is new and the table cannot grow, STATSD_MEMORY_ERROR is returned
+ * \param table the table to record in
+ * \param line the line, without '\n'
+ * \param length the length of the line
+ * \return STATSD_NO_ERROR if no error occurs during execution
+ */
+int statsd_record(statsd_table_t* table, const char* line, unsigned int length);
+
+/**
+ * Records every line of data received from connection 'connection_id'
+ * A line which is not terminated yet is kept until the next data of the connection completes it
+ * \param table the table to record in
+ * \param connection_id the id of the connection the data was received from
+ * \param data the received data
+ * \param length the number of received bytes
+ */
+void statsd_ingest(statsd_table_t* table, uint32_t connection_id, const void* data, unsigned int length);
+
+/**
+ * Copies the unterminated line kept for connection 'connection_id', e.g. to carry it over to another table
+ * Passing the copy to statsd_ingest of the other table continues the line there
+ * \param table the table holding the line
+ * \param connection_id the id of the connection
+ * \param buffer a buffer, that will hold the line
+ * \param size the size of 'buffer'
+ * \return the length of the line, 0 if there is none or it does not fit in 'buffer'
+ */
+unsigned int statsd_partial(const statsd_table_t* table, uint32_t connection_id, void* buffer, unsigned int size);
+
+/**
+ * Adds the metrics recorded in 'other' since its last flush to 'table'
+ * Gauges recorded in both take the value of 'other'
+ * If 'table' cannot grow, STATSD_MEMORY_ERROR is returned
+ * \param table the table to add to
+ * \param other the table to add
+ * \return STATSD_NO_ERROR if no error occurs during execution
+ */
+int statsd_merge(statsd_table_t* table, const statsd_table_t* other);
+
+/**
+ * Emits the metrics recorded since the last flush to 'sink' and resets them
+ * Counters are emitted as 'name:sum|c', gauges as 'name:value|g' and timers as 'name.count:n|c' followed by
+ * 'name.mean', 'name.min', 'name.max', 'name.p50' and 'name.p99' gauges
+ * Unless 'force' is set, nothing is done if the flush interval has not yet passed
+ * Unterminated lines which were not extended since the previous flush are dropped as malformed
+ * \param table the table to flush
+ * \param force flush regardless of the flush interval
+ * \param sink the function receiving the lines
+ * \param context the last argument of 'sink'
+ * \return the number of lines emitted
+ */
+unsigned int statsd_flush(statsd_table_t* table, bool force, statsd_sink_t sink, void* context);
+
+/**
+ * Pipeline stage which records frames with statsd_ingest in the statsd_table_t 'context' and consumes them
+ */
+pipeline_verdict_t statsd_stage(pipeline_frame_t* frame, void* context);
+
+#endif //__STATSD_H__
\ No newline at end of file
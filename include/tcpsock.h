@@ -1,7 +1,14 @@
 #ifndef __TCPSOCK_H__
 #define __TCPSOCK_H__
 
+#include <poll.h>
+#include <time.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "ratelimit.h"
 
 #define MIN_PORT    1024
 #define MAX_PORT    65536
@@ -12,19 +19,95 @@
 #define    TCP_SOCKOP_ERROR         3   // socket operator (socket, listen, bind, accept,...) error
 #define    TCP_CONNECTION_CLOSED    4   // send/receive indicate connection is closed
 #define    TCP_MEMORY_ERROR         5   // mem alloc error
+#define    TCP_WOULD_BLOCK          6   // send/receive on a non-blocking socket would have to wait
+#define    TCP_NO_BUFFERS           7   // zero-copy send could not pin more pages, retry once sends complete
 
 #define MAX_PENDING 10
 
+#define TCP_ZEROCOPY_MAP_SIZE   (2 * 1024 * 1024)   // default size of a zero-copy receive mapping
+
+struct tcp_transport;
+
+/**
+ * Socket options applied to a listening socket and the sockets it accepts, a value of 0 leaves the kernel default
+ * TCP options are ignored for AF_UNIX sockets
+ */
+typedef struct tcp_profile {
+    bool nodelay;           /**< disable Nagle's algorithm (TCP_NODELAY) */
+    bool quickack;          /**< acknowledge immediately, re-armed after every receive (TCP_QUICKACK) */
+    int rcvbuf;             /**< receive buffer size in bytes (SO_RCVBUF) */
+    int sndbuf;             /**< send buffer size in bytes (SO_SNDBUF) */
+    int defer_accept;       /**< seconds to wait for data before a connection is accepted (TCP_DEFER_ACCEPT) */
+    int fastopen;           /**< queue length of TCP Fast Open requests (TCP_FASTOPEN) */
+    int busy_poll;          /**< microseconds to busy poll the device queue on blocking receives (SO_BUSY_POLL) */
+    bool reuseaddr;         /**< allow binding while old connections linger in TIME_WAIT (SO_REUSEADDR) */
+    bool reuseport;         /**< allow several sockets to listen on the same port (SO_REUSEPORT) */
+    bool keepalive;         /**< send keepalive probes on idle connections (SO_KEEPALIVE) */
+    int keepidle;           /**< idle seconds before the first keepalive probe (TCP_KEEPIDLE) */
+    int keepintvl;          /**< seconds between keepalive probes (TCP_KEEPINTVL) */
+    int keepcnt;            /**< unanswered probes before the connection is dropped (TCP_KEEPCNT) */
+    int backlog;            /**< length of the listen queue, 0 for MAX_PENDING */
+} tcp_profile_t;
+
+/**
+ * Structure for holding a TCP_INFO sample of a connection
+ */
+typedef struct tcp_info_sample {
+    uint32_t rtt_us;        /**< smoothed round trip time */
+    uint32_t rtt_var_us;    /**< round trip time variance */
+    uint32_t retransmits;   /**< segments retransmitted over the lifetime of the connection */
+    uint32_t unacked;       /**< segments sent but not yet acknowledged */
+    uint32_t send_queue;    /**< bytes queued for sending which the peer did not acknowledge yet */
+} tcp_info_sample_t;
+
 /**
  * Structure for holding the TCP socket information
  */
 typedef struct tcpsock {
+    const struct tcp_transport* transport; /**< backend of the socket, NULL for kernel sockets */
+    const tcp_profile_t* profile;   /**< socket options of the socket, inherited by accepted sockets, NULL for none */
     int fd;             /**< socket descriptor */
-    char* ip_addr;      /**< socket IP address */
-    int port;           /**< socket port number */
+    uint32_t id;        /**< connection id, assigned by the owner of the socket */
+    char* ip_addr;      /**< socket IP address (filesystem path for AF_UNIX sockets) */
+    int port;           /**< socket port number (0 for AF_UNIX sockets) */
+    uint8_t peer_addr[16];  /**< binary peer address, IPv4 as IPv4-mapped IPv6 (all zero for AF_UNIX sockets) */
+    int family;         /**< address family (AF_INET, AF_INET6 or AF_UNIX) */
+    bool passive;       /**< is socket a listening socket? */
     bool connected;     /**< is socket connected? */
+    void* zc_map;       /**< zero-copy receive mapping, NULL if zero-copy receive is not enabled */
+    unsigned int zc_map_size; /**< size of the zero-copy receive mapping */
+    bool zc_send;       /**< is MSG_ZEROCOPY sending enabled? */
+    uint32_t zc_send_seq;       /**< notification id of the next zero-copy send */
+    uint32_t zc_send_completed; /**< all zero-copy sends with an id below this value have completed */
+    bool rx_timestamps; /**< are software receive timestamps (SO_TIMESTAMPING) enabled? */
+    tcp_info_sample_t info;     /**< last sample taken by tcp_sample_info */
+    uint32_t queue_growth;      /**< number of consecutive samples in which the send queue grew */
+    rate_state_t rate;  /**< receive rate buckets, only used when the owner rate limits the socket */
+    uint64_t rate_resume;       /**< ms timestamp until which reading is paused by the rate limit, 0 if not paused */
+    void* task;         /**< coroutine serving the socket, owned by the owner of the socket, NULL for none */
+    uint8_t priority;   /**< priority class, assigned by the owner of the socket */
 } tcpsock_t;
 
+/**
+ * Operations of a socket backend
+ * Sockets opened with the tcp_*_open functions use tcp_socket_transport, other transports hand out their own sockets
+ * The 'fd' of a socket is only meaningful to its own transport, e.g. as index into a connection table
+ */
+typedef struct tcp_transport {
+    const char* name;   /**< name of the backend */
+    int (*listen)(const struct tcp_transport* transport, tcpsock_t* sock);    /**< open a listening socket, NULL if listeners need an address */
+    int (*accept)(tcpsock_t* sock, tcpsock_t* new_sock);                      /**< see tcp_wait_for_connection */
+    int (*receive)(tcpsock_t* sock, void* buffer, unsigned int* buff_size);   /**< see tcp_receive */
+    int (*send)(tcpsock_t* sock, const void* buffer, unsigned int* buff_size);/**< see tcp_send */
+    int (*close)(tcpsock_t* sock);                                            /**< see tcp_close */
+    int (*poll)(const struct tcp_transport* transport, struct pollfd* fds, unsigned int count, int timeout_ms); /**< see tcp_poll */
+} tcp_transport_t;
+
+/**
+ * The kernel socket backend
+ */
+extern const tcp_transport_t tcp_socket_transport;
+
 /**
  * Creates a new socket and opens this socket in 'passive listening mode' (waiting for an active connection setup request)
  * The socket is bound to port number 'port' and to any active IP interface of the system
@@ -33,17 +116,46 @@ typedef struct tcpsock {
  * If port 'port' is not between MIN_PORT and MAX_PORT, TCP_ADDRESS_ERROR is returned
  * If memory allocation for the newly created socket fails, TCP_MEMORY_ERROR is returned
  * If a socket operation (socket, listen, bind, accept,...) fails, TCP_SOCKOP_ERROR is returned
+ * The options in 'profile' are applied to the socket and to every socket it accepts, so 'profile' must outlive them
+ * \param socket a pointer, that will be initialised as a new socket
+ * \param port a port number between MIN_PORT and MAX_PORT
+ * \param profile the socket options to apply, NULL for none
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_passive_open(tcpsock_t* sock, const uint16_t port, const tcp_profile_t* profile);
+
+/**
+ * Same as tcp_passive_open, but the socket is bound to any active IPv6 interface of the system
+ * The socket is marked IPV6_V6ONLY, so it can share 'port' with an IPv4 socket opened by tcp_passive_open
  * \param socket a pointer, that will be initialised as a new socket
  * \param port a port number between MIN_PORT and MAX_PORT
+ * \param profile the socket options to apply, NULL for none
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_passive_open_ipv6(tcpsock_t* sock, const uint16_t port, const tcp_profile_t* profile);
+
+/**
+ * Creates a new AF_UNIX stream socket and opens this socket in 'passive listening mode'
+ * The socket is bound to the filesystem path 'path', a stale socket file at 'path' is removed first
+ * A socket file is stale once connecting to it is refused, other files at 'path' are never removed
+ * The socket file is removed again when the socket is closed with tcp_close
+ * If 'path' is NULL, empty or too long for a unix socket address, TCP_ADDRESS_ERROR is returned
+ * If 'path' holds anything but a stale socket file, TCP_ADDRESS_ERROR is returned
+ * If memory allocation for the path copy fails, TCP_MEMORY_ERROR is returned
+ * If a socket operation (socket, listen, bind, accept,...) fails, TCP_SOCKOP_ERROR is returned
+ * \param socket a pointer, that will be initialised as a new socket
+ * \param path the filesystem path to bind the socket to
+ * \param profile the socket options to apply, NULL for none
  * \return TCP_NO_ERROR if no error occurs during execution
  */
-int tcp_passive_open(tcpsock_t* sock, const uint16_t port);
+int tcp_passive_open_unix(tcpsock_t* sock, const char* path, const tcp_profile_t* profile);
 
 /**
  * Creates a new TCP socket and opens a TCP connection to the system with IP address 'remote_ip' on port 'remote_port'
  * This function is typically called by a client
  * If port 'remote_port' is not between MIN_PORT and MAX_PORT, TCP_ADDRESS_ERROR is returned
- * If 'remote_ip' is NULL or an IP address operation (inet_aton, ...) fails, TCP_ADDRESS_ERROR is returned
+ * 'remote_ip' may be either an IPv4 or an IPv6 address literal
+ * If 'remote_ip' is NULL or an IP address operation (inet_pton, ...) fails, TCP_ADDRESS_ERROR is returned
  * If memory allocation for the newly created socket fails, TCP_MEMORY_ERROR is returned
  * If a socket operation (socket, listen, bind, accept,...) fails, TCP_SOCKOP_ERROR is returned
  * \param socket a pointer, that will be initialised as a new socket
@@ -63,10 +175,31 @@ int tcp_active_open(tcpsock_t* sock, const uint16_t remote_port, const char* rem
  */
 int tcp_close(tcpsock_t* sock);
 
+/**
+ * Wraps the kernel socket descriptor 'fd', e.g. one inherited from another process, in 'sock'
+ * Listening sockets are recognised with SO_ACCEPTCONN, the addresses are read back with getsockname and getpeername
+ * The socket options of 'fd' are left as they are, 'profile' is only applied to connections accepted on it
+ * If a socket operation fails, TCP_SOCKOP_ERROR is returned and 'fd' is left open
+ * \param socket a pointer, that will be initialised as a new socket
+ * \param fd the socket descriptor to take over
+ * \param profile the socket options of connections accepted on the socket, NULL for none
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_adopt(tcpsock_t* sock, int fd, const tcp_profile_t* profile);
+
+/**
+ * Same as tcp_close, but without shutting the connection down or removing the socket file of an AF_UNIX listener
+ * For sockets another process holds a descriptor of as well, which keeps the connection open
+ * \param socket a pointer, to the socket that needs to be released
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_release(tcpsock_t* sock);
+
 /**
  * Puts the socket in a blocking wait mode
  * Returns when an incoming TCP connection setup request is received
  * A newly created socket identifying the remote system that initiated the connection request is returned as 'new_socket'
+ * The new socket inherits the address family of 'socket', for AF_UNIX sockets the IP address is set to the path of 'socket'
  * If memory allocation for the new socket fails, TCP_MEMORY_ERROR is returned
  * If a socket operation (socket, listen, bind, accept, ...) fails, TCP_SOCKOP_ERROR is returned
  * If either socket or new_socket is NULL or not yet bound, TCP_SOCKET_ERROR is returned
@@ -80,6 +213,7 @@ int tcp_wait_for_connection(tcpsock_t* sock, tcpsock_t* new_socket);
  * Initiates a send command on the socket and tries to send the total '*buf_size' bytes of data in 'buffer'
  * The function sets '*buf_size' to the number of bytes that were really sent, which might be less than the initial '*buf_size'
  * If a socket error happens while sending the data in 'buffer' or the connection is closed, TCP_SOCKOP_ERROR or TCP_CONNECTION_CLOSED is returned, respectively
+ * If 'socket' is non-blocking (tcp_set_nonblocking) and its send buffer is full, TCP_WOULD_BLOCK is returned
  * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
  * \param socket the socket where the data needs to be sent on
  * \param buffer a pointer to the buffer that holds the data that needs to be sent
@@ -88,10 +222,74 @@ int tcp_wait_for_connection(tcpsock_t* sock, tcpsock_t* new_socket);
  */
 int tcp_send(tcpsock_t* sock, const void* buffer, unsigned int* buff_size);
 
+/**
+ * Enables MSG_ZEROCOPY sending on 'socket' (SO_ZEROCOPY), which is required before calling tcp_send_zerocopy
+ * If the socket or kernel does not support zero-copy sending, TCP_SOCKOP_ERROR is returned
+ * If 'socket' is NULL or not connected, TCP_SOCKET_ERROR is returned
+ * \param socket the socket to enable zero-copy sending on
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_enable_zerocopy_send(tcpsock_t* sock);
+
+/**
+ * Same as tcp_send, but the pages of 'buffer' are handed to the kernel instead of copied (MSG_ZEROCOPY)
+ * 'buffer' must not be modified or freed until the send has completed, which tcp_reap_zerocopy reports
+ * '*seq' is set to the notification id of this send, the send has completed once tcp_reap_zerocopy reports a value above '*seq'
+ * If the kernel cannot pin more pages (errno ENOBUFS), TCP_NO_BUFFERS is returned and the send may be retried after
+ * tcp_reap_zerocopy reports completions, or the data may be sent with tcp_send instead
+ * If 'socket' is non-blocking (tcp_set_nonblocking) and its send buffer is full, TCP_WOULD_BLOCK is returned
+ * If zero-copy sending is not enabled on 'socket', TCP_SOCKET_ERROR is returned
+ * \param socket the socket where the data needs to be sent on
+ * \param buffer a pointer to the buffer that holds the data that needs to be sent
+ * \param buf_size the amount of bytes that need to be sent from the buffer
+ * \param seq a pointer, that will be set to the notification id of the send
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_send_zerocopy(tcpsock_t* sock, const void* buffer, unsigned int* buff_size, uint32_t* seq);
+
+/**
+ * Drains the zero-copy completion notifications from the error queue of 'socket' without blocking
+ * '*completed' is set such that every zero-copy send with a notification id below it has completed and its buffer can be reused
+ * TCP completes zero-copy sends in order, so a single counter describes all outstanding buffers
+ * If 'socket' is NULL or zero-copy sending is not enabled, TCP_SOCKET_ERROR is returned
+ * If reading the error queue fails, TCP_SOCKOP_ERROR is returned
+ * \param socket the socket to drain the notifications of
+ * \param completed a pointer, that will be set to the number of completed zero-copy sends
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_reap_zerocopy(tcpsock_t* sock, uint32_t* completed);
+
+/**
+ * Sends '*count' bytes of the file 'file_fd', starting at '*offset', on the socket without copying them to user space
+ * '*offset' is advanced and '*count' is set to the number of bytes that were really sent, which might be less than the initial '*count'
+ * If a socket error happens while sending or the connection is closed, TCP_SOCKOP_ERROR or TCP_CONNECTION_CLOSED is returned, respectively
+ * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * \param socket the socket where the data needs to be sent on
+ * \param file_fd the file descriptor to read the data from
+ * \param offset a pointer to the file offset to start sending from
+ * \param count the amount of bytes that need to be sent from the file
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_sendfile(tcpsock_t* sock, int file_fd, off_t* offset, unsigned int* count);
+
+/**
+ * Sends the 'count' buffers of 'iov' in order on the socket with a single system call, like writev but without SIGPIPE
+ * '*sent' is set to the number of bytes that were really sent, which might be less than the total length of 'iov'
+ * If a socket error happens while sending or the connection is closed, TCP_SOCKOP_ERROR or TCP_CONNECTION_CLOSED is returned, respectively
+ * If 'socket' is NULL, not connected or not a kernel socket, TCP_SOCKET_ERROR is returned
+ * \param socket the socket where the data needs to be sent on
+ * \param iov the buffers that need to be sent
+ * \param count the number of buffers in 'iov', at most IOV_MAX
+ * \param sent a pointer, that will be set to the number of sent bytes
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_sendv(tcpsock_t* sock, const struct iovec* iov, unsigned int count, size_t* sent);
+
 /**
  * Initiates a receive command on the socket 'socket' and tries to receive the total '*buf_size' bytes of data in 'buffer'
  * The function sets '*buf_size' to the number of bytes that were really received, which might be less than the inital '*buf_size'
  * If a socket error happens while receiving data or the connection is closed, TCP_SOCKOP_ERROR or TCP_CONNECTION_CLOSED is returned, respectively
+ * If 'socket' is non-blocking (tcp_set_nonblocking) and no data is available, TCP_WOULD_BLOCK is returned
  * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
  * \param socket the socket where the data needs to be received from
  * \param buffer a pointer to the buffer that can store the data that is received
@@ -100,6 +298,131 @@ int tcp_send(tcpsock_t* sock, const void* buffer, unsigned int* buff_size);
  */
 int tcp_receive(tcpsock_t* sock, void* buffer, unsigned int* buff_size);
 
+/**
+ * Enables zero-copy receive on 'socket' by reserving a read-only mapping of 'map_size' bytes (rounded to whole pages)
+ * Received pages are afterwards mapped into this region by tcp_receive_zerocopy instead of copied
+ * If the socket does not support zero-copy receive (e.g. AF_UNIX sockets or kernels without TCP_ZEROCOPY_RECEIVE), TCP_SOCKOP_ERROR is returned
+ * If 'socket' is NULL or not connected, TCP_SOCKET_ERROR is returned
+ * \param socket the socket to enable zero-copy receive on
+ * \param map_size the maximum number of bytes mapped by a single tcp_receive_zerocopy call
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_enable_zerocopy_receive(tcpsock_t* sock, unsigned int map_size);
+
+/**
+ * Initiates a zero-copy receive on the socket 'socket'
+ * Whole pages of received data are mapped at '*mapped', '*map_size' is set to the number of mapped bytes (could be 0)
+ * The sub-page remainder which could not be mapped is received into 'buffer' like tcp_receive does, the mapped bytes precede the bytes in 'buffer'
+ * '*buff_size' is set to the number of bytes copied into 'buffer'
+ * The mapped bytes stay valid until tcp_release_zerocopy, the next tcp_receive_zerocopy or tcp_close is called
+ * If zero-copy receive is not enabled on 'socket', or the kernel refuses it, the call behaves like tcp_receive
+ * Zero-copy receive, zero-copy send and tcp_sendfile are only available on kernel sockets
+ * If a socket error happens while receiving data or the connection is closed, TCP_SOCKOP_ERROR or TCP_CONNECTION_CLOSED is returned, respectively
+ * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * \param socket the socket where the data needs to be received from
+ * \param mapped a pointer, that will be set to the start of the mapped bytes or NULL
+ * \param map_size a pointer, that will be set to the number of mapped bytes
+ * \param buffer a pointer to the buffer that can store the bytes that could not be mapped
+ * \param buf_size the maximum amount of bytes that will be copied into 'buffer'
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_receive_zerocopy(tcpsock_t* sock, const void** mapped, unsigned int* map_size, void* buffer, unsigned int* buff_size);
+
+/**
+ * Releases the pages mapped by the last tcp_receive_zerocopy call on 'socket', after which they can no longer be read
+ * If 'socket' is NULL, TCP_SOCKET_ERROR is returned
+ * \param socket the socket to release the mapped pages of
+ * \param map_size the number of mapped bytes, as returned by tcp_receive_zerocopy
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_release_zerocopy(tcpsock_t* sock, unsigned int map_size);
+
+/**
+ * Writes the effective values of the options a tcp_profile_t can set on 'socket' to 'buffer', as read back from the kernel
+ * The kernel may round or clamp requested values, e.g. it doubles SO_RCVBUF and SO_SNDBUF for bookkeeping
+ * If 'socket' is NULL or not open, TCP_SOCKET_ERROR is returned
+ * \param socket the socket to describe
+ * \param buffer the buffer to write the description to
+ * \param size the size of 'buffer'
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_describe_options(tcpsock_t* sock, char* buffer, size_t size);
+
+/**
+ * Samples TCP_INFO and the send queue of 'socket' into 'socket->info'
+ * 'socket->queue_growth' is incremented when the send queue grew since the previous sample, and reset otherwise
+ * If 'socket' is not a TCP socket (e.g. AF_UNIX sockets), TCP_SOCKOP_ERROR is returned
+ * If 'socket' is NULL or not connected, TCP_SOCKET_ERROR is returned
+ * \param socket the socket to sample
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_sample_info(tcpsock_t* sock);
+
+/**
+ * Makes send and receive calls on 'socket' return TCP_WOULD_BLOCK instead of waiting
+ * Sends may then also transfer only part of the buffer, see tcp_send
+ * If 'socket' is NULL or not connected, TCP_SOCKET_ERROR is returned
+ * \param socket the socket to make non-blocking
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_set_nonblocking(tcpsock_t* sock);
+
+/**
+ * Associates 'socket' with 'cpu' (SO_INCOMING_CPU)
+ * On a listener in an SO_REUSEPORT group, connections whose packets are received on 'cpu' are queued to this listener
+ * If the kernel refuses the option, TCP_SOCKOP_ERROR is returned
+ * If 'socket' is NULL or not open, TCP_SOCKET_ERROR is returned
+ * \param socket the socket to associate
+ * \param cpu the index of the CPU
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_set_incoming_cpu(tcpsock_t* sock, unsigned int cpu);
+
+/**
+ * Makes the kernel timestamp every packet received on 'socket' when it arrives (SO_TIMESTAMPING, software RX)
+ * The timestamps can afterwards be read with tcp_receive_timestamped
+ * If the kernel does not support software receive timestamps, TCP_SOCKOP_ERROR is returned
+ * If 'socket' is NULL or not connected, TCP_SOCKET_ERROR is returned
+ * \param socket the socket to enable receive timestamps on
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_enable_rx_timestamps(tcpsock_t* sock);
+
+/**
+ * Receives data like tcp_receive does, and sets '*arrival' to the time (CLOCK_REALTIME) at which the kernel received it
+ * For a stream the timestamp belongs to the last packet from which bytes were received
+ * '*arrival' is zeroed when no timestamp is available, e.g. when tcp_enable_rx_timestamps was not called
+ * If 'socket' is NULL or not connected, TCP_SOCKET_ERROR is returned
+ * If the connection was closed by the peer, TCP_CONNECTION_CLOSED is returned
+ * If 'socket' is non-blocking (tcp_set_nonblocking) and no data is available, TCP_WOULD_BLOCK is returned
+ * If an other error occurs during receiving, TCP_SOCKOP_ERROR is returned
+ * \param socket the socket to receive data on
+ * \param buffer a pointer to the buffer that can store the received bytes
+ * \param buf_size the maximum amount of bytes that will be received, set to the number of bytes received
+ * \param arrival a pointer, that will be set to the arrival time of the received bytes
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_receive_timestamped(tcpsock_t* sock, void* buffer, unsigned int* buff_size, struct timespec* arrival);
+
+/**
+ * Waits until one of the 'count' sockets described by 'fds' is ready, like poll() does for file descriptors
+ * All sockets in 'fds' must belong to 'transport', a NULL 'transport' means tcp_socket_transport
+ * \param transport the transport the sockets belong to
+ * \param fds the socket descriptors and events to wait for, 'revents' is set on return
+ * \param count the number of entries in 'fds'
+ * \param timeout_ms the maximum time to wait, -1 waits forever and 0 returns immediately
+ * \return the number of entries with non-zero 'revents', 0 on timeout or -1 on error (see errno)
+ */
+int tcp_poll(const tcp_transport_t* transport, struct pollfd* fds, unsigned int count, int timeout_ms);
+
+/**
+ * Return the transport of the 'socket', tcp_socket_transport for kernel sockets
+ * If 'socket' is NULL, NULL is returned
+ * \param socket the socket to get the transport from
+ * \return transport of the given socket
+ */
+const tcp_transport_t* tcp_get_transport(tcpsock_t* sock);
+
 /**
  * Set '*ip_addr' to the IP address of 'socket' (could be NULL if the IP address is not set)
  * No memory allocation is done (pointer reference assignment!), hence, no free must be called to avoid a memory leak
@@ -0,0 +1,125 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRACE_NO_ERROR          0
+#define TRACE_FILE_ERROR        1   // trace file could not be opened, written or mapped
+#define TRACE_FORMAT_ERROR      2   // file is not a trace or is corrupt
+#define TRACE_END               3   // reader reached the end of the trace
+
+#define TRACE_MAGIC             0x45435254U     // "TRCE"
+#define TRACE_VERSION           1
+#define TRACE_BUFFER_SIZE       (1024 * 1024)
+#define TRACE_MAX_LENGTH        ((1U << 30) - 1)
+
+typedef enum trace_event {
+    TRACE_EVENT_OPEN = 0,   // a connection was accepted
+    TRACE_EVENT_DATA,       // data was received on a connection
+    TRACE_EVENT_CLOSE       // a connection was closed
+} trace_event_t;
+
+/**
+ * Header at the start of a trace file
+ */
+typedef struct trace_file_header {
+    uint32_t magic;         /**< TRACE_MAGIC */
+    uint32_t version;       /**< TRACE_VERSION */
+    uint64_t start;         /**< CLOCK_REALTIME in ns at which recording started */
+} trace_file_header_t;
+
+/**
+ * Header in front of every recorded event, only data events are followed by 'length' bytes
+ */
+typedef struct trace_record {
+    uint64_t time;          /**< ns since the start of the recording */
+    uint32_t connection_id; /**< id of the connection the event happened on */
+    uint32_t type_length;   /**< event type in the upper 2 bits, data length in the lower 30 bits */
+} trace_record_t;
+
+#define TRACE_RECORD_TYPE(record)   ((trace_event_t)((record)->type_length >> 30))
+#define TRACE_RECORD_LENGTH(record) ((record)->type_length & TRACE_MAX_LENGTH)
+
+/**
+ * Structure for holding a trace which is being recorded
+ */
+typedef struct trace {
+    FILE* file;             /**< buffered trace file */
+    uint64_t start;         /**< CLOCK_MONOTONIC in ns at which recording started */
+} trace_t;
+
+/**
+ * Structure for reading a recorded trace
+ */
+typedef struct trace_reader {
+    const uint8_t* map;     /**< mapping of the trace file */
+    size_t size;            /**< size of the trace file */
+    size_t offset;          /**< read position */
+    uint64_t start;         /**< CLOCK_REALTIME in ns at which recording started */
+} trace_reader_t;
+
+/**
+ * Creates (or truncates) the trace file at 'path' and starts recording
+ * Records are buffered in user space, so recording costs no system call per event
+ * If the file cannot be created, TRACE_FILE_ERROR is returned
+ * \param trace a pointer, that will be initialised as a new trace
+ * \param path the path of the trace file
+ * \return TRACE_NO_ERROR if no error occurs during execution
+ */
+int trace_open(trace_t* trace, const char* path);
+
+/**
+ * Records an event on connection 'connection_id', 'data' and 'length' are only used for TRACE_EVENT_DATA
+ * Data longer than TRACE_MAX_LENGTH is split over multiple records
+ * If writing to the trace file fails, TRACE_FILE_ERROR is returned
+ * \param trace the trace to record to
+ * \param type the type of the event
+ * \param connection_id the id of the connection
+ * \param data the received bytes
+ * \param length the number of received bytes
+ * \return TRACE_NO_ERROR if no error occurs during execution
+ */
+int trace_record(trace_t* trace, trace_event_t type, uint32_t connection_id, const void* data, uint32_t length);
+
+/**
+ * Flushes and closes the trace file
+ * \param trace the trace to close
+ * \return TRACE_NO_ERROR if no error occurs during execution
+ */
+int trace_close(trace_t* trace);
+
+/**
+ * Opens the trace file at 'path' for reading
+ * If the file cannot be opened or mapped, TRACE_FILE_ERROR is returned
+ * If the file is not a trace, TRACE_FORMAT_ERROR is returned
+ * \param reader a pointer, that will be initialised as a new reader
+ * \param path the path of the trace file
+ * \return TRACE_NO_ERROR if no error occurs during execution
+ */
+int trace_reader_open(trace_reader_t* reader, const char* path);
+
+/**
+ * Reads the next record, '*data' points into the mapped trace and stays valid until the reader is closed
+ * If all records have been read, TRACE_END is returned
+ * If the record is truncated, TRACE_FORMAT_ERROR is returned
+ * \param reader the reader to read from
+ * \param record a pointer, that will be set to the record
+ * \param data a pointer, that will be set to the data of a data record
+ * \return TRACE_NO_ERROR if no error occurs during execution
+ */
+int trace_reader_next(trace_reader_t* reader, trace_record_t* record, const void** data);
+
+/**
+ * Restarts reading at the first record
+ * \param reader the reader to rewind
+ */
+void trace_reader_rewind(trace_reader_t* reader);
+
+/**
+ * Unmaps the trace file
+ * \param reader the reader to close
+ */
+void trace_reader_close(trace_reader_t* reader);
+
+#endif //__TRACE_H__
\ No newline at end of file
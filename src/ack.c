@@ -0,0 +1,49 @@
+#include "ack.h"
+
+#include <stdio.h>
+
+ack_config_t ack_config = {
+    .journal = NULL,
+    .print = false,
+    .cache = NULL,
+    .cache_ttl_ms = RCACHE_DEFAULT_TTL
+};
+
+void ack_capture(uint32_t connection_id, const void* data, unsigned int length)
+{
+    // with a journal, the data is captured instead of printed
+    if (ack_config.journal != NULL) {
+        if (journal_append(ack_config.journal, connection_id, data, length) != JOURNAL_NO_ERROR) {
+            printf("Failed to append %u bytes to the journal\n", length);
+        }
+    } else if (ack_config.print) {
+        printf(" > %.*s", (int)length, (const char*)data);
+    }
+}
+
+void ack_report(bool sent)
+{
+    if (!sent) {
+        printf("Failed to send response to client\n");
+    } else if (ack_config.journal == NULL && ack_config.print) {
+        printf(" < %s", ACK_RESPONSE_STRING);
+    }
+}
+
+void ack_handler(net_task_t* task)
+{
+    char buffer[1024];
+    unsigned int length = sizeof(buffer);
+
+    while (net_read(task, buffer, &length) == NET_SUCCESS) {
+        ack_capture(net_task_client(task)->id, buffer, length);
+
+        bool sent = net_write(task, ACK_RESPONSE_STRING, sizeof(ACK_RESPONSE_STRING)) == NET_SUCCESS;
+        ack_report(sent);
+        if (!sent) {
+            return;
+        }
+
+        length = sizeof(buffer);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,217 @@
+#define _GNU_SOURCE
+
+#include "batch.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+
+static uint64_t _now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// keep what is left of 'iov' after its first 'done' bytes as the pending bytes, the pending bytes may only be the
+// first buffer of 'iov'
+static int _keep(batch_t* batch, const struct iovec* iov, unsigned int count, size_t done)
+{
+    int err = BATCH_NO_ERROR;
+    size_t kept = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        size_t skip = done < iov[i].iov_len ? done : iov[i].iov_len;
+        const uint8_t* rest = (const uint8_t*)iov[i].iov_base + skip;
+        size_t length = iov[i].iov_len - skip;
+        done -= skip;
+
+        if (length == 0) {
+            continue;
+        } else if (iov[i].iov_base == batch->buffer) {
+            memmove(batch->buffer, rest, length);
+        } else if (skip == 0 && kept > 0 && kept + length > batch->capacity) {
+            // the upstream is behind, a message it did not start on is dropped whole
+            batch->dropped += length;
+            continue;
+        } else {
+            // the rest of a message the upstream started on must follow, or the stream is cut mid-message
+            if (kept + length > batch->capacity) {
+                uint8_t* buffer = realloc(batch->buffer, kept + length);
+                if (buffer == NULL) {
+                    batch->dropped += length;
+                    err = BATCH_MEMORY_ERROR;
+                    continue;
+                }
+                batch->buffer = buffer;
+                batch->capacity = kept + length;
+            }
+            memcpy(batch->buffer + kept, rest, length);
+        }
+        kept += length;
+    }
+
+    batch->pending = kept;
+    batch->stalled = kept > 0;
+    batch->deadline = kept > 0 ? _now_ms() + BATCH_RETRY_MS : UINT64_MAX;
+    return err;
+}
+
+// send the bytes of 'iov' until the upstream stops taking them, the rest is kept pending
+static int _send(batch_t* batch, const struct iovec* iov, unsigned int count)
+{
+    struct iovec unsent[2];
+    memcpy(unsent, iov, count * sizeof(struct iovec));
+    struct iovec* next = unsent;
+    unsigned int left = count;
+
+    size_t total = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        total += iov[i].iov_len;
+    }
+
+    size_t done = 0;
+    int tcp_err = TCP_NO_ERROR;
+    while (done < total) {
+        size_t sent;
+        tcp_err = tcp_sendv(&batch->upstream, next, left, &sent);
+        if (tcp_err != TCP_NO_ERROR) {
+            break;
+        }
+        batch->writes++;
+        done += sent;
+
+        // skip what was sent, the first buffer left may have been sent partially
+        while (left > 0 && sent >= next->iov_len) {
+            sent -= next->iov_len;
+            next++;
+            left--;
+        }
+        if (left > 0) {
+            next->iov_base = (uint8_t*)next->iov_base + sent;
+            next->iov_len -= sent;
+        }
+    }
+    batch->bytes += done;
+
+    if (tcp_err != TCP_NO_ERROR && tcp_err != TCP_WOULD_BLOCK) {
+        PRINTF_DEBUG("Upstream (fd = %i) stopped accepting data, errno = %i", batch->upstream.fd, errno);
+        batch->failed = true;
+        batch->stalled = false;
+        batch->dropped += total - done;
+        batch->pending = 0;
+        batch->deadline = UINT64_MAX;
+        return BATCH_SINK_ERROR;
+    }
+
+    return _keep(batch, iov, count, done);
+}
+
+int batch_open(batch_t* batch, const char* remote_ip, uint16_t remote_port, size_t threshold,
+               unsigned int max_delay_ms)
+{
+    memset(batch, 0, sizeof(batch_t));
+    batch->threshold = threshold > 0 ? threshold : BATCH_DEFAULT_THRESHOLD;
+    batch->max_delay_ms = max_delay_ms;
+    batch->deadline = UINT64_MAX;
+
+    batch->buffer = malloc(batch->threshold);
+    if (batch->buffer == NULL) {
+        return BATCH_MEMORY_ERROR;
+    }
+    batch->capacity = batch->threshold;
+
+    if (tcp_active_open(&batch->upstream, remote_port, remote_ip) != TCP_NO_ERROR) {
+        free(batch->buffer);
+        batch->buffer = NULL;
+        return BATCH_SINK_ERROR;
+    }
+
+    // a slow upstream must not stall the loop the batch is sent from
+    if (tcp_set_nonblocking(&batch->upstream) != TCP_NO_ERROR) {
+        tcp_close(&batch->upstream);
+        free(batch->buffer);
+        batch->buffer = NULL;
+        return BATCH_SINK_ERROR;
+    }
+
+    return BATCH_NO_ERROR;
+}
+
+int batch_append(batch_t* batch, const void* data, unsigned int length)
+{
+    batch->messages++;
+    if (batch->failed) {
+        batch->dropped += length;
+        return BATCH_SINK_ERROR;
+    }
+
+    // the message reaching the threshold goes out along with the pending bytes, instead of through the buffer
+    if (batch->pending + length >= batch->threshold || batch->max_delay_ms == 0) {
+        struct iovec iov[2] = {
+            { .iov_base = batch->buffer, .iov_len = batch->pending },
+            { .iov_base = (void*)data, .iov_len = length }
+        };
+        batch->size_flushes += batch->max_delay_ms > 0;
+        return batch->pending > 0 ? _send(batch, iov, 2) : _send(batch, &iov[1], 1);
+    }
+
+    if (batch->pending == 0) {
+        batch->deadline = _now_ms() + batch->max_delay_ms;
+    }
+    memcpy(batch->buffer + batch->pending, data, length);
+    batch->pending += length;
+    return BATCH_NO_ERROR;
+}
+
+uint64_t batch_poll(batch_t* batch, uint64_t now_ms)
+{
+    if (now_ms >= batch->deadline) {
+        batch->deadline_flushes += !batch->stalled;
+        batch_flush(batch);
+    }
+
+    return batch->deadline;
+}
+
+int batch_flush(batch_t* batch)
+{
+    if (batch->pending == 0) {
+        return batch->failed ? BATCH_SINK_ERROR : BATCH_NO_ERROR;
+    }
+
+    struct iovec iov = { .iov_base = batch->buffer, .iov_len = batch->pending };
+    return _send(batch, &iov, 1);
+}
+
+void batch_close(batch_t* batch)
+{
+    if (batch->buffer == NULL) {
+        return;
+    }
+
+    uint64_t give_up = _now_ms() + BATCH_CLOSE_TIMEOUT_MS;
+    batch_flush(batch);
+    while (batch->pending > 0 && !batch->failed) {
+        uint64_t now_ms = _now_ms();
+        struct pollfd pfd = { .fd = tcp_get_fd(&batch->upstream), .events = POLLOUT };
+        if (now_ms >= give_up || poll(&pfd, 1, give_up - now_ms) <= 0) {
+            batch->dropped += batch->pending;
+            break;
+        }
+        batch_flush(batch);
+    }
+
+    tcp_close(&batch->upstream);
+    free(batch->buffer);
+    batch->buffer = NULL;
+}
+
+pipeline_verdict_t batch_stage(pipeline_frame_t* frame, void* context)
+{
+    batch_append(context, frame->data, frame->length);
+    return PIPELINE_CONTINUE;
+}
\ No newline at end of file
@@ -0,0 +1,244 @@
+#define _GNU_SOURCE
+
+#include "coroutine.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "log.h"
+
+// x86-64 switches with a handful of instructions, other targets fall back to ucontext, which also saves the
+// signal mask and so costs a system call per switch
+#if defined(__x86_64__) && !defined(CORO_USE_UCONTEXT)
+#define CORO_FAST_SWITCH
+#else
+#include <ucontext.h>
+#endif
+
+static _Thread_local coro_t* _current = NULL;
+
+#ifdef CORO_FAST_SWITCH
+
+static _Thread_local void* _resumer_sp = NULL;
+
+// saves the callee-saved registers on the current stack, stores the stack pointer in '*save_sp', then switches to
+// 'load_sp' and restores the registers saved there
+void coro_switch_context(void** save_sp, void* load_sp) __attribute__((visibility("hidden")));
+
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl coro_switch_context\n"
+    ".type coro_switch_context, @function\n"
+    "coro_switch_context:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size coro_switch_context, .-coro_switch_context\n"
+);
+
+#else
+
+static _Thread_local ucontext_t _resumer_context;
+
+#endif
+
+static size_t _page_size(void)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    return page_size > 0 ? (size_t)page_size : 4096;
+}
+
+// first function on the stack of every coroutine, never returns
+static void _coro_entry(void)
+{
+    coro_t* coro = _current;
+    coro->fn(coro->arg);
+    coro->finished = true;
+
+#ifdef CORO_FAST_SWITCH
+    coro_switch_context(&coro->sp, _resumer_sp);
+#else
+    swapcontext(coro->context, &_resumer_context);
+#endif
+
+    // a finished coroutine is never resumed again
+    abort();
+}
+
+// prepare the stack of 'coro' so the next resume starts _coro_entry
+static void _prepare(coro_t* coro)
+{
+#ifdef CORO_FAST_SWITCH
+    uintptr_t* sp = (uintptr_t*)((uint8_t*)coro->stack + coro->mapping_size);
+
+    // on entry the stack is misaligned by the return address, like after a call
+    *--sp = 0;
+    *--sp = (uintptr_t)_coro_entry;
+
+    // zeroed rbp, rbx and r12 to r15, popped by coro_switch_context
+    for (int i = 0; i < 6; i++) {
+        *--sp = 0;
+    }
+    coro->sp = sp;
+#else
+    size_t guard_size = _page_size();
+    ucontext_t* context = coro->context;
+    getcontext(context);
+    context->uc_stack.ss_sp = (uint8_t*)coro->stack + guard_size;
+    context->uc_stack.ss_size = coro->mapping_size - guard_size;
+    context->uc_link = NULL;
+    makecontext(context, _coro_entry, 0);
+#endif
+}
+
+static void _free_coro(coro_t* coro)
+{
+    munmap(coro->stack, coro->mapping_size);
+    free(coro->context);
+    free(coro);
+}
+
+void coro_pool_init(coro_pool_t* pool, size_t stack_size)
+{
+    size_t page_size = _page_size();
+    stack_size = stack_size > 0 ? stack_size : CORO_DEFAULT_STACK_SIZE;
+
+    pool->stack_size = (stack_size + page_size - 1) / page_size * page_size;
+    pool->free = NULL;
+    pool->allocated = 0;
+    pool->in_use = 0;
+}
+
+void coro_pool_destroy(coro_pool_t* pool)
+{
+    if (pool->in_use > 0) {
+        PRINTF_DEBUG("Destroying coroutine pool with %u coroutines in use", pool->in_use);
+    }
+
+    while (pool->free != NULL) {
+        coro_t* coro = pool->free;
+        pool->free = coro->next_free;
+        _free_coro(coro);
+    }
+
+    pool->allocated = 0;
+}
+
+coro_t* coro_create(coro_pool_t* pool, coro_fn_t fn, void* arg)
+{
+    coro_t* coro = pool->free;
+    if (coro != NULL) {
+        pool->free = coro->next_free;
+        goto prepare;
+    }
+
+    coro = calloc(1, sizeof(coro_t));
+    if (coro == NULL) {
+        goto coro_malloc_error;
+    }
+
+#ifndef CORO_FAST_SWITCH
+    coro->context = malloc(sizeof(ucontext_t));
+    if (coro->context == NULL) {
+        goto context_malloc_error;
+    }
+#endif
+
+    // the lowest page stays inaccessible, stacks grow down into it on overflow
+    size_t guard_size = _page_size();
+    coro->mapping_size = guard_size + pool->stack_size;
+    coro->stack = mmap(NULL, coro->mapping_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (coro->stack == MAP_FAILED) {
+        PRINTF_DEBUG("Failed mapping a coroutine stack of %zu bytes", coro->mapping_size);
+        goto stack_mmap_error;
+    }
+
+    if (mprotect(coro->stack, guard_size, PROT_NONE) == -1) {
+        PRINTF_DEBUG("Failed protecting the guard page of a coroutine stack");
+        goto guard_error;
+    }
+
+    pool->allocated++;
+
+    prepare:
+    coro->fn = fn;
+    coro->arg = arg;
+    coro->finished = false;
+    coro->next_free = NULL;
+    _prepare(coro);
+    pool->in_use++;
+    return coro;
+
+    guard_error:
+    munmap(coro->stack, coro->mapping_size);
+
+    stack_mmap_error:
+    free(coro->context);
+
+#ifndef CORO_FAST_SWITCH
+    context_malloc_error:
+#endif
+    free(coro);
+
+    coro_malloc_error:
+    return NULL;
+}
+
+void coro_release(coro_pool_t* pool, coro_t* coro)
+{
+    coro->next_free = pool->free;
+    pool->free = coro;
+    pool->in_use--;
+}
+
+bool coro_resume(coro_t* coro)
+{
+    if (coro->finished || _current != NULL) {
+        return coro->finished;
+    }
+
+    _current = coro;
+#ifdef CORO_FAST_SWITCH
+    coro_switch_context(&_resumer_sp, coro->sp);
+#else
+    swapcontext(&_resumer_context, coro->context);
+#endif
+    _current = NULL;
+
+    return coro->finished;
+}
+
+void coro_yield(void)
+{
+    coro_t* coro = _current;
+    if (coro == NULL) {
+        return;
+    }
+
+#ifdef CORO_FAST_SWITCH
+    coro_switch_context(&coro->sp, _resumer_sp);
+#else
+    swapcontext(coro->context, &_resumer_context);
+#endif
+}
+
+coro_t* coro_current(void)
+{
+    return _current;
+}
\ No newline at end of file
@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+
+#include "handover.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log.h"
+
+// descriptor the successor finds the handover socket at
+#define SUCCESSOR_FD 3
+
+int handover_spawn(char* const argv[], int* fd, pid_t* pid)
+{
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) == -1) {
+        PRINTF_DEBUG("call to socketpair() failed with errno = %i [%s]", errno, strerror(errno));
+        return HANDOVER_SPAWN_ERROR;
+    }
+
+    *pid = fork();
+    if (*pid == -1) {
+        PRINTF_DEBUG("call to fork() failed with errno = %i [%s]", errno, strerror(errno));
+        close(pair[0]);
+        close(pair[1]);
+        return HANDOVER_SPAWN_ERROR;
+    }
+
+    if (*pid == 0) {
+        // the successor gets the sockets through the pair only, inherited copies would keep closed clients open
+        if (dup2(pair[1], SUCCESSOR_FD) == -1) {
+            _exit(127);
+        }
+        close_range(SUCCESSOR_FD + 1, ~0U, 0);
+
+        char fd_str[16];
+        snprintf(fd_str, sizeof(fd_str), "%i", SUCCESSOR_FD);
+        setenv(HANDOVER_ENV, fd_str, 1);
+
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    close(pair[1]);
+    *fd = pair[0];
+    return HANDOVER_NO_ERROR;
+}
+
+int handover_inherited_fd(void)
+{
+    const char* fd_str = getenv(HANDOVER_ENV);
+    if (fd_str == NULL) {
+        return -1;
+    }
+
+    char* end;
+    long fd = strtol(fd_str, &end, 10);
+    unsetenv(HANDOVER_ENV);
+    if (*end != '\0' || fd <= STDERR_FILENO || fd > INT32_MAX) {
+        return -1;
+    }
+
+    // descriptors of a later successor are passed explicitly, this one must not leak into it
+    int type;
+    socklen_t length = sizeof(type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &length) == -1 || type != SOCK_SEQPACKET) {
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    return fd;
+}
+
+int handover_send(int fd, handover_record_t* record, int sock_fd, const void* state)
+{
+    record->magic = HANDOVER_MAGIC;
+    if (record->length > HANDOVER_MAX_STATE) {
+        return HANDOVER_FORMAT_ERROR;
+    }
+
+    struct iovec iov[2] = {
+        { .iov_base = record, .iov_len = sizeof(handover_record_t) },
+        { .iov_base = (void*)state, .iov_len = record->length }
+    };
+
+    union {
+        struct cmsghdr header;
+        uint8_t buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen = record->length > 0 ? 2 : 1
+    };
+
+    if (sock_fd >= 0) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &sock_fd, sizeof(int));
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (sent == -1 && errno == EINTR);
+
+    if (sent != (ssize_t)(sizeof(handover_record_t) + record->length)) {
+        PRINTF_DEBUG("call to sendmsg() failed with errno = %i [%s]", errno, strerror(errno));
+        return HANDOVER_SOCKET_ERROR;
+    }
+
+    return HANDOVER_NO_ERROR;
+}
+
+int handover_receive(int fd, handover_record_t* record, int* sock_fd, void* state, int timeout_ms)
+{
+    *sock_fd = -1;
+
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    int ready;
+    do {
+        ready = poll(&pfd, 1, timeout_ms);
+    } while (ready == -1 && errno == EINTR);
+
+    if (ready == 0) {
+        return HANDOVER_TIMEOUT;
+    } else if (ready == -1) {
+        PRINTF_DEBUG("call to poll() failed with errno = %i [%s]", errno, strerror(errno));
+        return HANDOVER_SOCKET_ERROR;
+    }
+
+    struct iovec iov[2] = {
+        { .iov_base = record, .iov_len = sizeof(handover_record_t) },
+        { .iov_base = state, .iov_len = HANDOVER_MAX_STATE }
+    };
+
+    union {
+        struct cmsghdr header;
+        uint8_t buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen = 2,
+        .msg_control = control.buffer,
+        .msg_controllen = sizeof(control.buffer)
+    };
+
+    ssize_t received = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (received <= 0) {
+        PRINTF_DEBUG("call to recvmsg() returned %zi, errno = %i [%s]", received, errno, strerror(errno));
+        return HANDOVER_SOCKET_ERROR;
+    }
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+            && cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+        memcpy(sock_fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+
+    if ((msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || received < (ssize_t)sizeof(handover_record_t)
+            || record->magic != HANDOVER_MAGIC || received != (ssize_t)(sizeof(handover_record_t) + record->length)) {
+        if (*sock_fd >= 0) {
+            close(*sock_fd);
+            *sock_fd = -1;
+        }
+        return HANDOVER_FORMAT_ERROR;
+    }
+
+    return HANDOVER_NO_ERROR;
+}
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include "histogram.h"
+
+#include <string.h>
+
+static unsigned int _bucket_of(uint64_t value)
+{
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return value;
+    }
+
+    // the highest bit selects the group, the bits below it the sub-bucket
+    unsigned int msb = 63 - __builtin_clzll(value);
+    unsigned int shift = msb - HISTOGRAM_SUB_BUCKET_BITS;
+    return ((shift + 1) << HISTOGRAM_SUB_BUCKET_BITS) + ((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+static uint64_t _bucket_upper_bound(unsigned int bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    unsigned int shift = (bucket >> HISTOGRAM_SUB_BUCKET_BITS) - 1;
+    uint64_t sub = bucket & (HISTOGRAM_SUB_BUCKETS - 1);
+    uint64_t lower = ((uint64_t)HISTOGRAM_SUB_BUCKETS | sub) << shift;
+    return lower + (((uint64_t)1 << shift) - 1);
+}
+
+void histogram_reset(histogram_t* histogram)
+{
+    memset(histogram, 0, sizeof(histogram_t));
+    histogram->min = UINT64_MAX;
+}
+
+void histogram_record(histogram_t* histogram, uint64_t value)
+{
+    histogram->buckets[_bucket_of(value)]++;
+    histogram->count++;
+    histogram->sum += value;
+
+    if (value < histogram->min) {
+        histogram->min = value;
+    }
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+void histogram_merge(histogram_t* histogram, const histogram_t* other)
+{
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        histogram->buckets[i] += other->buckets[i];
+    }
+
+    histogram->count += other->count;
+    histogram->sum += other->sum;
+
+    if (other->min < histogram->min) {
+        histogram->min = other->min;
+    }
+    if (other->max > histogram->max) {
+        histogram->max = other->max;
+    }
+}
+
+uint64_t histogram_percentile(const histogram_t* histogram, double percentile)
+{
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * histogram->count + 0.5);
+    rank = rank < 1 ? 1 : rank;
+
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            uint64_t upper = _bucket_upper_bound(i);
+            return upper < histogram->max ? upper : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+double histogram_mean(const histogram_t* histogram)
+{
+    return histogram->count > 0 ? (double)histogram->sum / histogram->count : 0.0;
+}
\ No newline at end of file
@@ -0,0 +1,431 @@
+#define _GNU_SOURCE
+
+#include "journal.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define JOURNAL_ALIGN(x) (((x) + 7) & ~(size_t)7)
+
+static uint64_t _clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static char* _segment_path(const char* directory, uint64_t index)
+{
+    char* path;
+    if (asprintf(&path, "%s/%020llu" JOURNAL_SEGMENT_SUFFIX, directory, (unsigned long long)index) == -1) {
+        return NULL;
+    }
+
+    return path;
+}
+
+// parse the index out of a segment file name, returns false for other files
+static bool _parse_segment_name(const char* name, uint64_t* index)
+{
+    char* end;
+    errno = 0;
+    unsigned long long value = strtoull(name, &end, 10);
+    if (errno != 0 || end == name || strcmp(end, JOURNAL_SEGMENT_SUFFIX) != 0) {
+        return false;
+    }
+
+    *index = value;
+    return true;
+}
+
+static int _compare_indices(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// list the segment indices in 'directory', sorted ascending
+static int _list_segments(const char* directory, uint64_t** indices, unsigned int* count)
+{
+    DIR* dir = opendir(directory);
+    if (dir == NULL) {
+        PRINTF_DEBUG("call to opendir(\"%s\") failed with errno = %i [%s]", directory, errno, strerror(errno));
+        return JOURNAL_FILE_ERROR;
+    }
+
+    unsigned int capacity = 16;
+    *count = 0;
+    *indices = malloc(capacity * sizeof(uint64_t));
+    if (*indices == NULL) {
+        closedir(dir);
+        return JOURNAL_MEMORY_ERROR;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        uint64_t index;
+        if (!_parse_segment_name(entry->d_name, &index)) {
+            continue;
+        }
+
+        if (*count == capacity) {
+            capacity *= 2;
+            uint64_t* grown = realloc(*indices, capacity * sizeof(uint64_t));
+            if (grown == NULL) {
+                free(*indices);
+                closedir(dir);
+                return JOURNAL_MEMORY_ERROR;
+            }
+            *indices = grown;
+        }
+
+        (*indices)[(*count)++] = index;
+    }
+
+    closedir(dir);
+    qsort(*indices, *count, sizeof(uint64_t), _compare_indices);
+    return JOURNAL_NO_ERROR;
+}
+
+static int _open_segment(journal_t* journal)
+{
+    char* path = _segment_path(journal->directory, journal->index);
+    if (path == NULL) {
+        return JOURNAL_MEMORY_ERROR;
+    }
+
+    int err = JOURNAL_NO_ERROR;
+    journal->fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    while (journal->fd == -1 && errno == EEXIST) {
+        // another writer took the index, segments are never shared so move past it
+        free(path);
+        path = _segment_path(journal->directory, ++journal->index);
+        if (path == NULL) {
+            return JOURNAL_MEMORY_ERROR;
+        }
+        journal->fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    }
+    if (journal->fd == -1) {
+        PRINTF_DEBUG("call to open(\"%s\") failed with errno = %i [%s]", path, errno, strerror(errno));
+        err = JOURNAL_FILE_ERROR;
+        goto open_error;
+    }
+
+    // size the file up front, so appending never has to extend it
+    if (ftruncate(journal->fd, journal->segment_size) == -1) {
+        PRINTF_DEBUG("call to ftruncate() failed with errno = %i [%s]", errno, strerror(errno));
+        err = JOURNAL_FILE_ERROR;
+        goto truncate_error;
+    }
+
+    journal->map = mmap(NULL, journal->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, journal->fd, 0);
+    if (journal->map == MAP_FAILED) {
+        PRINTF_DEBUG("call to mmap() failed with errno = %i [%s]", errno, strerror(errno));
+        journal->map = NULL;
+        err = JOURNAL_FILE_ERROR;
+        goto truncate_error;
+    }
+
+    journal_segment_header_t* header = (journal_segment_header_t*)journal->map;
+    header->magic = JOURNAL_MAGIC;
+    header->version = JOURNAL_VERSION;
+    header->index = journal->index;
+
+    journal->offset = JOURNAL_ALIGN(sizeof(journal_segment_header_t));
+    journal->synced = 0;
+    goto success;
+
+    truncate_error:
+    close(journal->fd);
+    unlink(path);
+    journal->fd = -1;
+
+    open_error:
+    success:
+    free(path);
+
+    return err;
+}
+
+// sync the segment up to the append position, trim the unused tail and unmap it
+static int _close_segment(journal_t* journal)
+{
+    int err = journal_sync(journal, true);
+
+    munmap(journal->map, journal->segment_size);
+    journal->map = NULL;
+
+    if (ftruncate(journal->fd, journal->offset) == -1 || fdatasync(journal->fd) == -1) {
+        PRINTF_DEBUG("trimming segment %llu failed with errno = %i [%s]",
+            (unsigned long long)journal->index, errno, strerror(errno));
+        err = JOURNAL_FILE_ERROR;
+    }
+
+    close(journal->fd);
+    journal->fd = -1;
+    return err;
+}
+
+int journal_open(journal_t* journal, const char* directory, size_t segment_size, unsigned int sync_interval_ms)
+{
+    if (journal == NULL || directory == NULL) {
+        return JOURNAL_FILE_ERROR;
+    }
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    journal->segment_size = (segment_size + page_size - 1) & ~(page_size - 1);
+    journal->sync_interval = (uint64_t)sync_interval_ms * 1000000ULL;
+    journal->last_sync = _clock_ns(CLOCK_MONOTONIC);
+    journal->map = NULL;
+    journal->fd = -1;
+
+    journal->directory = strdup(directory);
+    if (journal->directory == NULL) {
+        return JOURNAL_MEMORY_ERROR;
+    }
+
+    // never append to a segment of a previous run, start after the last one
+    uint64_t* indices;
+    unsigned int count;
+    int err = _list_segments(directory, &indices, &count);
+    if (err != JOURNAL_NO_ERROR) {
+        goto list_error;
+    }
+
+    journal->index = count > 0 ? indices[count - 1] + 1 : 0;
+    free(indices);
+
+    if ((err = _open_segment(journal)) != JOURNAL_NO_ERROR) {
+        goto list_error;
+    }
+
+    goto success;
+
+    list_error:
+    free(journal->directory);
+    journal->directory = NULL;
+
+    success:
+    // no action taken
+
+    return err;
+}
+
+int journal_append(journal_t* journal, uint32_t connection_id, const void* data, unsigned int length)
+{
+    size_t frame_size = JOURNAL_ALIGN(sizeof(journal_frame_header_t) + length);
+
+    // the end marker needs room for a header, so never fill a segment completely
+    size_t usable = journal->segment_size - sizeof(journal_frame_header_t);
+    if (length == 0 || JOURNAL_ALIGN(sizeof(journal_segment_header_t)) + frame_size > usable) {
+        return length == 0 ? JOURNAL_NO_ERROR : JOURNAL_FRAME_ERROR;
+    }
+
+    if (journal->map != NULL && journal->offset + frame_size > usable) {
+        int err = _close_segment(journal);
+        journal->index++;
+        if (err != JOURNAL_NO_ERROR) {
+            return err;
+        }
+    }
+
+    // a segment which failed to open is retried with every frame, the frames in between are lost
+    if (journal->map == NULL) {
+        int err = _open_segment(journal);
+        if (err != JOURNAL_NO_ERROR) {
+            return err;
+        }
+    }
+
+    uint8_t* frame = journal->map + journal->offset;
+    journal_frame_header_t* header = (journal_frame_header_t*)frame;
+    memcpy(frame + sizeof(journal_frame_header_t), data, length);
+    header->connection_id = connection_id;
+    header->timestamp = _clock_ns(CLOCK_REALTIME);
+    header->length = length;
+
+    journal->offset += frame_size;
+    return JOURNAL_NO_ERROR;
+}
+
+int journal_sync(journal_t* journal, bool force)
+{
+    if (journal == NULL || journal->map == NULL) {
+        return JOURNAL_FILE_ERROR;
+    }
+
+    uint64_t now = _clock_ns(CLOCK_MONOTONIC);
+    if (journal->synced == journal->offset || (!force && now - journal->last_sync < journal->sync_interval)) {
+        return JOURNAL_NO_ERROR;
+    }
+
+    // msync() needs a page aligned start, the page holding 'synced' may have been partially written
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t start = journal->synced & ~(page_size - 1);
+
+    int err = JOURNAL_NO_ERROR;
+    if (msync(journal->map + start, journal->offset - start, MS_ASYNC) == -1 || fdatasync(journal->fd) == -1) {
+        PRINTF_DEBUG("syncing segment %llu failed with errno = %i [%s]",
+            (unsigned long long)journal->index, errno, strerror(errno));
+        err = JOURNAL_FILE_ERROR;
+    } else {
+        journal->synced = journal->offset;
+    }
+
+    journal->last_sync = now;
+    return err;
+}
+
+int journal_close(journal_t* journal)
+{
+    if (journal == NULL) {
+        return JOURNAL_FILE_ERROR;
+    }
+
+    // after a failed rotation there is no segment left to close, but the directory is still held
+    int err = journal->map != NULL ? _close_segment(journal) : JOURNAL_FILE_ERROR;
+    free(journal->directory);
+    journal->directory = NULL;
+    return err;
+}
+
+static void _reader_unmap(journal_reader_t* reader)
+{
+    if (reader->map != NULL) {
+        munmap(reader->map, reader->size);
+        reader->map = NULL;
+    }
+}
+
+static int _reader_map(journal_reader_t* reader)
+{
+    char* path = _segment_path(reader->directory, reader->indices[reader->current]);
+    if (path == NULL) {
+        return JOURNAL_MEMORY_ERROR;
+    }
+
+    int err = JOURNAL_NO_ERROR;
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        PRINTF_DEBUG("opening segment \"%s\" failed with errno = %i [%s]", path, errno, strerror(errno));
+        err = JOURNAL_FILE_ERROR;
+        goto open_error;
+    }
+
+    reader->size = st.st_size;
+    if (reader->size < sizeof(journal_segment_header_t)) {
+        err = JOURNAL_FORMAT_ERROR;
+        goto open_error;
+    }
+
+    reader->map = mmap(NULL, reader->size, PROT_READ, MAP_SHARED, fd, 0);
+    if (reader->map == MAP_FAILED) {
+        reader->map = NULL;
+        err = JOURNAL_FILE_ERROR;
+        goto open_error;
+    }
+
+    // segments are read front to back exactly once
+    madvise(reader->map, reader->size, MADV_SEQUENTIAL);
+
+    const journal_segment_header_t* header = (const journal_segment_header_t*)reader->map;
+    if (header->magic != JOURNAL_MAGIC || header->version != JOURNAL_VERSION) {
+        _reader_unmap(reader);
+        err = JOURNAL_FORMAT_ERROR;
+        goto open_error;
+    }
+
+    reader->offset = JOURNAL_ALIGN(sizeof(journal_segment_header_t));
+
+    open_error:
+    if (fd != -1) {
+        close(fd);
+    }
+    free(path);
+
+    return err;
+}
+
+int journal_reader_open(journal_reader_t* reader, const char* directory)
+{
+    if (reader == NULL || directory == NULL) {
+        return JOURNAL_FILE_ERROR;
+    }
+
+    reader->map = NULL;
+    reader->current = 0;
+    reader->directory = strdup(directory);
+    if (reader->directory == NULL) {
+        return JOURNAL_MEMORY_ERROR;
+    }
+
+    int err = _list_segments(directory, &reader->indices, &reader->count);
+    if (err != JOURNAL_NO_ERROR) {
+        free(reader->directory);
+        reader->directory = NULL;
+    }
+
+    return err;
+}
+
+int journal_reader_next(journal_reader_t* reader, journal_frame_header_t* header, const void** data)
+{
+    while (reader->current < reader->count) {
+        if (reader->map == NULL) {
+            int err = _reader_map(reader);
+            if (err != JOURNAL_NO_ERROR) {
+                return err;
+            }
+        }
+
+        if (reader->offset + sizeof(journal_frame_header_t) <= reader->size) {
+            const journal_frame_header_t* frame = (const journal_frame_header_t*)(reader->map + reader->offset);
+            if (frame->length != 0) {
+                if (reader->offset + sizeof(journal_frame_header_t) + frame->length > reader->size) {
+                    return JOURNAL_FORMAT_ERROR;
+                }
+
+                *header = *frame;
+                *data = reader->map + reader->offset + sizeof(journal_frame_header_t);
+                reader->offset += JOURNAL_ALIGN(sizeof(journal_frame_header_t) + frame->length);
+                return JOURNAL_NO_ERROR;
+            }
+        }
+
+        // end of this segment, continue with the next one
+        _reader_unmap(reader);
+        reader->current++;
+    }
+
+    return JOURNAL_END;
+}
+
+uint64_t journal_reader_segment(journal_reader_t* reader)
+{
+    return reader->current < reader->count ? reader->indices[reader->current] : 0;
+}
+
+void journal_reader_close(journal_reader_t* reader)
+{
+    if (reader == NULL) {
+        return;
+    }
+
+    _reader_unmap(reader);
+    free(reader->indices);
+    free(reader->directory);
+    reader->indices = NULL;
+    reader->directory = NULL;
+}
\ No newline at end of file
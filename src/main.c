@@ -7,12 +7,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <arpa/inet.h>
 
+#include "ack.h"
+#include "batch.h"
+#include "histogram.h"
 #include "network.h"
+#include "handover.h"
+#include "journal.h"
 #include "log.h"
+#include "netloop.h"
+#include "rcache.h"
 #include "res.h"
+#include "statsd.h"
 
-#define SERVER_RESPONSE_STRING "Message received\n"
+#define MAX_FORWARDS 4
 
 void* malloc_safe(unsigned int size)
 {
@@ -29,11 +38,137 @@ void* malloc_safe(unsigned int size)
 }
 
 static char error_msg[64] = "";
+static bool listen_ipv6 = false;
+static unsigned int unix_priority = 0;
+
+static const char* journal_directory = NULL;
+static unsigned int journal_segment_mb = JOURNAL_DEFAULT_SEGMENT_SIZE / (1024 * 1024);
+static unsigned int journal_sync_ms = JOURNAL_DEFAULT_SYNC_INTERVAL;
+static journal_t journal;
+static histogram_t rx_latency;
+static net_tcp_stats_t tcp_stats;
+static net_admission_stats_t admission_stats;
+static net_coalesce_stats_t coalesce_stats;
+static bool coalesce_enabled = false;
+static tcp_profile_t socket_profile;
+static pipeline_t pipeline;
+static pipeline_counter_t pipeline_counter;
+static bool statsd_enabled = false;
+static unsigned int statsd_flush_ms = STATSD_DEFAULT_FLUSH_INTERVAL;
+static statsd_table_t statsd;
+static net_relay_t forward_sinks[MAX_FORWARDS];
+static unsigned int forward_delays_ms[MAX_FORWARDS];
+static batch_t forwards[MAX_FORWARDS];
+static unsigned int forward_count = 0;
+static unsigned int forward_batch_kb = BATCH_DEFAULT_THRESHOLD / 1024;
+static int forward_err = BATCH_NO_ERROR;
+static bool cache_enabled = false;
+static unsigned int cache_kb = RCACHE_DEFAULT_SIZE / 1024;
+static unsigned int cache_ttl_ms = RCACHE_DEFAULT_TTL;
+static rcache_t response_cache;
 static char doc[] = RES_DOC;
 static char args_doc[] = RES_ARGS_DOC;
 
+// keys for options without a short name
+enum option_key {
+    OPT_RELAY = 0x100,
+    OPT_RELAY_FILE,
+    OPT_ZEROCOPY_RECEIVE,
+    OPT_JOURNAL,
+    OPT_JOURNAL_SEGMENT_MB,
+    OPT_JOURNAL_SYNC_MS,
+    OPT_TRACE,
+    OPT_RX_LATENCY,
+    OPT_TCP_INFO_MS,
+    OPT_EVICT_SLOW,
+    OPT_MAX_CONNECTIONS,
+    OPT_MAX_BUFFERED_KB,
+    OPT_MAX_ACCEPTS,
+    OPT_SHED,
+    OPT_CLIENT_BYTES,
+    OPT_CLIENT_MESSAGES,
+    OPT_SOURCE_BYTES,
+    OPT_SOURCE_MESSAGES,
+    OPT_SOCKET_PROFILE,
+    OPT_NODELAY,
+    OPT_QUICKACK,
+    OPT_RCVBUF,
+    OPT_SNDBUF,
+    OPT_DEFER_ACCEPT,
+    OPT_FASTOPEN,
+    OPT_BUSY_POLL,
+    OPT_REUSEADDR,
+    OPT_REUSEPORT,
+    OPT_KEEPALIVE,
+    OPT_BUSY_LOOP,
+    OPT_CPU,
+    OPT_INCOMING_CPU,
+    OPT_COROUTINES,
+    OPT_RING,
+    OPT_RING_SIZE_KB,
+    OPT_STAGE,
+    OPT_STATSD,
+    OPT_PRIORITY,
+    OPT_PRIORITY_SOURCE,
+    OPT_UNIX_PRIORITY,
+    OPT_ROUND_BUDGET,
+    OPT_FORWARD,
+    OPT_FORWARD_BATCH_KB,
+    OPT_CACHE_KB,
+    OPT_CACHE_TTL_MS,
+    OPT_COALESCE_MAX_US
+};
+
 static struct argp_option options[] = {
     {"verbose", 'v', 0, 0, RES_ARGP_OPTIONS_VERBOSE},
+    {"ipv6", '6', 0, 0, RES_ARGP_OPTIONS_IPV6},
+    {"unix", 'u', "PATH", 0, RES_ARGP_OPTIONS_UNIX},
+    {"relay", OPT_RELAY, "IP:PORT", 0, RES_ARGP_OPTIONS_RELAY},
+    {"relay-file", OPT_RELAY_FILE, "PATH", 0, RES_ARGP_OPTIONS_RELAY_FILE},
+    {"zerocopy-receive", OPT_ZEROCOPY_RECEIVE, 0, 0, RES_ARGP_OPTIONS_ZEROCOPY_RECEIVE},
+    {"journal", OPT_JOURNAL, "DIR", 0, RES_ARGP_OPTIONS_JOURNAL},
+    {"journal-segment-mb", OPT_JOURNAL_SEGMENT_MB, "MB", 0, RES_ARGP_OPTIONS_JOURNAL_SEGMENT_MB},
+    {"journal-sync-ms", OPT_JOURNAL_SYNC_MS, "MS", 0, RES_ARGP_OPTIONS_JOURNAL_SYNC_MS},
+    {"trace", OPT_TRACE, "FILE", 0, RES_ARGP_OPTIONS_TRACE},
+    {"rx-latency", OPT_RX_LATENCY, 0, 0, RES_ARGP_OPTIONS_RX_LATENCY},
+    {"tcp-info-ms", OPT_TCP_INFO_MS, "MS", 0, RES_ARGP_OPTIONS_TCP_INFO_MS},
+    {"evict-slow", OPT_EVICT_SLOW, "N", 0, RES_ARGP_OPTIONS_EVICT_SLOW},
+    {"max-connections", OPT_MAX_CONNECTIONS, "N", 0, RES_ARGP_OPTIONS_MAX_CONNECTIONS},
+    {"max-buffered-kb", OPT_MAX_BUFFERED_KB, "KB", 0, RES_ARGP_OPTIONS_MAX_BUFFERED_KB},
+    {"max-accepts", OPT_MAX_ACCEPTS, "N", 0, RES_ARGP_OPTIONS_MAX_ACCEPTS},
+    {"shed", OPT_SHED, "POLICY", 0, RES_ARGP_OPTIONS_SHED},
+    {"client-bytes-per-sec", OPT_CLIENT_BYTES, "N", 0, RES_ARGP_OPTIONS_CLIENT_BYTES},
+    {"client-msgs-per-sec", OPT_CLIENT_MESSAGES, "N", 0, RES_ARGP_OPTIONS_CLIENT_MESSAGES},
+    {"source-bytes-per-sec", OPT_SOURCE_BYTES, "N", 0, RES_ARGP_OPTIONS_SOURCE_BYTES},
+    {"source-msgs-per-sec", OPT_SOURCE_MESSAGES, "N", 0, RES_ARGP_OPTIONS_SOURCE_MESSAGES},
+    {"socket-profile", OPT_SOCKET_PROFILE, "PROFILE", 0, RES_ARGP_OPTIONS_SOCKET_PROFILE},
+    {"nodelay", OPT_NODELAY, 0, 0, RES_ARGP_OPTIONS_NODELAY},
+    {"quickack", OPT_QUICKACK, 0, 0, RES_ARGP_OPTIONS_QUICKACK},
+    {"rcvbuf", OPT_RCVBUF, "BYTES", 0, RES_ARGP_OPTIONS_RCVBUF},
+    {"sndbuf", OPT_SNDBUF, "BYTES", 0, RES_ARGP_OPTIONS_SNDBUF},
+    {"defer-accept", OPT_DEFER_ACCEPT, "S", 0, RES_ARGP_OPTIONS_DEFER_ACCEPT},
+    {"fastopen", OPT_FASTOPEN, "N", 0, RES_ARGP_OPTIONS_FASTOPEN},
+    {"busy-poll", OPT_BUSY_POLL, "US", 0, RES_ARGP_OPTIONS_BUSY_POLL},
+    {"reuseaddr", OPT_REUSEADDR, 0, 0, RES_ARGP_OPTIONS_REUSEADDR},
+    {"reuseport", OPT_REUSEPORT, 0, 0, RES_ARGP_OPTIONS_REUSEPORT},
+    {"keepalive", OPT_KEEPALIVE, "IDLE:INTVL:CNT", 0, RES_ARGP_OPTIONS_KEEPALIVE},
+    {"busy-loop", OPT_BUSY_LOOP, 0, 0, RES_ARGP_OPTIONS_BUSY_LOOP},
+    {"cpu", OPT_CPU, "N", 0, RES_ARGP_OPTIONS_CPU},
+    {"incoming-cpu", OPT_INCOMING_CPU, 0, 0, RES_ARGP_OPTIONS_INCOMING_CPU},
+    {"coroutines", OPT_COROUTINES, 0, 0, RES_ARGP_OPTIONS_COROUTINES},
+    {"ring", OPT_RING, "NAME", 0, RES_ARGP_OPTIONS_RING},
+    {"ring-size-kb", OPT_RING_SIZE_KB, "KB", 0, RES_ARGP_OPTIONS_RING_SIZE_KB},
+    {"stage", OPT_STAGE, "STAGE", 0, RES_ARGP_OPTIONS_STAGE},
+    {"statsd", OPT_STATSD, "MS", 0, RES_ARGP_OPTIONS_STATSD},
+    {"priority", OPT_PRIORITY, "CLASS:WEIGHT[:RESERVED]", 0, RES_ARGP_OPTIONS_PRIORITY},
+    {"priority-source", OPT_PRIORITY_SOURCE, "ADDR[/BITS]=CLASS", 0, RES_ARGP_OPTIONS_PRIORITY_SOURCE},
+    {"unix-priority", OPT_UNIX_PRIORITY, "CLASS", 0, RES_ARGP_OPTIONS_UNIX_PRIORITY},
+    {"round-budget", OPT_ROUND_BUDGET, "N", 0, RES_ARGP_OPTIONS_ROUND_BUDGET},
+    {"forward", OPT_FORWARD, "IP:PORT[@MS]", 0, RES_ARGP_OPTIONS_FORWARD},
+    {"forward-batch-kb", OPT_FORWARD_BATCH_KB, "KB", 0, RES_ARGP_OPTIONS_FORWARD_BATCH_KB},
+    {"cache-kb", OPT_CACHE_KB, "KB", 0, RES_ARGP_OPTIONS_CACHE_KB},
+    {"cache-ttl-ms", OPT_CACHE_TTL_MS, "MS", 0, RES_ARGP_OPTIONS_CACHE_TTL_MS},
+    {"coalesce-max-us", OPT_COALESCE_MAX_US, "US", 0, RES_ARGP_OPTIONS_COALESCE_MAX_US},
     {0}
 };
 
@@ -41,7 +176,7 @@ static error_t _parse_port(const char* port_str, uint16_t* port)
 {
     uint16_t p = atoi(port_str);
     if (p < 1024) {
-        sprintf(error_msg, RES_ARGP_PORT_ERROR_FORMAT, port_str);
+        snprintf(error_msg, sizeof(error_msg), RES_ARGP_PORT_ERROR_FORMAT, port_str);
         return EINVAL;
     }
 
@@ -49,21 +184,503 @@ static error_t _parse_port(const char* port_str, uint16_t* port)
     return 0;
 }
 
+static error_t _parse_uint(const char* uint_str, unsigned int* value)
+{
+    char* end;
+    unsigned long v = strtoul(uint_str, &end, 10);
+    if (end == uint_str || *end != '\0' || v > UINT32_MAX) {
+        snprintf(error_msg, sizeof(error_msg), RES_ARGP_NUMBER_ERROR_FORMAT, uint_str);
+        return EINVAL;
+    }
+
+    *value = v;
+    return 0;
+}
+
+static error_t _parse_relay(char* relay_str, net_relay_t* relay)
+{
+    // split on the last colon, so IPv6 addresses keep their own colons
+    char* colon = strrchr(relay_str, ':');
+    if (colon == NULL) {
+        snprintf(error_msg, sizeof(error_msg), RES_ARGP_RELAY_ERROR_FORMAT, relay_str);
+        return EINVAL;
+    }
+
+    *colon = '\0';
+    error_t err = _parse_port(colon + 1, &relay->port);
+    if (err != 0) {
+        return err;
+    }
+
+    relay->type = NET_RELAY_UPSTREAM;
+    relay->ip = relay_str;
+    return 0;
+}
+
+static error_t _parse_shed(const char* shed_str, net_shed_policy_t* policy)
+{
+    if (strcmp(shed_str, "reject") == 0) {
+        *policy = NET_SHED_REJECT;
+    } else if (strcmp(shed_str, "pause") == 0) {
+        *policy = NET_SHED_PAUSE;
+    } else {
+        snprintf(error_msg, sizeof(error_msg), RES_ARGP_SHED_ERROR_FORMAT, shed_str);
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+static error_t _parse_socket_profile(const char* profile_str, tcp_profile_t* profile)
+{
+    // small writes and acks go out right away, at the cost of more packets
+    static const tcp_profile_t latency = {
+        .nodelay = true,
+        .quickack = true,
+        .busy_poll = 50,
+        .reuseaddr = true
+    };
+
+    // large windows and no wakeups for connections which have nothing to say yet
+    static const tcp_profile_t throughput = {
+        .rcvbuf = 4 * 1024 * 1024,
+        .sndbuf = 4 * 1024 * 1024,
+        .defer_accept = 5,
+        .reuseaddr = true,
+        .backlog = 1024
+    };
+
+    if (strcmp(profile_str, "latency") == 0) {
+        *profile = latency;
+    } else if (strcmp(profile_str, "throughput") == 0) {
+        *profile = throughput;
+    } else {
+        snprintf(error_msg, sizeof(error_msg), RES_ARGP_PROFILE_ERROR_FORMAT, profile_str);
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+static error_t _parse_int(const char* int_str, int* value)
+{
+    unsigned int v;
+    error_t err = _parse_uint(int_str, &v);
+    if (err == 0 && v > INT32_MAX) {
+        snprintf(error_msg, sizeof(error_msg), RES_ARGP_NUMBER_ERROR_FORMAT, int_str);
+        return EINVAL;
+    }
+
+    *value = v;
+    return err;
+}
+
+static error_t _parse_keepalive(const char* keepalive_str, tcp_profile_t* profile)
+{
+    int idle, interval, count;
+    char trailing;
+    if (sscanf(keepalive_str, "%i:%i:%i%c", &idle, &interval, &count, &trailing) != 3
+            || idle <= 0 || interval <= 0 || count <= 0) {
+        snprintf(error_msg, sizeof(error_msg), RES_ARGP_KEEPALIVE_ERROR_FORMAT, keepalive_str);
+        return EINVAL;
+    }
+
+    profile->keepalive = true;
+    profile->keepidle = idle;
+    profile->keepintvl = interval;
+    profile->keepcnt = count;
+    return 0;
+}
+
+static error_t _parse_priority(const char* priority_str, net_config_t* config)
+{
+    unsigned int priority, weight, reserved = 0;
+    char trailing;
+    int matched = sscanf(priority_str, "%u:%u:%u%c", &priority, &weight, &reserved, &trailing);
+    if ((matched != 2 && matched != 3) || priority >= NET_PRIORITY_CLASSES) {
+        snprintf(error_msg, sizeof(error_msg), RES_ARGP_PRIORITY_ERROR_FORMAT, priority_str);
+        return EINVAL;
+    }
+
+    config->priorities[priority].weight = weight;
+    config->priorities[priority].reserved = reserved;
+    return 0;
+}
+
+static error_t _parse_priority_source(char* source_str, net_config_t* config)
+{
+    if (config->priority_source_count >= NET_MAX_PRIORITY_SOURCES) {
+        snprintf(error_msg, sizeof(error_msg), RES_ARGP_PRIORITY_SOURCES_ERROR_FORMAT, NET_MAX_PRIORITY_SOURCES);
+        return EINVAL;
+    }
+
+    net_priority_source_t* source = &config->priority_sources[config->priority_source_count];
+    char* equals = strrchr(source_str, '=');
+    char* slash = strchr(source_str, '/');
+    unsigned int bits = 128;
+    char trailing;
+    if (equals == NULL || sscanf(equals + 1, "%u%c", &source->priority, &trailing) != 1
+            || source->priority >= NET_PRIORITY_CLASSES
+            || (slash != NULL && (slash > equals || sscanf(slash + 1, "%u%c", &bits, &trailing) != 2
+                                  || trailing != '='))) {
+        goto priority_source_error;
+    }
+
+    // IPv4 addresses are matched in their IPv4-mapped form, like tcpsock_t stores them
+    char addr_str[INET6_ADDRSTRLEN];
+    size_t length = (slash != NULL ? slash : equals) - source_str;
+    if (length >= sizeof(addr_str)) {
+        goto priority_source_error;
+    }
+    memcpy(addr_str, source_str, length);
+    addr_str[length] = '\0';
+
+    struct in_addr addr4;
+    if (inet_pton(AF_INET, addr_str, &addr4) == 1 && (slash == NULL || bits <= 32)) {
+        memset(source->addr, 0, 10);
+        memset(source->addr + 10, 0xff, 2);
+        memcpy(source->addr + 12, &addr4, 4);
+        source->prefix_length = 96 + (slash != NULL ? bits : 32);
+    } else if (inet_pton(AF_INET6, addr_str, source->addr) == 1 && bits <= 128) {
+        source->prefix_length = bits;
+    } else {
+        goto priority_source_error;
+    }
+
+    config->priority_source_count++;
+    return 0;
+
+    priority_source_error:
+    snprintf(error_msg, sizeof(error_msg), RES_ARGP_PRIORITY_SOURCE_ERROR_FORMAT, source_str);
+    return EINVAL;
+}
+
+static error_t _add_listener(net_config_t* config, net_listener_type_t type, uint16_t port, const char* path)
+{
+    if (config->listener_count >= NET_MAX_LISTENERS) {
+        sprintf(error_msg, RES_ARGP_LISTENERS_ERROR_FORMAT, NET_MAX_LISTENERS);
+        return EINVAL;
+    }
+
+    net_listener_t* listener = &config->listeners[config->listener_count++];
+    listener->type = type;
+    listener->port = port;
+    listener->path = path;
+    return 0;
+}
+
+static error_t _add_stage(net_config_t* config, const char* name, pipeline_stage_kind_t kind,
+                          pipeline_stage_fn_t fn, void* context)
+{
+    if (config->pipeline == NULL) {
+        pipeline_init(&pipeline, ack_data);
+        pipeline.timing = true;
+        config->pipeline = &pipeline;
+    }
+
+    if (pipeline_add(&pipeline, name, kind, fn, context) != PIPELINE_NO_ERROR) {
+        sprintf(error_msg, RES_ARGP_STAGES_ERROR_FORMAT, PIPELINE_MAX_STAGES);
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+static bool _has_stage(const char* name)
+{
+    for (unsigned int i = 0; i < pipeline.count; i++) {
+        if (strcmp(pipeline.stages[i].name, name) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static error_t _parse_stage(char* stage_str, net_config_t* config)
+{
+    char* stage_arg = strchr(stage_str, ':');
+    if (stage_arg != NULL) {
+        *stage_arg++ = '\0';
+    }
+
+    pipeline_stage_kind_t kind;
+    pipeline_stage_fn_t fn;
+    void* context = NULL;
+    if (strcmp(stage_str, "lines") == 0 && stage_arg == NULL) {
+        kind = PIPELINE_ROUTE;
+        fn = pipeline_split_lines;
+    } else if (strcmp(stage_str, "trim") == 0 && stage_arg == NULL) {
+        kind = PIPELINE_TRANSFORM;
+        fn = pipeline_trim;
+    } else if (strcmp(stage_str, "lower") == 0 && stage_arg == NULL) {
+        kind = PIPELINE_TRANSFORM;
+        fn = pipeline_lowercase;
+    } else if (strcmp(stage_str, "prefix") == 0 && stage_arg != NULL) {
+        kind = PIPELINE_FILTER;
+        fn = pipeline_prefix_filter;
+        context = stage_arg;
+    } else if (strcmp(stage_str, "count") == 0 && stage_arg == NULL) {
+        kind = PIPELINE_TAP;
+        fn = pipeline_count;
+        context = &pipeline_counter;
+    } else {
+        if (stage_arg != NULL) {
+            stage_arg[-1] = ':';
+        }
+        sprintf(error_msg, RES_ARGP_STAGE_ERROR_FORMAT, stage_str);
+        return EINVAL;
+    }
+
+    return _add_stage(config, stage_str, kind, fn, context);
+}
+
+static error_t _parse_forward(char* forward_str, net_config_t* config)
+{
+    if (forward_count >= MAX_FORWARDS) {
+        sprintf(error_msg, RES_ARGP_FORWARDS_ERROR_FORMAT, MAX_FORWARDS);
+        return EINVAL;
+    }
+
+    error_t err;
+    unsigned int delay_ms = BATCH_DEFAULT_MAX_DELAY;
+    char* at = strrchr(forward_str, '@');
+    if (at != NULL) {
+        *at = '\0';
+        if ((err = _parse_uint(at + 1, &delay_ms)) != 0) {
+            return err;
+        }
+    }
+
+    if ((err = _parse_relay(forward_str, &forward_sinks[forward_count])) != 0) {
+        return err;
+    }
+    forward_delays_ms[forward_count] = delay_ms;
+
+    // the upstream is connected in main, once the options are known
+    return _add_stage(config, "forward", PIPELINE_TAP, batch_stage, &forwards[forward_count++]);
+}
+
 static error_t _parse_opt (int key, char *arg, struct argp_state *state)
 {
     net_config_t *arguments = state->input;
+    unsigned int max_buffered_kb;
+    unsigned int ring_size_kb;
+    error_t err;
 
     switch (key) {
         case 'v':
             arguments->verbose = true;
             break;
 
+        case '6':
+            listen_ipv6 = true;
+            break;
+
+        case 'u':
+            return _add_listener(arguments, NET_LISTEN_UNIX, 0, arg);
+
+        case OPT_RELAY:
+            return _parse_relay(arg, &arguments->relay);
+
+        case OPT_RELAY_FILE:
+            arguments->relay.type = NET_RELAY_FILE;
+            arguments->relay.path = arg;
+            break;
+
+        case OPT_ZEROCOPY_RECEIVE:
+            arguments->zerocopy_receive = true;
+            break;
+
+        case OPT_JOURNAL:
+            journal_directory = arg;
+            break;
+
+        case OPT_JOURNAL_SEGMENT_MB:
+            return _parse_uint(arg, &journal_segment_mb);
+
+        case OPT_JOURNAL_SYNC_MS:
+            return _parse_uint(arg, &journal_sync_ms);
+
+        case OPT_TRACE:
+            arguments->trace_path = arg;
+            break;
+
+        case OPT_RX_LATENCY:
+            histogram_reset(&rx_latency);
+            arguments->rx_latency = &rx_latency;
+            break;
+
+        case OPT_TCP_INFO_MS:
+            arguments->tcp_stats = &tcp_stats;
+            return _parse_uint(arg, &arguments->info_interval_ms);
+
+        case OPT_EVICT_SLOW:
+            arguments->evict_slow_clients = true;
+            return _parse_uint(arg, &arguments->slow_client_samples);
+
+        case OPT_MAX_CONNECTIONS:
+            arguments->admission_stats = &admission_stats;
+            return _parse_uint(arg, &arguments->max_connections);
+
+        case OPT_MAX_BUFFERED_KB:
+            arguments->admission_stats = &admission_stats;
+            if ((err = _parse_uint(arg, &max_buffered_kb)) != 0) {
+                return err;
+            }
+            arguments->max_buffered_bytes = (uint64_t)max_buffered_kb * 1024;
+            break;
+
+        case OPT_MAX_ACCEPTS:
+            arguments->admission_stats = &admission_stats;
+            return _parse_uint(arg, &arguments->max_accepts_per_sec);
+
+        case OPT_SHED:
+            return _parse_shed(arg, &arguments->shed_policy);
+
+        // bursts default to one second worth of the rate
+        case OPT_CLIENT_BYTES:
+            return _parse_uint(arg, &arguments->client_limits.bytes.rate);
+
+        case OPT_CLIENT_MESSAGES:
+            return _parse_uint(arg, &arguments->client_limits.messages.rate);
+
+        case OPT_SOURCE_BYTES:
+            return _parse_uint(arg, &arguments->source_limits.bytes.rate);
+
+        case OPT_SOURCE_MESSAGES:
+            return _parse_uint(arg, &arguments->source_limits.messages.rate);
+
+        // every socket option applies to all listeners and the clients they accept
+        case OPT_SOCKET_PROFILE:
+            arguments->profile = &socket_profile;
+            return _parse_socket_profile(arg, &socket_profile);
+
+        case OPT_NODELAY:
+            arguments->profile = &socket_profile;
+            socket_profile.nodelay = true;
+            break;
+
+        case OPT_QUICKACK:
+            arguments->profile = &socket_profile;
+            socket_profile.quickack = true;
+            break;
+
+        case OPT_RCVBUF:
+            arguments->profile = &socket_profile;
+            return _parse_int(arg, &socket_profile.rcvbuf);
+
+        case OPT_SNDBUF:
+            arguments->profile = &socket_profile;
+            return _parse_int(arg, &socket_profile.sndbuf);
+
+        case OPT_DEFER_ACCEPT:
+            arguments->profile = &socket_profile;
+            return _parse_int(arg, &socket_profile.defer_accept);
+
+        case OPT_FASTOPEN:
+            arguments->profile = &socket_profile;
+            return _parse_int(arg, &socket_profile.fastopen);
+
+        case OPT_BUSY_POLL:
+            arguments->profile = &socket_profile;
+            return _parse_int(arg, &socket_profile.busy_poll);
+
+        case OPT_REUSEADDR:
+            arguments->profile = &socket_profile;
+            socket_profile.reuseaddr = true;
+            break;
+
+        case OPT_REUSEPORT:
+            arguments->profile = &socket_profile;
+            socket_profile.reuseport = true;
+            break;
+
+        case OPT_KEEPALIVE:
+            arguments->profile = &socket_profile;
+            return _parse_keepalive(arg, &socket_profile);
+
+        case OPT_BUSY_LOOP:
+            arguments->busy_loop = true;
+            break;
+
+        case OPT_CPU:
+            arguments->pin_cpu = true;
+            return _parse_uint(arg, &arguments->cpu);
+
+        case OPT_INCOMING_CPU:
+            arguments->incoming_cpu = true;
+            break;
+
+        case OPT_COROUTINES:
+            arguments->handler = ack_handler;
+            break;
+
+        case OPT_RING:
+            arguments->ring_name = arg;
+            break;
+
+        case OPT_RING_SIZE_KB:
+            if ((err = _parse_uint(arg, &ring_size_kb)) != 0) {
+                return err;
+            }
+            arguments->ring_size = (size_t)ring_size_kb * 1024;
+            break;
+
+        case OPT_STAGE:
+            return _parse_stage(arg, arguments);
+
+        case OPT_STATSD:
+            statsd_enabled = true;
+            return _parse_uint(arg, &statsd_flush_ms);
+
+        // any of the priority options switches the loop to dispatching by priority class
+        case OPT_PRIORITY:
+            arguments->priority_dispatch = true;
+            return _parse_priority(arg, arguments);
+
+        case OPT_PRIORITY_SOURCE:
+            arguments->priority_dispatch = true;
+            return _parse_priority_source(arg, arguments);
+
+        case OPT_UNIX_PRIORITY:
+            arguments->priority_dispatch = true;
+            if ((err = _parse_uint(arg, &unix_priority)) == 0 && unix_priority >= NET_PRIORITY_CLASSES) {
+                snprintf(error_msg, sizeof(error_msg), RES_ARGP_NUMBER_ERROR_FORMAT, arg);
+                err = EINVAL;
+            }
+            return err;
+
+        case OPT_ROUND_BUDGET:
+            arguments->priority_dispatch = true;
+            return _parse_uint(arg, &arguments->round_budget);
+
+        case OPT_FORWARD:
+            return _parse_forward(arg, arguments);
+
+        case OPT_FORWARD_BATCH_KB:
+            return _parse_uint(arg, &forward_batch_kb);
+
+        case OPT_CACHE_KB:
+            cache_enabled = true;
+            return _parse_uint(arg, &cache_kb);
+
+        case OPT_CACHE_TTL_MS:
+            cache_enabled = true;
+            return _parse_uint(arg, &cache_ttl_ms);
+
+        case OPT_COALESCE_MAX_US:
+            arguments->coalesce_stats = &coalesce_stats;
+            err = _parse_uint(arg, &arguments->coalesce_max_us);
+            coalesce_enabled = arguments->coalesce_max_us > 0;
+            return err;
+
         case ARGP_KEY_ARG:
             if (state->arg_num >= 1) {
                 argp_usage(state);
             }
 
-            error_t err = _parse_port(arg, &arguments->port);
+            err = _parse_port(arg, &arguments->port);
             if (err != 0) {
                 return err;
             }
@@ -73,6 +690,58 @@ static error_t _parse_opt (int key, char *arg, struct argp_state *state)
             if (state->arg_num < 1) {
                 argp_usage(state);
             }
+
+            if (arguments->incoming_cpu && !arguments->pin_cpu) {
+                strcpy(error_msg, RES_ARGP_INCOMING_CPU_ERROR);
+                return EINVAL;
+            }
+
+            // the send queues are only known from the TCP_INFO samples
+            if (arguments->max_buffered_bytes > 0 && arguments->info_interval_ms == 0) {
+                strcpy(error_msg, RES_ARGP_MAX_BUFFERED_ERROR);
+                return EINVAL;
+            }
+            if (arguments->evict_slow_clients && arguments->info_interval_ms == 0) {
+                strcpy(error_msg, RES_ARGP_EVICT_SLOW_ERROR);
+                return EINVAL;
+            }
+
+            // responses are cached per request, which raw reads split wherever the kernel did
+            if (cache_enabled && !_has_stage("lines")) {
+                strcpy(error_msg, RES_ARGP_CACHE_ERROR);
+                return EINVAL;
+            }
+
+            unsigned int reserved = 0;
+            for (unsigned int c = 0; c < NET_PRIORITY_CLASSES; c++) {
+                reserved += arguments->priorities[c].reserved;
+            }
+            if (arguments->round_budget > 0 && arguments->round_budget <= reserved) {
+                snprintf(error_msg, sizeof(error_msg), RES_ARGP_ROUND_BUDGET_ERROR_FORMAT, reserved);
+                return EINVAL;
+            }
+
+            for (unsigned int i = 0; i < arguments->listener_count; i++) {
+                if (arguments->listeners[i].type == NET_LISTEN_UNIX) {
+                    arguments->listeners[i].priority = unix_priority;
+                }
+            }
+
+            // metrics are aggregated after the stages given with --stage
+            if (statsd_enabled) {
+                if ((err = _add_stage(arguments, "statsd", PIPELINE_ROUTE, statsd_stage, &statsd)) != 0) {
+                    return err;
+                }
+            }
+
+            // the TCP listeners all share the PORT argument
+            if ((err = _add_listener(arguments, NET_LISTEN_IPV4, arguments->port, NULL)) != 0) {
+                return err;
+            }
+
+            if (listen_ipv6) {
+                return _add_listener(arguments, NET_LISTEN_IPV6, arguments->port, NULL);
+            }
             break;
 
         default:
@@ -86,28 +755,59 @@ static struct argp argp = { options, _parse_opt, args_doc, doc };
 
 static int _callback_connected(tcpsock_t* client)
 {
-    // TODO: implement   
+    // the priority class set up by the options is kept
+    return NET_CB_SUCCESS;
 }
 
-static int _callback_data(tcpsock_t* client, const void* data, unsigned int length)
+static int _callback_relayed(tcpsock_t* client, unsigned long length)
 {
-    char* msg = malloc_safe(length + 1);
-    strncpy(msg, data, length);
+    printf(" > relayed %lu bytes from fd %i\n", length, tcp_get_fd(client));
 
-    int flags = NET_CB_SUCCESS;
+    return NET_CB_SUCCESS;
+}
 
-    printf(" > %s", msg);
+static void _statsd_sink(const char* line, unsigned int length, void* context)
+{
+    (void)context;
+    printf("%.*s\n", (int)length, line);
+}
 
-    unsigned int buff_size = sizeof(SERVER_RESPONSE_STRING);
-    int err = tcp_send(client, SERVER_RESPONSE_STRING, &buff_size);
-    if (err != TCP_NO_ERROR) {
-        printf("Failed to send response to client\n");
-        flags |= NET_CB_DISCONNECT | NET_CB_CLIENT_ERROR;
-    } else {
-        printf(" < %s", SERVER_RESPONSE_STRING);
+static int _callback_tick(void)
+{
+    if (journal_directory != NULL) {
+        journal_sync(&journal, false);
+    }
+    if (statsd_enabled) {
+        statsd_flush(&statsd, false, _statsd_sink, NULL);
+        fflush(stdout);
+    }
+
+    return NET_CB_SUCCESS;
+}
+
+// the unterminated statsd line of the client continues in the successor
+static unsigned int _callback_handover(tcpsock_t* client, void* buffer, unsigned int size)
+{
+    return statsd_enabled ? statsd_partial(&statsd, client->id, buffer, size) : 0;
+}
+
+static int _callback_adopted(tcpsock_t* client, const void* state, unsigned int length)
+{
+    if (statsd_enabled && length > 0) {
+        statsd_ingest(&statsd, client->id, state, length);
     }
 
-    return flags;
+    return NET_CB_SUCCESS;
+}
+
+static int _callback_listening(tcpsock_t* listener)
+{
+    char options[256];
+    if (tcp_describe_options(listener, options, sizeof(options)) == TCP_NO_ERROR) {
+        printf(RES_LISTENING_FORMAT "\n", tcp_get_fd(listener), options);
+    }
+
+    return NET_CB_SUCCESS;
 }
 
 static int _callback_error(tcpsock_t* client, int err)
@@ -120,15 +820,46 @@ static int _callback_disconnected(tcpsock_t* client)
     // TODO: implement
 }
 
+// the acknowledging loop, with ack_data bound instead of called through cb_data
+NET_LOOP_DEFINE(_ack_loop, ack_data)
+
 static net_config_t arguments = {
     .verbose = false,
     .running = true,
     .cb_connected = _callback_connected,
-    .cb_data = _callback_data,
+    .cb_data = ack_data,
+    .cb_relayed = _callback_relayed,
     .cb_error = _callback_error,
-    .cb_disconnected = _callback_disconnected
+    .cb_disconnected = _callback_disconnected,
+    .cb_tick = _callback_tick,
+    .cb_listening = _callback_listening,
+    .cb_handover = _callback_handover,
+    .cb_adopted = _callback_adopted
 };
 
+static uint64_t _callback_timer(uint64_t now_ms, unsigned int load_level)
+{
+    uint64_t deadline = UINT64_MAX;
+    for (unsigned int i = 0; i < forward_count; i++) {
+        // while the loop is idle no more messages are coming to share a batch, so there is no point in waiting
+        if (coalesce_enabled && load_level == 0) {
+            batch_flush(&forwards[i]);
+        }
+
+        uint64_t forward_deadline = batch_poll(&forwards[i], now_ms);
+        deadline = forward_deadline < deadline ? forward_deadline : deadline;
+
+        // everything forwarded later would be dropped, so the server stops like on an interrupt
+        if (forwards[i].failed && forward_err == BATCH_NO_ERROR) {
+            printf(RES_FORWARD_FAILED_FORMAT "\n", forward_sinks[i].ip, forward_sinks[i].port);
+            forward_err = BATCH_SINK_ERROR;
+            arguments.running = false;
+        }
+    }
+
+    return deadline;
+}
+
 static void _signal_handler(int signum)
 {
     switch (signum) {
@@ -137,6 +868,11 @@ static void _signal_handler(int signum)
             arguments.running = false;
             break;
 
+        case SIGUSR2:
+            PRINTF_DEBUG("Handover requested, starting successor...");
+            arguments.handover = true;
+            break;
+
         default:
             PRINTF_DEBUG("Non-handled signal %i", signum);
             break;
@@ -151,6 +887,11 @@ int main(int argc, char **argv)
     act.sa_flags = 0;
 
     sigaction(SIGINT, &act, NULL);
+    sigaction(SIGUSR2, &act, NULL);
+
+    // a closed relay upstream must surface as an error, not kill the server
+    act.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &act, NULL);
     
     error_t err = argp_parse(&argp, argc, argv, 0, 0, &arguments);
 
@@ -159,9 +900,142 @@ int main(int argc, char **argv)
         return err;
     }
 
+    // the successor is started the same way, and finds the sockets of this process on the handover socket
+    arguments.handover_argv = argv;
+    arguments.inherit_fd = handover_inherited_fd();
+
     PRINTF_DEBUG("options:\n\t> verbose: %s\n\t> port: %u", 
             arguments.verbose ? "yes" : "no",
             arguments.port);
 
-    return net_loop(&arguments);
+    if (journal_directory != NULL) {
+        int journal_err = journal_open(&journal, journal_directory,
+                (size_t)journal_segment_mb * 1024 * 1024, journal_sync_ms);
+        if (journal_err != JOURNAL_NO_ERROR) {
+            printf("%s: " RES_JOURNAL_OPEN_ERROR_FORMAT "\n", argv[0], journal_directory, journal_err);
+            return journal_err;
+        }
+
+        // the tick keeps syncing while no client sends anything
+        arguments.tick_interval_ms = journal_sync_ms > 0 ? journal_sync_ms : 1;
+    }
+
+    if (statsd_enabled) {
+        if (statsd_init(&statsd, 0, statsd_flush_ms) != STATSD_NO_ERROR) {
+            printf("%s: " RES_STATSD_OPEN_ERROR "\n", argv[0]);
+            return STATSD_MEMORY_ERROR;
+        }
+
+        // both flushing and syncing run on the tick, each checking its own interval
+        unsigned int flush_ms = statsd_flush_ms > 0 ? statsd_flush_ms : 1;
+        if (arguments.tick_interval_ms == 0 || flush_ms < arguments.tick_interval_ms) {
+            arguments.tick_interval_ms = flush_ms;
+        }
+    }
+
+    if (cache_enabled) {
+        if (rcache_init(&response_cache, (size_t)cache_kb * 1024) != RCACHE_NO_ERROR) {
+            printf("%s: " RES_CACHE_OPEN_ERROR "\n", argv[0]);
+            return RCACHE_MEMORY_ERROR;
+        }
+    }
+
+    // ack_data looks the cache up itself, so the data is captured on hits as well
+    ack_config.journal = journal_directory != NULL ? &journal : NULL;
+    ack_config.print = true;
+    ack_config.cache = cache_enabled ? &response_cache : NULL;
+    ack_config.cache_ttl_ms = cache_ttl_ms;
+
+    for (unsigned int i = 0; i < forward_count; i++) {
+        int batch_err = batch_open(&forwards[i], forward_sinks[i].ip, forward_sinks[i].port,
+                (size_t)forward_batch_kb * 1024, forward_delays_ms[i]);
+        if (batch_err != BATCH_NO_ERROR) {
+            printf("%s: " RES_FORWARD_OPEN_ERROR_FORMAT "\n", argv[0], forward_sinks[i].ip, forward_sinks[i].port);
+            return batch_err;
+        }
+        arguments.cb_timer = _callback_timer;
+    }
+
+    // stages replace the sink, so only a bare server runs the bound loop
+    int net_err = arguments.pipeline == NULL ? _ack_loop(&arguments) : net_loop(&arguments);
+
+    if (arguments.rx_latency != NULL) {
+        printf(RES_RX_LATENCY_FORMAT "\n", (unsigned long long)rx_latency.count,
+            histogram_mean(&rx_latency) / 1000.0,
+            histogram_percentile(&rx_latency, 50) / 1000.0,
+            histogram_percentile(&rx_latency, 99) / 1000.0,
+            histogram_percentile(&rx_latency, 99.9) / 1000.0,
+            rx_latency.max / 1000.0);
+    }
+
+    if (arguments.tcp_stats != NULL) {
+        printf(RES_TCP_STATS_FORMAT "\n", (unsigned long long)tcp_stats.samples,
+            histogram_percentile(&tcp_stats.rtt_us, 50) / 1000.0,
+            histogram_percentile(&tcp_stats.rtt_us, 99) / 1000.0,
+            (unsigned long long)tcp_stats.retransmits,
+            (unsigned long long)tcp_stats.slow_clients,
+            (unsigned long long)tcp_stats.evicted);
+    }
+
+    if (arguments.admission_stats != NULL) {
+        printf(RES_ADMISSION_STATS_FORMAT "\n", (unsigned long long)admission_stats.accepted,
+            (unsigned long long)admission_stats.rejected_connections,
+            (unsigned long long)admission_stats.rejected_memory,
+            (unsigned long long)admission_stats.rejected_rate,
+            (unsigned long long)admission_stats.paused_connections,
+            (unsigned long long)admission_stats.paused_memory,
+            (unsigned long long)admission_stats.paused_rate);
+    }
+
+    if (arguments.coalesce_stats != NULL) {
+        printf(RES_COALESCE_STATS_FORMAT "\n", (unsigned long long)coalesce_stats.wakeups,
+            coalesce_stats.wakeups > 0 ? (double)coalesce_stats.events / coalesce_stats.wakeups : 0.0,
+            (unsigned long long)coalesce_stats.rounds[0], (unsigned long long)coalesce_stats.rounds[1],
+            (unsigned long long)coalesce_stats.rounds[2], (unsigned long long)coalesce_stats.rounds[3],
+            coalesce_stats.delay_us / 1000.0);
+    }
+
+    if (statsd_enabled) {
+        statsd_flush(&statsd, true, _statsd_sink, NULL);
+        printf(RES_STATSD_STATS_FORMAT "\n", (unsigned long long)statsd.lines,
+            (unsigned long long)statsd.malformed, statsd.count, (unsigned long long)statsd.flushes);
+        statsd_destroy(&statsd);
+    }
+
+    if (cache_enabled) {
+        printf(RES_CACHE_STATS_FORMAT "\n", (unsigned long long)response_cache.hits,
+            (unsigned long long)response_cache.misses, (unsigned long long)response_cache.expired,
+            (unsigned long long)response_cache.evictions, response_cache.count, response_cache.size);
+        rcache_destroy(&response_cache);
+    }
+
+    for (unsigned int i = 0; i < forward_count; i++) {
+        batch_t* forward = &forwards[i];
+        batch_close(forward);
+        printf(RES_FORWARD_STATS_FORMAT "\n", forward_sinks[i].ip, forward_sinks[i].port,
+            (unsigned long long)forward->messages, (unsigned long long)forward->bytes,
+            (unsigned long long)forward->writes, (unsigned long long)forward->size_flushes,
+            (unsigned long long)forward->deadline_flushes, (unsigned long long)forward->dropped);
+    }
+
+    if (arguments.pipeline != NULL) {
+        for (unsigned int i = 0; i < pipeline.count; i++) {
+            pipeline_stage_t* stage = &pipeline.stages[i];
+            printf(RES_PIPELINE_STAGE_FORMAT "\n", stage->name, (unsigned long long)stage->frames,
+                (unsigned long long)stage->dropped, (unsigned long long)stage->emitted,
+                stage->frames > 0 ? (double)stage->ns / stage->frames : 0.0);
+        }
+
+        if (pipeline_counter.frames > 0) {
+            printf(RES_PIPELINE_COUNT_FORMAT "\n", (unsigned long long)pipeline_counter.frames,
+                (unsigned long long)pipeline_counter.bytes);
+        }
+        pipeline_destroy(&pipeline);
+    }
+
+    if (journal_directory != NULL) {
+        journal_close(&journal);
+    }
+
+    return net_err != NET_SUCCESS ? net_err : forward_err;
 }
\ No newline at end of file
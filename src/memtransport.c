@@ -0,0 +1,310 @@
+#include "memtransport.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "log.h"
+
+#define MEMTRANSPORT_MIN_BUFFER 256
+
+// sockets of this transport point at the embedded base, which is the first member
+#define MEMTRANSPORT_OF(sock) ((memtransport_t*)(sock)->transport)
+#define CONN_OF(transport, fd) (&(transport)->conns[(fd) - MEMTRANSPORT_FD_BASE])
+
+static bool _is_conn_fd(const memtransport_t* transport, int fd)
+{
+    return fd >= MEMTRANSPORT_FD_BASE && (uint32_t)(fd - MEMTRANSPORT_FD_BASE) < transport->conn_count;
+}
+
+static void _init_sock(memtransport_t* transport, tcpsock_t* sock, int fd)
+{
+    memset(sock, 0, sizeof(tcpsock_t));
+    sock->transport = &transport->base;
+    sock->fd = fd;
+    sock->family = AF_UNSPEC;
+    sock->connected = true;
+}
+
+static int _mem_listen(const tcp_transport_t* base, tcpsock_t* sock)
+{
+    memtransport_t* transport = (memtransport_t*)base;
+    if (transport->listening) {
+        return TCP_ADDRESS_ERROR;
+    }
+
+    _init_sock(transport, sock, MEMTRANSPORT_LISTENER_FD);
+    sock->passive = true;
+    transport->listening = true;
+    return TCP_NO_ERROR;
+}
+
+static int _mem_accept(tcpsock_t* sock, tcpsock_t* new_sock)
+{
+    memtransport_t* transport = MEMTRANSPORT_OF(sock);
+    if (!sock->passive) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    uint32_t conn;
+    if (vec_pop_back(&transport->pending, &conn) != VEC_ERR_SUCCESS) {
+        // nothing to accept, a kernel socket would block here
+        return TCP_SOCKOP_ERROR;
+    }
+
+    transport->conns[conn].state = MEMCONN_OPEN;
+    _init_sock(transport, new_sock, conn + MEMTRANSPORT_FD_BASE);
+    return TCP_NO_ERROR;
+}
+
+static int _mem_receive(tcpsock_t* sock, void* buffer, unsigned int* buff_size)
+{
+    memtransport_t* transport = MEMTRANSPORT_OF(sock);
+    if (!sock->connected || !_is_conn_fd(transport, sock->fd)) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    memconn_t* conn = CONN_OF(transport, sock->fd);
+    uint32_t available = conn->length - conn->offset;
+    if (available == 0) {
+        *buff_size = 0;
+        return conn->state == MEMCONN_HUNGUP ? TCP_CONNECTION_CLOSED : TCP_NO_ERROR;
+    }
+
+    if (*buff_size > available) {
+        *buff_size = available;
+    }
+
+    memcpy(buffer, conn->data + conn->offset, *buff_size);
+    conn->offset += *buff_size;
+    return TCP_NO_ERROR;
+}
+
+static int _mem_send(tcpsock_t* sock, const void* buffer, unsigned int* buff_size)
+{
+    memtransport_t* transport = MEMTRANSPORT_OF(sock);
+    if (!sock->connected || !_is_conn_fd(transport, sock->fd)) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    memconn_t* conn = CONN_OF(transport, sock->fd);
+    if (conn->state == MEMCONN_HUNGUP) {
+        *buff_size = 0;
+        return TCP_CONNECTION_CLOSED;
+    }
+
+    // the peer never reads, sent bytes are only counted
+    (void)buffer;
+    conn->sent += *buff_size;
+    transport->bytes_sent += *buff_size;
+    transport->sends++;
+    return TCP_NO_ERROR;
+}
+
+static int _mem_close(tcpsock_t* sock)
+{
+    memtransport_t* transport = MEMTRANSPORT_OF(sock);
+
+    if (sock->passive) {
+        transport->listening = false;
+    } else if (sock->connected && _is_conn_fd(transport, sock->fd)) {
+        // keep the buffer around, the id is likely to be reused soon
+        uint32_t id = sock->fd - MEMTRANSPORT_FD_BASE;
+        memconn_t* conn = &transport->conns[id];
+        conn->state = MEMCONN_FREE;
+        conn->offset = 0;
+        conn->length = 0;
+        vec_push_back(&transport->free_ids, &id);
+    }
+
+    sock->connected = false;
+    sock->passive = false;
+    sock->fd = -1;
+    return TCP_NO_ERROR;
+}
+
+static short _conn_events(memtransport_t* transport, int fd)
+{
+    if (fd == MEMTRANSPORT_LISTENER_FD) {
+        return transport->listening && vec_size(&transport->pending) > 0 ? POLLIN : 0;
+    }
+
+    if (!_is_conn_fd(transport, fd)) {
+        return POLLNVAL;
+    }
+
+    memconn_t* conn = CONN_OF(transport, fd);
+    switch (conn->state) {
+        case MEMCONN_OPEN:      return POLLOUT | (conn->offset < conn->length ? POLLIN : 0);
+        case MEMCONN_HUNGUP:    return POLLIN | POLLHUP;
+        default:                return POLLNVAL;
+    }
+}
+
+static int _mem_scan(memtransport_t* transport, struct pollfd* fds, unsigned int count)
+{
+    int ready = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        short events = _conn_events(transport, fds[i].fd);
+        fds[i].revents = events & (fds[i].events | POLLHUP | POLLNVAL);
+        ready += fds[i].revents != 0;
+    }
+
+    return ready;
+}
+
+static int _mem_poll(const tcp_transport_t* base, struct pollfd* fds, unsigned int count, int timeout_ms)
+{
+    memtransport_t* transport = (memtransport_t*)base;
+
+    int ready = _mem_scan(transport, fds, count);
+    if (ready == 0 && timeout_ms != 0 && transport->on_idle != NULL) {
+        // instead of sleeping, give the driver a chance to produce traffic
+        transport->on_idle(transport, transport->idle_context);
+        ready = _mem_scan(transport, fds, count);
+    }
+
+    return ready;
+}
+
+int memtransport_create(memtransport_t* transport, uint32_t initial_connections)
+{
+    if (transport == NULL) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    memset(transport, 0, sizeof(memtransport_t));
+    transport->base = (tcp_transport_t) {
+        .name = "memory",
+        .listen = _mem_listen,
+        .accept = _mem_accept,
+        .receive = _mem_receive,
+        .send = _mem_send,
+        .close = _mem_close,
+        .poll = _mem_poll
+    };
+
+    transport->conn_capacity = initial_connections > 0 ? initial_connections : DEFAULT_CAPACITY;
+    transport->conns = calloc(transport->conn_capacity, sizeof(memconn_t));
+    if (transport->conns == NULL) {
+        return TCP_MEMORY_ERROR;
+    }
+
+    if (vec_create(&transport->pending, sizeof(uint32_t), DEFAULT_CAPACITY) != VEC_ERR_SUCCESS) {
+        goto pending_error;
+    }
+
+    if (vec_create(&transport->free_ids, sizeof(uint32_t), DEFAULT_CAPACITY) != VEC_ERR_SUCCESS) {
+        goto free_ids_error;
+    }
+
+    return TCP_NO_ERROR;
+
+    free_ids_error:
+    vec_destroy(&transport->pending);
+
+    pending_error:
+    free(transport->conns);
+    transport->conns = NULL;
+
+    return TCP_MEMORY_ERROR;
+}
+
+void memtransport_destroy(memtransport_t* transport)
+{
+    if (transport == NULL) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < transport->conn_count; i++) {
+        free(transport->conns[i].data);
+    }
+
+    free(transport->conns);
+    transport->conns = NULL;
+    vec_destroy(&transport->pending);
+    vec_destroy(&transport->free_ids);
+}
+
+void memtransport_set_idle(memtransport_t* transport, memtransport_idle_t on_idle, void* context)
+{
+    transport->on_idle = on_idle;
+    transport->idle_context = context;
+}
+
+int memtransport_connect(memtransport_t* transport, uint32_t* conn)
+{
+    uint32_t id;
+    if (vec_pop_back(&transport->free_ids, &id) != VEC_ERR_SUCCESS) {
+        if (transport->conn_count == transport->conn_capacity) {
+            uint32_t capacity = transport->conn_capacity * 2;
+            memconn_t* conns = realloc(transport->conns, capacity * sizeof(memconn_t));
+            if (conns == NULL) {
+                return TCP_MEMORY_ERROR;
+            }
+
+            memset(conns + transport->conn_capacity, 0, (capacity - transport->conn_capacity) * sizeof(memconn_t));
+            transport->conns = conns;
+            transport->conn_capacity = capacity;
+        }
+
+        id = transport->conn_count++;
+    }
+
+    if (vec_push_back(&transport->pending, &id) != VEC_ERR_SUCCESS) {
+        return TCP_MEMORY_ERROR;
+    }
+
+    memconn_t* c = &transport->conns[id];
+    c->state = MEMCONN_PENDING;
+    c->offset = 0;
+    c->length = 0;
+    c->sent = 0;
+    *conn = id;
+    return TCP_NO_ERROR;
+}
+
+int memtransport_write(memtransport_t* transport, uint32_t conn, const void* data, unsigned int length)
+{
+    if (conn >= transport->conn_count) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    memconn_t* c = &transport->conns[conn];
+    if (c->state != MEMCONN_OPEN && c->state != MEMCONN_PENDING) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    if (c->offset == c->length) {
+        c->offset = 0;
+        c->length = 0;
+    }
+
+    if (c->length + length > c->capacity) {
+        uint32_t capacity = c->capacity > 0 ? c->capacity : MEMTRANSPORT_MIN_BUFFER;
+        while (capacity < c->length + length) {
+            capacity *= 2;
+        }
+
+        uint8_t* grown = realloc(c->data, capacity);
+        if (grown == NULL) {
+            return TCP_MEMORY_ERROR;
+        }
+        c->data = grown;
+        c->capacity = capacity;
+    }
+
+    memcpy(c->data + c->length, data, length);
+    c->length += length;
+    return TCP_NO_ERROR;
+}
+
+int memtransport_hangup(memtransport_t* transport, uint32_t conn)
+{
+    if (conn >= transport->conn_count || transport->conns[conn].state != MEMCONN_OPEN) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    transport->conns[conn].state = MEMCONN_HUNGUP;
+    return TCP_NO_ERROR;
+}
\ No newline at end of file
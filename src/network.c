@@ -1,22 +1,56 @@
+#define _GNU_SOURCE
+
 #include "network.h"
 
 #include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdlib.h>
-#include <sys/select.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "coroutine.h"
+#include "handover.h"
 #include "log.h"
+#include "netloop_impl.h"
+#include "probes.h"
+#include "ratelimit.h"
+#include "relay.h"
+#include "shmring.h"
 #include "tcpsock.h"
+#include "trace.h"
 #include "vector.h"
 
 #define SERVER_WELCOME_STRING "Successfully connected to server!\n"
+#define SERVER_BUSY_STRING "Server is busy, try again later\n"
+
+#define ACCEPT_WINDOW_MS 1000
 
-#define READ_BUFFER_SIZE 1024
+#define COALESCE_WEIGHT 8           // rounds over which the load average settles
+#define COALESCE_MIN_EVENTS 2       // average events per wakeup at which level 1 starts, each level needs 4 times more
+#define COALESCE_BUFFER_SIZE (NETLOOP_READ_BUFFER_SIZE << (2 * (NET_COALESCE_LEVELS - 1)))
 
-typedef enum client_action {
-    CACT_NONE = 0,
-    CACT_REMOVE
-} client_action_t;
+struct net_task {
+    coro_t* coro;           // coroutine running config->handler
+    netloop_server_t* server;
+    net_config_t* config;
+    tcpsock_t* client;      // client served by the task, refreshed on every resume as the client vector moves
+    short events;           // poll events the task waits for, 0 while sleeping or running
+    short revents;          // poll events which resumed the task
+    uint64_t wake;          // CLOCK_MONOTONIC ms at which a sleeping task resumes, 0 if it does not sleep
+    bool closing;           // is the client being disconnected? every wait fails once set
+};
+
+static uint64_t _now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
 static int _reinterpret_error(int tcp_err)
 {
@@ -31,55 +65,562 @@ static int _reinterpret_error(int tcp_err)
     }
 }
 
-static int _initialize_server(net_config_t* config, tcpsock_t* server_sock, vec_t* client_vec)
+static int _open_listener(const tcp_transport_t* transport, const net_listener_t* listener,
+                          const tcp_profile_t* profile, tcpsock_t* server_sock)
+{
+    if (transport != &tcp_socket_transport) {
+        // other transports provide a single listener of their own
+        return transport->listen(transport, server_sock);
+    }
+
+    switch (listener->type) {
+        case NET_LISTEN_IPV4:   return tcp_passive_open(server_sock, listener->port, profile);
+        case NET_LISTEN_IPV6:   return tcp_passive_open_ipv6(server_sock, listener->port, profile);
+        case NET_LISTEN_UNIX:   return tcp_passive_open_unix(server_sock, listener->path, profile);
+        default:                return TCP_ADDRESS_ERROR;
+    }
+}
+
+static void _close_sockets(vec_t* sock_vec)
+{
+    for (unsigned int i = 0; i < vec_size(sock_vec); i++) {
+        tcpsock_t* sock;
+        vec_get_ref(sock_vec, (void**)&sock, i);
+
+        tcp_close(sock);
+    }
+}
+
+// close the descriptors of sockets handed over to a successor, leaving the connections open
+static void _release_sockets(vec_t* sock_vec)
+{
+    for (unsigned int i = 0; i < vec_size(sock_vec); i++) {
+        tcpsock_t* sock;
+        vec_get_ref(sock_vec, (void**)&sock, i);
+
+        tcp_release(sock);
+    }
+}
+
+static int _open_relay(const net_relay_t* relay_config, relay_t* relay)
+{
+    switch (relay_config->type) {
+        case NET_RELAY_UPSTREAM:    return relay_open_upstream(relay, relay_config->ip, relay_config->port);
+        case NET_RELAY_FILE:        return relay_open_file(relay, relay_config->path);
+        default:                    return RELAY_SINK_ERROR;
+    }
+}
+
+static int _inherit(netloop_server_t* server, net_config_t* config);
+
+static int _initialize_server(net_config_t* config, netloop_server_t* server)
 {
     int err = NET_SUCCESS;
+    vec_t* server_vec = &server->server_vec;
+    vec_t* client_vec = &server->client_vec;
+
+    // without explicit listeners, fall back to a single IPv4 listener on config->port
+    net_listener_t default_listener = { .type = NET_LISTEN_IPV4, .port = config->port };
+    const net_listener_t* listeners = config->listener_count > 0 ? config->listeners : &default_listener;
+    unsigned int listener_count = config->listener_count > 0 ? config->listener_count : 1;
+
+    server->transport = config->transport != NULL ? config->transport : &tcp_socket_transport;
+    if (server->transport != &tcp_socket_transport) {
+        listener_count = 1;
+    }
+
+    if (listener_count > NET_MAX_LISTENERS) {
+        return NET_ADDRESS_ERROR;
+    }
 
-    if ((err = tcp_passive_open(server_sock, config->port)) != TCP_NO_ERROR) {
-        err = _reinterpret_error(err);
+    if (vec_create(server_vec, sizeof(tcpsock_t), listener_count) != VEC_ERR_SUCCESS) {
+        return NET_MEMORY_ERROR;
+    }
+
+    // the listeners of a predecessor are taken over below, once everything else is set up
+    bool inherit = config->inherit_fd > 0;
+    if (inherit && server->transport != &tcp_socket_transport) {
+        err = NET_HANDOVER_ERROR;
         goto server_sock_error;
     }
 
+    for (unsigned int i = 0; !inherit && i < listener_count; i++) {
+        tcpsock_t server_sock;
+        const tcp_profile_t* profile = listeners[i].profile != NULL ? listeners[i].profile : config->profile;
+        if ((err = _open_listener(server->transport, &listeners[i], profile, &server_sock)) != TCP_NO_ERROR) {
+            PRINTF_DEBUG("Failed opening listener %u (%i), errno = %i", i, err, errno);
+            err = _reinterpret_error(err);
+            goto server_sock_error;
+        }
+
+        server_sock.priority = listeners[i].priority;
+        vec_push_back(server_vec, &server_sock);
+
+        if (config->incoming_cpu && server->transport == &tcp_socket_transport
+                && tcp_set_incoming_cpu(&server_sock, config->cpu) != TCP_NO_ERROR) {
+            PRINTF_DEBUG("Failed associating listener %u with CPU %u, errno = %i", i, config->cpu, errno);
+            err = NET_SOCKOP_ERROR;
+            goto server_sock_error;
+        }
+
+        if (config->cb_listening && config->cb_listening(&server_sock) != NET_CB_SUCCESS) {
+            err = NET_CALLBACK_ERROR;
+            goto server_sock_error;
+        }
+    }
+
     vec_err_t vec_err;
     if ((vec_err = vec_create(client_vec, sizeof(tcpsock_t), DEFAULT_CAPACITY)) != VEC_ERR_SUCCESS) {
         err = NET_MEMORY_ERROR;
         goto client_vec_error;
     }
 
+    server->next_id = 0;
+    server->pfds = NULL;
+    server->pfd_capacity = 0;
+    server->ready = NULL;
+    memset(server->resume, 0, sizeof(server->resume));
+    server->fatal_err = NET_SUCCESS;
+    if (config->pipeline != NULL) {
+        config->pipeline->cache = config->response_cache;
+    }
+    server->relay_enabled = config->relay.type != NET_RELAY_NONE;
+    if (server->relay_enabled && config->handler != NULL) {
+        PRINTF_DEBUG("Relay cannot be combined with a handler");
+        err = NET_RELAY_ERROR;
+        goto relay_error;
+    }
+
+    if (server->relay_enabled && server->transport != &tcp_socket_transport) {
+        // splicing needs kernel sockets
+        PRINTF_DEBUG("Relay is not supported by the %s transport", server->transport->name);
+        err = NET_RELAY_ERROR;
+        goto relay_error;
+    }
+
+    if (server->relay_enabled && _open_relay(&config->relay, &server->relay) != RELAY_NO_ERROR) {
+        PRINTF_DEBUG("Failed opening relay, errno = %i", errno);
+        err = NET_RELAY_ERROR;
+        goto relay_error;
+    }
+
+    server->trace_enabled = config->trace_path != NULL;
+    if (server->trace_enabled && trace_open(&server->trace, config->trace_path) != TRACE_NO_ERROR) {
+        PRINTF_DEBUG("Failed opening trace \"%s\", errno = %i", config->trace_path, errno);
+        err = NET_TRACE_ERROR;
+        goto trace_error;
+    }
+
+    server->ring_enabled = config->ring_name != NULL;
+    if (server->ring_enabled && shmring_create(&server->ring, config->ring_name, config->ring_size) != SHMRING_NO_ERROR) {
+        PRINTF_DEBUG("Failed creating ring \"%s\", errno = %i", config->ring_name, errno);
+        err = NET_RING_ERROR;
+        goto ring_error;
+    }
+
+    server->rate_enabled = rate_limits_enabled(&config->client_limits) || rate_limits_enabled(&config->source_limits);
+    server->next_resume = UINT64_MAX;
+    if (rate_limits_enabled(&config->source_limits)
+            && ratelimit_table_create(&server->sources, DEFAULT_CAPACITY) != RATELIMIT_NO_ERROR) {
+        err = NET_MEMORY_ERROR;
+        goto sources_error;
+    }
+
+    server->next_wake = UINT64_MAX;
+    if (config->handler != NULL) {
+        coro_pool_init(&server->coros, config->handler_stack_size);
+    }
+
+    server->read_buffer = NULL;
+    server->load = 0;
+    server->level = 0;
+    server->round_events = 0;
+    if (config->coalesce_max_us > 0 && (server->read_buffer = malloc(COALESCE_BUFFER_SIZE)) == NULL) {
+        err = NET_MEMORY_ERROR;
+        goto buffer_error;
+    }
+
+    if (inherit && (err = _inherit(server, config)) != NET_SUCCESS) {
+        goto inherit_error;
+    }
+
     goto success;
 
-    client_vec_error:
-    tcp_close(server_sock);
+    inherit_error:
+    // the predecessor keeps serving the sockets, so they must not be shut down
+    _release_sockets(client_vec);
+    _release_sockets(server_vec);
+    free(server->read_buffer);
+
+    buffer_error:
+    if (config->handler != NULL) {
+        coro_pool_destroy(&server->coros);
+    }
+    if (rate_limits_enabled(&config->source_limits)) {
+        ratelimit_table_destroy(&server->sources);
+    }
+
+    sources_error:
+    if (server->ring_enabled) {
+        shmring_close(&server->ring);
+    }
+
+    ring_error:
+    if (server->trace_enabled) {
+        trace_close(&server->trace);
+    }
+
+    trace_error:
+    if (server->relay_enabled) {
+        relay_close(&server->relay);
+    }
+
+    relay_error:
+    vec_destroy(client_vec);
 
+    client_vec_error:
     server_sock_error:
+    _close_sockets(server_vec);
+    vec_destroy(server_vec);
+
     success:
     // no action taken
 
     return err;
 }
 
-static int _setup_fds(fd_set* fds, int server_fd, vec_t* client_vec)
+// fill the poll set with all listeners (without events unless 'accepting') and clients (without events while
+// paused by the rate limit), returns the number of entries or -1 if out of memory
+static int _setup_pollfds(netloop_server_t* server, bool accepting)
 {
-    FD_ZERO(fds);
-    FD_SET(server_fd, fds);
-    int biggest_fd = server_fd;
+    vec_t* server_vec = &server->server_vec;
+    vec_t* client_vec = &server->client_vec;
+    unsigned int count = vec_size(server_vec) + vec_size(client_vec);
+
+    if (count > server->pfd_capacity) {
+        unsigned int capacity = server->pfd_capacity > 0 ? server->pfd_capacity : DEFAULT_CAPACITY;
+        while (capacity < count) {
+            capacity *= 2;
+        }
+
+        struct pollfd* pfds = realloc(server->pfds, capacity * sizeof(struct pollfd));
+        if (pfds == NULL) {
+            return -1;
+        }
+        server->pfds = pfds;
+
+        unsigned int* ready = realloc(server->ready, capacity * sizeof(unsigned int));
+        if (ready == NULL) {
+            return -1;
+        }
+        server->ready = ready;
+        server->pfd_capacity = capacity;
+    }
+
+    unsigned int n = 0;
+    for (unsigned int i = 0; i < vec_size(server_vec); i++) {
+        tcpsock_t* server_sock;
+        vec_get_ref(server_vec, (void**)&server_sock, i);
+
+        // a paused listener stays in the set, so indices keep matching the listener vector
+        server->pfds[n++] = (struct pollfd) { .fd = tcp_get_fd(server_sock), .events = accepting ? POLLIN : 0 };
+    }
+
+    uint64_t now = server->rate_enabled ? _now_ms() : 0;
+    server->next_resume = UINT64_MAX;
+    server->next_wake = UINT64_MAX;
 
     for (unsigned int i = 0; i < vec_size(client_vec); i++) {
         tcpsock_t* client_sock;
         vec_get_ref(client_vec, (void**)&client_sock, i);
 
-        int client_sd = tcp_get_fd(client_sock);
-        FD_SET(client_sd, fds);
+        // clients paused by the rate limit are not read from until their buckets refill
+        bool paused = client_sock->rate_resume > now;
+        if (paused && client_sock->rate_resume < server->next_resume) {
+            server->next_resume = client_sock->rate_resume;
+        }
+
+        // tasks wait for what they need themselves, net_read sleeps through the rate limit
+        short events = paused ? 0 : POLLIN;
+        net_task_t* task = client_sock->task;
+        if (task != NULL) {
+            events = task->events;
+            if (task->wake != 0 && task->wake < server->next_wake) {
+                server->next_wake = task->wake;
+            }
+        }
+
+        server->pfds[n++] = (struct pollfd) { .fd = tcp_get_fd(client_sock), .events = events };
+    }
+
+    return n;
+}
+
+static void _rate_admit(netloop_server_t* server, tcpsock_t* client_sock, net_config_t* config)
+{
+    uint64_t now = _now_ms();
+    rate_state_init(&client_sock->rate, &config->client_limits, now);
+    client_sock->rate_resume = 0;
+
+    if (rate_limits_enabled(&config->source_limits)
+            && ratelimit_table_acquire(&server->sources, client_sock->peer_addr, &config->source_limits, now)
+                != RATELIMIT_NO_ERROR) {
+        PRINTF_DEBUG("Client (fd = %i) is only rate limited per connection, the address table is full", client_sock->fd);
+    }
+}
+
+// check whether reading from a client has to wait, if so it is paused until its buckets hold tokens again
+bool netloop_rate_paused(netloop_server_t* server, tcpsock_t* client_sock, net_config_t* config)
+{
+    uint64_t now = _now_ms();
+    uint64_t resume = rate_state_check(&client_sock->rate, &config->client_limits, now);
+
+    ratelimit_entry_t* source = rate_limits_enabled(&config->source_limits)
+            ? ratelimit_table_find(&server->sources, client_sock->peer_addr)
+            : NULL;
+    if (source != NULL) {
+        uint64_t source_resume = rate_state_check(&source->state, &config->source_limits, now);
+        resume = source_resume > resume ? source_resume : resume;
+    }
+
+    client_sock->rate_resume = resume;
+    if (resume != 0) {
+        PROBE2(rate_pause, client_sock->fd, resume - now);
+    }
+    return resume != 0;
+}
+
+void netloop_rate_consume(netloop_server_t* server, tcpsock_t* client_sock, uint64_t bytes, net_config_t* config)
+{
+    rate_state_consume(&client_sock->rate, &config->client_limits, bytes);
+
+    ratelimit_entry_t* source = rate_limits_enabled(&config->source_limits)
+            ? ratelimit_table_find(&server->sources, client_sock->peer_addr)
+            : NULL;
+    if (source != NULL) {
+        rate_state_consume(&source->state, &config->source_limits, bytes);
+    }
+}
+
+static netloop_admission_t _admission(netloop_server_t* server, net_config_t* config)
+{
+    if (config->max_accepts_per_sec > 0) {
+        uint64_t now = _now_ms();
+        if (now - server->accept_window >= ACCEPT_WINDOW_MS) {
+            server->accept_window = now;
+            server->window_accepts = 0;
+        }
+
+        if (server->window_accepts >= config->max_accepts_per_sec) {
+            return NETLOOP_ADMIT_RATE;
+        }
+    }
+
+    if (config->max_connections > 0 && vec_size(&server->client_vec) >= config->max_connections) {
+        return NETLOOP_ADMIT_CONNECTIONS;
+    }
+
+    if (config->max_buffered_bytes > 0 && server->queued_bytes > config->max_buffered_bytes) {
+        return NETLOOP_ADMIT_MEMORY;
+    }
+
+    return NETLOOP_ADMIT_OK;
+}
+
+// decide whether the listeners are polled this iteration
+static bool _update_admission(netloop_server_t* server, net_config_t* config)
+{
+    netloop_admission_t reason = _admission(server, config);
+
+    // rejecting costs as much as accepting, so the rate limit always pauses
+    netloop_admission_t paused = reason == NETLOOP_ADMIT_RATE
+            || (reason != NETLOOP_ADMIT_OK && config->shed_policy == NET_SHED_PAUSE) ? reason : NETLOOP_ADMIT_OK;
+
+    if (paused != NETLOOP_ADMIT_OK && paused != server->paused && config->admission_stats != NULL) {
+        net_admission_stats_t* stats = config->admission_stats;
+        switch (paused) {
+            case NETLOOP_ADMIT_CONNECTIONS: stats->paused_connections++; break;
+            case NETLOOP_ADMIT_MEMORY:      stats->paused_memory++; break;
+            default:                stats->paused_rate++; break;
+        }
+    }
+
+    if (paused != server->paused) {
+        PRINTF_DEBUG("Accepting %s (reason %i)", paused != NETLOOP_ADMIT_OK ? "paused" : "resumed", paused);
+    }
+
+    server->paused = paused;
+    return paused == NETLOOP_ADMIT_OK;
+}
+
+// close a client right after accepting it, telling it the server is busy
+static void _shed_client(tcpsock_t* client_sock, netloop_admission_t reason, net_config_t* config)
+{
+    PRINTF_DEBUG("Shedding client (fd = %i), reason %i", client_sock->fd, reason);
+    unsigned int busy_size = sizeof(SERVER_BUSY_STRING);
+    tcp_send(client_sock, SERVER_BUSY_STRING, &busy_size);
+    tcp_close(client_sock);
+
+    net_admission_stats_t* stats = config->admission_stats;
+    if (stats != NULL) {
+        switch (reason) {
+            case NETLOOP_ADMIT_CONNECTIONS: stats->rejected_connections++; break;
+            case NETLOOP_ADMIT_MEMORY:      stats->rejected_memory++; break;
+            default:                stats->rejected_rate++; break;
+        }
+    }
+}
+
+static void _task_entry(void* arg)
+{
+    net_task_t* task = arg;
+    task->config->handler(task);
+}
+
+// resume the task of a client until it waits again, returns NETLOOP_CACT_REMOVE if the handler returned
+int netloop_resume_task(netloop_server_t* server, tcpsock_t* client_sock, short revents, net_config_t* config)
+{
+    net_task_t* task = client_sock->task;
+    task->client = client_sock;
+    task->revents = revents;
+
+    if (!coro_resume(task->coro)) {
+        return NETLOOP_CACT_NONE;
+    }
+
+    PRINTF_DEBUG("Handler of client (fd = %i) returned", client_sock->fd);
+    netloop_close_client(server, client_sock, config);
+    return NETLOOP_CACT_REMOVE;
+}
+
+// give a new client a task and run it up to its first wait, returns NETLOOP_CACT_REMOVE if the client was closed
+static int _start_task(netloop_server_t* server, tcpsock_t* client_sock, net_config_t* config)
+{
+    net_task_t* task = calloc(1, sizeof(net_task_t));
+    if (task == NULL) {
+        goto task_malloc_error;
+    }
+
+    task->coro = coro_create(&server->coros, _task_entry, task);
+    if (task->coro == NULL) {
+        goto coro_error;
+    }
+
+    task->server = server;
+    task->config = config;
+    client_sock->task = task;
+
+    // other transports never block
+    if (tcp_set_nonblocking(client_sock) != TCP_NO_ERROR && client_sock->transport == NULL) {
+        PRINTF_DEBUG("Client (fd = %i) could not be made non-blocking, errno = %i", client_sock->fd, errno);
+    }
+
+    return netloop_resume_task(server, client_sock, 0, config);
+
+    coro_error:
+    free(task);
+
+    task_malloc_error:
+    PRINTF_DEBUG("Failed creating a task for client (fd = %i)", client_sock->fd);
+    netloop_close_client(server, client_sock, config);
+    return NETLOOP_CACT_REMOVE;
+}
+
+// let the task of a closing client unwind, its waits fail from now on
+static void _end_task(netloop_server_t* server, tcpsock_t* client_sock)
+{
+    net_task_t* task = client_sock->task;
+    client_sock->task = NULL;
+
+    if (!task->coro->finished) {
+        task->closing = true;
+        task->client = client_sock;
+        task->revents = 0;
+        if (!coro_resume(task->coro)) {
+            PRINTF_DEBUG("Handler of client (fd = %i) kept running after its client closed", client_sock->fd);
+        }
+    }
+
+    coro_release(&server->coros, task->coro);
+    free(task);
+}
+
+// resume the sleeping tasks which are due
+static void _wake_tasks(netloop_server_t* server, net_config_t* config)
+{
+    if (server->next_wake == UINT64_MAX) {
+        return;
+    }
+
+    uint64_t now = _now_ms();
+    if (now < server->next_wake) {
+        return;
+    }
+
+    vec_t* client_vec = &server->client_vec;
+    for (unsigned int i = 0; i < vec_size(client_vec);) {
+        tcpsock_t* client_sock;
+        vec_get_ref(client_vec, (void**)&client_sock, i);
+
+        net_task_t* task = client_sock->task;
+        if (task != NULL && task->wake != 0 && task->wake <= now
+                && netloop_resume_task(server, client_sock, 0, config) == NETLOOP_CACT_REMOVE) {
+            vec_remove(client_vec, i);
+        } else {
+            i++;
+        }
+    }
+}
+
+static bool _prefix_match(const uint8_t* addr, const net_priority_source_t* source)
+{
+    unsigned int bytes = source->prefix_length / 8;
+    unsigned int bits = source->prefix_length % 8;
+    if (source->prefix_length > 128 || memcmp(addr, source->addr, bytes) != 0) {
+        return false;
+    }
+
+    uint8_t mask = 0xff << (8 - bits);
+    return bits == 0 || ((addr[bytes] ^ source->addr[bytes]) & mask) == 0;
+}
+
+// prepare a client accepted or taken over from a predecessor for serving, 'client_sock->id' must be set
+static void _setup_client(netloop_server_t* server, tcpsock_t* client_sock, net_config_t* config)
+{
+    if (config->zerocopy_receive) {
+        unsigned int map_size = config->zerocopy_map_size > 0 ? config->zerocopy_map_size : TCP_ZEROCOPY_MAP_SIZE;
+        if (tcp_enable_zerocopy_receive(client_sock, map_size) != TCP_NO_ERROR) {
+            PRINTF_DEBUG("Client (fd = %i) does not support zero-copy receive, errno = %i", client_sock->fd, errno);
+        }
+    }
+
+    if (config->rx_latency != NULL && tcp_enable_rx_timestamps(client_sock) != TCP_NO_ERROR) {
+        PRINTF_DEBUG("Client (fd = %i) does not support receive timestamps, errno = %i", client_sock->fd, errno);
+    }
+
+    if (server->rate_enabled) {
+        _rate_admit(server, client_sock, config);
+    }
 
-        if (client_sd > biggest_fd) {
-            biggest_fd = client_sd;
+    for (unsigned int i = 0; i < config->priority_source_count; i++) {
+        if (_prefix_match(client_sock->peer_addr, &config->priority_sources[i])) {
+            client_sock->priority = config->priority_sources[i].priority;
+            break;
         }
     }
+    if (client_sock->priority >= NET_PRIORITY_CLASSES) {
+        client_sock->priority = NET_PRIORITY_CLASSES - 1;
+    }
 
-    return biggest_fd;
+    if (server->trace_enabled) {
+        trace_record(&server->trace, TRACE_EVENT_OPEN, client_sock->id, NULL, 0);
+    }
+    if (server->ring_enabled) {
+        shmring_publish(&server->ring, SHMRING_FRAME_OPEN, client_sock->id, NULL, 0);
+    }
 }
 
-static int _accept_client(tcpsock_t* server_sock, vec_t* client_vec)
+static int _accept_client(netloop_server_t* server, tcpsock_t* server_sock, net_config_t* config)
 {
     tcpsock_t client_sock;
     int err = tcp_wait_for_connection(server_sock, &client_sock);
@@ -87,101 +628,673 @@ static int _accept_client(tcpsock_t* server_sock, vec_t* client_vec)
     if (err != TCP_NO_ERROR) {
         PRINTF_DEBUG("Server failed accepting client (%i), errno = %i", err, errno);
         // TODO: handle TCP_SOCKOP_ERROR and TCP_MEMORY_ERROR appropriately
-    } else {
-        int welcome_size = sizeof(SERVER_WELCOME_STRING);
-        tcp_send(&client_sock, SERVER_WELCOME_STRING, &welcome_size);
-        vec_push_back(client_vec, &client_sock);
+        return err;
+    }
+
+    // the rate window counts shed clients too, they cost an accept all the same
+    netloop_admission_t reason = _admission(server, config);
+    server->window_accepts++;
+    if (reason != NETLOOP_ADMIT_OK) {
+        _shed_client(&client_sock, reason, config);
+        return err;
+    }
+
+    if (config->admission_stats != NULL) {
+        config->admission_stats->accepted++;
+    }
+
+    client_sock.id = server->next_id++;
+    client_sock.priority = server_sock->priority;
+    _setup_client(server, &client_sock, config);
+
+    int flags = config->cb_connected ? config->cb_connected(&client_sock) : NET_CB_SUCCESS;
+    if (flags & NET_CB_DISCONNECT) {
+        netloop_close_client(server, &client_sock, config);
+        return err;
+    }
+    if ((flags & NET_CB_PRIORITY_SET) && (unsigned int)(flags >> 8) < NET_PRIORITY_CLASSES) {
+        client_sock.priority = flags >> 8;
+    }
+
+    unsigned int welcome_size = sizeof(SERVER_WELCOME_STRING);
+    tcp_send(&client_sock, SERVER_WELCOME_STRING, &welcome_size);
+    vec_push_back(&server->client_vec, &client_sock);
+
+    if (config->handler != NULL) {
+        unsigned int last = vec_size(&server->client_vec) - 1;
+        tcpsock_t* client_ref;
+        vec_get_ref(&server->client_vec, (void**)&client_ref, last);
+
+        if (_start_task(server, client_ref, config) == NETLOOP_CACT_REMOVE) {
+            vec_remove(&server->client_vec, last);
+        }
     }
 
     return err;
 }
 
-static int _handle_client(tcpsock_t* client_sock, int client_fd, net_config_t* config)
+// take over the listeners and clients of a predecessor, and tell it once they are all served here
+static int _inherit(netloop_server_t* server, net_config_t* config)
 {
-    uint8_t buff[READ_BUFFER_SIZE];
-    unsigned int buff_size = READ_BUFFER_SIZE;
-    
-    int err = tcp_receive(client_sock, buff, &buff_size);
+    int err;
+    int sock_fd;
+    handover_record_t record;
+    uint8_t state[HANDOVER_MAX_STATE];
+
+    while ((err = handover_receive(config->inherit_fd, &record, &sock_fd, state, HANDOVER_TIMEOUT_MS))
+            == HANDOVER_NO_ERROR && record.kind != HANDOVER_END) {
+        tcpsock_t sock;
+        if (sock_fd < 0 || (record.kind != HANDOVER_LISTENER && record.kind != HANDOVER_CLIENT)) {
+            err = HANDOVER_FORMAT_ERROR;
+        } else if (tcp_adopt(&sock, sock_fd, config->profile) != TCP_NO_ERROR) {
+            err = HANDOVER_SOCKET_ERROR;
+        }
+
+        if (err != HANDOVER_NO_ERROR) {
+            if (sock_fd >= 0) {
+                close(sock_fd);
+            }
+            break;
+        }
+
+        if (record.kind == HANDOVER_LISTENER) {
+            // listeners arrive in the order they were opened, from the same configuration
+            unsigned int index = vec_size(&server->server_vec);
+            sock.priority = index < config->listener_count ? config->listeners[index].priority : 0;
+            vec_push_back(&server->server_vec, &sock);
+            if (config->cb_listening && config->cb_listening(&sock) != NET_CB_SUCCESS) {
+                close(config->inherit_fd);
+                return NET_CALLBACK_ERROR;
+            }
+            continue;
+        }
+
+        sock.id = record.id;
+        _setup_client(server, &sock, config);
+        if (config->cb_adopted) {
+            config->cb_adopted(&sock, state, record.length);
+        }
+        vec_push_back(&server->client_vec, &sock);
+    }
+
+    if (err == HANDOVER_NO_ERROR) {
+        server->next_id = record.id;
+        record = (handover_record_t) { .kind = HANDOVER_ACK };
+        err = handover_send(config->inherit_fd, &record, -1, NULL);
+    }
+    close(config->inherit_fd);
+
+    if (err != HANDOVER_NO_ERROR) {
+        PRINTF_DEBUG("Taking over the sockets of the predecessor failed (%i)", err);
+        return NET_HANDOVER_ERROR;
+    }
+
+    PRINTF_DEBUG("Took over %u listeners and %u clients", vec_size(&server->server_vec), vec_size(&server->client_vec));
+
+    // handlers only start once the predecessor stopped serving, their state did not survive the handover
+    for (unsigned int i = 0; config->handler != NULL && i < vec_size(&server->client_vec);) {
+        tcpsock_t* client_ref;
+        vec_get_ref(&server->client_vec, (void**)&client_ref, i);
+
+        if (_start_task(server, client_ref, config) == NETLOOP_CACT_REMOVE) {
+            vec_remove(&server->client_vec, i);
+        } else {
+            i++;
+        }
+    }
+
+    return NET_SUCCESS;
+}
+
+// hand all listeners and clients over to a successor started from config->handover_argv, returns NET_SUCCESS
+// once the successor serves them
+static int _hand_over(netloop_server_t* server, net_config_t* config)
+{
+    // spliced data in the relay pipes and buffered trace records cannot be handed over
+    if (config->handover_argv == NULL || server->relay_enabled || server->trace_enabled
+            || server->transport != &tcp_socket_transport) {
+        PRINTF_DEBUG("Handover is not possible in this configuration");
+        return NET_HANDOVER_ERROR;
+    }
+
+    int fd;
+    pid_t pid;
+    if (handover_spawn(config->handover_argv, &fd, &pid) != HANDOVER_NO_ERROR) {
+        return NET_HANDOVER_ERROR;
+    }
+
+    int err = HANDOVER_NO_ERROR;
+    handover_record_t record;
+    uint8_t state[HANDOVER_MAX_STATE];
+    for (unsigned int i = 0; err == HANDOVER_NO_ERROR && i < vec_size(&server->server_vec); i++) {
+        tcpsock_t* server_sock;
+        vec_get_ref(&server->server_vec, (void**)&server_sock, i);
+
+        record = (handover_record_t) { .kind = HANDOVER_LISTENER };
+        err = handover_send(fd, &record, server_sock->fd, NULL);
+    }
+
+    for (unsigned int i = 0; err == HANDOVER_NO_ERROR && i < vec_size(&server->client_vec); i++) {
+        tcpsock_t* client_sock;
+        vec_get_ref(&server->client_vec, (void**)&client_sock, i);
+
+        record = (handover_record_t) { .kind = HANDOVER_CLIENT, .id = client_sock->id };
+        if (config->cb_handover) {
+            record.length = config->cb_handover(client_sock, state, sizeof(state));
+        }
+        err = handover_send(fd, &record, client_sock->fd, state);
+    }
+
+    if (err == HANDOVER_NO_ERROR) {
+        record = (handover_record_t) { .kind = HANDOVER_END, .id = server->next_id };
+        err = handover_send(fd, &record, -1, NULL);
+    }
+
+    // nothing is read here until the successor answers, so no data is consumed by both
+    int sock_fd = -1;
+    if (err == HANDOVER_NO_ERROR) {
+        err = handover_receive(fd, &record, &sock_fd, state, HANDOVER_TIMEOUT_MS);
+        if (err == HANDOVER_NO_ERROR && (record.kind != HANDOVER_ACK || sock_fd >= 0)) {
+            err = HANDOVER_FORMAT_ERROR;
+        }
+    }
+    if (sock_fd >= 0) {
+        close(sock_fd);
+    }
+    close(fd);
+
+    if (err != HANDOVER_NO_ERROR) {
+        PRINTF_DEBUG("Handover to process %i failed (%i), serving on", (int)pid, err);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return NET_HANDOVER_ERROR;
+    }
+
+    PRINTF_DEBUG("Handed %u clients over to process %i", vec_size(&server->client_vec), (int)pid);
+    return NET_SUCCESS;
+}
+
+// drain zero-copy completions, returns whether the client also has data to read
+bool netloop_reap_client(tcpsock_t* client_sock, short revents, net_config_t* config)
+{
+    // completions are queued on the error queue, which poll() only reports as POLLERR
+    if (!(revents & POLLERR)) {
+        return true;
+    }
+
+    uint32_t completed_before = client_sock->zc_send_completed;
+    uint32_t completed;
+    tcp_reap_zerocopy(client_sock, &completed);
+
+    // a POLLERR without completions is a socket error, which the read reports
+    if (completed == completed_before) {
+        return true;
+    }
+
+    if (config->cb_zerocopy_sent) {
+        config->cb_zerocopy_sent(client_sock, completed);
+    }
+
+    return (revents & (POLLIN | POLLHUP)) != 0;
+}
+
+// replace the contribution of a client's 'previous' sample to the aggregates by its current one
+static void _account_sample(netloop_server_t* server, net_config_t* config,
+                            const tcp_info_sample_t* previous, const tcp_info_sample_t* current)
+{
+    server->queued_bytes += (uint64_t)current->send_queue - previous->send_queue;
+
+    net_tcp_stats_t* stats = config->tcp_stats;
+    if (stats == NULL) {
+        return;
+    }
+
+    stats->retransmits += (uint64_t)current->retransmits - previous->retransmits;
+    stats->unacked += (uint64_t)current->unacked - previous->unacked;
+    stats->send_queue += (uint64_t)current->send_queue - previous->send_queue;
+}
+
+static void _end_task(netloop_server_t* server, tcpsock_t* client_sock);
+
+void netloop_close_client(netloop_server_t* server, tcpsock_t* client_sock, net_config_t* config)
+{
+    if (client_sock->task != NULL) {
+        _end_task(server, client_sock);
+    }
+
+    if (server->trace_enabled) {
+        trace_record(&server->trace, TRACE_EVENT_CLOSE, client_sock->id, NULL, 0);
+    }
+    if (server->ring_enabled) {
+        shmring_publish(&server->ring, SHMRING_FRAME_CLOSE, client_sock->id, NULL, 0);
+    }
+
+    tcp_info_sample_t none = { 0 };
+    _account_sample(server, config, &client_sock->info, &none);
+
+    if (rate_limits_enabled(&config->source_limits)) {
+        ratelimit_table_release(&server->sources, client_sock->peer_addr);
+    }
+
+    tcp_close(client_sock);
+}
+
+// let go of a client handed over to a successor, without closing the connection
+static void _release_client(netloop_server_t* server, tcpsock_t* client_sock)
+{
+    if (client_sock->task != NULL) {
+        _end_task(server, client_sock);
+    }
+
+    tcp_release(client_sock);
+}
+
+// record the time between the kernel receiving the data and it being handed to cb_data
+void netloop_record_rx_latency(const struct timespec* arrival, net_config_t* config)
+{
+    if (arrival->tv_sec == 0 && arrival->tv_nsec == 0) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t latency = (int64_t)(now.tv_sec - arrival->tv_sec) * 1000000000LL + (now.tv_nsec - arrival->tv_nsec);
+    histogram_record(config->rx_latency, latency > 0 ? latency : 0);
+}
+
+int netloop_relay_client(netloop_server_t* server, tcpsock_t* client_sock, int client_fd, net_config_t* config)
+{
+    // once the sink failed the loop ends with this round, the data is left for nobody
+    if (server->fatal_err != NET_SUCCESS) {
+        return NETLOOP_CACT_NONE;
+    }
+
+    size_t length;
+    int err = relay_forward(&server->relay, client_fd, &length);
 
     switch (err) {
-        case TCP_CONNECTION_CLOSED:
+        case RELAY_CONNECTION_CLOSED:
             PRINTF_DEBUG("Client (fd = %i) disconnected", client_fd);
-            tcp_close(client_sock);
-            return CACT_REMOVE;
-
-        case TCP_SOCKOP_ERROR:
-            PRINTF_DEBUG("Client (fd = %i) failed socket operation while reading, errno = %i", client_fd, errno);
-            tcp_close(client_sock);
-            return CACT_REMOVE;
-
-        case TCP_NO_ERROR:
-            PRINTF_DEBUG("Client (fd = %i) sent %i bytes", client_sock->fd, buff_size);
-            if (config->cb_data) {
-                config->cb_data(client_sock, buff, buff_size);
+            netloop_close_client(server, client_sock, config);
+            return NETLOOP_CACT_REMOVE;
+
+        case RELAY_NO_ERROR:
+            PRINTF_DEBUG("Client (fd = %i) relayed %zu bytes", client_fd, length);
+            PROBE3(relay, client_fd, length, err);
+            if (server->rate_enabled && length > 0) {
+                netloop_rate_consume(server, client_sock, length, config);
+            }
+            if (config->cb_relayed && length > 0) {
+                config->cb_relayed(client_sock, length);
             }
-            return CACT_NONE;
+            return NETLOOP_CACT_NONE;
+
+        case RELAY_SOURCE_ERROR:
+            PRINTF_DEBUG("Client (fd = %i) failed relaying, errno = %i", client_fd, errno);
+            if (config->cb_error) {
+                config->cb_error(client_sock, NET_RELAY_ERROR);
+            }
+            netloop_close_client(server, client_sock, config);
+            return NETLOOP_CACT_REMOVE;
 
         default:
-            PRINTF_DEBUG("Unhandled tcp_receive error, code = %i", err);
-            tcp_close(client_sock);
-            return CACT_REMOVE;
+            // the sink is shared by all clients, so none of them can be relayed anymore
+            PRINTF_DEBUG("Relay sink failed while relaying client (fd = %i), error code = %i", client_fd, err);
+            if (config->cb_error) {
+                config->cb_error(client_sock, NET_RELAY_ERROR);
+            }
+            netloop_close_client(server, client_sock, config);
+            server->fatal_err = NET_RELAY_ERROR;
+            return NETLOOP_CACT_REMOVE;
+    }
+}
+
+// poll() timeout in ms until the next tick, TCP_INFO sample, accept window, rate limited client or sleeping task
+// is due, -1 if none is pending
+static int _poll_timeout(netloop_server_t* server, net_config_t* config)
+{
+    if (config->busy_loop) {
+        // everything that is due is handled by the next round anyway
+        return 0;
+    }
+
+    uint64_t deadline = UINT64_MAX;
+    if (config->cb_tick != NULL && config->tick_interval_ms != 0) {
+        deadline = server->next_tick;
+    }
+    if (config->info_interval_ms != 0 && server->next_sample < deadline) {
+        deadline = server->next_sample;
+    }
+    if (server->paused == NETLOOP_ADMIT_RATE && server->accept_window + ACCEPT_WINDOW_MS < deadline) {
+        deadline = server->accept_window + ACCEPT_WINDOW_MS;
+    }
+    if (server->next_resume < deadline) {
+        deadline = server->next_resume;
+    }
+    if (server->next_wake < deadline) {
+        deadline = server->next_wake;
+    }
+    if (server->next_timer < deadline) {
+        deadline = server->next_timer;
+    }
+
+    if (deadline == UINT64_MAX) {
+        return -1;
+    }
+
+    uint64_t now = _now_ms();
+    return deadline > now ? (int)(deadline - now) : 0;
+}
+
+// fold the events of a round into the load average, which sets the level of the next round
+static void _adapt_level(netloop_server_t* server, unsigned int events, net_config_t* config)
+{
+    if (config->coalesce_stats != NULL) {
+        net_coalesce_stats_t* stats = config->coalesce_stats;
+        stats->wakeups++;
+        stats->events += events;
+        stats->rounds[server->level]++;
+    }
+
+    server->load = (server->load * (COALESCE_WEIGHT - 1) + ((uint64_t)events << 4)) / COALESCE_WEIGHT;
+
+    unsigned int level = 0;
+    uint64_t threshold = COALESCE_MIN_EVENTS << 4;
+    while (level + 1 < NET_COALESCE_LEVELS && server->load >= threshold) {
+        level++;
+        threshold *= 4;
+    }
+
+    if (level != server->level) {
+        PRINTF_DEBUG("Load level %u -> %u at %.1f events per wakeup", server->level, level, server->load / 16.0);
+        server->level = level;
+    }
+}
+
+// is a client ready whose class has reads reserved, or which is in the highest class?
+static bool _urgent_ready(netloop_server_t* server, unsigned int listener_count, int pfd_count, net_config_t* config)
+{
+    if (!config->priority_dispatch) {
+        return false;
+    }
+
+    for (int p = listener_count; p < pfd_count; p++) {
+        if (server->pfds[p].revents == 0) {
+            continue;
+        }
+
+        tcpsock_t* client_sock;
+        vec_get_ref(&server->client_vec, (void**)&client_sock, p - listener_count);
+        if (client_sock->priority == NET_PRIORITY_CLASSES - 1 || config->priorities[client_sock->priority].reserved > 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// wait when a poll found fewer events ready than the level expects, so the next poll finds more, longer at higher
+// levels, nothing that is due within 'timeout' ms and no urgent client is held back, returns whether it waited
+static bool _coalesce(netloop_server_t* server, int activity, unsigned int listener_count, int pfd_count, int timeout,
+                      net_config_t* config)
+{
+    unsigned int expected = COALESCE_MIN_EVENTS << (2 * (server->level - 1));
+    if (activity < 0 || (unsigned int)activity >= expected
+            || _urgent_ready(server, listener_count, pfd_count, config)) {
+        return false;
+    }
+
+    uint64_t delay_us = (uint64_t)config->coalesce_max_us * server->level / (NET_COALESCE_LEVELS - 1);
+    if (timeout >= 0 && delay_us > (uint64_t)timeout * 1000) {
+        delay_us = (uint64_t)timeout * 1000;
+    }
+    if (delay_us == 0) {
+        return false;
+    }
+
+    struct timespec delay = { .tv_sec = delay_us / 1000000, .tv_nsec = (delay_us % 1000000) * 1000 };
+    nanosleep(&delay, NULL);
+
+    if (config->coalesce_stats != NULL) {
+        config->coalesce_stats->delay_us += delay_us;
+    }
+    return true;
+}
+
+static void _run_tick(netloop_server_t* server, net_config_t* config)
+{
+    if (config->cb_tick == NULL || config->tick_interval_ms == 0) {
+        return;
+    }
+
+    uint64_t now = _now_ms();
+    if (now >= server->next_tick) {
+        config->cb_tick();
+        server->next_tick = now + config->tick_interval_ms;
+    }
+}
+
+// flags (and possibly evicts) a client whose send queue kept growing, returns NETLOOP_CACT_REMOVE if it was evicted
+static int _check_slow_client(netloop_server_t* server, tcpsock_t* client_sock, net_config_t* config)
+{
+    if (config->slow_client_samples == 0 || client_sock->queue_growth < config->slow_client_samples) {
+        return NETLOOP_CACT_NONE;
+    }
+
+    PRINTF_DEBUG("Client (fd = %i) is slow, send queue grew to %u bytes", client_sock->fd, client_sock->info.send_queue);
+    int flags = config->cb_slow_client ? config->cb_slow_client(client_sock) : NET_CB_SUCCESS;
+
+    // only flag again after another run of growth
+    client_sock->queue_growth = 0;
+    if (config->tcp_stats != NULL) {
+        config->tcp_stats->slow_clients++;
+    }
+
+    if (!config->evict_slow_clients && !(flags & NET_CB_DISCONNECT)) {
+        return NETLOOP_CACT_NONE;
+    }
+
+    if (config->tcp_stats != NULL) {
+        config->tcp_stats->evicted++;
     }
+    netloop_close_client(server, client_sock, config);
+    return NETLOOP_CACT_REMOVE;
 }
 
-static int _listen_loop(tcpsock_t* server_sock, vec_t* client_vec, net_config_t* config)
+// sample TCP_INFO of the next batch of clients, round-robin so every iteration stays cheap
+static void _sample_clients(netloop_server_t* server, net_config_t* config)
+{
+    if (config->info_interval_ms == 0) {
+        return;
+    }
+
+    uint64_t now = _now_ms();
+    if (now < server->next_sample) {
+        return;
+    }
+    server->next_sample = now + config->info_interval_ms;
+
+    vec_t* client_vec = &server->client_vec;
+    unsigned int count = vec_size(client_vec);
+    unsigned int batch = config->info_batch > 0 && config->info_batch < count ? config->info_batch : count;
+
+    for (unsigned int n = 0; n < batch && vec_size(client_vec) > 0; n++) {
+        if (server->sample_cursor >= vec_size(client_vec)) {
+            server->sample_cursor = 0;
+        }
+
+        tcpsock_t* client_sock;
+        vec_get_ref(client_vec, (void**)&client_sock, server->sample_cursor);
+
+        tcp_info_sample_t previous = client_sock->info;
+        if (tcp_sample_info(client_sock) != TCP_NO_ERROR) {
+            server->sample_cursor++;
+            continue;
+        }
+
+        if (config->tcp_stats != NULL) {
+            config->tcp_stats->samples++;
+            histogram_record(&config->tcp_stats->rtt_us, client_sock->info.rtt_us);
+        }
+        _account_sample(server, config, &previous, &client_sock->info);
+
+        if (_check_slow_client(server, client_sock, config) == NETLOOP_CACT_REMOVE) {
+            // the next client moved into the cursor position
+            vec_remove(client_vec, server->sample_cursor);
+        } else {
+            server->sample_cursor++;
+        }
+    }
+}
+
+bool netloop_still_readable(netloop_server_t* server, int client_fd)
+{
+    struct pollfd pfd = { .fd = client_fd, .events = POLLIN };
+    return tcp_poll(server->transport, &pfd, 1, 0) > 0 && (pfd.revents & POLLIN) != 0;
+}
+
+static int _listen_loop(netloop_server_t* server, net_config_t* config, netloop_round_t round)
 {
     int sock_err;
     int net_err = NET_SUCCESS;
-    int server_fd = tcp_get_fd(server_sock);
+    vec_t* server_vec = &server->server_vec;
+    vec_t* client_vec = &server->client_vec;
+
+    server->next_tick = _now_ms() + config->tick_interval_ms;
+    server->next_timer = UINT64_MAX;
+    server->next_sample = _now_ms() + config->info_interval_ms;
+    server->sample_cursor = 0;
+    if (config->tcp_stats != NULL) {
+        memset(config->tcp_stats, 0, sizeof(net_tcp_stats_t));
+        histogram_reset(&config->tcp_stats->rtt_us);
+    }
 
+    server->queued_bytes = 0;
+    server->accept_window = _now_ms();
+    server->window_accepts = 0;
+    server->paused = NETLOOP_ADMIT_OK;
+    if (config->admission_stats != NULL) {
+        memset(config->admission_stats, 0, sizeof(net_admission_stats_t));
+    }
+    if (config->coalesce_stats != NULL) {
+        memset(config->coalesce_stats, 0, sizeof(net_coalesce_stats_t));
+    }
+
+    bool handed_over = false;
     while (config->running) {
-        fd_set fds;
-        int biggest_fd = _setup_fds(&fds, server_fd, client_vec);
+        if (config->handover) {
+            config->handover = false;
+            if (_hand_over(server, config) == NET_SUCCESS) {
+                handed_over = true;
+                break;
+            }
+        }
 
-        int activity = select(biggest_fd + 1, &fds, NULL, NULL, NULL);
+        int pfd_count = _setup_pollfds(server, _update_admission(server, config));
+        if (pfd_count < 0) {
+            net_err = NET_MEMORY_ERROR;
+            break;
+        }
 
-        if (activity > 0 && FD_ISSET(server_fd, &fds)) {
-            sock_err = _accept_client(server_sock, client_vec);
+        // under load the events are looked at first, and only a wakeup that finds few of them waits for more
+        unsigned int listener_count = vec_size(server_vec);
+        int timeout = _poll_timeout(server, config);
+        int activity = tcp_poll(server->transport, server->pfds, pfd_count, server->level > 0 ? 0 : timeout);
+        if (server->level > 0) {
+            bool waited = _coalesce(server, activity, listener_count, pfd_count, timeout, config);
+            if (waited || activity == 0) {
+                activity = tcp_poll(server->transport, server->pfds, pfd_count, activity > 0 ? 0 : timeout);
+            }
+        }
+
+        unsigned int ready = activity > 0 ? activity : 0;
+        server->round_events = 0;
+
+        for (unsigned int i = 0; activity > 0 && i < listener_count; i++) {
+            if (server->pfds[i].revents == 0) {
+                continue;
+            }
+
+            tcpsock_t* server_sock;
+            vec_get_ref(server_vec, (void**)&server_sock, i);
+
+            sock_err = _accept_client(server, server_sock, config);
             if (sock_err != TCP_NO_ERROR) {
                 PRINTF_DEBUG("Failure when accepting client, error code %i", sock_err);
                 // TODO: handle accept error, maybe ignore?
             } else {
-                PRINTF_DEBUG("New client connected!");
+                PRINTF_DEBUG("New client connected on listener %u!", i);
             }
 
             activity--;
         }
 
-        unsigned int i = 0;
-        while (activity > 0 && i < vec_size(client_vec)) {
-            tcpsock_t* client_sock;
-            vec_get_ref(client_vec, (void**)&client_sock, i);
+        // clients accepted above are appended after the polled ones, so they are left for the next round
+        if (activity > 0) {
+            round(server, listener_count, pfd_count, activity, config);
+        }
 
-            int client_fd = tcp_get_fd(client_sock);
-            int client_action = CACT_NONE;
-            if (FD_ISSET(client_fd, &fds)) {
-                client_action = _handle_client(client_sock, client_fd, config);
-                activity--;
-            }
+        if (server->fatal_err != NET_SUCCESS) {
+            net_err = server->fatal_err;
+            break;
+        }
 
-            if (client_action == CACT_REMOVE) {
-                vec_remove(client_vec, i);
-            } else {
-                i++;
-            }
+        _wake_tasks(server, config);
+        _run_tick(server, config);
+        if (config->coalesce_max_us > 0) {
+            _adapt_level(server, ready + server->round_events, config);
         }
+        if (config->cb_timer != NULL) {
+            server->next_timer = config->cb_timer(_now_ms(), server->level);
+        }
+        _sample_clients(server, config);
     }
 
-    // cleanup
+    // cleanup, sockets handed over are served by the successor and must not be shut down
     for (unsigned int i = 0; i < vec_size(client_vec); i++) {
         tcpsock_t* client_sock;
         vec_get_ref(client_vec, (void**)&client_sock, i);
 
-        tcp_close(client_sock);
+        if (handed_over) {
+            _release_client(server, client_sock);
+        } else {
+            netloop_close_client(server, client_sock, config);
+        }
     }
-
     vec_destroy(client_vec);
-    tcp_close(server_sock);
+
+    if (handed_over) {
+        _release_sockets(server_vec);
+    } else {
+        _close_sockets(server_vec);
+    }
+    vec_destroy(server_vec);
+
+    if (server->relay_enabled) {
+        relay_close(&server->relay);
+    }
+
+    if (server->trace_enabled) {
+        trace_close(&server->trace);
+    }
+
+    if (server->ring_enabled && handed_over) {
+        shmring_detach(&server->ring);
+    } else if (server->ring_enabled) {
+        shmring_close(&server->ring);
+    }
+
+    if (rate_limits_enabled(&config->source_limits)) {
+        ratelimit_table_destroy(&server->sources);
+    }
+
+    if (config->handler != NULL) {
+        coro_pool_destroy(&server->coros);
+    }
+
+    free(server->pfds);
+    free(server->ready);
+    free(server->read_buffer);
 
     return net_err;
 }
@@ -195,24 +1308,171 @@ const char* net_strerror(int net_error)
         case NET_SOCKOP_ERROR:      return "NET_SOCKOP_ERROR";
         case NET_CONNECTION_CLOSED: return "NET_CONNECTION_CLOSED";
         case NET_MEMORY_ERROR:      return "NET_MEMORY_ERROR";
+        case NET_RELAY_ERROR:       return "NET_RELAY_ERROR";
+        case NET_TRACE_ERROR:       return "NET_TRACE_ERROR";
+        case NET_CALLBACK_ERROR:    return "NET_CALLBACK_ERROR";
+        case NET_AFFINITY_ERROR:    return "NET_AFFINITY_ERROR";
+        case NET_RING_ERROR:        return "NET_RING_ERROR";
+        case NET_HANDOVER_ERROR:    return "NET_HANDOVER_ERROR";
         case NET_UNSPECIFIED_ERROR: return "NET_UNSPECIFIED_ERROR";
         case NET_UNEXPECTED_NULL:   return "NET_UNEXPECTED_NULL";
         default:                    return "<error>";
     }
 }
 
-int net_loop(net_config_t* config)
+int netloop_run(net_config_t* config, netloop_round_t round)
 {
     if (config == NULL) {
         return NET_UNEXPECTED_NULL;
     }
 
-    tcpsock_t server_sock;
-    vec_t client_vec;
-    int err = _initialize_server(config, &server_sock, &client_vec);
+    if (config->incoming_cpu && !config->pin_cpu) {
+        return NET_AFFINITY_ERROR;
+    }
+
+    // pin before opening anything, so memory allocated for the server is local to the CPU
+    if (config->pin_cpu) {
+        if (config->cpu >= CPU_SETSIZE) {
+            return NET_AFFINITY_ERROR;
+        }
+
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(config->cpu, &cpus);
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+            PRINTF_DEBUG("Failed pinning to CPU %u, errno = %i", config->cpu, errno);
+            return NET_AFFINITY_ERROR;
+        }
+    }
+
+    netloop_server_t server;
+    int err = _initialize_server(config, &server);
     if (err != NET_SUCCESS) {
         return err;
     }
 
-    return _listen_loop(&server_sock, &client_vec, config);
+    return _listen_loop(&server, config, round);
+}
+
+// the runtime instance, calling config->cb_data or the pipeline
+static void _serve_round(netloop_server_t* server, unsigned int listener_count, int pfd_count, int activity,
+                         net_config_t* config)
+{
+    netloop_serve_round(server, listener_count, pfd_count, activity, config, NULL);
+}
+
+int net_loop(net_config_t* config)
+{
+    return netloop_run(config, _serve_round);
+}
+
+// suspend the running task until one of 'events' is reported or 'wake' is reached
+static int _task_wait(net_task_t* task, short events, uint64_t wake)
+{
+    task->events = events;
+    task->wake = wake;
+    coro_yield();
+    task->events = 0;
+    task->wake = 0;
+
+    if (task->closing) {
+        return NET_CONNECTION_CLOSED;
+    }
+
+    // hangups are reported whatever the task waits for
+    if ((task->revents & (POLLHUP | POLLERR)) && !(task->revents & events)) {
+        return NET_CONNECTION_CLOSED;
+    }
+
+    return NET_SUCCESS;
+}
+
+tcpsock_t* net_task_client(net_task_t* task)
+{
+    return task->client;
+}
+
+int net_read(net_task_t* task, void* buffer, unsigned int* size)
+{
+    netloop_server_t* server = task->server;
+    net_config_t* config = task->config;
+
+    int err = NET_SUCCESS;
+    while (err == NET_SUCCESS) {
+        if (task->closing) {
+            err = NET_CONNECTION_CLOSED;
+            break;
+        }
+
+        tcpsock_t* client_sock = task->client;
+        if (server->rate_enabled && netloop_rate_paused(server, client_sock, config)) {
+            err = _task_wait(task, 0, client_sock->rate_resume);
+            continue;
+        }
+
+        unsigned int length = *size;
+        int tcp_err = tcp_receive(client_sock, buffer, &length);
+
+        // other transports report an empty receive when nothing is buffered
+        if (tcp_err == TCP_WOULD_BLOCK || (tcp_err == TCP_NO_ERROR && length == 0 && *size > 0)) {
+            err = _task_wait(task, POLLIN, 0);
+            continue;
+        }
+
+        if (tcp_err != TCP_NO_ERROR) {
+            err = _reinterpret_error(tcp_err);
+            break;
+        }
+
+        if (server->trace_enabled) {
+            trace_record(&server->trace, TRACE_EVENT_DATA, client_sock->id, buffer, length);
+        }
+        if (server->ring_enabled) {
+            shmring_publish(&server->ring, SHMRING_FRAME_DATA, client_sock->id, buffer, length);
+        }
+        if (server->rate_enabled) {
+            netloop_rate_consume(server, client_sock, length, config);
+        }
+
+        *size = length;
+        return NET_SUCCESS;
+    }
+
+    *size = 0;
+    return err;
+}
+
+int net_write(net_task_t* task, const void* data, unsigned int size)
+{
+    const uint8_t* remaining = data;
+    while (size > 0) {
+        if (task->closing) {
+            return NET_CONNECTION_CLOSED;
+        }
+
+        unsigned int length = size;
+        int tcp_err = tcp_send(task->client, remaining, &length);
+        if (tcp_err != TCP_NO_ERROR && tcp_err != TCP_WOULD_BLOCK) {
+            return _reinterpret_error(tcp_err);
+        }
+
+        remaining += length;
+        size -= length;
+
+        int err;
+        if (size > 0 && (err = _task_wait(task, POLLOUT, 0)) != NET_SUCCESS) {
+            return err;
+        }
+    }
+
+    return NET_SUCCESS;
+}
+
+int net_sleep(net_task_t* task, unsigned int ms)
+{
+    if (task->closing) {
+        return NET_CONNECTION_CLOSED;
+    }
+
+    return _task_wait(task, 0, _now_ms() + (ms > 0 ? ms : 1));
 }
\ No newline at end of file
@@ -0,0 +1,226 @@
+#define _GNU_SOURCE
+
+#include "pipeline.h"
+#include "network.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t _clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// run 'frame' through the stages from frame->stage on, and into the sink if it passes all of them
+static void _run(pipeline_t* pipeline, pipeline_frame_t* frame)
+{
+    for (; frame->stage < pipeline->count; frame->stage++) {
+        pipeline_stage_t* stage = &pipeline->stages[frame->stage];
+        stage->frames++;
+
+        pipeline_verdict_t verdict;
+        if (pipeline->timing) {
+            uint64_t emitted_before = pipeline->emitted_ns;
+            uint64_t start = _clock_ns();
+            verdict = stage->fn(frame, stage->context);
+            stage->ns += _clock_ns() - start - (pipeline->emitted_ns - emitted_before);
+        } else {
+            verdict = stage->fn(frame, stage->context);
+        }
+
+        if (stage->kind == PIPELINE_TAP) {
+            continue;
+        }
+
+        switch (verdict) {
+            case PIPELINE_DROP:
+                stage->dropped++;
+                return;
+
+            case PIPELINE_CONSUMED:
+                stage->consumed++;
+                return;
+
+            default:
+                break;
+        }
+    }
+
+    int send_err;
+    if (pipeline->cache != NULL && rcache_answer(pipeline->cache, frame->client, frame->data, frame->length, &send_err)) {
+        if (send_err != TCP_NO_ERROR) {
+            frame->flags |= NET_CB_DISCONNECT | NET_CB_CLIENT_ERROR;
+        }
+        return;
+    }
+
+    if (pipeline->sink != NULL) {
+        frame->flags |= pipeline->sink(frame->client, frame->data, frame->length);
+    }
+}
+
+void pipeline_init(pipeline_t* pipeline, pipeline_sink_t sink)
+{
+    memset(pipeline, 0, sizeof(pipeline_t));
+    pipeline->sink = sink;
+}
+
+void pipeline_destroy(pipeline_t* pipeline)
+{
+    for (unsigned int i = 0; i < PIPELINE_MAX_STAGES; i++) {
+        free(pipeline->scratch[i]);
+        pipeline->scratch[i] = NULL;
+        pipeline->scratch_size[i] = 0;
+    }
+}
+
+int pipeline_add(pipeline_t* pipeline, const char* name, pipeline_stage_kind_t kind,
+                 pipeline_stage_fn_t fn, void* context)
+{
+    if (pipeline->count >= PIPELINE_MAX_STAGES) {
+        return PIPELINE_FULL_ERROR;
+    }
+
+    pipeline->stages[pipeline->count++] = (pipeline_stage_t) {
+        .name = name,
+        .kind = kind,
+        .fn = fn,
+        .context = context
+    };
+
+    return PIPELINE_NO_ERROR;
+}
+
+int pipeline_run(pipeline_t* pipeline, tcpsock_t* client, void* data, unsigned int length, bool writable)
+{
+    pipeline_frame_t frame = {
+        .client = client,
+        .data = data,
+        .length = length,
+        .writable = writable,
+        .pipeline = pipeline
+    };
+
+    _run(pipeline, &frame);
+    return frame.flags;
+}
+
+void pipeline_emit(pipeline_frame_t* frame, uint8_t* data, unsigned int length)
+{
+    pipeline_t* pipeline = frame->pipeline;
+    pipeline->stages[frame->stage].emitted++;
+
+    // parts of a writable frame are writable too
+    pipeline_frame_t emitted = {
+        .client = frame->client,
+        .data = data,
+        .length = length,
+        .writable = frame->writable && data >= frame->data && data + length <= frame->data + frame->length,
+        .pipeline = pipeline,
+        .stage = frame->stage + 1
+    };
+
+    // the time of the emitted frame is charged to the stages handling it, not to the emitting one
+    uint64_t emitted_before = pipeline->emitted_ns;
+    uint64_t start = pipeline->timing ? _clock_ns() : 0;
+    _run(pipeline, &emitted);
+    if (pipeline->timing) {
+        pipeline->emitted_ns = emitted_before + (_clock_ns() - start);
+    }
+
+    frame->flags |= emitted.flags;
+}
+
+int pipeline_make_writable(pipeline_frame_t* frame)
+{
+    if (frame->writable) {
+        return PIPELINE_NO_ERROR;
+    }
+
+    // ancestors of the frame were made writable at earlier stages, so the buffer of this stage never holds them
+    pipeline_t* pipeline = frame->pipeline;
+    unsigned int stage = frame->stage;
+    if (frame->length > pipeline->scratch_size[stage]) {
+        uint8_t* scratch = realloc(pipeline->scratch[stage], frame->length);
+        if (scratch == NULL) {
+            return PIPELINE_MEMORY_ERROR;
+        }
+        pipeline->scratch[stage] = scratch;
+        pipeline->scratch_size[stage] = frame->length;
+    }
+
+    memcpy(pipeline->scratch[stage], frame->data, frame->length);
+    frame->data = pipeline->scratch[stage];
+    frame->writable = true;
+    return PIPELINE_NO_ERROR;
+}
+
+pipeline_verdict_t pipeline_split_lines(pipeline_frame_t* frame, void* context)
+{
+    (void)context;
+
+    uint8_t* line = frame->data;
+    uint8_t* end = frame->data + frame->length;
+    while (line < end) {
+        uint8_t* newline = memchr(line, '\n', end - line);
+        uint8_t* next = newline != NULL ? newline + 1 : end;
+
+        pipeline_emit(frame, line, next - line);
+        line = next;
+    }
+
+    return PIPELINE_CONSUMED;
+}
+
+pipeline_verdict_t pipeline_trim(pipeline_frame_t* frame, void* context)
+{
+    (void)context;
+
+    while (frame->length > 0 && isspace(frame->data[0])) {
+        frame->data++;
+        frame->length--;
+    }
+    while (frame->length > 0 && isspace(frame->data[frame->length - 1])) {
+        frame->length--;
+    }
+
+    return frame->length > 0 ? PIPELINE_CONTINUE : PIPELINE_DROP;
+}
+
+pipeline_verdict_t pipeline_lowercase(pipeline_frame_t* frame, void* context)
+{
+    (void)context;
+
+    if (pipeline_make_writable(frame) != PIPELINE_NO_ERROR) {
+        return PIPELINE_DROP;
+    }
+
+    for (unsigned int i = 0; i < frame->length; i++) {
+        if (frame->data[i] >= 'A' && frame->data[i] <= 'Z') {
+            frame->data[i] += 'a' - 'A';
+        }
+    }
+
+    return PIPELINE_CONTINUE;
+}
+
+pipeline_verdict_t pipeline_prefix_filter(pipeline_frame_t* frame, void* context)
+{
+    const char* prefix = context;
+    size_t length = strlen(prefix);
+
+    return frame->length >= length && memcmp(frame->data, prefix, length) == 0 ? PIPELINE_CONTINUE : PIPELINE_DROP;
+}
+
+pipeline_verdict_t pipeline_count(pipeline_frame_t* frame, void* context)
+{
+    pipeline_counter_t* counter = context;
+    counter->frames++;
+    counter->bytes += frame->length;
+
+    return PIPELINE_CONTINUE;
+}
\ No newline at end of file
@@ -0,0 +1,190 @@
+#include "ratelimit.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TOKEN_SCALE 1000    // tokens are kept in thousandths, so a ms of refill is never rounded away
+#define MAX_LOAD_PERCENT 70
+
+static int64_t _capacity(const rate_limit_t* limit)
+{
+    return (int64_t)(limit->burst > 0 ? limit->burst : limit->rate) * TOKEN_SCALE;
+}
+
+static void _refill(token_bucket_t* bucket, const rate_limit_t* limit, uint64_t now)
+{
+    if (now <= bucket->updated) {
+        return;
+    }
+
+    // rate tokens per second are rate thousandths per ms
+    int64_t tokens = bucket->tokens + (int64_t)(now - bucket->updated) * limit->rate;
+    int64_t capacity = _capacity(limit);
+    bucket->tokens = tokens < capacity ? tokens : capacity;
+    bucket->updated = now;
+}
+
+// time at which 'bucket' holds a token again, 0 if it does now
+static uint64_t _ready_at(const token_bucket_t* bucket, const rate_limit_t* limit, uint64_t now)
+{
+    if (limit->rate == 0 || bucket->tokens > 0) {
+        return 0;
+    }
+
+    uint64_t deficit = -bucket->tokens + 1;
+    return now + (deficit + limit->rate - 1) / limit->rate;
+}
+
+bool rate_limits_enabled(const rate_limits_t* limits)
+{
+    return limits->bytes.rate > 0 || limits->messages.rate > 0;
+}
+
+void rate_state_init(rate_state_t* state, const rate_limits_t* limits, uint64_t now)
+{
+    state->bytes = (token_bucket_t) { .tokens = _capacity(&limits->bytes), .updated = now };
+    state->messages = (token_bucket_t) { .tokens = _capacity(&limits->messages), .updated = now };
+}
+
+uint64_t rate_state_check(rate_state_t* state, const rate_limits_t* limits, uint64_t now)
+{
+    _refill(&state->bytes, &limits->bytes, now);
+    _refill(&state->messages, &limits->messages, now);
+
+    uint64_t bytes_ready = _ready_at(&state->bytes, &limits->bytes, now);
+    uint64_t messages_ready = _ready_at(&state->messages, &limits->messages, now);
+    return bytes_ready > messages_ready ? bytes_ready : messages_ready;
+}
+
+void rate_state_consume(rate_state_t* state, const rate_limits_t* limits, uint64_t bytes)
+{
+    if (limits->bytes.rate > 0) {
+        state->bytes.tokens -= (int64_t)bytes * TOKEN_SCALE;
+    }
+    if (limits->messages.rate > 0) {
+        state->messages.tokens -= TOKEN_SCALE;
+    }
+}
+
+static uint32_t _hash(const uint8_t* addr)
+{
+    uint64_t a, b;
+    memcpy(&a, addr, sizeof(uint64_t));
+    memcpy(&b, addr + sizeof(uint64_t), sizeof(uint64_t));
+
+    // multiply-xorshift mix, the upper bits are spread best
+    uint64_t h = (a ^ (b * 0x9E3779B97F4A7C15ULL)) * 0xBF58476D1CE4E5B9ULL;
+    return (uint32_t)(h >> 32);
+}
+
+static ratelimit_entry_t* _slot(ratelimit_table_t* table, const uint8_t* addr)
+{
+    uint32_t mask = table->capacity - 1;
+    for (uint32_t i = _hash(addr) & mask; ; i = (i + 1) & mask) {
+        ratelimit_entry_t* entry = &table->entries[i];
+        if (!entry->used || memcmp(entry->addr, addr, RATELIMIT_ADDR_SIZE) == 0) {
+            return entry;
+        }
+    }
+}
+
+static bool _is_idle(const ratelimit_entry_t* entry, const rate_limits_t* limits, uint64_t now)
+{
+    if (entry->connections > 0) {
+        return false;
+    }
+
+    rate_state_t state = entry->state;
+    rate_state_check(&state, limits, now);
+    return state.bytes.tokens >= _capacity(&limits->bytes) && state.messages.tokens >= _capacity(&limits->messages);
+}
+
+// rehash into a table of 'capacity' slots, dropping idle entries
+static int _rebuild(ratelimit_table_t* table, uint32_t capacity, const rate_limits_t* limits, uint64_t now)
+{
+    ratelimit_entry_t* entries = calloc(capacity, sizeof(ratelimit_entry_t));
+    if (entries == NULL) {
+        return RATELIMIT_MEMORY_ERROR;
+    }
+
+    ratelimit_table_t rebuilt = { .entries = entries, .capacity = capacity, .count = 0 };
+    for (uint32_t i = 0; i < table->capacity; i++) {
+        ratelimit_entry_t* entry = &table->entries[i];
+        if (entry->used && !_is_idle(entry, limits, now)) {
+            *_slot(&rebuilt, entry->addr) = *entry;
+            rebuilt.count++;
+        }
+    }
+
+    free(table->entries);
+    *table = rebuilt;
+    return RATELIMIT_NO_ERROR;
+}
+
+int ratelimit_table_create(ratelimit_table_t* table, uint32_t capacity)
+{
+    uint32_t slots = 16;
+    while (slots * MAX_LOAD_PERCENT / 100 < capacity) {
+        slots *= 2;
+    }
+
+    table->entries = calloc(slots, sizeof(ratelimit_entry_t));
+    if (table->entries == NULL) {
+        return RATELIMIT_MEMORY_ERROR;
+    }
+
+    table->capacity = slots;
+    table->count = 0;
+    return RATELIMIT_NO_ERROR;
+}
+
+void ratelimit_table_destroy(ratelimit_table_t* table)
+{
+    free(table->entries);
+    table->entries = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
+
+int ratelimit_table_acquire(ratelimit_table_t* table, const uint8_t* addr, const rate_limits_t* limits, uint64_t now)
+{
+    ratelimit_entry_t* entry = _slot(table, addr);
+    if (entry->used) {
+        entry->connections++;
+        return RATELIMIT_NO_ERROR;
+    }
+
+    if ((table->count + 1) * 100 > table->capacity * MAX_LOAD_PERCENT) {
+        // reclaiming idle entries may already make enough room, only grow if it did not free a quarter
+        uint32_t capacity = table->capacity;
+        int err = _rebuild(table, capacity, limits, now);
+        if (err == RATELIMIT_NO_ERROR && (table->count + 1) * 100 > capacity * MAX_LOAD_PERCENT * 3 / 4) {
+            err = _rebuild(table, capacity * 2, limits, now);
+        }
+        if (err != RATELIMIT_NO_ERROR) {
+            return err;
+        }
+        entry = _slot(table, addr);
+    }
+
+    memcpy(entry->addr, addr, RATELIMIT_ADDR_SIZE);
+    entry->used = true;
+    entry->connections = 1;
+    rate_state_init(&entry->state, limits, now);
+    table->count++;
+    return RATELIMIT_NO_ERROR;
+}
+
+ratelimit_entry_t* ratelimit_table_find(ratelimit_table_t* table, const uint8_t* addr)
+{
+    ratelimit_entry_t* entry = _slot(table, addr);
+    return entry->used ? entry : NULL;
+}
+
+void ratelimit_table_release(ratelimit_table_t* table, const uint8_t* addr)
+{
+    ratelimit_entry_t* entry = ratelimit_table_find(table, addr);
+    if (entry != NULL && entry->connections > 0) {
+        entry->connections--;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,247 @@
+#define _GNU_SOURCE
+
+#include "rcache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define INITIAL_BUCKETS 1024
+
+// coarse clock, TTLs are far longer than its resolution and it is read on every lookup
+static uint64_t _now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// FNV-1a over the request
+static uint64_t _hash(const uint8_t* data, unsigned int length)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned int i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static size_t _entry_size(const rcache_entry_t* entry)
+{
+    return sizeof(rcache_entry_t) + entry->request_length + entry->response_length;
+}
+
+// bucket slot pointing at the entry for 'request', or at the NULL ending its chain
+static rcache_entry_t** _find(rcache_t* cache, const void* request, unsigned int length, uint64_t hash)
+{
+    rcache_entry_t** slot = &cache->buckets[hash & (cache->bucket_count - 1)];
+    while (*slot != NULL && ((*slot)->hash != hash || (*slot)->request_length != length
+            || memcmp((*slot)->data, request, length) != 0)) {
+        slot = &(*slot)->chain;
+    }
+
+    return slot;
+}
+
+static void _unlink_lru(rcache_t* cache, rcache_entry_t* entry)
+{
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    } else {
+        cache->newest = entry->older;
+    }
+
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+}
+
+static void _push_newest(rcache_t* cache, rcache_entry_t* entry)
+{
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest != NULL) {
+        cache->newest->newer = entry;
+    } else {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+}
+
+// take 'entry' out of the table and the LRU list and free it, 'slot' is the bucket slot pointing at it
+static void _remove(rcache_t* cache, rcache_entry_t** slot)
+{
+    rcache_entry_t* entry = *slot;
+    *slot = entry->chain;
+    _unlink_lru(cache, entry);
+
+    cache->size -= _entry_size(entry);
+    cache->count--;
+    free(entry);
+}
+
+static void _grow(rcache_t* cache)
+{
+    unsigned int bucket_count = cache->bucket_count * 2;
+    rcache_entry_t** buckets = calloc(bucket_count, sizeof(rcache_entry_t*));
+    if (buckets == NULL) {
+        // longer chains are slower, but still correct
+        return;
+    }
+
+    for (unsigned int i = 0; i < cache->bucket_count; i++) {
+        rcache_entry_t* entry = cache->buckets[i];
+        while (entry != NULL) {
+            rcache_entry_t* next = entry->chain;
+            rcache_entry_t** bucket = &buckets[entry->hash & (bucket_count - 1)];
+            entry->chain = *bucket;
+            *bucket = entry;
+            entry = next;
+        }
+    }
+
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucket_count = bucket_count;
+}
+
+int rcache_init(rcache_t* cache, size_t max_size)
+{
+    memset(cache, 0, sizeof(rcache_t));
+    cache->max_size = max_size > 0 ? max_size : RCACHE_DEFAULT_SIZE;
+
+    cache->buckets = calloc(INITIAL_BUCKETS, sizeof(rcache_entry_t*));
+    if (cache->buckets == NULL) {
+        return RCACHE_MEMORY_ERROR;
+    }
+    cache->bucket_count = INITIAL_BUCKETS;
+
+    return RCACHE_NO_ERROR;
+}
+
+void rcache_destroy(rcache_t* cache)
+{
+    rcache_entry_t* entry = cache->newest;
+    while (entry != NULL) {
+        rcache_entry_t* older = entry->older;
+        free(entry);
+        entry = older;
+    }
+
+    free(cache->buckets);
+    cache->buckets = NULL;
+    cache->newest = NULL;
+    cache->oldest = NULL;
+    cache->count = 0;
+    cache->size = 0;
+}
+
+const rcache_entry_t* rcache_lookup(rcache_t* cache, const void* request, unsigned int length)
+{
+    uint64_t hash = _hash(request, length);
+    rcache_entry_t** slot = _find(cache, request, length, hash);
+    rcache_entry_t* entry = *slot;
+
+    if (entry != NULL && _now_ms() >= entry->expires) {
+        _remove(cache, slot);
+        cache->expired++;
+        entry = NULL;
+    }
+
+    if (entry == NULL) {
+        cache->misses++;
+        return NULL;
+    }
+
+    _unlink_lru(cache, entry);
+    _push_newest(cache, entry);
+    cache->hits++;
+    return entry;
+}
+
+int rcache_insert(rcache_t* cache, const void* request, unsigned int request_length,
+                  const void* response, unsigned int response_length, unsigned int ttl_ms)
+{
+    size_t size = sizeof(rcache_entry_t) + request_length + response_length;
+    if (size > cache->max_size) {
+        return RCACHE_SIZE_ERROR;
+    }
+
+    uint64_t hash = _hash(request, request_length);
+    rcache_entry_t** slot = _find(cache, request, request_length, hash);
+    if (*slot != NULL) {
+        _remove(cache, slot);
+    }
+
+    while (cache->size + size > cache->max_size) {
+        rcache_entry_t* oldest = cache->oldest;
+        _remove(cache, _find(cache, oldest->data, oldest->request_length, oldest->hash));
+        cache->evictions++;
+    }
+
+    rcache_entry_t* entry = malloc(size);
+    if (entry == NULL) {
+        return RCACHE_MEMORY_ERROR;
+    }
+
+    entry->hash = hash;
+    entry->expires = _now_ms() + ttl_ms;
+    entry->request_length = request_length;
+    entry->response_length = response_length;
+    memcpy(entry->data, request, request_length);
+    memcpy(entry->data + request_length, response, response_length);
+
+    // evictions may have changed the chain, so the entry goes in at the head of its bucket
+    rcache_entry_t** bucket = &cache->buckets[hash & (cache->bucket_count - 1)];
+    entry->chain = *bucket;
+    *bucket = entry;
+    _push_newest(cache, entry);
+
+    cache->size += size;
+    cache->count++;
+    cache->insertions++;
+
+    if (cache->count > cache->bucket_count) {
+        _grow(cache);
+    }
+
+    return RCACHE_NO_ERROR;
+}
+
+// a response cut short would leave the client with part of it, so a short send is an error too
+static int _send_response(tcpsock_t* client, const void* response, unsigned int length)
+{
+    unsigned int size = length;
+    int err = tcp_send(client, response, &size);
+    if (err == TCP_NO_ERROR && size < length) {
+        return TCP_WOULD_BLOCK;
+    }
+
+    return err;
+}
+
+bool rcache_answer(rcache_t* cache, tcpsock_t* client, const void* request, unsigned int length, int* err)
+{
+    const rcache_entry_t* entry = rcache_lookup(cache, request, length);
+    if (entry == NULL) {
+        return false;
+    }
+
+    *err = _send_response(client, RCACHE_RESPONSE(entry), entry->response_length);
+    return true;
+}
+
+int rcache_respond(rcache_t* cache, tcpsock_t* client, const void* request, unsigned int request_length,
+                   const void* response, unsigned int response_length, unsigned int ttl_ms)
+{
+    // a response which did not reach the client is not known to be a good answer
+    int err = _send_response(client, response, response_length);
+    if (err == TCP_NO_ERROR && cache != NULL) {
+        rcache_insert(cache, request, request_length, response, response_length, ttl_ms);
+    }
+
+    return err;
+}
\ No newline at end of file
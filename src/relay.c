@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+
+#include "relay.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+
+static int _open_pipe(relay_t* relay)
+{
+    if (pipe2(relay->pipe_fds, O_CLOEXEC) == -1) {
+        PRINTF_DEBUG("call to pipe2() failed with errno = %i [%s]", errno, strerror(errno));
+        return RELAY_PIPE_ERROR;
+    }
+
+    // a bigger pipe means less splice() calls per forwarded chunk
+    int size = fcntl(relay->pipe_fds[1], F_SETPIPE_SZ, RELAY_PIPE_SIZE);
+    relay->pipe_size = size > 0 ? size : fcntl(relay->pipe_fds[1], F_GETPIPE_SZ);
+
+    return RELAY_NO_ERROR;
+}
+
+static void _close_pipe(relay_t* relay)
+{
+    close(relay->pipe_fds[0]);
+    close(relay->pipe_fds[1]);
+    relay->pipe_fds[0] = -1;
+    relay->pipe_fds[1] = -1;
+}
+
+int relay_open_upstream(relay_t* relay, const char* remote_ip, const uint16_t remote_port)
+{
+    if (relay == NULL) {
+        return RELAY_PIPE_ERROR;
+    }
+
+    int err = _open_pipe(relay);
+    if (err != RELAY_NO_ERROR) {
+        return err;
+    }
+
+    if (tcp_active_open(&relay->upstream, remote_port, remote_ip) != TCP_NO_ERROR) {
+        _close_pipe(relay);
+        return RELAY_SINK_ERROR;
+    }
+
+    relay->sink_fd = tcp_get_fd(&relay->upstream);
+    return RELAY_NO_ERROR;
+}
+
+int relay_open_file(relay_t* relay, const char* path)
+{
+    if (relay == NULL) {
+        return RELAY_PIPE_ERROR;
+    }
+
+    int err = _open_pipe(relay);
+    if (err != RELAY_NO_ERROR) {
+        return err;
+    }
+
+    // splice() refuses O_APPEND files, so append by seeking to the end instead
+    relay->upstream.connected = false;
+    relay->upstream.ip_addr = NULL;
+    relay->sink_fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (relay->sink_fd == -1 || lseek(relay->sink_fd, 0, SEEK_END) == -1) {
+        PRINTF_DEBUG("failed opening relay file \"%s\", errno = %i [%s]", path, errno, strerror(errno));
+        if (relay->sink_fd != -1) {
+            close(relay->sink_fd);
+        }
+        _close_pipe(relay);
+        return RELAY_SINK_ERROR;
+    }
+
+    return RELAY_NO_ERROR;
+}
+
+int relay_forward(relay_t* relay, int source_fd, size_t* length)
+{
+    *length = 0;
+
+    ssize_t received = splice(source_fd, NULL, relay->pipe_fds[1], NULL, relay->pipe_size,
+                              SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (received == 0) {
+        return RELAY_CONNECTION_CLOSED;
+    } else if (received < 0) {
+        if (errno == EAGAIN) {
+            return RELAY_NO_ERROR;
+        }
+
+        PRINTF_DEBUG("call to splice() from fd %i failed with errno = %i [%s]", source_fd, errno, strerror(errno));
+        return errno == ECONNRESET || errno == ENOTCONN ? RELAY_CONNECTION_CLOSED : RELAY_SOURCE_ERROR;
+    }
+
+    // the pipe is shared by all sources, so it must be empty again before returning
+    size_t drained = 0;
+    while (drained < (size_t)received) {
+        ssize_t sent = splice(relay->pipe_fds[0], NULL, relay->sink_fd, NULL, received - drained,
+                              SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (sent <= 0) {
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+
+            PRINTF_DEBUG("call to splice() into sink failed with errno = %i [%s]", errno, strerror(errno));
+            return RELAY_SINK_ERROR;
+        }
+
+        drained += sent;
+    }
+
+    *length = drained;
+    return RELAY_NO_ERROR;
+}
+
+int relay_close(relay_t* relay)
+{
+    if (relay == NULL) {
+        return RELAY_PIPE_ERROR;
+    }
+
+    _close_pipe(relay);
+
+    if (relay->upstream.connected) {
+        tcp_close(&relay->upstream);
+    } else if (relay->sink_fd != -1) {
+        close(relay->sink_fd);
+    }
+
+    relay->sink_fd = -1;
+    return RELAY_NO_ERROR;
+}
\ No newline at end of file
@@ -0,0 +1,333 @@
+#define _GNU_SOURCE
+
+#include "shmring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+_Static_assert(sizeof(shmring_header_t) <= SHMRING_HEADER_SIZE, "ring header does not fit SHMRING_HEADER_SIZE");
+_Static_assert(sizeof(shmring_frame_t) == SHMRING_ALIGN, "frame header must fill one alignment unit");
+
+#define ALIGN_UP(length) (((length) + SHMRING_ALIGN - 1) & ~(uint64_t)(SHMRING_ALIGN - 1))
+
+// the ring lives in another process' memory too, so the futex must not be process private
+static void _futex_wake(_Atomic uint32_t* word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void _futex_wait(_Atomic uint32_t* word, uint32_t expected, int timeout_ms)
+{
+    struct timespec timeout = { .tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000L };
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, timeout_ms >= 0 ? &timeout : NULL, NULL, 0);
+}
+
+static void _object_name(char* buffer, size_t size, const char* name)
+{
+    snprintf(buffer, size, "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+int shmring_create(shmring_t* ring, const char* name, size_t size)
+{
+    if (ring == NULL || name == NULL) {
+        return SHMRING_FILE_ERROR;
+    }
+
+    size_t capacity = SHMRING_ALIGN * 4;
+    size = size > 0 ? size : SHMRING_DEFAULT_SIZE;
+    while (capacity < size) {
+        capacity *= 2;
+    }
+
+    // replace instead of truncating, consumers still attached to an old ring keep a valid mapping
+    _object_name(ring->name, sizeof(ring->name), name);
+    shm_unlink(ring->name);
+    int fd = shm_open(ring->name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        PRINTF_DEBUG("call to shm_open(\"%s\") failed with errno = %i [%s]", ring->name, errno, strerror(errno));
+        goto shm_open_error;
+    }
+
+    ring->map_size = SHMRING_HEADER_SIZE + capacity;
+    if (ftruncate(fd, ring->map_size) == -1) {
+        PRINTF_DEBUG("call to ftruncate() failed with errno = %i [%s]", errno, strerror(errno));
+        goto truncate_error;
+    }
+
+    void* map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (map == MAP_FAILED) {
+        PRINTF_DEBUG("call to mmap() failed with errno = %i [%s]", errno, strerror(errno));
+        goto mmap_error;
+    }
+    close(fd);
+
+    ring->header = map;
+    ring->data = (uint8_t*)map + SHMRING_HEADER_SIZE;
+    ring->position = 0;
+    ring->seq = 0;
+
+    ring->header->capacity = capacity;
+    ring->header->version = SHMRING_VERSION;
+    atomic_store(&ring->header->closed, 0);
+    atomic_store(&ring->header->reserve_pos, 0);
+    atomic_store(&ring->header->write_pos, 0);
+    atomic_store(&ring->header->notify, 0);
+    atomic_store(&ring->header->waiters, 0);
+
+    // consumers check the magic last, so they never see a half initialised header
+    atomic_thread_fence(memory_order_release);
+    ring->header->magic = SHMRING_MAGIC;
+    return SHMRING_NO_ERROR;
+
+    mmap_error:
+    truncate_error:
+    close(fd);
+    shm_unlink(ring->name);
+
+    shm_open_error:
+    ring->header = NULL;
+    return SHMRING_FILE_ERROR;
+}
+
+// write a single frame which fits a quarter of the ring
+static void _write_frame(shmring_t* ring, shmring_frame_type_t type, uint32_t connection_id,
+                         const void* data, uint32_t length)
+{
+    shmring_header_t* header = ring->header;
+    uint64_t mask = header->capacity - 1;
+    uint64_t total = ALIGN_UP(sizeof(shmring_frame_t) + length);
+
+    // a frame never wraps, the rest of the ring is skipped with a padding frame instead
+    uint64_t remaining = header->capacity - (ring->position & mask);
+    bool pad = remaining < total;
+    uint64_t end = ring->position + (pad ? remaining : 0) + total;
+
+    // claim the space first, so consumers reading it can tell it is being overwritten
+    atomic_store_explicit(&header->reserve_pos, end, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    if (pad) {
+        shmring_frame_t padding = {
+            .seq = ring->seq,
+            .type_length = ((uint32_t)SHMRING_FRAME_PADDING << 30) | (uint32_t)(remaining - sizeof(shmring_frame_t))
+        };
+        memcpy(ring->data + (ring->position & mask), &padding, sizeof(shmring_frame_t));
+        ring->position += remaining;
+    }
+
+    shmring_frame_t frame = {
+        .seq = ring->seq++,
+        .connection_id = connection_id,
+        .type_length = ((uint32_t)type << 30) | length
+    };
+    uint8_t* destination = ring->data + (ring->position & mask);
+    memcpy(destination, &frame, sizeof(shmring_frame_t));
+    if (length > 0) {
+        memcpy(destination + sizeof(shmring_frame_t), data, length);
+    }
+    ring->position = end;
+}
+
+void shmring_publish(shmring_t* ring, shmring_frame_type_t type, uint32_t connection_id,
+                     const void* data, uint32_t length)
+{
+    if (type != SHMRING_FRAME_DATA) {
+        length = 0;
+    }
+
+    uint32_t max_length = ring->header->capacity / 4 - sizeof(shmring_frame_t);
+    const uint8_t* bytes = data;
+    do {
+        uint32_t chunk = length > max_length ? max_length : length;
+        _write_frame(ring, type, connection_id, bytes, chunk);
+        bytes += chunk;
+        length -= chunk;
+    } while (length > 0);
+
+    // sequentially consistent, so either the producer sees a waiter or the waiter sees the new position
+    atomic_store(&ring->header->write_pos, ring->position);
+    if (atomic_load(&ring->header->waiters) > 0) {
+        atomic_fetch_add(&ring->header->notify, 1);
+        _futex_wake(&ring->header->notify);
+    }
+}
+
+static void _close(shmring_t* ring, bool unlink)
+{
+    if (ring == NULL || ring->header == NULL) {
+        return;
+    }
+
+    atomic_store(&ring->header->closed, 1);
+    atomic_fetch_add(&ring->header->notify, 1);
+    _futex_wake(&ring->header->notify);
+
+    munmap(ring->header, ring->map_size);
+    if (unlink) {
+        shm_unlink(ring->name);
+    }
+    ring->header = NULL;
+}
+
+void shmring_close(shmring_t* ring)
+{
+    _close(ring, true);
+}
+
+void shmring_detach(shmring_t* ring)
+{
+    _close(ring, false);
+}
+
+int shmring_consumer_open(shmring_consumer_t* consumer, const char* name)
+{
+    if (consumer == NULL || name == NULL) {
+        return SHMRING_FILE_ERROR;
+    }
+
+    int err = SHMRING_NO_ERROR;
+    char object_name[64];
+    _object_name(object_name, sizeof(object_name), name);
+
+    // consumers only write the futex words, but they share the page with the rest of the header
+    int fd = shm_open(object_name, O_RDWR | O_CLOEXEC, 0);
+    if (fd == -1) {
+        PRINTF_DEBUG("call to shm_open(\"%s\") failed with errno = %i [%s]", object_name, errno, strerror(errno));
+        err = SHMRING_FILE_ERROR;
+        goto shm_open_error;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < SHMRING_HEADER_SIZE + SHMRING_ALIGN * 4) {
+        err = SHMRING_FORMAT_ERROR;
+        goto size_error;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        PRINTF_DEBUG("call to mmap() failed with errno = %i [%s]", errno, strerror(errno));
+        err = SHMRING_FILE_ERROR;
+        goto mmap_error;
+    }
+
+    consumer->header = map;
+    consumer->data = (const uint8_t*)map + SHMRING_HEADER_SIZE;
+    consumer->map_size = st.st_size;
+
+    shmring_header_t* header = consumer->header;
+    uint32_t magic = header->magic;
+    atomic_thread_fence(memory_order_acquire);
+    if (magic != SHMRING_MAGIC || header->version != SHMRING_VERSION
+            || header->capacity + SHMRING_HEADER_SIZE > consumer->map_size) {
+        err = SHMRING_FORMAT_ERROR;
+        goto format_error;
+    }
+
+    consumer->position = atomic_load(&header->write_pos);
+    consumer->frame_position = consumer->position;
+    consumer->overruns = 0;
+    goto success;
+
+    format_error:
+    munmap(map, st.st_size);
+    consumer->header = NULL;
+
+    mmap_error:
+    size_error:
+    success:
+    close(fd);
+
+    shm_open_error:
+    return err;
+}
+
+int shmring_consumer_next(shmring_consumer_t* consumer, shmring_frame_t* frame, const void** data)
+{
+    shmring_header_t* header = consumer->header;
+    uint64_t mask = header->capacity - 1;
+
+    while (true) {
+        uint64_t write_pos = atomic_load_explicit(&header->write_pos, memory_order_acquire);
+        if (consumer->position == write_pos) {
+            return SHMRING_EMPTY;
+        }
+
+        if (write_pos - consumer->position > header->capacity) {
+            goto overrun;
+        }
+
+        const uint8_t* source = consumer->data + (consumer->position & mask);
+        memcpy(frame, source, sizeof(shmring_frame_t));
+
+        // the header may have been overwritten while it was copied
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&header->reserve_pos, memory_order_relaxed) > consumer->position + header->capacity) {
+            goto overrun;
+        }
+
+        uint64_t total = ALIGN_UP(sizeof(shmring_frame_t) + SHMRING_FRAME_LENGTH(frame));
+        consumer->frame_position = consumer->position;
+        consumer->position += total;
+
+        if (SHMRING_FRAME_TYPE(frame) == SHMRING_FRAME_PADDING) {
+            continue;
+        }
+
+        *data = source + sizeof(shmring_frame_t);
+        return SHMRING_NO_ERROR;
+
+        overrun:
+        consumer->position = write_pos;
+        consumer->frame_position = write_pos;
+        consumer->overruns++;
+        return SHMRING_OVERRUN;
+    }
+}
+
+bool shmring_consumer_valid(shmring_consumer_t* consumer)
+{
+    shmring_header_t* header = consumer->header;
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&header->reserve_pos, memory_order_relaxed)
+            <= consumer->frame_position + header->capacity;
+}
+
+bool shmring_consumer_wait(shmring_consumer_t* consumer, int timeout_ms)
+{
+    shmring_header_t* header = consumer->header;
+    uint32_t seen = atomic_load(&header->notify);
+
+    atomic_fetch_add(&header->waiters, 1);
+    if (atomic_load(&header->write_pos) == consumer->position && !atomic_load(&header->closed)) {
+        _futex_wait(&header->notify, seen, timeout_ms);
+    }
+    atomic_fetch_sub(&header->waiters, 1);
+
+    return atomic_load(&header->write_pos) != consumer->position;
+}
+
+bool shmring_consumer_closed(shmring_consumer_t* consumer)
+{
+    return atomic_load(&consumer->header->closed) != 0;
+}
+
+void shmring_consumer_close(shmring_consumer_t* consumer)
+{
+    if (consumer == NULL || consumer->header == NULL) {
+        return;
+    }
+
+    munmap(consumer->header, consumer->map_size);
+    consumer->header = NULL;
+}
\ No newline at end of file
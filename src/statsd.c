@@ -0,0 +1,498 @@
+#define _GNU_SOURCE
+
+#include "statsd.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+
+// length of a partial line which outgrew STATSD_MAX_LINE, the rest of it is discarded up to its '\n'
+#define PARTIAL_OVERFLOW (STATSD_MAX_LINE + 1)
+
+static uint64_t _clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// FNV-1a over the name and type, 0 marks empty slots so it is never returned
+static uint64_t _hash(const char* name, unsigned int length, statsd_type_t type)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned int i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 0x100000001b3ULL;
+    }
+    hash = (hash ^ type) * 0x100000001b3ULL;
+
+    return hash != 0 ? hash : 1;
+}
+
+// slot of the metric, or the empty slot it would be inserted in
+static statsd_metric_t* _find(statsd_table_t* table, const char* name, unsigned int length, statsd_type_t type,
+                              uint64_t hash)
+{
+    unsigned int mask = table->capacity - 1;
+    for (unsigned int i = hash & mask;; i = (i + 1) & mask) {
+        statsd_metric_t* metric = &table->metrics[i];
+        if (metric->hash == 0 || (metric->hash == hash && metric->type == type && metric->name_length == length
+                && memcmp(table->names + metric->name, name, length) == 0)) {
+            return metric;
+        }
+    }
+}
+
+static int _grow(statsd_table_t* table)
+{
+    unsigned int capacity = table->capacity * 2;
+    statsd_metric_t* metrics = calloc(capacity, sizeof(statsd_metric_t));
+    if (metrics == NULL) {
+        return STATSD_MEMORY_ERROR;
+    }
+
+    // the hashes are kept, so moving a metric does not touch its name
+    for (unsigned int i = 0; i < table->capacity; i++) {
+        statsd_metric_t* metric = &table->metrics[i];
+        if (metric->hash == 0) {
+            continue;
+        }
+
+        unsigned int j = metric->hash & (capacity - 1);
+        while (metrics[j].hash != 0) {
+            j = (j + 1) & (capacity - 1);
+        }
+        metrics[j] = *metric;
+    }
+
+    free(table->metrics);
+    table->metrics = metrics;
+    table->capacity = capacity;
+    return STATSD_NO_ERROR;
+}
+
+// find the metric, adding it and interning its name if it is new
+static statsd_metric_t* _lookup(statsd_table_t* table, const char* name, unsigned int length, statsd_type_t type)
+{
+    uint64_t hash = _hash(name, length, type);
+    statsd_metric_t* metric = _find(table, name, length, type, hash);
+    if (metric->hash != 0) {
+        return metric;
+    }
+
+    // keep the load below 3/4, probe sequences grow quickly beyond that
+    if ((table->count + 1) * 4 > table->capacity * 3) {
+        if (_grow(table) != STATSD_NO_ERROR) {
+            return NULL;
+        }
+        metric = _find(table, name, length, type, hash);
+    }
+
+    if (table->names_size + length > table->names_capacity) {
+        size_t names_capacity = table->names_capacity * 2;
+        while (table->names_size + length > names_capacity) {
+            names_capacity *= 2;
+        }
+
+        char* names = realloc(table->names, names_capacity);
+        if (names == NULL) {
+            return NULL;
+        }
+        table->names = names;
+        table->names_capacity = names_capacity;
+    }
+
+    histogram_t* histogram = NULL;
+    if (type == STATSD_TIMER) {
+        histogram = malloc(sizeof(histogram_t));
+        if (histogram == NULL) {
+            return NULL;
+        }
+        histogram_reset(histogram);
+    }
+
+    memcpy(table->names + table->names_size, name, length);
+    *metric = (statsd_metric_t) {
+        .hash = hash,
+        .name = table->names_size,
+        .name_length = length,
+        .type = type,
+        .min = INFINITY,
+        .max = -INFINITY,
+        .histogram = histogram
+    };
+    table->names_size += length;
+    table->count++;
+
+    return metric;
+}
+
+static bool _parse_double(const char* str, const char* end, double* value)
+{
+    char buffer[64];
+    size_t length = end - str;
+    if (length == 0 || length >= sizeof(buffer)) {
+        return false;
+    }
+
+    // strtod() needs a terminated string
+    memcpy(buffer, str, length);
+    buffer[length] = '\0';
+
+    char* parsed;
+    *value = strtod(buffer, &parsed);
+    return parsed == buffer + length && isfinite(*value);
+}
+
+static void _record_timer(statsd_metric_t* metric, double value)
+{
+    metric->count++;
+    metric->sum += value;
+    metric->min = value < metric->min ? value : metric->min;
+    metric->max = value > metric->max ? value : metric->max;
+    histogram_record(metric->histogram, value > 0 ? (uint64_t)(value * 1000 + 0.5) : 0);
+}
+
+int statsd_init(statsd_table_t* table, unsigned int capacity, unsigned int flush_interval_ms)
+{
+    memset(table, 0, sizeof(statsd_table_t));
+
+    // slots for 'capacity' metrics at the maximum load
+    unsigned int slots = 16;
+    capacity = capacity > 0 ? capacity : STATSD_DEFAULT_CAPACITY;
+    while (slots * 3 < capacity * 4) {
+        slots *= 2;
+    }
+
+    table->metrics = calloc(slots, sizeof(statsd_metric_t));
+    table->names_capacity = (size_t)slots * 16;
+    table->names = malloc(table->names_capacity);
+    if (table->metrics == NULL || table->names == NULL) {
+        PRINTF_DEBUG("unable to allocate a statsd table of %u slots", slots);
+        statsd_destroy(table);
+        return STATSD_MEMORY_ERROR;
+    }
+
+    table->capacity = slots;
+    table->flush_interval = (uint64_t)flush_interval_ms * 1000000ULL;
+    table->last_flush = _clock_ns();
+    return STATSD_NO_ERROR;
+}
+
+void statsd_destroy(statsd_table_t* table)
+{
+    if (table->metrics != NULL) {
+        for (unsigned int i = 0; i < table->capacity; i++) {
+            free(table->metrics[i].histogram);
+        }
+    }
+
+    free(table->metrics);
+    free(table->names);
+    free(table->partials);
+    memset(table, 0, sizeof(statsd_table_t));
+}
+
+int statsd_record(statsd_table_t* table, const char* line, unsigned int length)
+{
+    if (length > 0 && line[length - 1] == '\r') {
+        length--;
+    }
+    if (length > STATSD_MAX_LINE) {
+        return STATSD_PARSE_ERROR;
+    }
+
+    const char* end = line + length;
+    const char* colon = memchr(line, ':', length);
+    if (colon == NULL || colon == line) {
+        return STATSD_PARSE_ERROR;
+    }
+
+    const char* value_str = colon + 1;
+    const char* bar = memchr(value_str, '|', end - value_str);
+    if (bar == NULL) {
+        return STATSD_PARSE_ERROR;
+    }
+
+    const char* type_str = bar + 1;
+    const char* type_end = memchr(type_str, '|', end - type_str);
+    type_end = type_end != NULL ? type_end : end;
+
+    statsd_type_t type;
+    size_t type_length = type_end - type_str;
+    if (type_length == 1 && type_str[0] == 'c') {
+        type = STATSD_COUNTER;
+    } else if (type_length == 1 && type_str[0] == 'g') {
+        type = STATSD_GAUGE;
+    } else if ((type_length == 2 && memcmp(type_str, "ms", 2) == 0) || (type_length == 1 && type_str[0] == 'h')) {
+        type = STATSD_TIMER;
+    } else {
+        return STATSD_PARSE_ERROR;
+    }
+
+    double rate = 1.0;
+    if (type_end + 1 < end && type_end[1] == '@') {
+        const char* rate_end = memchr(type_end + 1, '|', end - type_end - 1);
+        if (!_parse_double(type_end + 2, rate_end != NULL ? rate_end : end, &rate) || rate <= 0 || rate > 1) {
+            return STATSD_PARSE_ERROR;
+        }
+    }
+
+    double value;
+    if (!_parse_double(value_str, bar, &value)) {
+        return STATSD_PARSE_ERROR;
+    }
+
+    statsd_metric_t* metric = _lookup(table, line, colon - line, type);
+    if (metric == NULL) {
+        return STATSD_MEMORY_ERROR;
+    }
+
+    switch (type) {
+        case STATSD_COUNTER:
+            metric->value += value / rate;
+            break;
+
+        case STATSD_GAUGE:
+            // a signed value changes the gauge instead of setting it
+            if (*value_str == '+' || *value_str == '-') {
+                metric->value += value;
+            } else {
+                metric->value = value;
+            }
+            break;
+
+        case STATSD_TIMER:
+            _record_timer(metric, value);
+            break;
+    }
+
+    metric->updated = true;
+    return STATSD_NO_ERROR;
+}
+
+static void _record_line(statsd_table_t* table, const char* line, unsigned int length)
+{
+    if (length == 0 || (length == 1 && line[0] == '\r')) {
+        return;
+    }
+
+    if (statsd_record(table, line, length) == STATSD_NO_ERROR) {
+        table->lines++;
+    } else {
+        table->malformed++;
+    }
+}
+
+static void _remove_partial(statsd_table_t* table, statsd_partial_t* partial)
+{
+    *partial = table->partials[--table->partial_count];
+}
+
+// keep the unterminated end of the data of a connection
+static void _add_partial(statsd_table_t* table, uint32_t connection_id, const char* data, unsigned int length)
+{
+    if (table->partial_count == table->partial_capacity) {
+        unsigned int capacity = table->partial_capacity > 0 ? table->partial_capacity * 2 : 8;
+        statsd_partial_t* partials = realloc(table->partials, capacity * sizeof(statsd_partial_t));
+        if (partials == NULL) {
+            table->malformed++;
+            return;
+        }
+        table->partials = partials;
+        table->partial_capacity = capacity;
+    }
+
+    statsd_partial_t* partial = &table->partials[table->partial_count++];
+    partial->connection_id = connection_id;
+    partial->flushes = table->flushes;
+    if (length > STATSD_MAX_LINE) {
+        partial->length = PARTIAL_OVERFLOW;
+    } else {
+        memcpy(partial->line, data, length);
+        partial->length = length;
+    }
+}
+
+void statsd_ingest(statsd_table_t* table, uint32_t connection_id, const void* data, unsigned int length)
+{
+    const char* line = data;
+    const char* end = line + length;
+
+    // only connections in the middle of a line have a partial, there are few of them
+    for (unsigned int i = 0; i < table->partial_count; i++) {
+        statsd_partial_t* partial = &table->partials[i];
+        if (partial->connection_id != connection_id) {
+            continue;
+        }
+
+        const char* newline = memchr(line, '\n', length);
+        unsigned int part = (newline != NULL ? newline : end) - line;
+        if (partial->length != PARTIAL_OVERFLOW && partial->length + part <= STATSD_MAX_LINE) {
+            memcpy(partial->line + partial->length, line, part);
+            partial->length += part;
+        } else {
+            partial->length = PARTIAL_OVERFLOW;
+        }
+
+        if (newline == NULL) {
+            partial->flushes = table->flushes;
+            return;
+        }
+
+        if (partial->length == PARTIAL_OVERFLOW) {
+            table->malformed++;
+        } else {
+            _record_line(table, partial->line, partial->length);
+        }
+        _remove_partial(table, partial);
+        line = newline + 1;
+        break;
+    }
+
+    while (line < end) {
+        const char* newline = memchr(line, '\n', end - line);
+        if (newline == NULL) {
+            _add_partial(table, connection_id, line, end - line);
+            return;
+        }
+
+        _record_line(table, line, newline - line);
+        line = newline + 1;
+    }
+}
+
+unsigned int statsd_partial(const statsd_table_t* table, uint32_t connection_id, void* buffer, unsigned int size)
+{
+    for (unsigned int i = 0; i < table->partial_count; i++) {
+        const statsd_partial_t* partial = &table->partials[i];
+        if (partial->connection_id != connection_id) {
+            continue;
+        }
+
+        if (partial->length == PARTIAL_OVERFLOW || partial->length > size) {
+            return 0;
+        }
+        memcpy(buffer, partial->line, partial->length);
+        return partial->length;
+    }
+
+    return 0;
+}
+
+int statsd_merge(statsd_table_t* table, const statsd_table_t* other)
+{
+    for (unsigned int i = 0; i < other->capacity; i++) {
+        const statsd_metric_t* source = &other->metrics[i];
+        if (source->hash == 0 || !source->updated) {
+            continue;
+        }
+
+        statsd_metric_t* metric = _lookup(table, other->names + source->name, source->name_length, source->type);
+        if (metric == NULL) {
+            return STATSD_MEMORY_ERROR;
+        }
+
+        switch (source->type) {
+            case STATSD_COUNTER:
+                metric->value += source->value;
+                break;
+
+            case STATSD_GAUGE:
+                metric->value = source->value;
+                break;
+
+            case STATSD_TIMER:
+                metric->count += source->count;
+                metric->sum += source->sum;
+                metric->min = source->min < metric->min ? source->min : metric->min;
+                metric->max = source->max > metric->max ? source->max : metric->max;
+                histogram_merge(metric->histogram, source->histogram);
+                break;
+        }
+
+        metric->updated = true;
+    }
+
+    return STATSD_NO_ERROR;
+}
+
+static void _emit(const statsd_table_t* table, const statsd_metric_t* metric, const char* suffix, double value,
+                  const char* type, statsd_sink_t sink, void* context)
+{
+    char line[STATSD_MAX_LINE + 64];
+    int length = snprintf(line, sizeof(line), "%.*s%s:%.15g|%s", metric->name_length, table->names + metric->name,
+        suffix, value, type);
+
+    sink(line, length < (int)sizeof(line) ? length : (int)sizeof(line) - 1, context);
+}
+
+unsigned int statsd_flush(statsd_table_t* table, bool force, statsd_sink_t sink, void* context)
+{
+    uint64_t now = _clock_ns();
+    if (!force && now - table->last_flush < table->flush_interval) {
+        return 0;
+    }
+
+    unsigned int emitted = 0;
+    for (unsigned int i = 0; i < table->capacity; i++) {
+        statsd_metric_t* metric = &table->metrics[i];
+        if (metric->hash == 0 || !metric->updated) {
+            continue;
+        }
+
+        switch (metric->type) {
+            case STATSD_COUNTER:
+                _emit(table, metric, "", metric->value, "c", sink, context);
+                metric->value = 0;
+                emitted++;
+                break;
+
+            // gauges keep their value, so later changes apply to it
+            case STATSD_GAUGE:
+                _emit(table, metric, "", metric->value, "g", sink, context);
+                emitted++;
+                break;
+
+            case STATSD_TIMER:
+                _emit(table, metric, ".count", metric->count, "c", sink, context);
+                _emit(table, metric, ".mean", metric->sum / metric->count, "g", sink, context);
+                _emit(table, metric, ".min", metric->min, "g", sink, context);
+                _emit(table, metric, ".max", metric->max, "g", sink, context);
+                _emit(table, metric, ".p50", histogram_percentile(metric->histogram, 50) / 1000.0, "g", sink, context);
+                _emit(table, metric, ".p99", histogram_percentile(metric->histogram, 99) / 1000.0, "g", sink, context);
+                metric->count = 0;
+                metric->sum = 0;
+                metric->min = INFINITY;
+                metric->max = -INFINITY;
+                histogram_reset(metric->histogram);
+                emitted += 6;
+                break;
+        }
+
+        metric->updated = false;
+    }
+
+    // a line left unterminated for a whole interval belongs to a connection which is gone
+    for (unsigned int i = 0; i < table->partial_count;) {
+        if (table->partials[i].flushes != table->flushes) {
+            table->malformed++;
+            _remove_partial(table, &table->partials[i]);
+        } else {
+            i++;
+        }
+    }
+
+    table->flushes++;
+    table->last_flush = now;
+    return emitted;
+}
+
+pipeline_verdict_t statsd_stage(pipeline_frame_t* frame, void* context)
+{
+    statsd_ingest(context, frame->client->id, frame->data, frame->length);
+    return PIPELINE_CONSUMED;
+}
\ No newline at end of file
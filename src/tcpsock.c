@@ -1,18 +1,32 @@
 #define _GNU_SOURCE
 
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <linux/tcp.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 
 #include "log.h"
+#include "probes.h"
 #include "tcpsock.h"
 
-#define CHAR_IP_ADDR_LENGTH  16              // 4 numbers of 3 digits, 3 dots and \0
+#define CHAR_IP_ADDR_LENGTH  INET6_ADDRSTRLEN    // longest textual IPv6 address and \0
 #define PROTOCOLFAMILY       AF_INET         // internet protocol suite
 #define TYPE                 SOCK_STREAM     // streaming protool type
 #define PROTOCOL             IPPROTO_TCP     // TCP protocol
@@ -32,53 +46,269 @@ do {                                                                        \
 #define CHECK_FOR_ERROR(condition, format, ...) \
     HANDLE_ERROR(condition, NO_ACTION, format, __VA_ARGS__)
 
-int tcp_passive_open(tcpsock_t* sock, const uint16_t port)
+// sockets without a transport live on the kernel socket backend
+#define TRANSPORT_OF(sock) ((sock)->transport != NULL ? (sock)->transport : &tcp_socket_transport)
+#define IS_KERNEL_SOCKET(sock) (TRANSPORT_OF(sock) == &tcp_socket_transport)
+
+// reset all fields of 'sock' to an unopened socket of 'family'
+static void _init_sock(tcpsock_t* sock, int family)
 {
-    if (sock == NULL) {
-        return TCP_SOCKET_ERROR;
+    memset(sock, 0, sizeof(tcpsock_t));
+    sock->fd = -1;
+    sock->family = family;
+}
+
+static int _set_option(int fd, int level, int option, int value, const char* name)
+{
+    (void)name;     // only printed in debug builds
+
+    int result = setsockopt(fd, level, option, &value, sizeof(value));
+    if (result == -1) {
+        PRINTF_DEBUG("call to setsockopt(%s) failed with errno = %i [%s]", name, errno, strerror(errno));
+        return TCP_SOCKOP_ERROR;
     }
 
-    if (port < MIN_PORT || port > MAX_PORT) {
-        return TCP_ADDRESS_ERROR;
+    return TCP_NO_ERROR;
+}
+
+#define SET_OPTION(fd, level, option, value) _set_option(fd, level, option, value, #option)
+
+// the kernel falls back to delayed acks after a while, so quick acks have to be re-armed after every read
+static void _rearm_quickack(tcpsock_t* sock)
+{
+    if (sock->profile != NULL && sock->profile->quickack && sock->family != AF_UNIX) {
+        SET_OPTION(sock->fd, IPPROTO_TCP, TCP_QUICKACK, 1);
+    }
+}
+
+// options which have to be in place before bind() and listen()
+static int _apply_listen_options(int fd, int family, const tcp_profile_t* profile)
+{
+    int err = TCP_NO_ERROR;
+    if (profile->reuseaddr) {
+        err |= SET_OPTION(fd, SOL_SOCKET, SO_REUSEADDR, 1);
+    }
+    if (profile->reuseport) {
+        err |= SET_OPTION(fd, SOL_SOCKET, SO_REUSEPORT, 1);
+    }
+
+    // buffer sizes set before listen() also decide the window scale of accepted connections
+    if (profile->rcvbuf > 0) {
+        err |= SET_OPTION(fd, SOL_SOCKET, SO_RCVBUF, profile->rcvbuf);
+    }
+    if (profile->sndbuf > 0) {
+        err |= SET_OPTION(fd, SOL_SOCKET, SO_SNDBUF, profile->sndbuf);
+    }
+
+    if (family != AF_UNIX) {
+        if (profile->defer_accept > 0) {
+            err |= SET_OPTION(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, profile->defer_accept);
+        }
+        if (profile->fastopen > 0) {
+            err |= SET_OPTION(fd, IPPROTO_TCP, TCP_FASTOPEN, profile->fastopen);
+        }
+    }
+
+    return err != TCP_NO_ERROR ? TCP_SOCKOP_ERROR : TCP_NO_ERROR;
+}
+
+// options of connections, set on the listener too so they are inherited where the kernel supports that
+static int _apply_connection_options(int fd, int family, const tcp_profile_t* profile)
+{
+    int err = TCP_NO_ERROR;
+    if (profile->busy_poll > 0) {
+        err |= SET_OPTION(fd, SOL_SOCKET, SO_BUSY_POLL, profile->busy_poll);
+    }
+    if (profile->keepalive) {
+        err |= SET_OPTION(fd, SOL_SOCKET, SO_KEEPALIVE, 1);
+    }
+
+    if (family == AF_UNIX) {
+        return err != TCP_NO_ERROR ? TCP_SOCKOP_ERROR : TCP_NO_ERROR;
+    }
+
+    if (profile->nodelay) {
+        err |= SET_OPTION(fd, IPPROTO_TCP, TCP_NODELAY, 1);
+    }
+    if (profile->quickack) {
+        err |= SET_OPTION(fd, IPPROTO_TCP, TCP_QUICKACK, 1);
     }
+    if (profile->keepalive && profile->keepidle > 0) {
+        err |= SET_OPTION(fd, IPPROTO_TCP, TCP_KEEPIDLE, profile->keepidle);
+    }
+    if (profile->keepalive && profile->keepintvl > 0) {
+        err |= SET_OPTION(fd, IPPROTO_TCP, TCP_KEEPINTVL, profile->keepintvl);
+    }
+    if (profile->keepalive && profile->keepcnt > 0) {
+        err |= SET_OPTION(fd, IPPROTO_TCP, TCP_KEEPCNT, profile->keepcnt);
+    }
+
+    return err != TCP_NO_ERROR ? TCP_SOCKOP_ERROR : TCP_NO_ERROR;
+}
 
+// create a socket of 'family', bind it to 'addr' and start listening on it
+static int _passive_open(tcpsock_t* sock, int family, const struct sockaddr* addr, socklen_t addr_length,
+                         const tcp_profile_t* profile)
+{
     int result;
     int err = TCP_NO_ERROR;
-    sock->connected = false;
+    sock->passive = true;
+    sock->profile = profile;
 
-    sock->fd = socket(PROTOCOLFAMILY, TYPE, PROTOCOL);
+    sock->fd = socket(family, TYPE, family == AF_UNIX ? 0 : PROTOCOL);
     HANDLE_ERROR_GOTO(sock->fd < 0, err = TCP_SOCKOP_ERROR, socket_creation_error,
                 "call to socket() failed with errno = %i", errno);
 
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(struct sockaddr_in));
-    addr.sin_family = PROTOCOLFAMILY;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(port);
-    
-    result = bind(sock->fd, (struct sockaddr*)&addr, sizeof(addr));
+    if (family == AF_INET6) {
+        // leave IPv4 traffic to the AF_INET listener on the same port
+        int v6only = 1;
+        result = setsockopt(sock->fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+        HANDLE_ERROR_GOTO(result == -1, err = TCP_SOCKOP_ERROR, socket_option_error,
+                "call to setsockopt(IPV6_V6ONLY) failed with errno = %i", errno);
+    }
+
+    if (profile != NULL) {
+        // an option the kernel refuses is not fatal, the socket works with its default
+        CHECK_FOR_ERROR(_apply_listen_options(sock->fd, family, profile) != TCP_NO_ERROR,
+            "some listen options could not be applied to fd %i", sock->fd);
+        CHECK_FOR_ERROR(_apply_connection_options(sock->fd, family, profile) != TCP_NO_ERROR,
+            "some connection options could not be applied to fd %i", sock->fd);
+    }
+
+    result = bind(sock->fd, addr, addr_length);
     HANDLE_ERROR_GOTO(result == -1, err = TCP_SOCKOP_ERROR, socket_binding_error,
                 "call to bind() failed with errno = %i", errno);
 
-    result = listen(sock->fd, MAX_PENDING);
+    result = listen(sock->fd, profile != NULL && profile->backlog > 0 ? profile->backlog : MAX_PENDING);
     HANDLE_ERROR_GOTO(result == -1, err = TCP_SOCKOP_ERROR, socket_listening_error,
                 "call to listen() failed with errno = %i", errno);
 
     sock->connected = true;
-    sock->ip_addr = NULL;
-    sock->port = port;
     goto success;
 
     socket_listening_error:
     socket_binding_error:
+    socket_option_error:
+    close(sock->fd);
+    sock->fd = -1;
+
     socket_creation_error:
-    ip_memory_alloc_error:
     success:
     // do nothing
 
     return err;
 }
 
+int tcp_passive_open(tcpsock_t* sock, const uint16_t port, const tcp_profile_t* profile)
+{
+    if (sock == NULL) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    if (port < MIN_PORT || port > MAX_PORT) {
+        return TCP_ADDRESS_ERROR;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family = PROTOCOLFAMILY;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    _init_sock(sock, PROTOCOLFAMILY);
+    sock->port = port;
+    return _passive_open(sock, PROTOCOLFAMILY, (struct sockaddr*)&addr, sizeof(addr), profile);
+}
+
+int tcp_passive_open_ipv6(tcpsock_t* sock, const uint16_t port, const tcp_profile_t* profile)
+{
+    if (sock == NULL) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    if (port < MIN_PORT || port > MAX_PORT) {
+        return TCP_ADDRESS_ERROR;
+    }
+
+    struct sockaddr_in6 addr;
+    memset(&addr, 0, sizeof(struct sockaddr_in6));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons(port);
+
+    _init_sock(sock, AF_INET6);
+    sock->port = port;
+    return _passive_open(sock, AF_INET6, (struct sockaddr*)&addr, sizeof(addr), profile);
+}
+
+// remove a socket file left behind by a previous run, which would make bind() fail
+// anything else at the path, including the socket of a server which still accepts on it, is left alone
+static int _clear_unix_path(const struct sockaddr_un* addr)
+{
+    struct stat st;
+    if (lstat(addr->sun_path, &st) == -1) {
+        return errno == ENOENT ? TCP_NO_ERROR : TCP_ADDRESS_ERROR;
+    }
+
+    if (!S_ISSOCK(st.st_mode)) {
+        PRINTF_DEBUG("\"%s\" exists and is not a socket", addr->sun_path);
+        return TCP_ADDRESS_ERROR;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        PRINTF_DEBUG("call to socket() failed with errno = %i [%s]", errno, strerror(errno));
+        return TCP_SOCKOP_ERROR;
+    }
+
+    // only a refused connection proves nobody is listening, a full backlog or missing permissions do not
+    int result = connect(fd, (const struct sockaddr*)addr, sizeof(struct sockaddr_un));
+    int connect_errno = errno;
+    close(fd);
+
+    if (result == -1 && connect_errno == ECONNREFUSED) {
+        unlink(addr->sun_path);
+        return TCP_NO_ERROR;
+    }
+
+    PRINTF_DEBUG("\"%s\" is still in use", addr->sun_path);
+    return TCP_ADDRESS_ERROR;
+}
+
+int tcp_passive_open_unix(tcpsock_t* sock, const char* path, const tcp_profile_t* profile)
+{
+    if (sock == NULL) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    struct sockaddr_un addr;
+    if (path == NULL || path[0] == '\0' || strlen(path) >= sizeof(addr.sun_path)) {
+        return TCP_ADDRESS_ERROR;
+    }
+
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    _init_sock(sock, AF_UNIX);
+    sock->ip_addr = strdup(path);
+    if (sock->ip_addr == NULL) {
+        return TCP_MEMORY_ERROR;
+    }
+
+    int err = _clear_unix_path(&addr);
+    if (err == TCP_NO_ERROR) {
+        err = _passive_open(sock, AF_UNIX, (struct sockaddr*)&addr, sizeof(addr), profile);
+    }
+
+    if (err != TCP_NO_ERROR) {
+        free(sock->ip_addr);
+        sock->ip_addr = NULL;
+    }
+
+    return err;
+}
+
 /**
     int tcp_passive_open(tcpsock_t **sock, int port) {
         int result;
@@ -110,25 +340,87 @@ int tcp_passive_open(tcpsock_t* sock, const uint16_t port)
 
 int tcp_active_open(tcpsock_t* sock, const uint16_t remote_port, const char* remote_ip)
 {
-    // TODO: implement
-    return TCP_SOCKET_ERROR;
+    if (sock == NULL) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    if (remote_ip == NULL || remote_port < MIN_PORT || remote_port > MAX_PORT) {
+        return TCP_ADDRESS_ERROR;
+    }
+
+    struct sockaddr_storage addr;
+    socklen_t addr_length;
+    memset(&addr, 0, sizeof(struct sockaddr_storage));
+
+    struct sockaddr_in* addr4 = (struct sockaddr_in*)&addr;
+    struct sockaddr_in6* addr6 = (struct sockaddr_in6*)&addr;
+    if (inet_pton(AF_INET, remote_ip, &addr4->sin_addr) == 1) {
+        addr4->sin_family = AF_INET;
+        addr4->sin_port = htons(remote_port);
+        addr_length = sizeof(struct sockaddr_in);
+    } else if (inet_pton(AF_INET6, remote_ip, &addr6->sin6_addr) == 1) {
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_port = htons(remote_port);
+        addr_length = sizeof(struct sockaddr_in6);
+    } else {
+        return TCP_ADDRESS_ERROR;
+    }
+
+    int result;
+    int err = TCP_NO_ERROR;
+    _init_sock(sock, addr.ss_family);
+    sock->port = remote_port;
+
+    sock->ip_addr = strdup(remote_ip);
+    HANDLE_ERROR_GOTO(sock->ip_addr == NULL, err = TCP_MEMORY_ERROR, ip_memory_alloc_error,
+                "Failed to allocation memory for ip char buffer");
+
+    sock->fd = socket(sock->family, TYPE, PROTOCOL);
+    HANDLE_ERROR_GOTO(sock->fd < 0, err = TCP_SOCKOP_ERROR, socket_creation_error,
+                "call to socket() failed with errno = %i", errno);
+
+    result = connect(sock->fd, (struct sockaddr*)&addr, addr_length);
+    HANDLE_ERROR_GOTO(result == -1, err = TCP_SOCKOP_ERROR, socket_connect_error,
+                "call to connect() failed with errno = %i [%s]", errno, strerror(errno));
+
+    sock->connected = true;
+    goto success;
+
+    socket_connect_error:
+    close(sock->fd);
+    sock->fd = -1;
+
+    socket_creation_error:
+    free(sock->ip_addr);
+    sock->ip_addr = NULL;
+
+    ip_memory_alloc_error:
+    success:
+    // do nothing
+
+    return err;
 }
 
-int tcp_close(tcpsock_t* sock)
+static int _socket_close(tcpsock_t* sock)
 {
     if (sock == NULL) {
         return TCP_SOCKET_ERROR;
     }
 
     if (sock->connected) {
-        int result = shutdown(sock->fd, SHUT_RDWR);
+        // listening sockets have no peer to shut down, but still need closing
+        if (!sock->passive) {
+            int result = shutdown(sock->fd, SHUT_RDWR);
+            CHECK_FOR_ERROR(result == -1,
+                "call to shutdown() failed with errno = %i [%s]", errno, strerror(errno));
+        }
+
+        int result = close(sock->fd);
         CHECK_FOR_ERROR(result == -1,
-            "call to shutdown() failed with errno = %i [%s]", errno, strerror(errno));
+            "call to close() failed with errno = %i [%s]", errno, strerror(errno));
 
-        if (result != -1) {
-            result = close(sock->fd);
-            CHECK_FOR_ERROR(result == -1,
-                "call to close() failed with errno = %i [%s]", errno, strerror(errno));
+        if (sock->passive && sock->family == AF_UNIX && sock->ip_addr != NULL) {
+            unlink(sock->ip_addr);
         }
     }
 
@@ -136,40 +428,83 @@ int tcp_close(tcpsock_t* sock)
         free(sock->ip_addr);
     }
 
-    sock->connected = false;
-    sock->fd = -1;
-    sock->ip_addr = NULL;
-    sock->port = 0;
+    if (sock->zc_map != NULL) {
+        munmap(sock->zc_map, sock->zc_map_size);
+    }
+
+    _init_sock(sock, AF_UNSPEC);
 
     return TCP_NO_ERROR;
 }
 
-int tcp_wait_for_connection(tcpsock_t* sock, tcpsock_t* new_sock)
+// fill in the textual and binary peer address of an IPv4 or IPv6 socket
+static int _set_peer_addr(tcpsock_t* sock, const struct sockaddr_storage* addr)
+{
+    sock->ip_addr = malloc(CHAR_IP_ADDR_LENGTH);
+    if (sock->ip_addr == NULL) {
+        return TCP_MEMORY_ERROR;
+    }
+
+    if (addr->ss_family == AF_INET6) {
+        const struct sockaddr_in6* addr6 = (const struct sockaddr_in6*)addr;
+        inet_ntop(AF_INET6, &addr6->sin6_addr, sock->ip_addr, CHAR_IP_ADDR_LENGTH);
+        sock->port = ntohs(addr6->sin6_port);
+        memcpy(sock->peer_addr, &addr6->sin6_addr, sizeof(struct in6_addr));
+    } else {
+        const struct sockaddr_in* addr4 = (const struct sockaddr_in*)addr;
+        inet_ntop(AF_INET, &addr4->sin_addr, sock->ip_addr, CHAR_IP_ADDR_LENGTH);
+        sock->port = ntohs(addr4->sin_port);
+
+        // store as ::ffff:a.b.c.d, so both families share one key format
+        sock->peer_addr[10] = 0xff;
+        sock->peer_addr[11] = 0xff;
+        memcpy(sock->peer_addr + 12, &addr4->sin_addr, sizeof(struct in_addr));
+    }
+
+    return TCP_NO_ERROR;
+}
+
+static int _socket_accept(tcpsock_t* sock, tcpsock_t* new_sock)
 {
     if (sock == NULL || new_sock == NULL) {
         return TCP_SOCKET_ERROR;
     }
 
     int err = TCP_NO_ERROR;
-    struct sockaddr_in addr;
-    unsigned int length = sizeof(struct sockaddr_in);
+    struct sockaddr_storage addr;
+    socklen_t length = sizeof(struct sockaddr_storage);
 
+    _init_sock(new_sock, sock->family);
 
     new_sock->fd = accept(sock->fd, (struct sockaddr*)&addr, &length);
     HANDLE_ERROR_GOTO(new_sock->fd == -1, err = TCP_SOCKOP_ERROR, socket_accept_error,
         "call to accept() failed with errno = %i [%s]", errno, strerror(errno));
-    
-    const char* ip_addr = inet_ntoa(addr.sin_addr);
-    new_sock->ip_addr = malloc(CHAR_IP_ADDR_LENGTH);
-    HANDLE_ERROR_GOTO(new_sock->ip_addr == NULL, err = TCP_MEMORY_ERROR, ip_buff_malloc_error,
-        "Failed to allocation memory for ip char buffer");
-
-    strncpy(new_sock->ip_addr, ip_addr, CHAR_IP_ADDR_LENGTH);
-    new_sock->port = ntohs(addr.sin_port);
+
+    if (sock->family == AF_UNIX) {
+        // unix peers are usually unnamed, so identify them by the listening path
+        new_sock->ip_addr = sock->ip_addr != NULL ? strdup(sock->ip_addr) : NULL;
+        HANDLE_ERROR_GOTO(sock->ip_addr != NULL && new_sock->ip_addr == NULL, err = TCP_MEMORY_ERROR,
+            ip_buff_malloc_error, "Failed to allocation memory for path char buffer");
+    } else {
+        err = _set_peer_addr(new_sock, &addr);
+        HANDLE_ERROR_GOTO(err != TCP_NO_ERROR, NO_ACTION, ip_buff_malloc_error,
+            "Failed to allocation memory for ip char buffer (%i)", err);
+    }
+
+    // not every option is inherited from the listener, so set them again
+    new_sock->profile = sock->profile;
+    if (sock->profile != NULL) {
+        CHECK_FOR_ERROR(_apply_connection_options(new_sock->fd, sock->family, sock->profile) != TCP_NO_ERROR,
+            "some connection options could not be applied to fd %i", new_sock->fd);
+    }
+
     new_sock->connected = true;
     goto success;
 
     ip_buff_malloc_error:
+    close(new_sock->fd);
+    new_sock->fd = -1;
+
     socket_accept_error:
     success:
     // do nothing
@@ -177,7 +512,7 @@ int tcp_wait_for_connection(tcpsock_t* sock, tcpsock_t* new_sock)
     return err;
 }
 
-int tcp_send(tcpsock_t* sock, const void* buffer, unsigned int* buff_size)
+static int _socket_send(tcpsock_t* sock, const void* buffer, unsigned int* buff_size)
 {
     if (sock == NULL || buff_size == NULL) {
         return TCP_SOCKET_ERROR;
@@ -189,15 +524,18 @@ int tcp_send(tcpsock_t* sock, const void* buffer, unsigned int* buff_size)
 
     int err = TCP_NO_ERROR;
     if (buffer != NULL && *buff_size != 0) {
-        *buff_size = sendto(sock->fd, buffer, *buff_size, MSG_NOSIGNAL, NULL, 0);
-        
-        HANDLE_ERROR_GOTO(*buff_size == 0, err = TCP_CONNECTION_CLOSED, zero_bytes_sent,
+        ssize_t result = sendto(sock->fd, buffer, *buff_size, MSG_NOSIGNAL, NULL, 0);
+        *buff_size = result < 0 ? 0 : result;
+
+        HANDLE_ERROR_GOTO(result == 0, err = TCP_CONNECTION_CLOSED, zero_bytes_sent,
             "call to sendto() returned 0 sent bytes : connection with peer is closed");
-        HANDLE_ERROR_GOTO(*buff_size < 0 && ((errno == EPIPE) || (errno == ENOTCONN)),
+        HANDLE_ERROR_GOTO(result < 0 && ((errno == EPIPE) || (errno == ENOTCONN) || (errno == ECONNRESET)),
             err = TCP_CONNECTION_CLOSED, sendto_pipe_notconn_error,
             "call to sendto() returned errno = %i [%s] : connection with peer is closed",
             errno, strerror(errno));
-        HANDLE_ERROR_GOTO(*buff_size < 0, err = TCP_SOCKOP_ERROR, sendto_other_error,
+        HANDLE_ERROR_GOTO(result < 0 && ((errno == EAGAIN) || (errno == EWOULDBLOCK)),
+            err = TCP_WOULD_BLOCK, sendto_would_block, "call to sendto() would block");
+        HANDLE_ERROR_GOTO(result < 0, err = TCP_SOCKOP_ERROR, sendto_other_error,
             "call to sendto() returned errno = %i [%s]", errno, strerror(errno));
     } else {
         *buff_size = 0;
@@ -207,6 +545,7 @@ int tcp_send(tcpsock_t* sock, const void* buffer, unsigned int* buff_size)
 
     zero_bytes_sent:
     sendto_pipe_notconn_error:
+    sendto_would_block:
     sendto_other_error:
     success:
     // do nothing
@@ -214,7 +553,199 @@ int tcp_send(tcpsock_t* sock, const void* buffer, unsigned int* buff_size)
     return err;
 }
 
-int tcp_receive(tcpsock_t* sock, void* buffer, unsigned int* buff_size)
+int tcp_enable_zerocopy_send(tcpsock_t* sock)
+{
+    if (sock == NULL || !sock->connected || sock->passive || !IS_KERNEL_SOCKET(sock)) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    if (sock->zc_send) {
+        return TCP_NO_ERROR;
+    }
+
+    int enable = 1;
+    int result = setsockopt(sock->fd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable));
+    if (result == -1) {
+        PRINTF_DEBUG("call to setsockopt(SO_ZEROCOPY) failed with errno = %i [%s]", errno, strerror(errno));
+        return TCP_SOCKOP_ERROR;
+    }
+
+    sock->zc_send = true;
+    sock->zc_send_seq = 0;
+    sock->zc_send_completed = 0;
+    return TCP_NO_ERROR;
+}
+
+int tcp_send_zerocopy(tcpsock_t* sock, const void* buffer, unsigned int* buff_size, uint32_t* seq)
+{
+    if (sock == NULL || buff_size == NULL || seq == NULL) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    if (!sock->connected || !sock->zc_send) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    int err = TCP_NO_ERROR;
+    if (buffer != NULL && *buff_size != 0) {
+        ssize_t result = send(sock->fd, buffer, *buff_size, MSG_NOSIGNAL | MSG_ZEROCOPY);
+        *buff_size = result < 0 ? 0 : result;
+
+        HANDLE_ERROR_GOTO(result == 0, err = TCP_CONNECTION_CLOSED, zero_bytes_sent,
+            "call to send() returned 0 sent bytes : connection with peer is closed");
+        HANDLE_ERROR_GOTO(result < 0 && ((errno == EPIPE) || (errno == ENOTCONN) || (errno == ECONNRESET)),
+            err = TCP_CONNECTION_CLOSED, send_pipe_notconn_error,
+            "call to send() returned errno = %i [%s] : connection with peer is closed",
+            errno, strerror(errno));
+        HANDLE_ERROR_GOTO(result < 0 && ((errno == EAGAIN) || (errno == EWOULDBLOCK)),
+            err = TCP_WOULD_BLOCK, send_would_block, "call to send() would block");
+        HANDLE_ERROR_GOTO(result < 0 && errno == ENOBUFS, err = TCP_NO_BUFFERS, send_no_buffers,
+            "call to send(MSG_ZEROCOPY) returned ENOBUFS : too many pages pinned by pending sends");
+        HANDLE_ERROR_GOTO(result < 0, err = TCP_SOCKOP_ERROR, send_other_error,
+            "call to send() returned errno = %i [%s]", errno, strerror(errno));
+
+        // every successful MSG_ZEROCOPY call consumes exactly one notification id
+        *seq = sock->zc_send_seq++;
+    } else {
+        *buff_size = 0;
+        *seq = sock->zc_send_completed;
+    }
+
+    goto success;
+
+    zero_bytes_sent:
+    send_pipe_notconn_error:
+    send_would_block:
+    send_no_buffers:
+    send_other_error:
+    success:
+    // do nothing
+
+    return err;
+}
+
+int tcp_reap_zerocopy(tcpsock_t* sock, uint32_t* completed)
+{
+    if (sock == NULL || completed == NULL || !sock->zc_send) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    int err = TCP_NO_ERROR;
+    while (true) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err)) * 4];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(struct msghdr));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t result = recvmsg(sock->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if (result == -1) {
+            HANDLE_ERROR(errno != EAGAIN && errno != EWOULDBLOCK, err = TCP_SOCKOP_ERROR,
+                "call to recvmsg(MSG_ERRQUEUE) returned errno = %i [%s]", errno, strerror(errno));
+            break;
+        }
+
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            bool is_recverr = (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                           || (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+            if (!is_recverr) {
+                continue;
+            }
+
+            struct sock_extended_err* serr = (struct sock_extended_err*)CMSG_DATA(cmsg);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            // notifications cover the inclusive id range [ee_info, ee_data]
+            if ((int32_t)(serr->ee_data + 1 - sock->zc_send_completed) > 0) {
+                sock->zc_send_completed = serr->ee_data + 1;
+            }
+
+            CHECK_FOR_ERROR(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED,
+                "zero-copy sends %u-%u on fd %i were copied by the kernel", serr->ee_info, serr->ee_data, sock->fd);
+        }
+    }
+
+    *completed = sock->zc_send_completed;
+    return err;
+}
+
+int tcp_sendfile(tcpsock_t* sock, int file_fd, off_t* offset, unsigned int* count)
+{
+    if (sock == NULL || offset == NULL || count == NULL) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    if (!sock->connected || !IS_KERNEL_SOCKET(sock)) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    int err = TCP_NO_ERROR;
+    if (*count != 0) {
+        ssize_t result = sendfile(sock->fd, file_fd, offset, *count);
+        *count = result < 0 ? 0 : result;
+
+        HANDLE_ERROR_GOTO(result < 0 && ((errno == EPIPE) || (errno == ENOTCONN) || (errno == ECONNRESET)),
+            err = TCP_CONNECTION_CLOSED, sendfile_pipe_notconn_error,
+            "call to sendfile() returned errno = %i [%s] : connection with peer is closed",
+            errno, strerror(errno));
+        HANDLE_ERROR_GOTO(result < 0, err = TCP_SOCKOP_ERROR, sendfile_other_error,
+            "call to sendfile() returned errno = %i [%s]", errno, strerror(errno));
+    }
+
+    goto success;
+
+    sendfile_pipe_notconn_error:
+    sendfile_other_error:
+    success:
+    // do nothing
+
+    return err;
+}
+
+int tcp_sendv(tcpsock_t* sock, const struct iovec* iov, unsigned int count, size_t* sent)
+{
+    if (sock == NULL || sent == NULL || (iov == NULL && count != 0)) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    if (!sock->connected || !IS_KERNEL_SOCKET(sock)) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    int err = TCP_NO_ERROR;
+    *sent = 0;
+    if (count != 0) {
+        struct msghdr msg = {
+            .msg_iov = (struct iovec*)iov,
+            .msg_iovlen = count
+        };
+        ssize_t result = sendmsg(sock->fd, &msg, MSG_NOSIGNAL);
+        *sent = result < 0 ? 0 : result;
+
+        HANDLE_ERROR_GOTO(result < 0 && ((errno == EPIPE) || (errno == ENOTCONN) || (errno == ECONNRESET)),
+            err = TCP_CONNECTION_CLOSED, sendmsg_pipe_notconn_error,
+            "call to sendmsg() returned errno = %i [%s] : connection with peer is closed",
+            errno, strerror(errno));
+        HANDLE_ERROR_GOTO(result < 0 && ((errno == EAGAIN) || (errno == EWOULDBLOCK)),
+            err = TCP_WOULD_BLOCK, sendmsg_would_block, "call to sendmsg() would block");
+        HANDLE_ERROR_GOTO(result < 0, err = TCP_SOCKOP_ERROR, sendmsg_other_error,
+            "call to sendmsg() returned errno = %i [%s]", errno, strerror(errno));
+    }
+
+    goto success;
+
+    sendmsg_pipe_notconn_error:
+    sendmsg_would_block:
+    sendmsg_other_error:
+    success:
+    // do nothing
+
+    return err;
+}
+
+static int _socket_receive(tcpsock_t* sock, void* buffer, unsigned int* buff_size)
 {
     if (sock == NULL || buffer == NULL || buff_size == NULL) {
         return TCP_SOCKET_ERROR;
@@ -226,16 +757,21 @@ int tcp_receive(tcpsock_t* sock, void* buffer, unsigned int* buff_size)
 
     int err = TCP_NO_ERROR;
     if (buffer != NULL && *buff_size != 0) {
-        *buff_size = recv(sock->fd, buffer, *buff_size, 0);
-        
-        HANDLE_ERROR_GOTO(*buff_size == 0, err = TCP_CONNECTION_CLOSED, zero_bytes_sent,
+        ssize_t result = recv(sock->fd, buffer, *buff_size, 0);
+        *buff_size = result < 0 ? 0 : result;
+
+        HANDLE_ERROR_GOTO(result == 0, err = TCP_CONNECTION_CLOSED, zero_bytes_sent,
             "call to recv() returned 0 received bytes : connection with peer is closed");
-        HANDLE_ERROR_GOTO(*buff_size < 0 && (errno == ENOTCONN),
+        HANDLE_ERROR_GOTO(result < 0 && ((errno == ENOTCONN) || (errno == ECONNRESET)),
             err = TCP_CONNECTION_CLOSED, recv_notconn_error,
             "call to recv() returned errno = %i [%s] : connection with peer is closed",
             errno, strerror(errno));
-        HANDLE_ERROR_GOTO(*buff_size < 0, err = TCP_SOCKOP_ERROR, recv_other_error,
+        HANDLE_ERROR_GOTO(result < 0 && ((errno == EAGAIN) || (errno == EWOULDBLOCK)),
+            err = TCP_WOULD_BLOCK, recv_would_block, "call to recv() would block");
+        HANDLE_ERROR_GOTO(result < 0, err = TCP_SOCKOP_ERROR, recv_other_error,
             "call to recv() returned errno = %i [%s]", errno, strerror(errno));
+
+        _rearm_quickack(sock);
     } else {
         *buff_size = 0;
     }
@@ -244,6 +780,7 @@ int tcp_receive(tcpsock_t* sock, void* buffer, unsigned int* buff_size)
 
     zero_bytes_sent:
     recv_notconn_error:
+    recv_would_block:
     recv_other_error:
     success:
     // do nothing
@@ -251,6 +788,461 @@ int tcp_receive(tcpsock_t* sock, void* buffer, unsigned int* buff_size)
     return err;
 }
 
+int tcp_enable_zerocopy_receive(tcpsock_t* sock, unsigned int map_size)
+{
+    if (sock == NULL || !sock->connected || sock->passive || !IS_KERNEL_SOCKET(sock)) {
+        return TCP_SOCKET_ERROR;
+    }
+
+#ifdef TCP_ZEROCOPY_RECEIVE
+    if (sock->family == AF_UNIX || sock->zc_map != NULL) {
+        return sock->zc_map != NULL ? TCP_NO_ERROR : TCP_SOCKOP_ERROR;
+    }
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    map_size = (map_size + page_size - 1) & ~(page_size - 1);
+
+    // the mapping has to be backed by the socket itself, received pages are swapped into it
+    void* map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, sock->fd, 0);
+    if (map == MAP_FAILED) {
+        PRINTF_DEBUG("call to mmap() on fd %i failed with errno = %i [%s]", sock->fd, errno, strerror(errno));
+        return TCP_SOCKOP_ERROR;
+    }
+
+    sock->zc_map = map;
+    sock->zc_map_size = map_size;
+    return TCP_NO_ERROR;
+#else
+    return TCP_SOCKOP_ERROR;
+#endif
+}
+
+int tcp_receive_zerocopy(tcpsock_t* sock, const void** mapped, unsigned int* map_size, void* buffer, unsigned int* buff_size)
+{
+    if (sock == NULL || mapped == NULL || map_size == NULL) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    *mapped = NULL;
+    *map_size = 0;
+
+#ifdef TCP_ZEROCOPY_RECEIVE
+    if (sock->zc_map == NULL || !sock->connected) {
+        return tcp_receive(sock, buffer, buff_size);
+    }
+
+    struct tcp_zerocopy_receive zc;
+    memset(&zc, 0, sizeof(struct tcp_zerocopy_receive));
+    zc.address = (uintptr_t)sock->zc_map;
+    zc.length = sock->zc_map_size;
+    socklen_t zc_length = sizeof(struct tcp_zerocopy_receive);
+
+    int result = getsockopt(sock->fd, IPPROTO_TCP, TCP_ZEROCOPY_RECEIVE, &zc, &zc_length);
+    if (result == -1) {
+        // the kernel refuses zero-copy for this socket, don't try again
+        PRINTF_DEBUG("call to getsockopt(TCP_ZEROCOPY_RECEIVE) failed with errno = %i [%s] : falling back to recv()",
+            errno, strerror(errno));
+        munmap(sock->zc_map, sock->zc_map_size);
+        sock->zc_map = NULL;
+        sock->zc_map_size = 0;
+        return _socket_receive(sock, buffer, buff_size);
+    }
+
+    // the kernel hands pending socket errors over here, and clears them, so they are reported right away
+    if (zc.err != 0) {
+        PRINTF_DEBUG("call to getsockopt(TCP_ZEROCOPY_RECEIVE) reported socket error %i [%s]", zc.err, strerror(zc.err));
+        return zc.err == ECONNRESET || zc.err == ENOTCONN || zc.err == EPIPE ? TCP_CONNECTION_CLOSED : TCP_SOCKOP_ERROR;
+    }
+
+    if (zc.length == 0) {
+        // nothing could be mapped, copy the unaligned head (or detect a closed connection)
+        if (zc.recv_skip_hint > 0 && zc.recv_skip_hint < *buff_size) {
+            *buff_size = zc.recv_skip_hint;
+        }
+        return _socket_receive(sock, buffer, buff_size);
+    }
+
+    *mapped = sock->zc_map;
+    *map_size = zc.length;
+    _rearm_quickack(sock);
+
+    // the mapped pages are already consumed, only the remainder may still be read
+    // a close after the mapped bytes is left for the next receive to report, so they are still handled
+    unsigned int remainder = zc.recv_skip_hint < *buff_size ? zc.recv_skip_hint : *buff_size;
+    ssize_t received = remainder > 0 ? recv(sock->fd, buffer, remainder, MSG_DONTWAIT) : 0;
+    *buff_size = received < 0 ? 0 : received;
+
+    int err = TCP_NO_ERROR;
+    HANDLE_ERROR_GOTO(received < 0 && ((errno == ENOTCONN) || (errno == ECONNRESET)),
+        err = TCP_CONNECTION_CLOSED, recv_notconn_error,
+        "call to recv() returned errno = %i [%s] : connection with peer is closed",
+        errno, strerror(errno));
+    HANDLE_ERROR_GOTO(received < 0 && errno != EAGAIN && errno != EWOULDBLOCK,
+        err = TCP_SOCKOP_ERROR, recv_other_error,
+        "call to recv() returned errno = %i [%s]", errno, strerror(errno));
+
+    goto success;
+
+    recv_notconn_error:
+    recv_other_error:
+    success:
+    // do nothing
+
+    return err;
+#else
+    return tcp_receive(sock, buffer, buff_size);
+#endif
+}
+
+int tcp_release_zerocopy(tcpsock_t* sock, unsigned int map_size)
+{
+    if (sock == NULL) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    if (sock->zc_map != NULL && map_size > 0) {
+        // dropping the pages now is cheaper than letting the next receive zap them
+        madvise(sock->zc_map, map_size, MADV_DONTNEED);
+    }
+
+    return TCP_NO_ERROR;
+}
+
+static int _get_option(int fd, int level, int option)
+{
+    int value = 0;
+    socklen_t length = sizeof(value);
+    return getsockopt(fd, level, option, &value, &length) == -1 ? -1 : value;
+}
+
+int tcp_describe_options(tcpsock_t* sock, char* buffer, size_t size)
+{
+    if (sock == NULL || buffer == NULL || sock->fd < 0 || !IS_KERNEL_SOCKET(sock)) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    int fd = sock->fd;
+    int written = snprintf(buffer, size, "rcvbuf=%i sndbuf=%i busy_poll=%i reuseaddr=%i reuseport=%i keepalive=%i",
+        _get_option(fd, SOL_SOCKET, SO_RCVBUF), _get_option(fd, SOL_SOCKET, SO_SNDBUF),
+        _get_option(fd, SOL_SOCKET, SO_BUSY_POLL), _get_option(fd, SOL_SOCKET, SO_REUSEADDR),
+        _get_option(fd, SOL_SOCKET, SO_REUSEPORT), _get_option(fd, SOL_SOCKET, SO_KEEPALIVE));
+
+    if (sock->family != AF_UNIX && written >= 0 && (size_t)written < size) {
+        snprintf(buffer + written, size - written,
+            " nodelay=%i quickack=%i defer_accept=%i fastopen=%i keepidle=%i keepintvl=%i keepcnt=%i",
+            _get_option(fd, IPPROTO_TCP, TCP_NODELAY), _get_option(fd, IPPROTO_TCP, TCP_QUICKACK),
+            _get_option(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT), _get_option(fd, IPPROTO_TCP, TCP_FASTOPEN),
+            _get_option(fd, IPPROTO_TCP, TCP_KEEPIDLE), _get_option(fd, IPPROTO_TCP, TCP_KEEPINTVL),
+            _get_option(fd, IPPROTO_TCP, TCP_KEEPCNT));
+    }
+
+    return TCP_NO_ERROR;
+}
+
+int tcp_sample_info(tcpsock_t* sock)
+{
+    if (sock == NULL || !sock->connected || sock->passive || !IS_KERNEL_SOCKET(sock)) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    if (sock->family == AF_UNIX) {
+        return TCP_SOCKOP_ERROR;
+    }
+
+    struct tcp_info info;
+    socklen_t length = sizeof(struct tcp_info);
+    if (getsockopt(sock->fd, IPPROTO_TCP, TCP_INFO, &info, &length) == -1) {
+        PRINTF_DEBUG("call to getsockopt(TCP_INFO) failed with errno = %i [%s]", errno, strerror(errno));
+        return TCP_SOCKOP_ERROR;
+    }
+
+    int send_queue;
+    if (ioctl(sock->fd, SIOCOUTQ, &send_queue) == -1) {
+        PRINTF_DEBUG("call to ioctl(SIOCOUTQ) failed with errno = %i [%s]", errno, strerror(errno));
+        return TCP_SOCKOP_ERROR;
+    }
+
+    sock->queue_growth = (uint32_t)send_queue > sock->info.send_queue ? sock->queue_growth + 1 : 0;
+    sock->info.rtt_us = info.tcpi_rtt;
+    sock->info.rtt_var_us = info.tcpi_rttvar;
+    sock->info.retransmits = info.tcpi_total_retrans;
+    sock->info.unacked = info.tcpi_unacked;
+    sock->info.send_queue = send_queue;
+    return TCP_NO_ERROR;
+}
+
+int tcp_set_nonblocking(tcpsock_t* sock)
+{
+    if (sock == NULL || !sock->connected || !IS_KERNEL_SOCKET(sock)) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    int flags = fcntl(sock->fd, F_GETFL);
+    if (flags == -1 || fcntl(sock->fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        PRINTF_DEBUG("call to fcntl(O_NONBLOCK) failed with errno = %i [%s]", errno, strerror(errno));
+        return TCP_SOCKOP_ERROR;
+    }
+
+    return TCP_NO_ERROR;
+}
+
+int tcp_set_incoming_cpu(tcpsock_t* sock, unsigned int cpu)
+{
+    if (sock == NULL || sock->fd < 0 || !IS_KERNEL_SOCKET(sock)) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    return SET_OPTION(sock->fd, SOL_SOCKET, SO_INCOMING_CPU, (int)cpu);
+}
+
+int tcp_enable_rx_timestamps(tcpsock_t* sock)
+{
+    if (sock == NULL || !sock->connected || sock->passive || !IS_KERNEL_SOCKET(sock)) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    int result = setsockopt(sock->fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+    if (result == -1) {
+        PRINTF_DEBUG("call to setsockopt(SO_TIMESTAMPING) failed with errno = %i [%s]", errno, strerror(errno));
+        return TCP_SOCKOP_ERROR;
+    }
+
+    sock->rx_timestamps = true;
+    return TCP_NO_ERROR;
+}
+
+int tcp_receive_timestamped(tcpsock_t* sock, void* buffer, unsigned int* buff_size, struct timespec* arrival)
+{
+    if (sock == NULL || buffer == NULL || buff_size == NULL || arrival == NULL) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    memset(arrival, 0, sizeof(struct timespec));
+    if (!sock->rx_timestamps || !IS_KERNEL_SOCKET(sock)) {
+        return tcp_receive(sock, buffer, buff_size);
+    }
+
+    if (!sock->connected) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    int err = TCP_NO_ERROR;
+    if (*buff_size != 0) {
+        char control[CMSG_SPACE(sizeof(struct scm_timestamping))];
+        struct iovec iov = { .iov_base = buffer, .iov_len = *buff_size };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(struct msghdr));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t result = recvmsg(sock->fd, &msg, 0);
+        *buff_size = result < 0 ? 0 : result;
+
+        HANDLE_ERROR_GOTO(result == 0, err = TCP_CONNECTION_CLOSED, zero_bytes_received,
+            "call to recvmsg() returned 0 received bytes : connection with peer is closed");
+        HANDLE_ERROR_GOTO(result < 0 && ((errno == ENOTCONN) || (errno == ECONNRESET)),
+            err = TCP_CONNECTION_CLOSED, recvmsg_notconn_error,
+            "call to recvmsg() returned errno = %i [%s] : connection with peer is closed",
+            errno, strerror(errno));
+        HANDLE_ERROR_GOTO(result < 0 && ((errno == EAGAIN) || (errno == EWOULDBLOCK)),
+            err = TCP_WOULD_BLOCK, recvmsg_would_block, "call to recvmsg() would block");
+        HANDLE_ERROR_GOTO(result < 0, err = TCP_SOCKOP_ERROR, recvmsg_other_error,
+            "call to recvmsg() returned errno = %i [%s]", errno, strerror(errno));
+
+        _rearm_quickack(sock);
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                // ts[0] holds the software timestamp, ts[2] the (unused) hardware one
+                struct scm_timestamping* stamps = (struct scm_timestamping*)CMSG_DATA(cmsg);
+                *arrival = stamps->ts[0];
+            }
+        }
+    }
+
+    goto success;
+
+    zero_bytes_received:
+    recvmsg_notconn_error:
+    recvmsg_would_block:
+    recvmsg_other_error:
+    success:
+    // do nothing
+
+    return err;
+}
+
+static int _socket_poll(const tcp_transport_t* transport, struct pollfd* fds, unsigned int count, int timeout_ms)
+{
+    return poll(fds, count, timeout_ms);
+}
+
+const tcp_transport_t tcp_socket_transport = {
+    .name = "socket",
+    .listen = NULL,
+    .accept = _socket_accept,
+    .receive = _socket_receive,
+    .send = _socket_send,
+    .close = _socket_close,
+    .poll = _socket_poll
+};
+
+int tcp_close(tcpsock_t* sock)
+{
+    if (sock == NULL) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    // probe before closing, while the fd is still valid
+    PROBE1(close, sock->fd);
+    return TRANSPORT_OF(sock)->close(sock);
+}
+
+int tcp_adopt(tcpsock_t* sock, int fd, const tcp_profile_t* profile)
+{
+    if (sock == NULL) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    int err = TCP_NO_ERROR;
+    struct sockaddr_storage addr;
+    socklen_t length = sizeof(struct sockaddr_storage);
+    int listening = 0;
+    socklen_t option_length = sizeof(listening);
+
+    _init_sock(sock, AF_UNSPEC);
+
+    int result = getsockname(fd, (struct sockaddr*)&addr, &length);
+    HANDLE_ERROR_GOTO(result == -1, err = TCP_SOCKOP_ERROR, socket_name_error,
+        "call to getsockname() failed with errno = %i [%s]", errno, strerror(errno));
+
+    result = getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &option_length);
+    HANDLE_ERROR_GOTO(result == -1, err = TCP_SOCKOP_ERROR, socket_name_error,
+        "call to getsockopt(SO_ACCEPTCONN) failed with errno = %i [%s]", errno, strerror(errno));
+
+    sock->family = addr.ss_family;
+    sock->passive = listening != 0;
+    if (addr.ss_family == AF_UNIX) {
+        // listeners and their clients are both named by the listening path
+        struct sockaddr_un* addr_un = (struct sockaddr_un*)&addr;
+        if (length > offsetof(struct sockaddr_un, sun_path) && addr_un->sun_path[0] != '\0') {
+            sock->ip_addr = strndup(addr_un->sun_path, length - offsetof(struct sockaddr_un, sun_path));
+            HANDLE_ERROR_GOTO(sock->ip_addr == NULL, err = TCP_MEMORY_ERROR, socket_name_error,
+                "Failed to allocation memory for path char buffer");
+        }
+    } else if (sock->passive) {
+        // listeners are bound to any interface, so only the port is kept
+        sock->port = ntohs(addr.ss_family == AF_INET6
+            ? ((struct sockaddr_in6*)&addr)->sin6_port : ((struct sockaddr_in*)&addr)->sin_port);
+    } else {
+        length = sizeof(struct sockaddr_storage);
+        result = getpeername(fd, (struct sockaddr*)&addr, &length);
+        HANDLE_ERROR_GOTO(result == -1, err = TCP_SOCKOP_ERROR, socket_name_error,
+            "call to getpeername() failed with errno = %i [%s]", errno, strerror(errno));
+
+        err = _set_peer_addr(sock, &addr);
+        HANDLE_ERROR_GOTO(err != TCP_NO_ERROR, NO_ACTION, socket_name_error,
+            "Failed to allocation memory for ip char buffer (%i)", err);
+    }
+
+    sock->fd = fd;
+    sock->profile = profile;
+    sock->connected = true;
+    goto success;
+
+    socket_name_error:
+    free(sock->ip_addr);
+    _init_sock(sock, AF_UNSPEC);
+
+    success:
+    // do nothing
+
+    return err;
+}
+
+int tcp_release(tcpsock_t* sock)
+{
+    if (sock == NULL) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    if (!IS_KERNEL_SOCKET(sock)) {
+        return tcp_close(sock);
+    }
+
+    if (sock->connected) {
+        int result = close(sock->fd);
+        CHECK_FOR_ERROR(result == -1,
+            "call to close() failed with errno = %i [%s]", errno, strerror(errno));
+    }
+
+    free(sock->ip_addr);
+    if (sock->zc_map != NULL) {
+        munmap(sock->zc_map, sock->zc_map_size);
+    }
+
+    _init_sock(sock, AF_UNSPEC);
+
+    return TCP_NO_ERROR;
+}
+
+int tcp_wait_for_connection(tcpsock_t* sock, tcpsock_t* new_sock)
+{
+    if (sock == NULL || new_sock == NULL) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    int err = TRANSPORT_OF(sock)->accept(sock, new_sock);
+    PROBE3(accept, sock->fd, new_sock->fd, err);
+    return err;
+}
+
+int tcp_send(tcpsock_t* sock, const void* buffer, unsigned int* buff_size)
+{
+    if (sock == NULL || buff_size == NULL) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    unsigned int requested = *buff_size;
+    int err = TRANSPORT_OF(sock)->send(sock, buffer, buff_size);
+    PROBE4(send, sock->fd, requested, *buff_size, err);
+    if (err == TCP_NO_ERROR && *buff_size < requested) {
+        PROBE3(short_write, sock->fd, requested, *buff_size);
+    }
+    return err;
+}
+
+int tcp_receive(tcpsock_t* sock, void* buffer, unsigned int* buff_size)
+{
+    if (sock == NULL || buffer == NULL || buff_size == NULL) {
+        return TCP_SOCKET_ERROR;
+    }
+
+    int err = TRANSPORT_OF(sock)->receive(sock, buffer, buff_size);
+    PROBE3(receive, sock->fd, *buff_size, err);
+    return err;
+}
+
+int tcp_poll(const tcp_transport_t* transport, struct pollfd* fds, unsigned int count, int timeout_ms)
+{
+    if (transport == NULL) {
+        transport = &tcp_socket_transport;
+    }
+
+    return transport->poll(transport, fds, count, timeout_ms);
+}
+
+const tcp_transport_t* tcp_get_transport(tcpsock_t* sock)
+{
+    if (sock == NULL) {
+        return NULL;
+    }
+
+    return TRANSPORT_OF(sock);
+}
+
 char* tcp_get_ip_addr(tcpsock_t* sock)
 {
     if (sock == NULL) {
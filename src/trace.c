@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+static uint64_t _clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int trace_open(trace_t* trace, const char* path)
+{
+    if (trace == NULL || path == NULL) {
+        return TRACE_FILE_ERROR;
+    }
+
+    trace->file = fopen(path, "wbe");
+    if (trace->file == NULL) {
+        PRINTF_DEBUG("call to fopen(\"%s\") failed with errno = %i [%s]", path, errno, strerror(errno));
+        return TRACE_FILE_ERROR;
+    }
+
+    setvbuf(trace->file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+
+    trace_file_header_t header = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .start = _clock_ns(CLOCK_REALTIME)
+    };
+    trace->start = _clock_ns(CLOCK_MONOTONIC);
+
+    if (fwrite(&header, sizeof(trace_file_header_t), 1, trace->file) != 1) {
+        fclose(trace->file);
+        trace->file = NULL;
+        return TRACE_FILE_ERROR;
+    }
+
+    return TRACE_NO_ERROR;
+}
+
+int trace_record(trace_t* trace, trace_event_t type, uint32_t connection_id, const void* data, uint32_t length)
+{
+    if (type != TRACE_EVENT_DATA) {
+        length = 0;
+    }
+
+    trace_record_t record = {
+        .time = _clock_ns(CLOCK_MONOTONIC) - trace->start,
+        .connection_id = connection_id
+    };
+
+    const uint8_t* bytes = data;
+    do {
+        uint32_t chunk = length > TRACE_MAX_LENGTH ? TRACE_MAX_LENGTH : length;
+        record.type_length = ((uint32_t)type << 30) | chunk;
+
+        if (fwrite(&record, sizeof(trace_record_t), 1, trace->file) != 1
+                || (chunk > 0 && fwrite(bytes, chunk, 1, trace->file) != 1)) {
+            PRINTF_DEBUG("writing trace record failed with errno = %i [%s]", errno, strerror(errno));
+            return TRACE_FILE_ERROR;
+        }
+
+        bytes += chunk;
+        length -= chunk;
+    } while (length > 0);
+
+    return TRACE_NO_ERROR;
+}
+
+int trace_close(trace_t* trace)
+{
+    if (trace == NULL || trace->file == NULL) {
+        return TRACE_FILE_ERROR;
+    }
+
+    int result = fclose(trace->file);
+    trace->file = NULL;
+    return result == 0 ? TRACE_NO_ERROR : TRACE_FILE_ERROR;
+}
+
+int trace_reader_open(trace_reader_t* reader, const char* path)
+{
+    if (reader == NULL || path == NULL) {
+        return TRACE_FILE_ERROR;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        PRINTF_DEBUG("opening trace \"%s\" failed with errno = %i [%s]", path, errno, strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        return TRACE_FILE_ERROR;
+    }
+
+    reader->size = st.st_size;
+    if (reader->size < sizeof(trace_file_header_t)) {
+        close(fd);
+        return TRACE_FORMAT_ERROR;
+    }
+
+    void* map = mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        PRINTF_DEBUG("call to mmap() failed with errno = %i [%s]", errno, strerror(errno));
+        return TRACE_FILE_ERROR;
+    }
+
+    const trace_file_header_t* header = map;
+    if (header->magic != TRACE_MAGIC || header->version != TRACE_VERSION) {
+        munmap(map, reader->size);
+        return TRACE_FORMAT_ERROR;
+    }
+
+    reader->map = map;
+    reader->start = header->start;
+    reader->offset = sizeof(trace_file_header_t);
+    return TRACE_NO_ERROR;
+}
+
+int trace_reader_next(trace_reader_t* reader, trace_record_t* record, const void** data)
+{
+    if (reader->offset == reader->size) {
+        return TRACE_END;
+    }
+
+    if (reader->offset + sizeof(trace_record_t) > reader->size) {
+        return TRACE_FORMAT_ERROR;
+    }
+
+    // records are not aligned in the file
+    memcpy(record, reader->map + reader->offset, sizeof(trace_record_t));
+    uint32_t length = TRACE_RECORD_LENGTH(record);
+    if (reader->offset + sizeof(trace_record_t) + length > reader->size) {
+        return TRACE_FORMAT_ERROR;
+    }
+
+    *data = reader->map + reader->offset + sizeof(trace_record_t);
+    reader->offset += sizeof(trace_record_t) + length;
+    return TRACE_NO_ERROR;
+}
+
+void trace_reader_rewind(trace_reader_t* reader)
+{
+    reader->offset = sizeof(trace_file_header_t);
+}
+
+void trace_reader_close(trace_reader_t* reader)
+{
+    if (reader != NULL && reader->map != NULL) {
+        munmap((void*)reader->map, reader->size);
+        reader->map = NULL;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,121 @@
+#define _GNU_SOURCE
+
+#include <argp.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "journal.h"
+
+static char doc[] = "Journal reader -- prints the frames captured by ascii_server --journal, "
+                    "scanning the segments in DIR sequentially";
+static char args_doc[] = "DIR";
+
+static struct argp_option options[] = {
+    {"summary", 's', 0, 0, "Only print the number of frames and bytes per connection"},
+    {"hex", 'x', 0, 0, "Print frame data as hex instead of escaped ASCII"},
+    {0}
+};
+
+typedef struct reader_args {
+    const char* directory;
+    bool summary;
+    bool hex;
+} reader_args_t;
+
+static error_t _parse_opt(int key, char* arg, struct argp_state* state)
+{
+    reader_args_t* args = state->input;
+
+    switch (key) {
+        case 's':
+            args->summary = true;
+            break;
+
+        case 'x':
+            args->hex = true;
+            break;
+
+        case ARGP_KEY_ARG:
+            if (state->arg_num >= 1) {
+                argp_usage(state);
+            }
+            args->directory = arg;
+            break;
+
+        case ARGP_KEY_END:
+            if (state->arg_num < 1) {
+                argp_usage(state);
+            }
+            break;
+
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+static struct argp argp = { options, _parse_opt, args_doc, doc };
+
+static void _print_data(const uint8_t* data, uint32_t length, bool hex)
+{
+    for (uint32_t i = 0; i < length; i++) {
+        if (hex) {
+            printf("%02x", data[i]);
+        } else if (data[i] == '\n') {
+            fputs("\\n", stdout);
+        } else if (isprint(data[i])) {
+            putchar(data[i]);
+        } else {
+            printf("\\x%02x", data[i]);
+        }
+    }
+    putchar('\n');
+}
+
+int main(int argc, char** argv)
+{
+    reader_args_t args = { .directory = NULL, .summary = false, .hex = false };
+    error_t arg_err = argp_parse(&argp, argc, argv, 0, 0, &args);
+    if (arg_err != 0) {
+        return arg_err;
+    }
+
+    journal_reader_t reader;
+    int err = journal_reader_open(&reader, args.directory);
+    if (err != JOURNAL_NO_ERROR) {
+        fprintf(stderr, "%s: failed to open journal in \"%s\" (error %i)\n", argv[0], args.directory, err);
+        return err;
+    }
+
+    unsigned long long frames = 0;
+    unsigned long long bytes = 0;
+    journal_frame_header_t header;
+    const void* data;
+
+    while ((err = journal_reader_next(&reader, &header, &data)) == JOURNAL_NO_ERROR) {
+        frames++;
+        bytes += header.length;
+
+        if (!args.summary) {
+            printf("%llu %llu.%09llu conn=%u len=%u ",
+                (unsigned long long)journal_reader_segment(&reader),
+                (unsigned long long)(header.timestamp / 1000000000ULL),
+                (unsigned long long)(header.timestamp % 1000000000ULL),
+                header.connection_id, header.length);
+            _print_data(data, header.length, args.hex);
+        }
+    }
+
+    printf("%llu frames, %llu bytes in %u segments\n", frames, bytes, reader.count);
+    journal_reader_close(&reader);
+
+    if (err != JOURNAL_END) {
+        fprintf(stderr, "%s: journal is corrupt or unreadable (error %i)\n", argv[0], err);
+        return err;
+    }
+
+    return 0;
+}
\ No newline at end of file
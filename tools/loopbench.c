@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+
+#include <argp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ack.h"
+#include "memtransport.h"
+#include "netloop.h"
+#include "network.h"
+
+#define CONNECT_BATCH 1024
+
+static char doc[] = "Loopbench -- drives net_loop over the in-memory transport, so dispatch and callback overhead "
+                    "can be measured without the kernel network stack";
+
+static struct argp_option options[] = {
+    {"connections", 'c', "N", 0, "Number of simulated connections (default 10000)"},
+    {"messages", 'm', "N", 0, "Messages sent on every connection (default 100)"},
+    {"size", 's', "BYTES", 0, "Size of every message (default 64)"},
+    {"tasks", 't', 0, 0, "Serve every connection from a coroutine instead of the data callback"},
+    {"echo", 'e', 0, 0, "Answer every message with an echo instead of counting it"},
+    {"ack", 'a', 0, 0, "Answer every message with the server's acknowledging callback, without printing"},
+    {"bound", 'b', 0, 0, "Run a loop instance with the data callback bound at compile time"},
+    {0}
+};
+
+typedef struct loopbench_args {
+    unsigned int connections;
+    unsigned int messages;
+    unsigned int size;
+    bool tasks;
+    bool echo;
+    bool ack;
+    bool bound;
+} loopbench_args_t;
+
+typedef struct loopbench {
+    const loopbench_args_t* args;
+    net_config_t* config;
+    uint8_t* message;
+    uint32_t* conns;            // connection ids, in connect order
+    unsigned int connected;
+    unsigned int rounds;        // message rounds injected so far
+    bool hung_up;
+    uint64_t message_start;
+    uint64_t message_end;
+    int err;
+} loopbench_t;
+
+static unsigned long long received_bytes;
+static unsigned long long received_calls;
+
+static error_t _parse_opt(int key, char* arg, struct argp_state* state)
+{
+    loopbench_args_t* args = state->input;
+
+    switch (key) {
+        case 'c':
+            args->connections = strtoul(arg, NULL, 10);
+            if (args->connections == 0) {
+                argp_error(state, "\"%s\" is not a valid number of connections", arg);
+            }
+            break;
+
+        case 'm':
+            args->messages = strtoul(arg, NULL, 10);
+            break;
+
+        case 's':
+            args->size = strtoul(arg, NULL, 10);
+            if (args->size == 0) {
+                argp_error(state, "\"%s\" is not a valid message size", arg);
+            }
+            break;
+
+        case 't':
+            args->tasks = true;
+            break;
+
+        case 'e':
+            args->echo = true;
+            break;
+
+        case 'a':
+            args->ack = true;
+            break;
+
+        case 'b':
+            args->bound = true;
+            break;
+
+        case ARGP_KEY_END:
+            if (args->echo && args->ack) {
+                argp_error(state, "--echo and --ack are mutually exclusive");
+            }
+            break;
+
+        case ARGP_KEY_ARG:
+            argp_usage(state);
+            break;
+
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+static struct argp argp = { options, _parse_opt, 0, doc };
+
+static uint64_t _clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int _callback_data(tcpsock_t* client, const void* data, unsigned int length)
+{
+    (void)client;
+    (void)data;
+    received_bytes += length;
+    received_calls++;
+    return NET_CB_SUCCESS;
+}
+
+// sample callback, sends the received data back to the client
+static int _echo_data(tcpsock_t* client, const void* data, unsigned int length)
+{
+    unsigned int size = length;
+    received_bytes += length;
+    received_calls++;
+    return tcp_send(client, data, &size) == TCP_NO_ERROR ? NET_CB_SUCCESS : NET_CB_CLIENT_ERROR;
+}
+
+// the same callbacks bound at compile time, to compare against the call through cb_data
+NET_LOOP_DEFINE(_count_loop, _callback_data)
+NET_LOOP_DEFINE(_echo_loop, _echo_data)
+NET_LOOP_DEFINE(_ack_loop, ack_data)
+
+static void _handler(net_task_t* task)
+{
+    uint8_t buffer[1024];
+    unsigned int length = sizeof(buffer);
+
+    while (net_read(task, buffer, &length) == NET_SUCCESS) {
+        received_bytes += length;
+        received_calls++;
+        length = sizeof(buffer);
+    }
+}
+
+// called whenever the loop has drained everything injected so far, injects the next step
+static void _inject(memtransport_t* transport, void* context)
+{
+    loopbench_t* bench = context;
+    const loopbench_args_t* args = bench->args;
+
+    if (bench->err != TCP_NO_ERROR || bench->hung_up) {
+        bench->config->running = 0;
+        return;
+    }
+
+    if (bench->connected < args->connections) {
+        unsigned int batch = args->connections - bench->connected;
+        batch = batch < CONNECT_BATCH ? batch : CONNECT_BATCH;
+        for (unsigned int i = 0; i < batch && bench->err == TCP_NO_ERROR; i++) {
+            bench->err = memtransport_connect(transport, &bench->conns[bench->connected++]);
+        }
+        return;
+    }
+
+    if (bench->rounds < args->messages) {
+        if (bench->rounds == 0) {
+            bench->message_start = _clock_ns();
+        }
+
+        for (unsigned int i = 0; i < args->connections && bench->err == TCP_NO_ERROR; i++) {
+            bench->err = memtransport_write(transport, bench->conns[i], bench->message, args->size);
+        }
+        bench->rounds++;
+        return;
+    }
+
+    bench->message_end = _clock_ns();
+    for (unsigned int i = 0; i < args->connections; i++) {
+        memtransport_hangup(transport, bench->conns[i]);
+    }
+    bench->hung_up = true;
+}
+
+int main(int argc, char** argv)
+{
+    loopbench_args_t args = { .connections = 10000, .messages = 100, .size = 64 };
+    error_t arg_err = argp_parse(&argp, argc, argv, 0, 0, &args);
+    if (arg_err != 0) {
+        return arg_err;
+    }
+
+    memtransport_t transport;
+    int err = memtransport_create(&transport, args.connections);
+    if (err != TCP_NO_ERROR) {
+        fprintf(stderr, "%s: failed to create the memory transport (error %i)\n", argv[0], err);
+        return err;
+    }
+
+    net_config_t config = {
+        .running = 1,
+        .transport = &transport.base,
+        .cb_data = args.echo ? _echo_data : args.ack ? ack_data : _callback_data,
+        .handler = args.tasks ? _handler : NULL
+    };
+
+    loopbench_t bench = {
+        .args = &args,
+        .config = &config,
+        .message = malloc(args.size),
+        .conns = malloc(args.connections * sizeof(uint32_t)),
+        .err = TCP_NO_ERROR
+    };
+
+    if (bench.message == NULL || bench.conns == NULL) {
+        fprintf(stderr, "%s: failed to allocate %u connections\n", argv[0], args.connections);
+        err = TCP_MEMORY_ERROR;
+        goto cleanup;
+    }
+
+    memset(bench.message, 'x', args.size);
+    bench.message[args.size - 1] = '\n';
+    memtransport_set_idle(&transport, _inject, &bench);
+
+    uint64_t start = _clock_ns();
+    if (!args.bound) {
+        err = net_loop(&config);
+    } else {
+        err = args.echo ? _echo_loop(&config) : args.ack ? _ack_loop(&config) : _count_loop(&config);
+    }
+    uint64_t elapsed = _clock_ns() - start;
+
+    if (err != NET_SUCCESS || bench.err != TCP_NO_ERROR) {
+        fprintf(stderr, "%s: loop failed (%s, transport error %i)\n", argv[0], net_strerror(err), bench.err);
+        err = err != NET_SUCCESS ? err : bench.err;
+        goto cleanup;
+    }
+
+    unsigned long long messages = (unsigned long long)args.connections * args.messages;
+    uint64_t message_time = bench.message_end - bench.message_start;
+    printf("%u connections, %llu messages of %u bytes in %.3f s\n", args.connections, messages, args.size,
+        elapsed / 1e9);
+    printf("messages: %.1f ns/message, %llu callbacks, %llu bytes received, %llu bytes sent\n",
+        messages > 0 ? (double)message_time / messages : 0.0,
+        received_calls, received_bytes, (unsigned long long)transport.bytes_sent);
+
+    cleanup:
+    free(bench.message);
+    free(bench.conns);
+    memtransport_destroy(&transport);
+
+    return err;
+}
\ No newline at end of file
@@ -0,0 +1,576 @@
+#define _GNU_SOURCE
+
+#include <argp.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLE_COUNTER 1
+#define CYCLE_COUNTER_NAME "rdtsc"
+#else
+#define HAVE_CYCLE_COUNTER 0
+#define CYCLE_COUNTER_NAME "none"
+#endif
+
+#include "tcpsock.h"
+#include "vector.h"
+
+#define OPS_PER_RUN     65536   // approximate number of operations in one repetition
+#define ROUND_TRIPS     1024    // send/receive pairs in one repetition of the socket benchmarks
+
+static char doc[] = "Microbench -- times the vector and socket wrappers and prints the results as JSON";
+
+static struct argp_option options[] = {
+    {"repetitions", 'r', "N", 0, "Timed repetitions per benchmark (default 15)"},
+    {"warmup", 'w', "N", 0, "Untimed repetitions before timing (default 3)"},
+    {"filter", 'f', "TEXT", 0, "Only run benchmarks whose name contains TEXT"},
+    {"output", 'o', "FILE", 0, "Write the JSON to FILE instead of stdout"},
+    {0}
+};
+
+typedef struct microbench_args {
+    unsigned int repetitions;
+    unsigned int warmup;
+    const char* filter;
+    const char* output;
+} microbench_args_t;
+
+/**
+ * A single benchmark, 'run' performs the measured operations on the state made by 'setup'
+ * and returns the number of operations it performed
+ */
+typedef struct bench_case {
+    const char* name;
+    void* (*setup)(unsigned int size);
+    unsigned long (*run)(void* state, unsigned int size);
+    void (*teardown)(void* state);
+    bool messages;      // sized by message_sizes instead of vec_sizes
+} bench_case_t;
+
+typedef struct bench_result {
+    unsigned long ops;          // operations per repetition
+    double median_ns;           // per operation
+    double min_ns;
+    double median_cycles;
+    double min_cycles;
+} bench_result_t;
+
+typedef struct socket_pair {
+    tcpsock_t socks[2];
+    uint8_t* buffer;    // 'size' bytes to send, followed by 'size' bytes to receive in
+    int file_fd;        // file holding the bytes to send for tcp_sendfile, -1 for none
+} socket_pair_t;
+
+// keeps the compiler from dropping results of the benchmarked calls
+static volatile uintptr_t sink;
+
+static error_t _parse_opt(int key, char* arg, struct argp_state* state)
+{
+    microbench_args_t* args = state->input;
+
+    switch (key) {
+        case 'r':
+            args->repetitions = strtoul(arg, NULL, 10);
+            if (args->repetitions == 0) {
+                argp_error(state, "\"%s\" is not a valid number of repetitions", arg);
+            }
+            break;
+
+        case 'w':
+            args->warmup = strtoul(arg, NULL, 10);
+            break;
+
+        case 'f':
+            args->filter = arg;
+            break;
+
+        case 'o':
+            args->output = arg;
+            break;
+
+        case ARGP_KEY_ARG:
+            argp_usage(state);
+            break;
+
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+static struct argp argp = { options, _parse_opt, 0, doc };
+
+static uint64_t _clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t _cycles(void)
+{
+#if HAVE_CYCLE_COUNTER
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int _compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double _median(double* values, unsigned int count)
+{
+    qsort(values, count, sizeof(double), _compare_double);
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+static vec_t* _filled_vec(unsigned int size)
+{
+    vec_t* vec = malloc(sizeof(vec_t));
+    if (vec == NULL || vec_create(vec, sizeof(tcpsock_t), DEFAULT_CAPACITY) != VEC_ERR_SUCCESS) {
+        free(vec);
+        return NULL;
+    }
+
+    tcpsock_t sock = { .fd = 3, .connected = true };
+    for (unsigned int i = 0; i < size; i++) {
+        vec_push_back(vec, &sock);
+        sock.fd++;
+    }
+
+    return vec;
+}
+
+static void _free_vec(void* state)
+{
+    vec_destroy(state);
+    free(state);
+}
+
+static void* _setup_none(unsigned int size)
+{
+    (void)size;
+    return (void*)&sink;
+}
+
+static void _teardown_none(void* state)
+{
+    (void)state;
+}
+
+// grows a vector from empty to 'size' elements, including the reallocations on the way
+static unsigned long _run_push_back(void* state, unsigned int size)
+{
+    (void)state;
+    unsigned int rounds = size < OPS_PER_RUN ? OPS_PER_RUN / size : 1;
+    tcpsock_t sock = { .fd = 3 };
+
+    for (unsigned int r = 0; r < rounds; r++) {
+        vec_t vec;
+        vec_create(&vec, sizeof(tcpsock_t), DEFAULT_CAPACITY);
+        for (unsigned int i = 0; i < size; i++) {
+            vec_push_back(&vec, &sock);
+        }
+        sink = (uintptr_t)vec.mem;
+        vec_destroy(&vec);
+    }
+
+    return (unsigned long)rounds * size;
+}
+
+static void* _setup_vec(unsigned int size)
+{
+    return _filled_vec(size);
+}
+
+static unsigned long _run_get_ref(void* state, unsigned int size)
+{
+    unsigned int rounds = size < OPS_PER_RUN ? OPS_PER_RUN / size : 1;
+    uintptr_t sum = 0;
+
+    for (unsigned int r = 0; r < rounds; r++) {
+        for (unsigned int i = 0; i < size; i++) {
+            tcpsock_t* sock;
+            vec_get_ref(state, (void**)&sock, i);
+            sum += sock->fd;
+        }
+    }
+
+    sink = sum;
+    return (unsigned long)rounds * size;
+}
+
+// removes the first element, the worst case, and pushes it back so the size stays constant
+static unsigned long _run_remove(void* state, unsigned int size)
+{
+    // every removal moves the whole vector, so scale down for big sizes
+    unsigned int ops = size <= 16 ? OPS_PER_RUN : OPS_PER_RUN * 16 / size;
+
+    for (unsigned int i = 0; i < ops; i++) {
+        tcpsock_t sock;
+        vec_get(state, &sock, 0);
+        vec_remove(state, 0);
+        vec_push_back(state, &sock);
+    }
+
+    return ops;
+}
+
+// the per-iteration poll set rebuild of net_loop
+static unsigned long _run_pollfd_setup(void* state, unsigned int size)
+{
+    unsigned int rounds = size < OPS_PER_RUN ? OPS_PER_RUN / size : 1;
+    struct pollfd* pfds = malloc(size * sizeof(struct pollfd));
+    if (pfds == NULL) {
+        return 0;
+    }
+
+    for (unsigned int r = 0; r < rounds; r++) {
+        for (unsigned int i = 0; i < vec_size(state); i++) {
+            tcpsock_t* sock;
+            vec_get_ref(state, (void**)&sock, i);
+
+            pfds[i] = (struct pollfd) { .fd = tcp_get_fd(sock), .events = POLLIN };
+        }
+        sink = pfds[size - 1].fd;
+    }
+
+    free(pfds);
+    return (unsigned long)rounds * size;
+}
+
+static void _init_pair_sock(tcpsock_t* sock, int fd)
+{
+    memset(sock, 0, sizeof(tcpsock_t));
+    sock->fd = fd;
+    sock->family = AF_UNIX;
+    sock->connected = true;
+}
+
+static void* _setup_socketpair(unsigned int size)
+{
+    socket_pair_t* pair = malloc(sizeof(socket_pair_t));
+    if (pair == NULL) {
+        return NULL;
+    }
+
+    int fds[2];
+    pair->buffer = malloc(2 * size);
+    pair->file_fd = -1;
+    if (pair->buffer == NULL || socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+        free(pair->buffer);
+        free(pair);
+        return NULL;
+    }
+
+    memset(pair->buffer, 'x', 2 * size);
+    _init_pair_sock(&pair->socks[0], fds[0]);
+    _init_pair_sock(&pair->socks[1], fds[1]);
+    return pair;
+}
+
+static void _teardown_socketpair(void* state)
+{
+    socket_pair_t* pair = state;
+    tcp_close(&pair->socks[0]);
+    tcp_close(&pair->socks[1]);
+    if (pair->file_fd != -1) {
+        close(pair->file_fd);
+    }
+    free(pair->buffer);
+    free(pair);
+}
+
+// a connected pair of kernel TCP sockets over loopback, which MSG_ZEROCOPY and sendfile need
+static void* _setup_loopback(unsigned int size)
+{
+    socket_pair_t* pair = calloc(1, sizeof(socket_pair_t));
+    if (pair == NULL) {
+        return NULL;
+    }
+
+    pair->buffer = malloc(2 * size);
+    pair->file_fd = -1;
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t length = sizeof(addr);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int fds[2] = { socket(AF_INET, SOCK_STREAM, 0), -1 };
+
+    bool ok = pair->buffer != NULL && listener != -1 && fds[0] != -1
+            && bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(listener, 1) == 0
+            && getsockname(listener, (struct sockaddr*)&addr, &length) == 0
+            && connect(fds[0], (struct sockaddr*)&addr, sizeof(addr)) == 0
+            && (fds[1] = accept(listener, NULL, NULL)) != -1;
+    if (listener != -1) {
+        close(listener);
+    }
+
+    if (!ok || tcp_adopt(&pair->socks[0], fds[0], NULL) != TCP_NO_ERROR) {
+        for (unsigned int i = 0; i < 2; i++) {
+            if (fds[i] != -1) {
+                close(fds[i]);
+            }
+        }
+        free(pair->buffer);
+        free(pair);
+        return NULL;
+    }
+
+    if (tcp_adopt(&pair->socks[1], fds[1], NULL) != TCP_NO_ERROR) {
+        close(fds[1]);
+        tcp_close(&pair->socks[0]);
+        free(pair->buffer);
+        free(pair);
+        return NULL;
+    }
+
+    memset(pair->buffer, 'x', 2 * size);
+    return pair;
+}
+
+static void* _setup_loopback_zerocopy(unsigned int size)
+{
+    socket_pair_t* pair = _setup_loopback(size);
+    if (pair != NULL && tcp_enable_zerocopy_send(&pair->socks[0]) != TCP_NO_ERROR) {
+        _teardown_socketpair(pair);
+        return NULL;
+    }
+
+    return pair;
+}
+
+// the bytes to send are put in an unlinked temporary file, which stays in the page cache
+static void* _setup_loopback_file(unsigned int size)
+{
+    socket_pair_t* pair = _setup_loopback(size);
+    if (pair == NULL) {
+        return NULL;
+    }
+
+    FILE* file = tmpfile();
+    pair->file_fd = file != NULL ? dup(fileno(file)) : -1;
+    bool ok = pair->file_fd != -1 && pwrite(pair->file_fd, pair->buffer, size, 0) == (ssize_t)size;
+    if (file != NULL) {
+        fclose(file);
+    }
+
+    if (!ok) {
+        _teardown_socketpair(pair);
+        return NULL;
+    }
+
+    return pair;
+}
+
+// reads 'size' bytes from the receiving socket of 'pair' into the second half of its buffer
+static bool _receive_all(socket_pair_t* pair, unsigned int size)
+{
+    unsigned int received = 0;
+    while (received < size) {
+        unsigned int length = size - received;
+        if (tcp_receive(&pair->socks[1], pair->buffer + size, &length) != TCP_NO_ERROR) {
+            return false;
+        }
+        received += length;
+    }
+
+    return true;
+}
+
+// one operation is a tcp_send of 'size' bytes followed by the tcp_receive calls reading them back
+static unsigned long _run_send_receive(void* state, unsigned int size)
+{
+    socket_pair_t* pair = state;
+
+    for (unsigned int i = 0; i < ROUND_TRIPS; i++) {
+        unsigned int length = size;
+        if (tcp_send(&pair->socks[0], pair->buffer, &length) != TCP_NO_ERROR || !_receive_all(pair, length)) {
+            return i;
+        }
+    }
+
+    return ROUND_TRIPS;
+}
+
+// same as _run_send_receive, but with tcp_send_zerocopy, reaping the completions after every send
+static unsigned long _run_send_zerocopy(void* state, unsigned int size)
+{
+    socket_pair_t* pair = state;
+    uint32_t completed;
+
+    for (unsigned int i = 0; i < ROUND_TRIPS; i++) {
+        unsigned int length = size;
+        uint32_t seq;
+        int err = tcp_send_zerocopy(&pair->socks[0], pair->buffer, &length, &seq);
+
+        // too many pages are pinned, wait for the receiver to release some
+        while (err == TCP_NO_BUFFERS) {
+            struct pollfd pfd = { .fd = tcp_get_fd(&pair->socks[0]) };
+            poll(&pfd, 1, -1);
+            tcp_reap_zerocopy(&pair->socks[0], &completed);
+
+            length = size;
+            err = tcp_send_zerocopy(&pair->socks[0], pair->buffer, &length, &seq);
+        }
+
+        if (err != TCP_NO_ERROR || !_receive_all(pair, length)) {
+            return i;
+        }
+        tcp_reap_zerocopy(&pair->socks[0], &completed);
+    }
+
+    sink = completed;
+    return ROUND_TRIPS;
+}
+
+// same as _run_send_receive, but the bytes are sent from a file with tcp_sendfile
+static unsigned long _run_sendfile(void* state, unsigned int size)
+{
+    socket_pair_t* pair = state;
+
+    for (unsigned int i = 0; i < ROUND_TRIPS; i++) {
+        off_t offset = 0;
+        unsigned int length = size;
+        if (tcp_sendfile(&pair->socks[0], pair->file_fd, &offset, &length) != TCP_NO_ERROR
+                || !_receive_all(pair, length)) {
+            return i;
+        }
+    }
+
+    return ROUND_TRIPS;
+}
+
+static const bench_case_t cases[] = {
+    { "vec_push_back", _setup_none, _run_push_back, _teardown_none, false },
+    { "vec_get_ref", _setup_vec, _run_get_ref, _free_vec, false },
+    { "vec_remove_front", _setup_vec, _run_remove, _free_vec, false },
+    { "pollfd_setup", _setup_vec, _run_pollfd_setup, _free_vec, false },
+    { "tcp_send_receive", _setup_socketpair, _run_send_receive, _teardown_socketpair, true },
+    { "tcp_loopback_send", _setup_loopback, _run_send_receive, _teardown_socketpair, true },
+    { "tcp_loopback_send_zerocopy", _setup_loopback_zerocopy, _run_send_zerocopy, _teardown_socketpair, true },
+    { "tcp_loopback_sendfile", _setup_loopback_file, _run_sendfile, _teardown_socketpair, true }
+};
+
+static const unsigned int vec_sizes[] = { 16, 1024, 65536 };
+static const unsigned int message_sizes[] = { 64, 1024, 16384 };
+
+static bool _run_case(const bench_case_t* bench, unsigned int size, const microbench_args_t* args,
+                      bench_result_t* result)
+{
+    void* state = bench->setup(size);
+    if (state == NULL) {
+        return false;
+    }
+
+    double* ns = malloc(args->repetitions * sizeof(double));
+    double* cycles = malloc(args->repetitions * sizeof(double));
+    bool ok = ns != NULL && cycles != NULL;
+
+    for (unsigned int i = 0; ok && i < args->warmup; i++) {
+        bench->run(state, size);
+    }
+
+    for (unsigned int i = 0; ok && i < args->repetitions; i++) {
+        uint64_t start_cycles = _cycles();
+        uint64_t start = _clock_ns();
+        unsigned long ops = bench->run(state, size);
+        uint64_t elapsed = _clock_ns() - start;
+        uint64_t elapsed_cycles = _cycles() - start_cycles;
+
+        if (ops == 0) {
+            ok = false;
+            break;
+        }
+
+        result->ops = ops;
+        ns[i] = (double)elapsed / ops;
+        cycles[i] = (double)elapsed_cycles / ops;
+    }
+
+    if (ok) {
+        // _median sorts, so the minimum ends up first
+        result->median_ns = _median(ns, args->repetitions);
+        result->min_ns = ns[0];
+        result->median_cycles = _median(cycles, args->repetitions);
+        result->min_cycles = cycles[0];
+    }
+
+    free(ns);
+    free(cycles);
+    bench->teardown(state);
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    microbench_args_t args = { .repetitions = 15, .warmup = 3 };
+    error_t arg_err = argp_parse(&argp, argc, argv, 0, 0, &args);
+    if (arg_err != 0) {
+        return arg_err;
+    }
+
+    FILE* out = args.output != NULL ? fopen(args.output, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "%s: failed to open \"%s\"\n", argv[0], args.output);
+        return 1;
+    }
+
+    fprintf(out, "{\n  \"repetitions\": %u,\n  \"warmup\": %u,\n  \"cycle_counter\": \"%s\",\n  \"results\": [",
+        args.repetitions, args.warmup, CYCLE_COUNTER_NAME);
+
+    int err = 0;
+    bool first = true;
+    for (unsigned int c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        const bench_case_t* bench = &cases[c];
+        if (args.filter != NULL && strstr(bench->name, args.filter) == NULL) {
+            continue;
+        }
+
+        const unsigned int* sizes = bench->messages ? message_sizes : vec_sizes;
+        unsigned int size_count = bench->messages
+                ? sizeof(message_sizes) / sizeof(message_sizes[0])
+                : sizeof(vec_sizes) / sizeof(vec_sizes[0]);
+
+        for (unsigned int s = 0; s < size_count; s++) {
+            bench_result_t result;
+            if (!_run_case(bench, sizes[s], &args, &result)) {
+                fprintf(stderr, "%s: benchmark %s/%u failed\n", argv[0], bench->name, sizes[s]);
+                err = 1;
+                continue;
+            }
+
+            fprintf(out, "%s\n    {\"name\": \"%s\", \"size\": %u, \"ops\": %lu, "
+                         "\"median_ns_per_op\": %.3f, \"min_ns_per_op\": %.3f",
+                first ? "" : ",", bench->name, sizes[s], result.ops, result.median_ns, result.min_ns);
+            if (HAVE_CYCLE_COUNTER) {
+                fprintf(out, ", \"median_cycles_per_op\": %.2f, \"min_cycles_per_op\": %.2f",
+                    result.median_cycles, result.min_cycles);
+            }
+            fprintf(out, "}");
+            first = false;
+        }
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    return err;
+}
\ No newline at end of file
@@ -0,0 +1,263 @@
+#define _GNU_SOURCE
+
+#include <argp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tcpsock.h"
+#include "trace.h"
+
+#define DRAIN_BUFFER_SIZE 65536
+
+static char doc[] = "Replay -- re-drives a trace recorded with ascii_server --trace against the server at IP:PORT, "
+                    "at the recorded pace, a multiple of it or as fast as possible";
+static char args_doc[] = "TRACE IP PORT";
+
+static struct argp_option options[] = {
+    {"speed", 's', "FACTOR", 0, "Replay FACTOR times faster than recorded (default 1)"},
+    {"max", 'm', 0, 0, "Replay as fast as possible, ignoring the recorded timestamps"},
+    {"clones", 'c', "N", 0, "Replay the trace N times in parallel, each over its own connections (default 1)"},
+    {0}
+};
+
+typedef struct replay_args {
+    const char* trace_path;
+    const char* ip;
+    uint16_t port;
+    double speed;       // 0 replays at maximum speed
+    unsigned int clones;
+} replay_args_t;
+
+typedef struct replay_stats {
+    unsigned long long events;
+    unsigned long long bytes;
+    unsigned long long connections;
+    unsigned long long failures;
+    uint64_t max_lag;   // ns the replay fell behind the recorded schedule
+} replay_stats_t;
+
+static error_t _parse_opt(int key, char* arg, struct argp_state* state)
+{
+    replay_args_t* args = state->input;
+
+    switch (key) {
+        case 's':
+            args->speed = strtod(arg, NULL);
+            if (args->speed <= 0) {
+                argp_error(state, "\"%s\" is not a valid speed factor", arg);
+            }
+            break;
+
+        case 'm':
+            args->speed = 0;
+            break;
+
+        case 'c':
+            args->clones = strtoul(arg, NULL, 10);
+            if (args->clones == 0) {
+                argp_error(state, "\"%s\" is not a valid number of clones", arg);
+            }
+            break;
+
+        case ARGP_KEY_ARG:
+            switch (state->arg_num) {
+                case 0:     args->trace_path = arg; break;
+                case 1:     args->ip = arg; break;
+                case 2:     args->port = atoi(arg); break;
+                default:    argp_usage(state);
+            }
+            break;
+
+        case ARGP_KEY_END:
+            if (state->arg_num < 3) {
+                argp_usage(state);
+            }
+            break;
+
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+static struct argp argp = { options, _parse_opt, args_doc, doc };
+
+static uint64_t _clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// discard whatever the server sent back, so it never blocks on a full send buffer
+static void _drain(int fd)
+{
+    static uint8_t buffer[DRAIN_BUFFER_SIZE];
+    while (recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0) {
+        // discard
+    }
+}
+
+static void _drain_all(tcpsock_t* socks, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++) {
+        if (socks[i].connected) {
+            _drain(tcp_get_fd(&socks[i]));
+        }
+    }
+}
+
+static bool _send_all(int fd, const uint8_t* data, uint32_t length)
+{
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent > 0) {
+            data += sent;
+            length -= sent;
+            continue;
+        }
+
+        if (sent == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            return false;
+        }
+
+        // wait for room, reading responses meanwhile
+        struct pollfd pfd = { .fd = fd, .events = POLLOUT | POLLIN };
+        poll(&pfd, 1, -1);
+        if (pfd.revents & POLLIN) {
+            _drain(fd);
+        }
+    }
+
+    return true;
+}
+
+static void _replay_event(const trace_record_t* record, const void* data, tcpsock_t* sock,
+                          const replay_args_t* args, replay_stats_t* stats)
+{
+    switch (TRACE_RECORD_TYPE(record)) {
+        case TRACE_EVENT_OPEN:
+            if (sock->connected) {
+                tcp_close(sock);
+            }
+            if (tcp_active_open(sock, args->port, args->ip) != TCP_NO_ERROR) {
+                stats->failures++;
+                break;
+            }
+            fcntl(tcp_get_fd(sock), F_SETFL, fcntl(tcp_get_fd(sock), F_GETFL) | O_NONBLOCK);
+            stats->connections++;
+            break;
+
+        case TRACE_EVENT_DATA:
+            if (!sock->connected || !_send_all(tcp_get_fd(sock), data, TRACE_RECORD_LENGTH(record))) {
+                stats->failures++;
+                break;
+            }
+            stats->bytes += TRACE_RECORD_LENGTH(record);
+            break;
+
+        case TRACE_EVENT_CLOSE:
+            if (sock->connected) {
+                tcp_close(sock);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    stats->events++;
+}
+
+int main(int argc, char** argv)
+{
+    replay_args_t args = { .speed = 1.0, .clones = 1 };
+    error_t arg_err = argp_parse(&argp, argc, argv, 0, 0, &args);
+    if (arg_err != 0) {
+        return arg_err;
+    }
+
+    trace_reader_t reader;
+    int err = trace_reader_open(&reader, args.trace_path);
+    if (err != TRACE_NO_ERROR) {
+        fprintf(stderr, "%s: failed to open trace \"%s\" (error %i)\n", argv[0], args.trace_path, err);
+        return err;
+    }
+
+    // connection ids are handed out sequentially, so they can index a table directly
+    trace_record_t record;
+    const void* data;
+    uint32_t max_id = 0;
+    while ((err = trace_reader_next(&reader, &record, &data)) == TRACE_NO_ERROR) {
+        max_id = record.connection_id > max_id ? record.connection_id : max_id;
+    }
+    trace_reader_rewind(&reader);
+
+    unsigned int sock_count = (max_id + 1) * args.clones;
+    tcpsock_t* socks = calloc(sock_count, sizeof(tcpsock_t));
+    if (socks == NULL) {
+        fprintf(stderr, "%s: failed to allocate %u connections\n", argv[0], sock_count);
+        trace_reader_close(&reader);
+        return TCP_MEMORY_ERROR;
+    }
+
+    replay_stats_t stats = { 0 };
+    uint64_t start = _clock_ns();
+
+    while ((err = trace_reader_next(&reader, &record, &data)) == TRACE_NO_ERROR) {
+        if (args.speed > 0) {
+            uint64_t due = start + (uint64_t)(record.time / args.speed);
+            uint64_t now = _clock_ns();
+            if (due > now) {
+                _drain_all(socks, sock_count);
+                struct timespec ts = { .tv_sec = due / 1000000000ULL, .tv_nsec = due % 1000000000ULL };
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+                    // sleep the remainder
+                }
+            } else if (now - due > stats.max_lag) {
+                stats.max_lag = now - due;
+            }
+        }
+
+        for (unsigned int clone = 0; clone < args.clones; clone++) {
+            tcpsock_t* sock = &socks[clone * (max_id + 1) + record.connection_id];
+            _replay_event(&record, data, sock, &args, &stats);
+        }
+    }
+
+    uint64_t elapsed = _clock_ns() - start;
+    for (unsigned int i = 0; i < sock_count; i++) {
+        if (socks[i].connected) {
+            _drain(tcp_get_fd(&socks[i]));
+            tcp_close(&socks[i]);
+        }
+    }
+
+    double seconds = elapsed / 1e9;
+    printf("%llu events, %llu bytes over %llu connections in %.3f s (%.1f events/s, %.2f MB/s), "
+           "%llu failures, max lag %.3f ms\n",
+        stats.events, stats.bytes, stats.connections, seconds,
+        seconds > 0 ? stats.events / seconds : 0.0,
+        seconds > 0 ? stats.bytes / seconds / 1e6 : 0.0,
+        stats.failures, stats.max_lag / 1e6);
+
+    free(socks);
+    trace_reader_close(&reader);
+
+    if (err != TRACE_END) {
+        fprintf(stderr, "%s: trace is corrupt (error %i)\n", argv[0], err);
+        return err;
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,159 @@
+#define _GNU_SOURCE
+
+#include <argp.h>
+#include <ctype.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "shmring.h"
+
+#define WAIT_TIMEOUT_MS 100
+
+static char doc[] = "Ring consumer -- prints the frames ascii_server --ring publishes to the shared memory ring NAME, "
+                    "until the server closes the ring";
+static char args_doc[] = "NAME";
+
+static struct argp_option options[] = {
+    {"summary", 's', 0, 0, "Only print the number of frames and bytes read"},
+    {"hex", 'x', 0, 0, "Print frame data as hex instead of escaped ASCII"},
+    {"spin", 'b', 0, 0, "Poll the ring continuously instead of sleeping until a frame is published"},
+    {0}
+};
+
+typedef struct consumer_args {
+    const char* name;
+    bool summary;
+    bool hex;
+    bool spin;
+} consumer_args_t;
+
+static volatile sig_atomic_t running = 1;
+
+static error_t _parse_opt(int key, char* arg, struct argp_state* state)
+{
+    consumer_args_t* args = state->input;
+
+    switch (key) {
+        case 's':
+            args->summary = true;
+            break;
+
+        case 'x':
+            args->hex = true;
+            break;
+
+        case 'b':
+            args->spin = true;
+            break;
+
+        case ARGP_KEY_ARG:
+            if (state->arg_num >= 1) {
+                argp_usage(state);
+            }
+            args->name = arg;
+            break;
+
+        case ARGP_KEY_END:
+            if (state->arg_num < 1) {
+                argp_usage(state);
+            }
+            break;
+
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+static struct argp argp = { options, _parse_opt, args_doc, doc };
+
+static void _signal_handler(int signum)
+{
+    (void)signum;
+    running = 0;
+}
+
+static void _print_data(const uint8_t* data, uint32_t length, bool hex)
+{
+    for (uint32_t i = 0; i < length; i++) {
+        if (hex) {
+            printf("%02x", data[i]);
+        } else if (data[i] == '\n') {
+            fputs("\\n", stdout);
+        } else if (isprint(data[i])) {
+            putchar(data[i]);
+        } else {
+            printf("\\x%02x", data[i]);
+        }
+    }
+    putchar('\n');
+}
+
+int main(int argc, char** argv)
+{
+    consumer_args_t args = { .name = NULL, .summary = false, .hex = false, .spin = false };
+    error_t arg_err = argp_parse(&argp, argc, argv, 0, 0, &args);
+    if (arg_err != 0) {
+        return arg_err;
+    }
+
+    struct sigaction act = { .sa_handler = _signal_handler };
+    sigemptyset(&act.sa_mask);
+    sigaction(SIGINT, &act, NULL);
+
+    shmring_consumer_t consumer;
+    int err = shmring_consumer_open(&consumer, args.name);
+    if (err != SHMRING_NO_ERROR) {
+        fprintf(stderr, "%s: failed to attach to ring \"%s\" (error %i)\n", argv[0], args.name, err);
+        return err;
+    }
+
+    static const char* type_names[] = { "open", "data", "close" };
+    unsigned long long frames = 0;
+    unsigned long long bytes = 0;
+    unsigned long long torn = 0;
+    shmring_frame_t frame;
+    const void* data;
+
+    while (running) {
+        err = shmring_consumer_next(&consumer, &frame, &data);
+        if (err == SHMRING_EMPTY) {
+            // frames published right before closing are read before stopping
+            if (shmring_consumer_closed(&consumer)) {
+                break;
+            }
+            if (!args.spin) {
+                shmring_consumer_wait(&consumer, WAIT_TIMEOUT_MS);
+            }
+            continue;
+        } else if (err == SHMRING_OVERRUN) {
+            fprintf(stderr, "%s: fell behind, frames were lost\n", argv[0]);
+            continue;
+        }
+
+        uint32_t length = SHMRING_FRAME_LENGTH(&frame);
+        if (!args.summary) {
+            printf("%llu conn=%u %s len=%u ", (unsigned long long)frame.seq, frame.connection_id,
+                type_names[SHMRING_FRAME_TYPE(&frame)], length);
+            _print_data(data, length, args.hex);
+        }
+
+        // the frame was overwritten while it was printed
+        if (!shmring_consumer_valid(&consumer)) {
+            torn++;
+            continue;
+        }
+
+        frames++;
+        bytes += length;
+    }
+
+    printf("%llu frames, %llu bytes, %llu overruns, %llu torn frames\n", frames, bytes,
+        (unsigned long long)consumer.overruns, torn);
+    shmring_consumer_close(&consumer);
+
+    return 0;
+}
\ No newline at end of file